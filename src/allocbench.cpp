@@ -0,0 +1,100 @@
+/*
+ * Microbenchmark of the physical page allocator: pages allocated per second
+ * by a number of threads faulting at once, through the buddy system alone
+ * and through the per-core page caches of the fault path
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "galloc.h"
+#include "log.h"
+#include "mmu/memory_management.h"
+#include "zsim.h"
+
+GlobSimInfo* zinfo;
+
+struct BenchThread {
+    pthread_t thread;
+    BuddyAllocator* buddy;
+    uint32_t cpu;
+    uint64_t pages;
+    bool cached;
+    uint64_t failed;
+};
+
+static volatile bool startFlag;
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* allocThread(void* arg) {
+    BenchThread* bt = (BenchThread*)arg;
+    while (!startFlag) {}
+    for (uint64_t i = 0; i < bt->pages; i++) {
+        Page* page = bt->cached? bt->buddy->allocate_page(bt->cpu) : bt->buddy->allocate_pages(0U, 0);
+        if (!page) bt->failed++;
+    }
+    return NULL;
+}
+
+// one round on a fresh node, so every round starts from the same free lists
+static double runRound(uint32_t threads, uint64_t pages, bool cached) {
+    MemoryNode* node = new (gm_memalign<MemoryNode>(CACHE_LINE_BYTES, 1)) MemoryNode(0, 0);
+    BuddyAllocator* buddy = new (gm_memalign<BuddyAllocator>(CACHE_LINE_BYTES, 1)) BuddyAllocator(node);
+    BenchThread* bts = gm_calloc<BenchThread>(threads);
+    startFlag = false;
+    for (uint32_t t = 0; t < threads; t++) {
+        bts[t].buddy = buddy;
+        bts[t].cpu = t;
+        bts[t].pages = pages;
+        bts[t].cached = cached;
+        pthread_create(&bts[t].thread, NULL, allocThread, &bts[t]);
+    }
+    double start = seconds();
+    startFlag = true;
+    uint64_t failed = 0;
+    for (uint32_t t = 0; t < threads; t++) {
+        pthread_join(bts[t].thread, NULL);
+        failed += bts[t].failed;
+    }
+    double elapsed = seconds() - start;
+    if (failed) panic("%lu allocations failed, the node is too small", failed);
+    gm_free(bts);
+    buddy->~BuddyAllocator();
+    gm_free(buddy);
+    node->~MemoryNode();
+    gm_free(node);
+    return threads * pages / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    InitLog(""); //no log header
+    if (argc > 3) {
+        info("Usage: %s [<max threads> [<pages per thread>]]", argv[0]);
+        exit(1);
+    }
+    uint32_t maxThreads = (argc > 1)? atoi(argv[1]) : 16;
+    uint64_t pages = (argc > 2)? strtoull(argv[2], NULL, 0) : (1 << 16);
+
+    gm_init(1024<<20 /*descriptors of the pages handed out, and the zones*/);
+    zinfo = gm_calloc<GlobSimInfo>();
+    zinfo->page_shift = 12;
+    zinfo->page_size = 1 << 12;
+    zinfo->numCores = maxThreads;
+    zinfo->memory_size = 64ULL << 30;
+    zinfo->max_zone_pfns[Zone_DMA] = (16 << 20) >> zinfo->page_shift;
+    zinfo->max_zone_pfns[Zone_Normal] = zinfo->memory_size >> zinfo->page_shift;
+
+    info("%lu pages per thread", pages);
+    info("%8s %16s %16s", "Threads", "M allocs/s buddy", "M allocs/s pcp");
+    for (uint32_t threads = 1; threads <= maxThreads; threads *= 2) {
+        double buddy = runRound(threads, pages, false);
+        double cached = runRound(threads, pages, true);
+        info("%8u %16.2f %16.2f", threads, buddy * 1e-6, cached * 1e-6);
+    }
+    return 0;
+}
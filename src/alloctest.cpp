@@ -0,0 +1,72 @@
+/*
+ * Self-check of the buddy allocator: frames that are freed must be handed
+ * out again, coalesced with their buddies into the blocks they came from.
+ * Exits with an error if a round of allocations after a full free gets
+ * fewer pages, or smaller blocks, than the first one.
+ */
+
+#include <stdlib.h>
+#include "galloc.h"
+#include "log.h"
+#include "mmu/memory_management.h"
+#include "zsim.h"
+
+GlobSimInfo* zinfo;
+
+// allocates blocks of 2^order pages until the node is full
+static uint64_t allocateAll(BuddyAllocator* buddy, unsigned order, g_vector<uint64_t>& frames) {
+    uint64_t blocks = 0;
+    while (Page* page = buddy->allocate_pages(0U, order)) {
+        for (uint64_t i = 0; i < (1UL << order); i++) frames.push_back(page->pageNo + i);
+        blocks++;
+    }
+    return blocks;
+}
+
+// frees every page alone, so all of them have to coalesce again
+static void freeAll(BuddyAllocator* buddy, g_vector<uint64_t>& frames) {
+    for (uint64_t i = 0; i < frames.size(); i++) buddy->free_one_page(frames[i]);
+    frames.clear();
+}
+
+int main(int argc, char *argv[]) {
+    InitLog(""); //no log header
+    if (argc > 2) {
+        info("Usage: %s [<memory MB>]", argv[0]);
+        exit(1);
+    }
+    uint64_t memMB = (argc > 1)? strtoull(argv[1], NULL, 0) : 64;
+
+    gm_init(256<<20);
+    zinfo = gm_calloc<GlobSimInfo>();
+    zinfo->page_shift = 12;
+    zinfo->page_size = 1 << 12;
+    zinfo->numCores = 1;
+    zinfo->memory_size = memMB << 20;
+    zinfo->max_zone_pfns[Zone_DMA] = (16 << 20) >> zinfo->page_shift;
+    zinfo->max_zone_pfns[Zone_Normal] = zinfo->memory_size >> zinfo->page_shift;
+
+    MemoryNode* node = new (gm_memalign<MemoryNode>(CACHE_LINE_BYTES, 1)) MemoryNode(0, 0);
+    BuddyAllocator* buddy = new (gm_memalign<BuddyAllocator>(CACHE_LINE_BYTES, 1)) BuddyAllocator(node);
+    uint64_t freeBytes = buddy->get_free_memory_size();
+    g_vector<uint64_t> frames;
+
+    uint64_t pages = allocateAll(buddy, 0, frames);
+    freeAll(buddy, frames);
+    if (buddy->get_free_memory_size() != freeBytes) {
+        panic("%lu free bytes after freeing all pages, %lu before", buddy->get_free_memory_size(), freeBytes);
+    }
+    uint64_t again = allocateAll(buddy, 0, frames);
+    info("%lu pages allocated, %lu after freeing them", pages, again);
+    if (again != pages) panic("%lu of %lu freed pages could not be allocated again", pages - again, pages);
+    freeAll(buddy, frames);
+
+    // the largest blocks only come back if the single pages coalesced
+    unsigned order = MAXORDER - 1;
+    uint64_t blocks = allocateAll(buddy, order, frames);
+    info("%lu blocks of order %u allocated after freeing single pages", blocks, order);
+    if (blocks != pages >> order) panic("%lu order %u blocks, %lu expected", blocks, order, pages >> order);
+    freeAll(buddy, frames);
+    info("PASS");
+    return 0;
+}
@@ -89,6 +89,12 @@ inline PagingStyle string_to_pagingmode( const char* mode_str)
 		return LongMode_Middle;
 	if( !strcmp(mode_str , "LongMode_Huge") )
 		return LongMode_Huge;
+	if( !strcmp(mode_str , "LongMode5_Normal") )
+		return LongMode5_Normal;
+	if( !strcmp(mode_str , "LongMode5_Middle") )
+		return LongMode5_Middle;
+	if( !strcmp(mode_str , "LongMode5_Huge") )
+		return LongMode5_Huge;
 	if( !strcmp(mode_str , "Hash_Normal") )
 		return Hash_Normal;
 	if( !strcmp(mode_str , "Hash_Chain") )
@@ -106,7 +112,8 @@ inline std::string pagingmode_to_string( PagingStyle mode)
 		return "Legacy";
 	if( mode==PAE_Normal || mode==PAE_Huge)
 		return "PAE";
-	else if( mode==LongMode_Normal || mode==LongMode_Middle || mode==LongMode_Huge)
+	else if( mode==LongMode_Normal || mode==LongMode_Middle || mode==LongMode_Huge
+			|| mode==LongMode5_Normal || mode==LongMode5_Middle || mode==LongMode5_Huge)
 		return "LongMode";
 	if( mode==Hash_Normal)
 		return "Hash_Normal";
@@ -121,6 +128,75 @@ inline std::string pagingmode_to_string( PagingStyle mode)
 
 }
 
+inline PgtHashKind string_to_pgthash( const char* hash_str)
+{
+	if( !strcmp(hash_str , "xxhash") )
+		return PgtHash_XXHash;
+	if( !strcmp(hash_str , "crc") )
+		return PgtHash_CRC;
+	if( !strcmp(hash_str , "h3") )
+		return PgtHash_H3;
+	if( !strcmp(hash_str , "blake2") )
+		return PgtHash_Blake2;
+	return PgtHash_City;	//default return cityhash
+}
+
+inline std::string pgthash_to_string( PgtHashKind kind)
+{
+	if( kind == PgtHash_XXHash)
+		return "xxhash";
+	if( kind == PgtHash_CRC)
+		return "crc";
+	if( kind == PgtHash_H3)
+		return "h3";
+	if( kind == PgtHash_Blake2)
+		return "blake2";
+	return "city";
+}
+
+inline NumaPolicy string_to_numapolicy( const char* policy_str)
+{
+	if( !strcmp(policy_str , "interleave") )
+		return Numa_Interleave;
+	if( !strcmp(policy_str , "bind") )
+		return Numa_Bind;
+	return Numa_Local;	//default first touch
+}
+
+inline std::string numapolicy_to_string( NumaPolicy policy)
+{
+	if( policy == Numa_Interleave)
+		return "interleave";
+	if( policy == Numa_Bind)
+		return "bind";
+	return "local";
+}
+
+/*
+ *@function: 5-level (LA57) long mode styles walk a PML5 table above the PML4
+ *@return: the 4-level style with the same page size, mode itself if it is
+ *		   not a 5-level style
+ */
+inline PagingStyle la57_to_4level( PagingStyle mode)
+{
+	if( mode==LongMode5_Normal)
+		return LongMode_Normal;
+	if( mode==LongMode5_Middle)
+		return LongMode_Middle;
+	if( mode==LongMode5_Huge)
+		return LongMode_Huge;
+	return mode;
+}
+
+/*
+ *@function: virtual address bits translated by a paging style
+ *@return: 57 for the 5-level (LA57) styles, 48 otherwise
+ */
+inline unsigned va_bits( PagingStyle mode)
+{
+	return la57_to_4level(mode) != mode ? 57 : 48;
+}
+
 /*
  *@function: translate string to ZoneType
  *			 "zone.zone_dma"->Zone_DMA
@@ -162,9 +238,11 @@ uint64_t power(S base , T exp )
  *@param mode: paging style , Legacy_Normal , Legacy_Huge
  *			   PAE_Normal ,PAE_Huge
  *			   LongMode_Normal,LongMode_Middle,LongMode_Huge
+ *			   LongMode5_Normal,LongMode5_Middle,LongMode5_Huge
  */
 inline uint64_t get_page_size_by_mode( PagingStyle mode)
 {
+	mode = la57_to_4level(mode);
 	uint64_t kb = power(2,10);
 	uint64_t mb = power(2,20);
 	uint64_t gb = power(2,30);
@@ -248,6 +326,12 @@ inline EVICTSTYLE stringToPolicy( std::string policy_str )
 		return HOTNESSAware;
 	if(policy_str == "HotMonitorTLBLRU")
 		return HotMonitorTLBLRU;
+	if(policy_str == "TreePLRU")
+		return TreePLRU;
+	if(policy_str == "SRRIP")
+		return SRRIP;
+	if(policy_str == "DRRIP")
+		return DRRIP;
 	//default return LRU
 	return LRU;
 }
@@ -26,7 +26,7 @@ typedef uint64_t Address;
 #define INVALID_PROC ((uint32_t)(-1))
 //default page size is 4KB
 const unsigned PAGE_SHIFT=12;
-const unsigned PAGE_2MB_SHIFT=20;
+const unsigned PAGE_2MB_SHIFT=21;
 const unsigned PAGE_4MB_SHIFT=22;
 const unsigned PAGE_1GB_SHIFT=30;
 const unsigned PAGE_SIZE=(1UL<<PAGE_SHIFT);
@@ -38,6 +38,7 @@ const unsigned ENTRY_1024=1024;
 const unsigned ENTRY_4=4;
 const unsigned ENTRY_512=512;
 const unsigned ENTRY_SHIFT_512=3;
+const unsigned HUGE_PAGE_ORDER=9; //base pages of a huge page a PD entry maps, log2
 const unsigned ENTRY_SIZE_512=(1UL<<ENTRY_SHIFT_512);
 const unsigned MAXPN_LEN=52;
 const char* const c_zone_sec="mem.zone";
@@ -88,7 +89,28 @@ enum PagingStyle
 	Hash_Normal,
 	Hash_Chain,
 	Cuckoo_Normal,
-	Cuckoo_Elastic
+	Cuckoo_Elastic,
+	LongMode5_Normal,	//4KB page, 5-level (LA57)
+	LongMode5_Middle,	//2MB page, 5-level (LA57)
+	LongMode5_Huge		//1GB page, 5-level (LA57)
+};
+
+//placement of physical pages over memory nodes (sys.numa.policy)
+enum NumaPolicy
+{
+	Numa_Local,			//first touch: the node of the faulting core
+	Numa_Interleave,	//round robin over all nodes
+	Numa_Bind			//the nodes of sys.numa.nodes only
+};
+
+//hash functions of hashed page tables
+enum PgtHashKind
+{
+	PgtHash_City,
+	PgtHash_XXHash,
+	PgtHash_CRC,	//CRC32C
+	PgtHash_H3,		//XOR of a random row per set bit, cheap in hardware
+	PgtHash_Blake2	//reference cryptographic hash, slow
 };
 
 enum ZoneType
@@ -128,6 +150,14 @@ enum TlbFlag
 	SHARED = 0x20,
 	DIRTY = 0x40
 };
+//page sizes a TLB level keeps separate (or unified) arrays for
+enum TlbPageSize
+{
+	TLB_4KB = 0,
+	TLB_2MB = 1,
+	TLB_1GB = 2,
+	TLB_PAGE_SIZES = 3
+};
 enum PAGE_FAULT
 {
 	DRAM_BUFFER_FAULT,
@@ -147,7 +177,9 @@ enum EVICTSTYLE
 	LRU = 0x01,
 	HOTNESSAware = 0x02,
 	HotMonitorTLBLRU= 0x03,
-	CLUSTER= 0x04
+	TreePLRU= 0x04,
+	SRRIP= 0x05,
+	DRRIP= 0x06
 };
 
 enum DRAMEVICTSTYLE
@@ -146,6 +146,7 @@ class Core : public GlobAlloc {
         virtual InstrFuncPtrs GetFuncPtrs() = 0;
         virtual void SetPaging(BasePaging* paging){}
         virtual void flushTlb(){}
+        virtual void switchTlbContext(uint32_t procIdx){}
         virtual void updateTlb(Address ppn, Address new_ppn){}
 		virtual BaseTlb* getInsTlb(){ return NULL;}
 		virtual BaseTlb* getDataTlb(){ return NULL;}
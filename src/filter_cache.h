@@ -64,8 +64,8 @@ class FilterCache : public Cache {
         lock_t filterLock;
         uint64_t fGETSHit, fGETXHit;
 
+        //private to this core, CommonTlb queues other cores' invalidations
         BaseTlb* tlb;
-		lock_t tlb_lock;
 		uint64_t tlb_access_num;
 
         bool enableFilter;
@@ -87,7 +87,6 @@ class FilterCache : public Cache {
             enableFilter = _enableFilter;
             tlb = NULL;
             tlb_access_num = 0;
-            futex_init(&tlb_lock);
         }
 
         void setSourceId(uint32_t id) {
@@ -102,22 +101,23 @@ class FilterCache : public Cache {
 
         BaseTlb*  getTlb() { return tlb; }
 
+        //only from the thread simulating this core: private TLBs flush
+        //without a lock (other cores use PrivateTlb::post_flush)
         void flushTlb(){
-            futex_lock(&tlb_lock);
             if(tlb != NULL)
                 tlb->flush_all();
-            futex_unlock(&tlb_lock);
+        }
+        void switchTlbContext(uint32_t procIdx){
+            if(tlb != NULL)
+                tlb->switch_context(procIdx);
         }
         void updateTlb(Address ppn, Address new_ppn){
-            futex_lock(&tlb_lock);
             if(tlb != NULL)
                 tlb->update_ppn(ppn, new_ppn);
-            futex_unlock(&tlb_lock);
         }
 
         uint64_t TlbTranslate( ADDRINT vLineAddr, ADDRINT& pLineAddr,bool isLoad, uint64_t startCycle, bool is_pim_inst, bool& nonCacheable)
         {
-            futex_lock(&tlb_lock);
             tlb_access_num++;
             MemReq req;
             req.lineAddr = vLineAddr;
@@ -129,7 +129,6 @@ class FilterCache : public Cache {
             else
                 req.type = PUTS;
             pLineAddr = tlb->access(req);
-            futex_unlock(&tlb_lock);
             return req.cycle;
         }
 
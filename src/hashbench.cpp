@@ -0,0 +1,60 @@
+/*
+ * Microbenchmark of the hash engines of hashed page tables: VPNs hashed per
+ * second by every kind, with all ways of a cuckoo table at once as walks
+ * hash them
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include "common/common_functions.h"
+#include "galloc.h"
+#include "log.h"
+#include "page-table/hash_engine.h"
+
+// hashes end up here so the loops are not optimized away
+static volatile uint64_t hashSink;
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+    InitLog(""); //no log header
+    if (argc > 3) {
+        info("Usage: %s [<ways> [<VPNs>]]", argv[0]);
+        exit(1);
+    }
+    uint32_t ways = (argc > 1)? atoi(argv[1]) : 4;
+    uint64_t vpns = (argc > 2)? strtoull(argv[2], NULL, 0) : (1 << 24);
+
+    gm_init(32<<20 /*32 MB, should be enough*/);
+    uint64_t seeds[PgtHashEngine::MAX_WAYS];
+    for (uint32_t w = 0; w < PgtHashEngine::MAX_WAYS; w++)
+        seeds[w] = 0x9E3779B97F4A7C15ULL * (w + 1);
+    uint64_t hashes[PgtHashEngine::MAX_WAYS];
+    const PgtHashKind kinds[] = {PgtHash_City, PgtHash_XXHash, PgtHash_CRC,
+                                 PgtHash_H3, PgtHash_Blake2};
+
+    info("%u ways, %lu VPNs", ways, vpns);
+    info("%8s %14s %14s", "Hash", "MVPNs/s", "Mhashes/s");
+    for (PgtHashKind kind : kinds) {
+        PgtHashEngine *engine = new PgtHashEngine(kind, ways, seeds);
+        // VPNs of a few dense regions, like a process' heap and stacks
+        uint64_t sink = 0;
+        double start = seconds();
+        for (uint64_t i = 0; i < vpns; i++) {
+            uint64_t vpn = ((i & 3) << 24) + (i >> 2);
+            engine->hash_ways(vpn, hashes);
+            for (uint32_t w = 0; w < ways; w++)
+                sink ^= hashes[w];
+        }
+        double elapsed = seconds() - start;
+        hashSink = sink;
+        info("%8s %14.2f %14.2f", pgthash_to_string(kind).c_str(),
+             vpns / elapsed * 1e-6, vpns * ways / elapsed * 1e-6);
+        delete engine;
+    }
+    return 0;
+}
@@ -77,14 +77,22 @@
 #include "common/common_functions.h"
 #include "common/global_const.h"
 #include "tlb/common_tlb.h"
-// #include "tlb/cluster_tlb.h"
+#include "tlb/hotness_profiler.h"
+#include "tlb/tlb_prefetcher.h"
+#include "tlb/shared_tlb.h"
+#include "tlb/tlb_shootdown.h"
+#include "tlb/cluster_tlb.h"
 #include "tlb/page_table_walker.h"
 #include "tlb/tlb_entry.h"
 #include "page-table/comm_page_table_op.h"
 #include "page-table/page_table.h"
 #include "page-table/baseline_hash/hash_page_table.h"
+#include "page-table/baseline_hash/chained_hash_page_table.h"
 #include "page-table/cuckoo_hash/cuckoo_page_table.h"
+#include "page-table/ech_hash/elastic_cuckoo_paging.h"
 #include "page-table/reversed_page_table.h"
+#include "page-table/nested_page_table.h"
+#include "page-table/pw_cache.h"
 #include "memory_hierarchy.h"
 #include "cd_arrays.h"
 #include "coherence_directory.h"
@@ -506,6 +514,211 @@ void initZsimWrapper(Config& config){
     }
 }
 
+/* Memory nodes of the HMC stacks (sys.numa.granularity = "stack") or vaults ("vault"), each a contiguous range of
+ * physical memory. Where a node sits comes from the ramulator address mapping, which must keep the range of a node on
+ * its stack or vault (addressing_type = CuVaRoBgBaCl); hop counts of memory accesses then follow the page placement.
+ */
+static void InitNumaNodes(Config& config) {
+    if (!zinfo->ramulatorWrapper) panic("sys.numa places pages on HMC stacks or vaults, it needs the Ramulator memory");
+    string granularity = config.get<const char*>("sys.numa.granularity", "stack");
+    if (granularity != "stack" && granularity != "vault") panic("sys.numa.granularity is %s, stack or vault", granularity.c_str());
+    bool vaults = (granularity == "vault");
+    uint32_t stacks = zinfo->ramulatorWrapper->getHMCStacks();
+    uint32_t vaultsPerStack = zinfo->ramulatorConfigs->get_vaults_per_stack();
+    uint32_t numNodes = vaults? stacks * vaultsPerStack : stacks;
+    uint64_t nodeSize = zinfo->memory_size / numNodes;
+    if (nodeSize % (zinfo->page_size << MAXORDER)) panic("sys.mem.capacityMB does not split in %u memory nodes of whole MAXORDER blocks", numNodes);
+
+    g_vector<MemoryNode*> nodes;
+    for (uint32_t n = 0; n < numNodes; n++) {
+        Address start = n * nodeSize;
+        Address ends[2] = {start, start + nodeSize - zinfo->lineSize};
+        for (Address addr : ends) {
+            int target = vaults? zinfo->ramulatorWrapper->getTargetVault(addr) : zinfo->ramulatorWrapper->getTargetStack(addr);
+            if (target != (int)n) panic("Memory node %u at 0x%lx maps to %s %d, the ramulator addressing_type must keep a node on one %s (CuVaRoBgBaCl)",
+                                        n, addr, granularity.c_str(), target, granularity.c_str());
+        }
+        nodes.push_back(new (gm_memalign<MemoryNode>(CACHE_LINE_BYTES, 1)) MemoryNode(n, start, start + nodeSize));
+    }
+
+    string policyStr = config.get<const char*>("sys.numa.policy", "local");
+    NumaPolicy policy = string_to_numapolicy(policyStr.c_str());
+    if (numapolicy_to_string(policy) != policyStr) panic("Unknown sys.numa.policy %s, local, interleave or bind", policyStr.c_str());
+    g_vector<unsigned> bindNodes;
+    std::stringstream bindStr(config.get<const char*>("sys.numa.bind", ""));
+    unsigned node;
+    while (bindStr >> node) bindNodes.push_back(node);
+
+    //PIM cores sit in the vaults, host cores are spread over the nodes
+    uint32_t coresPerNode;
+    if (zinfo->enable_pim_mode) coresPerNode = vaults? 1 : vaultsPerStack;
+    else coresPerNode = MAX(1, (zinfo->numCores + numNodes - 1) / numNodes);
+
+    zinfo->memory_node = nodes[0];
+    zinfo->buddy_allocator = new (gm_memalign<BuddyAllocator>(CACHE_LINE_BYTES, 1)) BuddyAllocator(nodes, policy, bindNodes, coresPerNode);
+    info("NUMA: %u memory nodes of %lu MB, one per %s, %u cores per node, %s policy", numNodes, nodeSize >> 20,
+         granularity.c_str(), coresPerNode, policyStr.c_str());
+}
+
+/* Returns the hot page profiler (sys.tlbs.profile) of a TLB or page table walker, NULL unless it is enabled.
+ * Memory is bounded by width x depth sketch counters plus topK pages; one in samplePeriod accesses is counted.
+ */
+static HotnessProfiler* CreateHotnessProfiler(Config& config, uint64_t seed) {
+    if (!config.get<bool>("sys.tlbs.profile.enable", false)) return NULL;
+    return new HotnessProfiler(config.get<uint32_t>("sys.tlbs.profile.width", 4096),
+                               config.get<uint32_t>("sys.tlbs.profile.depth", 4),
+                               config.get<uint32_t>("sys.tlbs.profile.topK", 64),
+                               config.get<uint32_t>("sys.tlbs.profile.samplePeriod", 1),
+                               0xB0757EDULL + seed);
+}
+
+/* Returns the prefetch stage (<tlb>.prefetcher) of an L2 TLB, NULL when type is "None" (the default).
+ * type is "Sequential", "Stride" (any constant stride between misses) or "Distance" (distance prefetching, with
+ * tableEntries rows); degree pages are proposed per miss and parked in a bufferEntries-entry prefetch buffer.
+ */
+static TlbPrefetchUnit* CreateTlbPrefetchUnit(Config& config, const string& tlb) {
+    string prefix = tlb + ".prefetcher.";
+    string type = config.get<const char*>(prefix + "type", "None");
+    if (type == "None") return NULL;
+    uint32_t degree = config.get<uint32_t>(prefix + "degree", 2);
+    TlbPrefetcher* prefetcher;
+    if (type == "Sequential") {
+        prefetcher = new SequentialTlbPrefetcher(degree);
+    } else if (type == "Stride") {
+        prefetcher = new StrideTlbPrefetcher(degree);
+    } else if (type == "Distance") {
+        prefetcher = new DistanceTlbPrefetcher(config.get<uint32_t>(prefix + "tableEntries", 64), degree);
+    } else {
+        panic("%s: invalid TLB prefetcher %s, should be None, Sequential, Stride or Distance", tlb.c_str(), type.c_str());
+    }
+    return new TlbPrefetchUnit(prefetcher, config.get<uint32_t>(prefix + "bufferEntries", 16), zinfo->page_shift);
+}
+
+/* Returns the replacement policy of a TLB (<tlb>.repl): "LRU" (the default), "TreePLRU" (power-of-two ways),
+ * "SRRIP", "DRRIP" (set-associative only) or "HOTNESSAware" (fewest hits, aged on every replacement).
+ */
+static EVICTSTYLE GetTlbReplPolicy(Config& config, const string& tlb) {
+    string repl = config.get<const char*>(tlb + ".repl", "LRU");
+    EVICTSTYLE policy = stringToPolicy(repl);
+    if (policy == LRU && repl != "LRU")
+        panic("%s: invalid TLB replacement policy %s, should be LRU, TreePLRU, SRRIP, DRRIP, HOTNESSAware or HotMonitorTLBLRU", tlb.c_str(), repl.c_str());
+    return policy;
+}
+
+/* Returns the shared last-level TLB (sys.tlbs.shared_tlb) of a core, creating it for the first core that uses it.
+ * scope selects which cores share one: "Global" (all of them), "Group" (a core group), "Stack" (the PIM cores
+ * of an HMC stack) or "Cluster" (clusterSize consecutive cores).
+ */
+static SharedTlb<TlbEntry>* GetSharedTlb(Config& config, uint32_t coreIdx, uint32_t groupFirstCore) {
+    string prefix = "sys.tlbs.shared_tlb.";
+    string scope = config.get<const char*>(prefix + "scope", "Global");
+    uint32_t firstCore;
+    if (scope == "Global") {
+        firstCore = 0;
+    } else if (scope == "Group") {
+        firstCore = groupFirstCore;
+    } else if (scope == "Stack") {
+        if (!zinfo->ramulatorConfigs) panic("shared_tlb: Stack scope needs an HMC memory (sys.mem.ramulatorConfig)");
+        uint32_t vaultsPerStack = zinfo->ramulatorConfigs->get_vaults_per_stack();
+        firstCore = coreIdx / vaultsPerStack * vaultsPerStack;
+    } else if (scope == "Cluster") {
+        uint32_t clusterSize = config.get<uint32_t>(prefix + "clusterSize");
+        firstCore = coreIdx / clusterSize * clusterSize;
+    } else {
+        panic("shared_tlb: invalid scope %s, should be Global, Group, Stack or Cluster", scope.c_str());
+    }
+
+    if (zinfo->shared_tlbs.empty()) zinfo->shared_tlbs.resize(zinfo->numCores, NULL);
+    if (!zinfo->shared_tlbs[firstCore]) {
+        uint32_t entries = config.get<uint32_t>(prefix + "entries", 4096);
+        uint32_t ways = config.get<uint32_t>(prefix + "ways", 16);
+        uint32_t banks = config.get<uint32_t>(prefix + "banks", 8);
+        uint32_t hitLat = config.get<uint32_t>(prefix + "hitLatency", 10);
+        uint32_t netLat = config.get<uint32_t>(prefix + "interconnectLatency", 5);
+        stringstream ss;
+        ss << "sys.tlbs.shared_tlb" << firstCore;
+        g_string name(ss.str().c_str());
+        zinfo->shared_tlbs[firstCore] = new SharedTlb<TlbEntry>(name, zinfo->tlb_enable_timing_mode, entries, ways, banks,
+                hitLat, netLat, ilog2(zinfo->lineSize), zinfo->page_shift, zinfo->numCores,
+                GetTlbReplPolicy(config, "sys.tlbs.shared_tlb"));
+        info("%s: %u entries, %u ways, %u banks, shared from core %u (%s scope)", name.c_str(), entries, ways, banks, firstCore, scope.c_str());
+    }
+    return static_cast<SharedTlb<TlbEntry>*>(zinfo->shared_tlbs[firstCore]);
+}
+
+//hash functions of hashed page tables: city, xxhash, crc, h3 or blake2
+static PgtHashKind CreatePgtHash(Config& config, const string& key, const char* def) {
+    string hash = config.get<const char*>(key, def);
+    PgtHashKind kind = string_to_pgthash(hash.c_str());
+    if (pgthash_to_string(kind) != hash) panic("%s: unknown page table hash %s", key.c_str(), hash.c_str());
+    return kind;
+}
+
+/* Returns the page walk cache of a walker configured at prefix (sys.pwc, or sys.ptw.nested.pwc for the host page
+ * table). type is "Split" (one array per level, subgroups from the top level down, like Intel's paging structure
+ * caches) or "Unified" (size/ways of one array for all levels, like AMD's PWC); skip makes them translation caches
+ * that skip the cached levels rather than page table caches.
+ */
+static PageWalkCache* CreatePageWalkCache(Config& config, const string& prefix, const g_string& name) {
+    g_vector<unsigned> sizes, ways;
+    uint32_t accLat = config.get<uint32_t>(prefix + ".AccLat", 10);
+    uint32_t missLat = config.get<uint32_t>(prefix + ".InvLat", 10);
+    string type = config.get<const char*>(prefix + ".type", "Split");
+    bool unified = (type == "Unified");
+    if (!unified && type != "Split") panic("Invalid %s.type %s, should be Split or Unified", prefix.c_str(), type.c_str());
+    bool skip = config.get<bool>(prefix + ".skip", false);
+    if (unified) {
+        sizes.push_back(config.get<unsigned>(prefix + ".size"));
+        ways.push_back(config.get<unsigned>(prefix + ".ways"));
+    } else {
+        vector<const char*> groupNames;
+        config.subgroups(prefix, groupNames);
+        for (const char* grp : groupNames) {
+            string group(grp);
+            sizes.push_back(config.get<unsigned>(prefix + "." + group + ".size"));
+            ways.push_back(config.get<unsigned>(prefix + "." + group + ".ways"));
+        }
+    }
+    return new PageWalkCache(name, unified, skip, sizes, ways, accLat, missLat);
+}
+
+/* khugepaged-style promotion of transparent huge pages: every period phases, while the cores are stopped, collapse
+ * the hot 4KB regions of the processes into huge pages. Every TLB drops the base pages of each region collapsed in
+ * one range invalidation, and translation caches that may skip to the retired page tables are cleared.
+ */
+class ThpCollapseEvent : public Event {
+    private:
+        uint32_t threshold;
+        uint32_t maxCollapse;
+        g_vector<Address> collapsed;
+
+    public:
+        ThpCollapseEvent(uint32_t period, uint32_t _threshold, uint32_t _maxCollapse)
+            : Event(period), threshold(_threshold), maxCollapse(_maxCollapse) {}
+
+        void callback() {
+            uint32_t done = 0;
+            for (uint32_t p = 0; p < zinfo->numProcs && done < maxCollapse; p++) {
+                LongModePaging* paging = static_cast<LongModePaging*>(zinfo->paging_array[p]);
+                collapsed.clear();
+                done += paging->collapse_huge_pages(maxCollapse - done, threshold, collapsed);
+                for (Address region : collapsed) {
+                    for (uint32_t c = 0; c < zinfo->numCores; c++) {
+                        BaseTlb* tlbs[2] = {zinfo->cores[c]->getInsTlb(), zinfo->cores[c]->getDataTlb()};
+                        for (BaseTlb* tlb : tlbs) if (tlb) tlb->shootdown_range(region, ENTRY_512, p);
+                    }
+                    for (BaseTlb* shared_tlb : zinfo->shared_tlbs) if (shared_tlb) shared_tlb->shootdown_range(region, ENTRY_512, p);
+                }
+            }
+            if (!done) return;
+            for (uint32_t c = 0; c < zinfo->numCores; c++) {
+                BaseTlb* dtlb = zinfo->cores[c]->getDataTlb();
+                BasePageTableWalker* ptw = dtlb ? dtlb->get_page_table_walker() : NULL;
+                if (ptw && ptw->Getpwc()) ptw->Getpwc()->switch_context();
+            }
+        }
+};
+
 typedef vector<vector<BaseCache*>> CacheGroup;
 
 CacheGroup* BuildCacheGroup(Config& config, const string& name, bool isTerminal) {
@@ -614,14 +827,17 @@ static void InitSystem(Config& config) {
 			    zinfo->page_shift=22;
                 break;
             case LongMode_Normal:
+            case LongMode5_Normal:
                 zinfo->page_size = 4 * power(2, 10);//4KB
                 zinfo->page_shift = 12;
                 break;
             case LongMode_Middle:
+            case LongMode5_Middle:
                 zinfo->page_size = 2 * power(2, 20);//2MB
                 zinfo->page_shift = 21;
                 break;
             case LongMode_Huge:
+            case LongMode5_Huge:
                 zinfo->page_size = power(2, 30);//1GB
                 zinfo->page_shift = 30;
                 break;
@@ -866,6 +1082,16 @@ static void InitSystem(Config& config) {
         zinfo->tlb_enabled = true;
         zinfo->tlb_enable_timing_mode = config.get<bool>("sys.tlbs.enableTimingMode",true);
         zinfo->ptw_enable_timing_mode = config.get<bool>("sys.ptw.enableTimingMode",true);
+        zinfo->tlb_asid_bits = config.get<uint32_t>("sys.tlbs.asidBits",0);
+        if (zinfo->tlb_asid_bits > 16) panic("sys.tlbs.asidBits is %u, at most 16 bits are supported", zinfo->tlb_asid_bits);
+        //sharer region size is in base pages, latencies in cycles
+        zinfo->tlb_shootdown_engine = new TlbShootdownEngine(zinfo->numCores,
+                config.get<uint32_t>("sys.tlbs.shootdown.regionShift", 9),
+                config.get<uint32_t>("sys.tlbs.shootdown.batchSize", 1),
+                config.get<uint64_t>("sys.tlbs.shootdown.batchEpoch", 0),
+                config.get<uint32_t>("sys.tlbs.shootdown.ipiLatency", 1000),
+                config.get<uint32_t>("sys.tlbs.shootdown.perTargetLatency", 100),
+                config.get<uint32_t>("sys.tlbs.shootdown.ackLatency", 500));
         info("TLB enabled!");
 		debug_printf("page size is: %lld",zinfo->page_size);
 		debug_printf("page shift is: %d",zinfo->page_shift);
@@ -894,12 +1120,16 @@ static void InitSystem(Config& config) {
 				zinfo->max_zone_pfns[Zone_HighMem] = 0;
 		}
 		debug_printf("init memory node and buddy allocator");
+		if( config.exists("sys.numa")){
+			InitNumaNodes(config);
+		}else{
 		//create MemoryNode and BuddyAllocator object 
 		MemoryNode* mem_node = gm_memalign<MemoryNode>(CACHE_LINE_BYTES , 1);
 		zinfo->memory_node = new (mem_node) MemoryNode(0,0);
 		//std::cout<<"number of node_zones:"<<zinfo->memory_node->node_zones.size()<<std::endl;
 		BuddyAllocator* buddy = gm_memalign<BuddyAllocator>(CACHE_LINE_BYTES , 1);
 		zinfo->buddy_allocator = new (buddy) BuddyAllocator(zinfo->memory_node);
+		}
 		//std::cout<<"number of node_zones:"<<zinfo->memory_node->node_zones.size()<<std::endl;
 		//debug_printf("number of pages is %ld",zinfo->memory_node->node_page_num);
 		debug_printf("init memory node and memory done");
@@ -907,6 +1137,8 @@ static void InitSystem(Config& config) {
         zinfo->tlb_enabled = false;
         zinfo->tlb_enable_timing_mode = false;
         zinfo->ptw_enable_timing_mode = false;
+        zinfo->tlb_asid_bits = 0;
+        zinfo->tlb_shootdown_engine = NULL;
 		zinfo->memory_node = NULL;
 		zinfo->buddy_allocator = NULL;
 
@@ -975,31 +1207,24 @@ static void InitSystem(Config& config) {
                 string tlb_type = config.get<const char*>("sys.tlbs.type" , "CommonTlb");
                 // assert(tlb_type == "CommonTlb");
                 if(tlb_type == "CommonTlb") zinfo->tlb_type = COMMONTLB;
-                // if(tlb_type == "ClusterTlb") zinfo->tlb_type = CLUSTERTLB;
+                else if(tlb_type == "ClusterTlb") zinfo->tlb_type = CLUSTERTLB;
+                else panic("Invalid sys.tlbs.type %s, should be CommonTlb or ClusterTlb", tlb_type.c_str());
                 debug_printf("tlb type is:%s", tlb_type.c_str());
                 union {
                     PageTableWalker<TlbEntry>* common_pgt;
                 };
                     
                 zinfo->paging_array = NULL;
+                zinfo->pte_arena = NULL;
                 bool reversed_pgt = config.get<bool>("sys.ptw.rpgt", false);
                 if(reversed_pgt)
                     debug_printf("Reversed page table enabled\n");
-                if(config.exists("sys.pwc")){
-                    zinfo->pwc_accLat = config.get<uint32_t>("sys.pwc.AccLat", 10);
-                    zinfo->pwc_invLat = config.get<uint32_t>("sys.pwc.InvLat", 10);
-                    vector<const char*> pwcGroupNames;
-                    config.subgroups("sys.pwc", pwcGroupNames);
-                    string prefix = "sys.pwc.";
-                    for (const char* grp : pwcGroupNames) {
-                        string group(grp);
-                        unsigned size = config.get<unsigned>("sys.pwc." + group + "." + "size", 0);
-                        unsigned ways = config.get<unsigned>("sys.pwc." + group + "." + "ways", 0);
-                        assert(size % ways == 0);
-                        zinfo->pwc_size.push_back(size);
-                        zinfo->pwc_ways.push_back(ways);
-                        }
-                }
+                //page walk caches, one per walker
+                AggregateStat* pwcStat = NULL;
+                //virtualized guests: the page tables of the processes are guest page tables, walked through one
+                //host page table (EPT) in 2D walks
+                bool nested = config.exists("sys.ptw.nested");
+                zinfo->host_paging = NULL;
                 if( config.exists("sys.tlbs")){
                     zinfo->pg_walkers = gm_memalign<BasePageTableWalker*>(CACHE_LINE_BYTES, cores);
                     common_pgt = gm_memalign<PageTableWalker<TlbEntry> >(CACHE_LINE_BYTES,cores );
@@ -1010,11 +1235,26 @@ static void InitSystem(Config& config) {
                         LongModePaging* longmode_paging;
                         ReversedPaging* reversed_paging;
                         HashPaging* hash_paging;
+                        ChainedHashPaging* chained_paging;
                         CuckooPaging* cuckoo_paging;
+                        ElasticCuckooPaging* elastic_paging;
                     }; 
                     zinfo->paging_array = gm_memalign<BasePaging*>(CACHE_LINE_BYTES , zinfo->numProcs);
+                    zinfo->pte_arena = new PteArena();
                     string mode_str = pagingmode_to_string(zinfo->paging_mode);
-                    if( !reversed_pgt && !zinfo->enable_shared_memory){
+                    NestedPaging* nested_paging = NULL;
+                    if( nested){
+                        if( mode_str != "LongMode" || reversed_pgt || zinfo->enable_shared_memory)
+                            panic("sys.ptw.nested needs a LongMode guest paging mode, without sys.ptw.rpgt or shared memory");
+                        string host_mode_str = config.get<const char*>("sys.ptw.nested.mode", "LongMode_Normal");
+                        PagingStyle host_mode = string_to_pagingmode(host_mode_str.c_str());
+                        //a guest frame is backed by one host leaf
+                        if( pagingmode_to_string(host_mode) != "LongMode" || get_page_size_by_mode(host_mode) != zinfo->page_size)
+                            panic("sys.ptw.nested.mode %s should be a LongMode mode of the guest page size", host_mode_str.c_str());
+                        info("Nested paging, host page table mode: %s", host_mode_str.c_str());
+                        zinfo->host_paging = new LongModePaging(host_mode);
+                        nested_paging = gm_memalign<NestedPaging>(CACHE_LINE_BYTES, zinfo->numProcs);
+                    } else if( !reversed_pgt && !zinfo->enable_shared_memory){
                         if( mode_str == "Legacy")
                             normal_paging = gm_memalign<NormalPaging>(CACHE_LINE_BYTES, zinfo->numProcs);
                         if( mode_str == "PAE")
@@ -1023,16 +1263,21 @@ static void InitSystem(Config& config) {
                             longmode_paging = gm_memalign<LongModePaging>(CACHE_LINE_BYTES, zinfo->numProcs);
                         if( mode_str == "Hash_Normal")
                             hash_paging = gm_memalign<HashPaging>(CACHE_LINE_BYTES, zinfo->numProcs);
+                        if( mode_str == "Hash_Chain")
+                            chained_paging = gm_memalign<ChainedHashPaging>(CACHE_LINE_BYTES, zinfo->numProcs);
                         if( mode_str == "Cuckoo_Normal")
                             cuckoo_paging = gm_memalign<CuckooPaging>(CACHE_LINE_BYTES, zinfo->numProcs);
-                        if( mode_str == "Cuckoo_elastic")
-                            cuckoo_paging = gm_memalign<CuckooPaging>(CACHE_LINE_BYTES, zinfo->numProcs);
+                        if( mode_str == "Cuckoo_Elastic")
+                            elastic_paging = gm_memalign<ElasticCuckooPaging>(CACHE_LINE_BYTES, zinfo->numProcs);
                     } else if( reversed_pgt || zinfo->enable_shared_memory ){
                         reversed_paging = gm_memalign<ReversedPaging>(CACHE_LINE_BYTES, zinfo->numProcs);
                     }
                     printf("num of paging: %d\n", zinfo->numProcs);
                     for( unsigned i=0; i<zinfo->numProcs; i++) {
-                        if( !reversed_pgt && !zinfo->enable_shared_memory){
+                        if( nested){
+                            info("Create nested guest page table for proc %d",i);
+                            zinfo->paging_array[i] = new (&nested_paging[i])NestedPaging(zinfo->paging_mode, zinfo->host_paging);
+                        } else if( !reversed_pgt && !zinfo->enable_shared_memory){
                             if( mode_str == "Legacy")
                                 zinfo->paging_array[i] = new (&normal_paging[i])NormalPaging(zinfo->paging_mode);
                             if( mode_str == "PAE")
@@ -1046,8 +1291,19 @@ static void InitSystem(Config& config) {
                                 zinfo->hdc_size = config.get<unsigned>("sys.hdc.size", 2048);
                                 zinfo->hdc_scale = config.get<double>("sys.hdc.scale", 2);
                                 zinfo->hdc_threshold = config.get<double>("sys.hdc.threshold", 0.60);
+                                zinfo->hdc_hash = CreatePgtHash(config, "sys.hdc.hash", "city");
+                                zinfo->hdc_moves = config.get<unsigned>("sys.hdc.moves", 16);
                                 zinfo->paging_array[i] = new (&hash_paging[i])HashPaging(zinfo->paging_mode);
                             }
+                            if( mode_str == "Hash_Chain") {
+                                info("Create chained hash page table");
+                                zinfo->hdc_size = config.get<unsigned>("sys.hdc.size", 2048);
+                                zinfo->hdc_scale = config.get<double>("sys.hdc.scale", 2);
+                                zinfo->hdc_threshold = config.get<double>("sys.hdc.threshold", 0.60);
+                                zinfo->hdc_hash = CreatePgtHash(config, "sys.hdc.hash", "city");
+                                zinfo->hdc_moves = config.get<unsigned>("sys.hdc.moves", 16);
+                                zinfo->paging_array[i] = new (&chained_paging[i])ChainedHashPaging(zinfo->paging_mode);
+                            }
                             if( mode_str == "Cuckoo_Normal") {
                                 cout<<"Cuckoo_Normal"<<endl;
                                 info("Create Cuckoo page table");
@@ -1056,32 +1312,75 @@ static void InitSystem(Config& config) {
                                     zinfo->cuckoo_d = config.get<unsigned>("sys.cuckoo.d", 2);
                                     zinfo->cuckoo_scale = config.get<double>("sys.cuckoo.scale", 2);
                                     zinfo->cuckoo_threshold = config.get<double>("sys.cuckoo.threshold", 0.60);
+                                    zinfo->cuckoo_hash = CreatePgtHash(config, "sys.cuckoo.hash", "blake2");
                                     zinfo->paging_array[i] = new (&cuckoo_paging[i])CuckooPaging(zinfo->paging_mode);
                                 }
                                 else panic("Cuckoo page table is not configured");
                                 std::cout<<"here"<<std::endl;
                             }
+                            if( mode_str == "Cuckoo_Elastic") {
+                                info("Create elastic cuckoo page table");
+                                if(!config.exists("sys.cuckoo")) panic("Cuckoo page table is not configured");
+                                zinfo->cuckoo_size = config.get<unsigned>("sys.cuckoo.size", 2048);
+                                zinfo->cuckoo_d = config.get<unsigned>("sys.cuckoo.d", 2);
+                                zinfo->cuckoo_scale = config.get<double>("sys.cuckoo.scale", 2);
+                                zinfo->cuckoo_threshold = config.get<double>("sys.cuckoo.threshold", 0.60);
+                                zinfo->cuckoo_hash = CreatePgtHash(config, "sys.cuckoo.hash", "blake2");
+                                //slots of the old table each insert moves while resizing, false resizes at once
+                                zinfo->cuckoo_swaps = config.get<unsigned>("sys.cuckoo.swaps", 16);
+                                zinfo->cuckoo_gradual = config.get<bool>("sys.cuckoo.gradual", true);
+                                zinfo->paging_array[i] = new (&elastic_paging[i])ElasticCuckooPaging(zinfo->paging_mode);
+                            }
                         }else if( reversed_pgt || zinfo->enable_shared_memory){
                             info("Create reversed paging");
                             zinfo->paging_array[i] = new (&reversed_paging[i]) ReversedPaging(mode_str, zinfo->paging_mode);	
                         }
                     }
+                    //transparent huge pages of the processes (the host page table of nested paging keeps its page size)
+                    if( config.get<bool>("sys.ptw.thp.enable", false)){
+                        if( (zinfo->paging_mode != LongMode_Normal && zinfo->paging_mode != LongMode5_Normal) || reversed_pgt || zinfo->enable_shared_memory || !zinfo->buddy_allocator)
+                            panic("sys.ptw.thp needs LongMode_Normal or LongMode5_Normal paging with a buddy allocator, without sys.ptw.rpgt or shared memory");
+                        bool thp_fault = config.get<bool>("sys.ptw.thp.fault", true);
+                        for( unsigned i=0; i<zinfo->numProcs; i++)
+                            static_cast<LongModePaging*>(zinfo->paging_array[i])->enable_thp(thp_fault);
+                        //background promotion, every interval phases
+                        uint32_t thp_interval = config.get<uint32_t>("sys.ptw.thp.interval", 1000);
+                        uint32_t thp_threshold = config.get<uint32_t>("sys.ptw.thp.threshold", 256);
+                        uint32_t thp_max_collapse = config.get<uint32_t>("sys.ptw.thp.maxCollapse", 8);
+                        if( thp_threshold == 0 || thp_threshold > ENTRY_512)
+                            panic("sys.ptw.thp.threshold should be 1-%u accessed PTEs", ENTRY_512);
+                        if( config.get<bool>("sys.ptw.thp.promote", true) && thp_interval && thp_max_collapse)
+                            zinfo->eventQueue->insert(new ThpCollapseEvent(thp_interval, thp_threshold, thp_max_collapse));
+                        info("Transparent huge pages: %s faults, promotion every %u phases", thp_fault ? "on" : "no", thp_interval);
+                    }
+                    //NUMA placement of the page tables, and their replicas per memory node (host page table of nested paging included)
+                    if( config.exists("sys.numa.pgtPolicy") || config.get<bool>("sys.numa.pgtReplicas", false)){
+                        if( !config.exists("sys.numa") || mode_str != "LongMode" || reversed_pgt || zinfo->enable_shared_memory)
+                            panic("sys.numa.pgtPolicy and pgtReplicas need sys.numa and a LongMode paging mode, without sys.ptw.rpgt or shared memory");
+                        string pgtPolicyStr = config.get<const char*>("sys.numa.pgtPolicy", "local");
+                        NumaPolicy pgtPolicy = string_to_numapolicy(pgtPolicyStr.c_str());
+                        if( pgtPolicy == Numa_Bind || numapolicy_to_string(pgtPolicy) != pgtPolicyStr) panic("Unknown sys.numa.pgtPolicy %s, local or interleave", pgtPolicyStr.c_str());
+                        bool pgtReplicas = config.get<bool>("sys.numa.pgtReplicas", false);
+                        for( unsigned i=0; i<zinfo->numProcs; i++)
+                            static_cast<LongModePaging*>(zinfo->paging_array[i])->place_tables(pgtPolicy, pgtReplicas);
+                        if( zinfo->host_paging) zinfo->host_paging->place_tables(pgtPolicy, pgtReplicas);
+                        info("Page tables: %s placement, %s", pgtPolicyStr.c_str(), pgtReplicas ? "a replica per memory node" : "no replicas");
+                    }
                 } else {
                     zinfo->pg_walkers = NULL;
                     zinfo->paging_array = NULL;
                 }
 
-                union {
-                    CommonTlb<TlbEntry> * common_tlb;
-                    // ClusterTlb<TlbEntry> * cluster_tlb;
-                    CommonTlb<TlbEntry> * potm_tlb;
-                };
+                CommonTlb<TlbEntry> * common_tlb;
+                //with ClusterTlb, only the L2 TLBs are clustered, L1 TLBs stay CommonTlb
+                ClusterTlb<TlbEntry> * cluster_tlb = NULL;
                 //string tlb_type = config.get<const char*>("sys.tlbs.type" , "CommonTlb");
                 debug_printf("tlb type: "+ tlb_type);
-                if(zinfo->tlb_type == COMMONTLB) common_tlb = gm_memalign<CommonTlb<TlbEntry> >(CACHE_LINE_BYTES, 3*cores);
-                // if(zinfo->tlb_type == CLUSTERTLB) cluster_tlb = gm_memalign<ClusterTlb<TlbEntry> >(CACHE_LINE_BYTES, 3*cores);
+                common_tlb = gm_memalign<CommonTlb<TlbEntry> >(CACHE_LINE_BYTES, 3*cores);
+                if(zinfo->tlb_type == CLUSTERTLB) cluster_tlb = gm_memalign<ClusterTlb<TlbEntry> >(CACHE_LINE_BYTES, cores);
                 // if(zinfo->potm_enabled == true) potm_tlb = gm_memalign<POTM_TLB<TlbEntry> >(CACHE_LINE_BYTES, cores);
                 int tlb_id = 0;
+                uint32_t groupFirstCore = coreIdx;
 
                 CacheGroup& parentLLCCaches = *cMap[llc];
                 for (uint32_t j = 0; j < cores; j++) {
@@ -1127,30 +1426,102 @@ static void InitSystem(Config& config) {
                             g_string pg_table_name(ss.str().c_str());
                             
                             // page table walkers, will be attached to LLC (if exists)
-                            zinfo->pg_walkers[j] = new (&common_pgt[j])PageTableWalker<TlbEntry>(ilog2(zinfo->lineSize),pg_table_name.c_str() ,zinfo->paging_mode, zinfo->ptw_enable_timing_mode);
+                            //walks each core can have in flight, 0 for no limit
+                            uint32_t walkers = config.get<uint32_t>("sys.ptw.walkers", 0);
+                            zinfo->pg_walkers[j] = new (&common_pgt[j])PageTableWalker<TlbEntry>(ilog2(zinfo->lineSize),pg_table_name.c_str() ,zinfo->paging_mode, zinfo->ptw_enable_timing_mode, walkers);
                             zinfo->pwc_enable = config.get<bool>("sys.ptw.pwc_enable", false);
-                            if(zinfo->pwc_enable) zinfo->pg_walkers[j]->Setpwc(zinfo->pwc_size, zinfo->pwc_ways, zinfo->pwc_accLat, zinfo->pwc_invLat);
+                            if(zinfo->pwc_enable && !config.exists("sys.pwc")) panic("sys.ptw.pwc_enable needs a sys.pwc configuration");
+                            //walkers of cuckoo tables may cache the cuckoo walk table (CWC)
+                            bool cwc = config.exists("sys.ptw.cwc");
+                            if(cwc && zinfo->paging_mode != Cuckoo_Normal) panic("sys.ptw.cwc needs a Cuckoo_Normal page table");
+                            //nested walkers always have one, for the host translations
+                            if(zinfo->pwc_enable || nested || cwc) {
+                                PageWalkCache* pwc;
+                                if (zinfo->pwc_enable) pwc = CreatePageWalkCache(config, "sys.pwc", pg_table_name + "-pwc");
+                                else pwc = new PageWalkCache(pg_table_name + "-pwc", false, false, g_vector<unsigned>(), g_vector<unsigned>(), 0, 0);
+                                if (!pwcStat) {
+                                    pwcStat = new AggregateStat(true);
+                                    pwcStat->init(gm_strdup((string(group) + "-pwc").c_str()), "Page walk cache stats");
+                                    zinfo->rootStat->append(pwcStat);
+                                }
+                                if (nested) {
+                                    //nested TLB of guest-physical to host-physical frames, and walk caches of the host page table
+                                    PageWalkCache* hostPwc = NULL;
+                                    if (config.exists("sys.ptw.nested.pwc")) {
+                                        hostPwc = CreatePageWalkCache(config, "sys.ptw.nested.pwc", pg_table_name + "-hpwc");
+                                        hostPwc->initStats(pwcStat);
+                                    }
+                                    pwc->set_nested(hostPwc, config.get<uint32_t>("sys.ptw.nested.tlb.entries", 16),
+                                                    config.get<uint32_t>("sys.ptw.nested.tlb.ways", 4),
+                                                    config.get<uint32_t>("sys.ptw.nested.tlb.latency", 1));
+                                }
+                                if (cwc) pwc->set_cuckoo(config.get<uint32_t>("sys.ptw.cwc.entries", 16),
+                                                         config.get<uint32_t>("sys.ptw.cwc.ways", 4),
+                                                         config.get<uint32_t>("sys.ptw.cwc.latency", 1));
+                                pwc->initStats(pwcStat);
+                                zinfo->pg_walkers[j]->Setpwc(pwc);
+                            }
+                            common_pgt[j].set_profiler(CreateHotnessProfiler(config, coreIdx));
                         }
                         // assert(tlb_group_names.size() == 3); //@buxin: L2 tlb is necessary.
                         for( const char* grp : tlb_group_names){
                             string tmp(grp);
+                            //built once per sharing domain below
+                            if(tmp == "shared_tlb") continue;
                             string name = tlb_prefix+tmp;
                             //default tlb entry num is 128
                             unsigned tlb_size = config.get<unsigned>(name +".entries",128);
+                            //default is fully associative
+                            unsigned tlb_ways = config.get<unsigned>(name +".ways",0);
+                            string tlb_hash = config.get<const char*>(name +".hash","None");
                             unsigned tlb_hit_lat = config.get<unsigned>(name+".hitLatency" , 1);
                             unsigned tlb_res_lat = config.get<unsigned>(name+".responseLatency",1);
                             //default tlb type is CommonTlb
                             debug_printf("%s hit latency %d , response latency %d",name.c_str(), tlb_hit_lat,tlb_res_lat);
                             //default eviction policy is LRU
-                            string evict_policy_str = config.get<const char*>(name+".repl","LRU");
+                            EVICTSTYLE evict_policy = GetTlbReplPolicy(config, name);
                             stringstream ss;
                             ss << name << coreIdx;
                             g_string tlb_name(ss.str().c_str());
                             // printf("name is %s\n", name.c_str());
                             // printf("core id is %d\n", coreIdx);
                             // printf("tlb_name is %s\n", tlb_name.c_str());
+                            HashFamily* tlb_hf = NULL;
+                            if (tlb_hash == "H3") tlb_hf = new H3HashFamily(1, 32, 0xF1A5EED + coreIdx);
+                            else if (tlb_hash != "None") panic("%s: invalid hash %s, should be None or H3", name.c_str(), tlb_hash.c_str());
                             BaseTlb* tlb = NULL;
-                            if(zinfo->tlb_type == COMMONTLB) tlb = new (&common_tlb[tlb_id]) CommonTlb<TlbEntry>( tlb_name.c_str(), zinfo->tlb_enable_timing_mode, tlb_size , tlb_hit_lat , tlb_res_lat, ilog2(zinfo->lineSize), zinfo->page_shift,stringToPolicy(evict_policy_str));
+                            if(zinfo->tlb_type == CLUSTERTLB && tmp == "l2_tlb") {
+                                //cluster entries map 2^clusterFactor pages, at most one PTE line
+                                unsigned cluster_entries = config.get<unsigned>(name +".clusterEntries",tlb_size);
+                                unsigned cluster_ways = config.get<unsigned>(name +".clusterWays",tlb_ways);
+                                unsigned cluster_pages = config.get<unsigned>(name +".clusterFactor",8);
+                                unsigned min_pages = config.get<unsigned>(name +".minPages",2);
+                                if(!isPow2(cluster_pages) || cluster_pages > zinfo->lineSize/8)
+                                    panic("%s: clusterFactor %u should be a power of two of at most %u, the PTEs in a cache line", name.c_str(), cluster_pages, zinfo->lineSize/8);
+                                if(min_pages < 1 || min_pages > cluster_pages)
+                                    panic("%s: minPages %u should be between 1 and clusterFactor (%u)", name.c_str(), min_pages, cluster_pages);
+                                if(CreateTlbPrefetchUnit(config, name)) panic("%s: TLB prefetching is not supported by ClusterTlb", name.c_str());
+                                ClusterTlb<TlbEntry>* cltb = new (&cluster_tlb[j]) ClusterTlb<TlbEntry>(tlb_name.c_str(), zinfo->tlb_enable_timing_mode, tlb_size, tlb_ways, cluster_entries, cluster_ways, ilog2(cluster_pages), min_pages, tlb_hit_lat, tlb_res_lat, ilog2(zinfo->lineSize), zinfo->page_shift, evict_policy, tlb_hf);
+                                cltb->set_asid_bits(zinfo->tlb_asid_bits);
+                                cltb->set_shootdown_engine(zinfo->tlb_shootdown_engine);
+                                cltb->set_profiler(CreateHotnessProfiler(config, tlb_id));
+                                tlb = cltb;
+                            } else {
+                                CommonTlb<TlbEntry>* ctlb = new (&common_tlb[tlb_id]) CommonTlb<TlbEntry>( tlb_name.c_str(), zinfo->tlb_enable_timing_mode, tlb_size , tlb_ways, tlb_hit_lat , tlb_res_lat, ilog2(zinfo->lineSize), zinfo->page_shift, evict_policy, tlb_hf);
+                                //huge pages share the base array (unified) unless they get their own
+                                unsigned entries_2m = config.get<unsigned>(name +".entries2M",0);
+                                unsigned entries_1g = config.get<unsigned>(name +".entries1G",0);
+                                if(entries_2m) ctlb->add_page_size_array(TLB_2MB, entries_2m, config.get<unsigned>(name +".ways2M",0), tlb_hf);
+                                if(entries_1g) ctlb->add_page_size_array(TLB_1GB, entries_1g, config.get<unsigned>(name +".ways1G",0), tlb_hf);
+                                ctlb->set_asid_bits(zinfo->tlb_asid_bits);
+                                ctlb->set_shootdown_engine(zinfo->tlb_shootdown_engine);
+                                ctlb->set_profiler(CreateHotnessProfiler(config, tlb_id));
+                                //prefetches are issued on L2 TLB misses only
+                                TlbPrefetchUnit* pf_unit = CreateTlbPrefetchUnit(config, name);
+                                if(pf_unit && tmp != "l2_tlb") panic("%s: TLB prefetching is only supported on l2_tlb", name.c_str());
+                                ctlb->set_prefetch_unit(pf_unit);
+                                tlb = ctlb;
+                            }
                             tlb_id++;
                             std::cout <<" tlb id: "<<tlb_id<<" tlb name: "<<tlb_name.c_str()<<std::endl;
                             /***----connect page table walker with TLB----***/
@@ -1182,6 +1553,11 @@ static void InitSystem(Config& config) {
                         assert(itlb);
                         assert(dtlb);
                         assert(l2_tlb);
+                        if(config.exists("sys.tlbs.shared_tlb")){
+                            SharedTlb<TlbEntry>* shared_tlb = GetSharedTlb(config, coreIdx, groupFirstCore);
+                            shared_tlb->add_requester(coreIdx, zinfo->pg_walkers[j]);
+                            l2_tlb->set_next_level_tlb(shared_tlb);
+                        }
                     }
 
                     //Build the core
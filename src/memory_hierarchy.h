@@ -129,11 +129,11 @@ struct MemReq {
     //for PTW
     bool isFirstPTW;
     bool isLastPTW;
-    bool pwc_hit;
     bool pageShared;
     bool pageDirty;
     bool triggerPageShared;
     bool triggerPageDirty;
+    uint32_t pageShift; //page size of the translation, filled by the walker or the TLB that hit
 
     bool nonCacheable;
 
@@ -225,8 +225,20 @@ class BaseTlb: public MemObject{
         virtual void setLevel(int level){};
         virtual void set_next_level_tlb(BaseTlb* tlb){};
         virtual BaseTlb* get_next_level_tlb(){};
-        virtual uint32_t shootdown(Address vpn) {return 0;};
-        virtual uint32_t update_entry(Address vpn, Address ppn) {return 0;};
+        //procIdx selects the address space, INVALID_PROC means the running one
+        virtual uint32_t shootdown(Address vpn, uint32_t procIdx = INVALID_PROC) {return 0;};
+        //drop the pages [vpn, vpn + pages), e.g. the base pages of a region collapsed into a huge page
+        virtual uint32_t shootdown_range(Address vpn, Address pages, uint32_t procIdx = INVALID_PROC) {
+            uint32_t lat = 0;
+            for (Address i = 0; i < pages; i++) {
+                uint32_t page_lat = shootdown(vpn + i, procIdx);
+                if (page_lat > lat) lat = page_lat;
+            }
+            return lat;
+        }
+        virtual uint32_t update_entry(Address vpn, Address ppn, uint32_t procIdx = INVALID_PROC) {return 0;};
+        //called when the core starts running procIdx; flushes unless entries are ASID-tagged
+        virtual void switch_context(uint32_t procIdx) { flush_all(); }
         virtual uint32_t update_ppn(Address ppn, Address new_ppn) {return 0;};
         virtual uint32_t update_tlb_flags(Address ppn, bool shared, bool dirty){return 0;}
 		virtual ~BaseTlb(){};
@@ -234,7 +246,7 @@ class BaseTlb: public MemObject{
 /*#-----------base class of paging--------------#*/
 class Page;
 class PageTable;
-class pwc_group;
+class PageWalkCache;
 class BasePDTEntry;
 class BaseCoreRecorder;
 class BasePaging: public MemObject
@@ -244,18 +256,25 @@ class BasePaging: public MemObject
 		virtual PagingStyle get_paging_style()=0;
 		virtual PageTable* get_root_directory()=0;
 		virtual Address access(MemReq& req )=0;
-        virtual Address access(MemReq& req , g_vector<MemObject*> &parents, g_vector<uint32_t> &parentRTTs, BaseCoreRecorder* cRec, bool sendPTW)=0;
+        //timing walk for a walker: its parents, core recorder and page walk cache (NULL if none)
+        virtual Address access(MemReq& req , g_vector<MemObject*> &parents, g_vector<uint32_t> &parentRTTs, BaseCoreRecorder* cRec, PageWalkCache* pwc, bool sendPTW)=0;
         virtual bool unmap_page_table(Address addr)=0;
 		virtual uint64_t remap_page_table( Address ppn,Address dst_ppn){return 0; };
-        virtual int map_page_table(Address addr, Page* pg_ptr , BasePDTEntry*& mapped_entry){	return 0;	};
+        virtual int map_page_table(Address addr, Page* pg_ptr , BasePDTEntry& mapped_entry){	return 0;	};
 		virtual int map_page_table(Address addr, Page* pg_ptr )=0;
         virtual int map_page_table(uint32_t req_id, Address addr, Page* pg_ptr, bool is_write) = 0;
+        //map the aligned huge page holding addr with a transparent huge page, set in head;
+        //returns the latency, -1 if the region is not eligible or no huge page is free (map a base page then)
+        virtual int map_huge_page(uint32_t req_id, Address addr, bool is_write, Page*& head){ return -1; }
 		virtual bool allocate_page_table(Address addr , Address size)=0;
 		virtual void remove_root_directory()=0;
 		virtual bool remove_page_table( Address addr , Address size)
 		{ return true; }
         // virtual Address get_vpn( Address ppn ){return -1;}
         virtual bool is_page_shared(Address ppn){return false;}
+        //functionally read the leaf PTEs of the n-page aligned group holding vpn (INVALID_PAGE_ADDR if unmapped);
+        //returns 0 if the paging mode cannot provide them
+        virtual uint32_t read_leaf_ptes(Address vpn, Address* ppns, uint32_t n, uint32_t& shared_mask, uint32_t& dirty_mask){ return 0; }
 		virtual void address_stats(std::ofstream &addrof){}
         virtual void calculate_stats(std::ofstream &vmof){}
 		virtual void calculate_stats(){}
@@ -263,6 +282,8 @@ class BasePaging: public MemObject
         virtual void setPTW(BasePageTableWalker* _ptw) {}
         virtual void lock() = 0;
         virtual void unlock() = 0;
+        //true if access() may run without lock(): walks then only lock() to fault pages in
+        virtual bool concurrent_walks() { return false; }
 };
 
 /*--------Base class for PageTableWalker object----------*/
@@ -272,6 +293,7 @@ class BasePageTableWalker: public BaseCache
 		//virtual bool add_child(const char* child_name , BaseTlb* tlb)=0;
 		virtual BasePaging* GetPaging(){ return NULL;}
 		virtual void SetPaging(uint32_t proc_id , BasePaging* copied_paging){}
+		virtual uint32_t GetProcIdx(){ return INVALID_PROC; }
 		virtual void convert_to_dirty( Address block_id){}
         virtual void calculate_stats(std::ofstream &vmof){}
 		virtual void calculate_stats(){}
@@ -281,9 +303,13 @@ class BasePageTableWalker: public BaseCache
         virtual uint64_t invalidate(const InvReq& req){assert(0);/* should never executed */};
         virtual void setCoreRecorder(BaseCoreRecorder* _cRec) {}
         virtual uint64_t tlb_shootdown(Address vpn){return 0;}
-        virtual uint64_t tlb_update(Address vpn, Address ppn){return 0;}
-        virtual void Setpwc(g_vector<unsigned>& size, g_vector<unsigned>& assoc, uint32_t accLat, uint32_t invLat) {};
-        virtual pwc_group* Getpwc(){ return NULL;}
+        virtual uint64_t tlb_update(uint32_t srcId, Address vpn, Address ppn){return 0;}
+        //leaf PTEs in the cache line of vpn's PTE, for coalescing TLBs; 0 if unavailable
+        virtual uint32_t read_pte_line(Address vpn, Address* ppns, uint32_t n, uint32_t& shared_mask, uint32_t& dirty_mask){ return 0; }
+        //functional walk for a TLB prefetch, PAGE_FAULT_SIG if vpn is not mapped
+        virtual Address prefetch(MemReq& req){ return PAGE_FAULT_SIG; }
+        virtual void Setpwc(PageWalkCache* pwc) {};
+        virtual PageWalkCache* Getpwc(){ return NULL;}
 };
 
 class PIMBasePageTableWalker;
@@ -310,26 +336,4 @@ class PIMBasePageTableWalker: public GlobAlloc
 
 };
 
-class BasePDTEntry;
-struct Content: public GlobAlloc
-{
-  public:
-	Content( BasePDTEntry* entry=NULL, Address page_no=0):
-		  pgt_entry(entry), vpn(page_no){}
-    Content( Content& forbid_copy){
-        pgt_entry = forbid_copy.get_pgt_entry();
-        vpn = forbid_copy.get_vpn();
-    };
-    ~Content(){
-        printf("vpn %ld deleted\n",vpn);
-    }
-	
-	Address get_vpn(){ return vpn; }
-	BasePDTEntry* get_pgt_entry(){	return pgt_entry; }
-
-  private:
-	BasePDTEntry* pgt_entry;
-	Address vpn;
-};
-
 #endif  // MEMORY_HIERARCHY_H_
@@ -22,26 +22,25 @@ inline Page *get_page_ptr(MemoryNode *mem_node, uint64_t page_id) {
  *			 belongs to buddy system
  */
 inline bool page_is_buddy(MemoryNode *mem_node, uint64_t page_id) {
-    return (mem_node->get_page_ptr(page_id)->map_count ==
-            PAGE_BUDDY_MAPCOUNT_VALUE);
+    return mem_node->get_page_ptr(page_id)->buddy;
 }
 
 inline void set_page_buddy(MemoryNode *mem_node, uint64_t page_id) {
-    mem_node->get_page_ptr(page_id)->map_count = PAGE_BUDDY_MAPCOUNT_VALUE;
+    mem_node->get_page_ptr(page_id)->buddy = 1;
 }
 
 inline void clear_page_buddy(MemoryNode *mem_node, uint64_t page_id) {
     // assert( page_is_buddy( mem_node , page_id));
-    mem_node->get_page_ptr(page_id)->map_count = -1;
+    mem_node->get_page_ptr(page_id)->buddy = 0;
 }
 
 inline unsigned get_page_private(MemoryNode *mem_node, uint64_t page_id) {
-    return get_page_ptr(mem_node, page_id)->private_;
+    return get_page_ptr(mem_node, page_id)->order;
 }
 
 inline void set_page_private(MemoryNode *mem_node, uint64_t page_id,
                              unsigned order) {
-    mem_node->get_page_ptr(page_id)->private_ = order;
+    mem_node->get_page_ptr(page_id)->order = order;
 }
 
 inline void set_page_order(MemoryNode *mem_node, uint64_t page_id,
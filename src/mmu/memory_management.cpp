@@ -14,39 +14,115 @@
 #include "zsim.h"
 // lock_t BuddyAllocator::buddy_lock;
 // MemoryNode* BuddyAllocator::mem_node;
-BuddyAllocator::BuddyAllocator(MemoryNode *node) {
+BuddyAllocator::BuddyAllocator(MemoryNode *node)
+    : policy(Numa_Local), cores_per_node(1), interleave_next(0) {
     mode = zinfo->paging_mode;
     total_memsize = zinfo->memory_size;
     assert(total_memsize > 0);
     free_page_num = total_memsize >> (zinfo->page_shift);
-    mem_node = node;
-    futex_init(&buddy_lock);
+    nodes.push_back(node);
+    node_pages = node->node_page_num;
+    allocated_pages.resize(1, 0);
+    fallback_pages.resize(1, 0);
+}
+
+BuddyAllocator::BuddyAllocator(const g_vector<MemoryNode *> &nodes,
+                               NumaPolicy policy,
+                               const g_vector<unsigned> &bind_nodes,
+                               uint32_t cores_per_node)
+    : nodes(nodes), policy(policy), bind_nodes(bind_nodes),
+      cores_per_node(cores_per_node), interleave_next(0) {
+    mode = zinfo->paging_mode;
+    total_memsize = zinfo->memory_size;
+    assert(total_memsize > 0);
+    free_page_num = total_memsize >> (zinfo->page_shift);
+    assert(!nodes.empty() && cores_per_node);
+    // node_of() divides, the nodes split the frames evenly
+    node_pages = nodes[0]->node_page_num;
+    for (unsigned i = 0; i < nodes.size(); i++)
+        assert(nodes[i]->node_start_pfn == i * node_pages);
+    if (policy == Numa_Bind && bind_nodes.empty())
+        panic("The bind NUMA policy needs the nodes to bind to");
+    for (unsigned i = 0; i < bind_nodes.size(); i++)
+        if (bind_nodes[i] >= nodes.size())
+            panic("Bound to memory node %u of %lu", bind_nodes[i],
+                  nodes.size());
+    allocated_pages.resize(nodes.size(), 0);
+    fallback_pages.resize(nodes.size(), 0);
 }
 
 void BuddyAllocator::InitMemoryNode(MemoryNode *node) {}
 
 BuddyAllocator::~BuddyAllocator() {}
 
+/***-----NUMA placement----------***/
+unsigned BuddyAllocator::preferred_node(int cpu_id) {
+    if (policy == Numa_Interleave)
+        return __sync_fetch_and_add(&interleave_next, 1) % nodes.size();
+    // no faulting core: allocations of the system start at node 0
+    unsigned home = cpu_id < 0 ? 0 : home_node(cpu_id);
+    if (policy == Numa_Bind) {
+        // the home node if it is bound, else the first bound one
+        for (unsigned i = 0; i < bind_nodes.size(); i++)
+            if (bind_nodes[i] == home)
+                return i;
+        return 0;
+    }
+    return home;
+}
+
+int BuddyAllocator::fallback_node(unsigned first, unsigned i) {
+    if (policy == Numa_Bind)
+        return i < bind_nodes.size()
+                   ? bind_nodes[(first + i) % bind_nodes.size()]
+                   : -1;
+    return i < nodes.size() ? (first + i) % nodes.size() : -1;
+}
+
 /***-----allocate pages----------***/
-Page *BuddyAllocator::allocate_pages(unsigned int gfp_mask, unsigned order) {
+Page *BuddyAllocator::allocate_node_pages(unsigned node_id, unsigned gfp_mask,
+                                          unsigned order, bool fallback) {
+    Zone *zone = gfp_zone(gfp_mask, nodes[node_id]);
+    if (!zone)
+        return NULL;
+    futex_lock(&zone->lock);
+    Page *page = allocate_pages(zone, order);
+    futex_unlock(&zone->lock);
+    if (page) {
+        __sync_fetch_and_add(&allocated_pages[node_id], 1UL << order);
+        if (fallback)
+            __sync_fetch_and_add(&fallback_pages[node_id], 1UL << order);
+    }
+    return page;
+}
+
+Page *BuddyAllocator::allocate_pages(unsigned int gfp_mask, unsigned order,
+                                     int cpu_id) {
     if (order >= MAXORDER) {
         return NULL;
     }
-    futex_lock(&buddy_lock);
-    Zone *zone = gfp_zone(gfp_mask);
-    if (zone) {
-        Page *page = allocate_pages(zone, order);
-        if (page == NULL)
-            std::cout << "allocate failed inner" << std::endl;
-        // else
-        // std::cout<<"page no:"<<std::hex<<page->pageNo<<std::endl;
-        futex_unlock(&buddy_lock);
-        return page;
-    } else {
-        futex_unlock(&buddy_lock);
+    unsigned first = preferred_node(cpu_id);
+    int node_id;
+    for (unsigned i = 0; (node_id = fallback_node(first, i)) >= 0; i++) {
+        Page *page = allocate_node_pages(node_id, gfp_mask, order, i);
+        if (page)
+            return page;
+    }
+    debug_printf("allocation of 2^%u pages failed on every node", order);
+    return NULL;
+}
+
+Page *BuddyAllocator::allocate_pages_on(unsigned node_id, unsigned order) {
+    assert(node_id < nodes.size());
+    if (order >= MAXORDER)
         return NULL;
-        panic("system has no zone specified by gfp_mask");
+    for (unsigned i = 0; i < nodes.size(); i++) {
+        Page *page = allocate_node_pages((node_id + i) % nodes.size(), 0,
+                                         order, i);
+        if (page)
+            return page;
     }
+    return NULL;
 }
 
 Address BuddyAllocator::get_free_pages(unsigned int gfp_mask, unsigned order) {
@@ -74,73 +150,92 @@ uint64_t BuddyAllocator::find_buddy_index(uint64_t page_no, unsigned order) {
  */
 bool BuddyAllocator::page_is_buddy(uint64_t page_id, uint64_t buddy_id,
                                    unsigned order) {
-    bool is_buddy = false;
-    assert(mem_node);
-    if (get_page_ptr(mem_node, buddy_id)->private_ == order) {
-        if (mem_node->get_page_ptr(page_id)->node ==
-                mem_node->get_page_ptr(buddy_id)->node &&
-            mem_node->get_page_ptr(page_id)->zone ==
-                mem_node->get_page_ptr(buddy_id)->zone)
-            is_buddy = true;
-    }
-    return is_buddy;
+    // nodes are aligned to MAXORDER blocks, buddies share one
+    MemoryNode *mem_node = node_of(page_id);
+    // the last blocks of a node may have their buddy past its end
+    if (buddy_id - mem_node->node_start_pfn >= mem_node->node_page_num)
+        return false;
+    Page *page = mem_node->get_page_ptr(page_id);
+    Page *buddy = mem_node->get_page_ptr(buddy_id);
+    return buddy->buddy && buddy->order == order &&
+           page->node_id == buddy->node_id && page->zone_id == buddy->zone_id;
 }
 
+/*
+ *@function: return a block of 2^order pages to the zone, coalescing it
+ *with its free buddies, called with the zone lock held
+ */
 void BuddyAllocator::free_one_page(Zone *zone, uint64_t page_no,
                                    unsigned order) {
-    uint64_t page_id = page_no & ((1 << MAXORDER) - 1);
-    while (order < MAXORDER - 1) {
+    MemoryNode *mem_node = zone->node_ptr;
+    uint64_t page_id = page_no;
+    zone->free_pages += 1UL << order;
+    __sync_fetch_and_add(&free_page_num, 1UL << order);
+    while (order < MAXORDER) {
         uint64_t buddy_id = find_buddy_index(page_id, order);
-        if (!page_is_buddy(page_no, buddy_id, order))
+        if (!page_is_buddy(page_id, buddy_id, order))
             break;
+        // take the buddy off its free list, the merged block goes up one
+        zone->free_area[order].block_list->fetch_block(
+            mem_node->get_page_ptr(buddy_id));
         zone->free_area[order].nr_free--;
         clear_page_buddy(mem_node, buddy_id);
         set_page_private(mem_node, buddy_id, 0);
         // page number after combined
-        uint64_t combined_id = buddy_id & page_no;
+        uint64_t combined_id = buddy_id & page_id;
         page_id = combined_id;
         order++;
     }
     // set bigger order for bigger block
     set_page_order(mem_node, page_id, order);
+    zone->free_area[order].block_list->push_block_back(
+        mem_node->get_page_ptr(page_id));
     zone->free_area[order].nr_free++;
 }
 
 void BuddyAllocator::free_one_page(uint64_t page_no) {
-    futex_lock(&buddy_lock);
-    Page *page = mem_node->get_page_ptr(page_no);
-    free_one_page(page->zone, page->pageNo, 0);
-    futex_unlock(&buddy_lock);
+    Page *page = get_page_ptr(page_no);
+    Zone *zone = page_zone(page);
+    futex_lock(&zone->lock);
+    free_one_page(zone, page->pageNo, 0);
+    futex_unlock(&zone->lock);
 }
 
 /*
- *@function: free a number of pages from pcp lists
+ *@function: free a number of pages from pcp lists, under one hold of the
+ *zone lock
  *@count: number of pages to be freed from pcp list
  *@pcp: PerCpuPages struct,
  */
 void BuddyAllocator::free_pcppages_bulk(Zone *zone, unsigned int count,
                                         PerCpuPages *pcp) {
     Page *page;
-    for (unsigned i = 0; (i < count) && (pcp->page_list.size() > 0); i++) {
-        page = pcp->page_list.front();
-        pcp->page_list.pop_front(); // delete page
-        pcp->count++;
+    futex_lock(&zone->lock);
+    for (unsigned i = 0; (i < count) && !pcp->page_list.is_empty(); i++) {
+        page = pcp->page_list.fetch_head(); // delete page
+        pcp->count--;
         free_one_page(zone, (page->pageNo), 0);
     }
+    futex_unlock(&zone->lock);
 }
 
+/*
+ *@function: refill a page cache, taking the zone lock once for the batch
+ *@return: number of pages allocated
+ */
 unsigned BuddyAllocator::allocate_bulk(Zone *zone, unsigned int order,
-                                       uint64_t count,
-                                       std::list<Page *> &list) {
+                                       uint64_t count, PageList &list) {
     Page *page;
     uint64_t i = 0;
+    futex_lock(&zone->lock);
     for (; i < count; i++) {
         page = allocate_pages(zone, order);
         // page allocate failed
         if (unlikely(page == NULL))
             break;
-        list.push_back(page);
+        list.push_block_back(page);
     }
+    futex_unlock(&zone->lock);
     return i; // return allocated page
 }
 
@@ -150,9 +245,9 @@ unsigned BuddyAllocator::allocate_bulk(Zone *zone, unsigned int order,
  *@param order:
  */
 Page *BuddyAllocator::allocate_pages(Zone *zone, unsigned order) {
-    assert(mem_node);
+    assert(zone->node_ptr);
     // get the page can be allocated
-    Page *page = rmqueue_page_smallest(mem_node, zone, order);
+    Page *page = rmqueue_page_smallest(zone->node_ptr, zone, order);
     return page;
 }
 
@@ -171,20 +266,20 @@ Page *BuddyAllocator::rmqueue_page_smallest(MemoryNode *mem_node, Zone *zone,
         FreeArea *area = &(zone->free_area[current_order]);
         // no free block whose order is current_order
         // continue find page block
-        if (area->block_list->get_size() == 0)
+        if (area->block_list->get_size() == 0 &&
+            !(current_order == MAXORDER &&
+              zone->release_deferred_block(mem_node)))
             continue;
-        // get page descriptor
+        // get page descriptor, its zone and node are set by the memmap
         page = area->block_list->fetch_head();
-        page->set_page_node(mem_node);
-        page->set_page_zone(zone);
         uint64_t page_id = page->pageNo;
-        page->map_count = -1;
-        page->private_ = 0;
+        page->buddy = 0;
+        page->order = 0;
         page->count = 1; // set reference count to 1
         area->nr_free--;
         // update free page of zone
-        zone->free_pages -= 1UL >> order;
-        free_page_num -= 1UL << order;
+        zone->free_pages -= 1UL << order;
+        __sync_fetch_and_sub(&free_page_num, 1UL << order);
         // std::cout<<"current_order:"<<current_order<<std::endl;
         // expand
         expand(mem_node, zone, page_id, order, current_order);
@@ -260,7 +355,7 @@ void BuddyAllocator::expand(MemoryNode *mem_node, Zone *zone,
     }
 }
 
-Zone *BuddyAllocator::gfp_zone(unsigned int flag) {
+Zone *BuddyAllocator::gfp_zone(unsigned int flag, MemoryNode *mem_node) {
     // futex_lock(&buddy_lock);
     // allocate pages from Zone DMA
     if (mem_node) {
@@ -283,41 +378,59 @@ Zone *BuddyAllocator::gfp_zone(unsigned int flag) {
 }
 
 /****------per cpu pageset allocation--------****/
+/*
+ *@function: allocate from the page cache of cpu_id, refilled by a batch
+ *from the buddy system when empty; orders above 0 bypass the caches
+ */
 Page *BuddyAllocator::buffered_rmqueue(unsigned int gfp_mask, Zone *zone,
                                        unsigned order, unsigned cpu_id) {
     PerCpuPages *pps;
     Page *page = NULL;
     bool cold = ((gfp_mask & GFP_COLD) != 0);
-    // allocate pages from hot per_cpu_pages
-    if (likely(order == 0)) {
-        // allocate from cold page list
-        if (!cold)
-            pps = zone->get_cpu_hot_pages(cpu_id);
-        else
-            pps = zone->get_cpu_cold_pages(cpu_id);
-        // has no pages in hot page list
-        // allocate pages through buddy allocator
-        if (pps->page_list.empty()) {
-            pps->count +=
-                allocate_bulk(zone, order, pps->batch, pps->page_list);
-        }
-        // need complement page
-        else if (pps->count <= pps->low) {
-            uint64_t page_need = pps->batch - pps->count;
-            pps->count += allocate_bulk(zone, order, page_need, pps->page_list);
-        }
-        // allocate succeed
-        if (!(pps->page_list.empty())) {
-            page = *(pps->page_list.begin());
-            pps->count--;
-        }
-    }
-    if (!page || pps->page_list.empty() || unlikely(order != 0)) {
+    if (unlikely(order != 0)) {
+        futex_lock(&zone->lock);
         page = allocate_pages(zone, order);
+        futex_unlock(&zone->lock);
+        return page;
     }
+    // allocate from cold page list
+    if (!cold)
+        pps = zone->get_cpu_hot_pages(cpu_id);
+    else
+        pps = zone->get_cpu_cold_pages(cpu_id);
+    futex_lock(&pps->lock);
+    // has no pages in page list, refill through buddy allocator
+    if (pps->count <= pps->low)
+        pps->count += allocate_bulk(zone, order, pps->batch - pps->count,
+                                    pps->page_list);
+    // allocate succeed
+    if (!pps->page_list.is_empty()) {
+        page = pps->page_list.fetch_head();
+        pps->count--;
+    }
+    futex_unlock(&pps->lock);
     return page;
 }
 
+Page *BuddyAllocator::allocate_page(unsigned cpu_id, unsigned int gfp_mask) {
+    unsigned first = preferred_node(cpu_id);
+    int node_id;
+    for (unsigned i = 0; (node_id = fallback_node(first, i)) >= 0; i++) {
+        Zone *zone = gfp_zone(gfp_mask, nodes[node_id]);
+        if (!zone)
+            continue;
+        assert(cpu_id < zone->page_set.size());
+        Page *page = buffered_rmqueue(gfp_mask, zone, 0, cpu_id);
+        if (page) {
+            __sync_fetch_and_add(&allocated_pages[node_id], 1);
+            if (i)
+                __sync_fetch_and_add(&fallback_pages[node_id], 1);
+            return page;
+        }
+    }
+    return NULL;
+}
+
 /****------per cpu pageset free--------****/
 /*
  *@function: free page to cpu cache list;
@@ -330,25 +443,33 @@ Page *BuddyAllocator::buffered_rmqueue(unsigned int gfp_mask, Zone *zone,
 void BuddyAllocator::free_hot_cold_page(Page *page, unsigned cpu_id,
                                         bool cold) {
     // get zone
-    Zone *zone = page->zone;
+    Zone *zone = page_zone(page);
     PerCpuPages *cpu_pages;
 
-    futex_lock(&buddy_lock);
     if (cold) // free cold page
         cpu_pages = zone->get_cpu_cold_pages(cpu_id);
     else if (!cold) // free hot page
         cpu_pages = zone->get_cpu_hot_pages(cpu_id);
+    futex_lock(&cpu_pages->lock);
     // add page to cpu page list
-    cpu_pages->page_list.push_back(page);
+    cpu_pages->page_list.push_block_back(page);
     cpu_pages->count++;
     // check whether need to clear cache
-    if (cpu_pages->count > cpu_pages->high) {
+    if (cpu_pages->count > cpu_pages->high)
         free_pcppages_bulk(zone, cpu_pages->batch, cpu_pages);
-        cpu_pages->count -= cpu_pages->batch;
-    }
-    futex_unlock(&buddy_lock);
+    futex_unlock(&cpu_pages->lock);
 }
 
 uint64_t BuddyAllocator::get_free_memory_size() {
     return free_page_num << (zinfo->page_shift);
-}
\ No newline at end of file
+}
+
+void BuddyAllocator::calculate_stats(std::ofstream &vmof) {
+    if (nodes.size() == 1)
+        return;
+    vmof << "NUMA policy: " << numapolicy_to_string(policy) << std::endl;
+    for (unsigned i = 0; i < nodes.size(); i++)
+        vmof << "memory node " << i << " pages allocated:"
+             << allocated_pages[i] << "\t by fallback:" << fallback_pages[i]
+             << std::endl;
+}
@@ -12,6 +12,7 @@
 #ifndef MEMORY_MANAGEMENT_H_
 #define MEMORY_MANAGEMENT_H_
 #include "common/common_functions.h"
+#include "g_std/g_vector.h"
 #include "locks.h"
 #include "memory_hierarchy.h"
 #include "mmu/common_memory_ops.h"
@@ -23,18 +24,34 @@
 #include <vector>
 
 /*-----manage memory by buddy allocating algorithm----*/
+/*
+ * One buddy system per memory node. With several nodes (sys.numa), every
+ * node is a contiguous range of frames held by one HMC stack or vault, and
+ * the NUMA policy picks the node a page comes from: the faulting core's
+ * own, round robin, or a bound set. A node that runs out falls back to the
+ * next ones.
+ */
 class BuddyAllocator {
   public:
     BuddyAllocator(MemoryNode *node);
+    BuddyAllocator(const g_vector<MemoryNode *> &nodes, NumaPolicy policy,
+                   const g_vector<unsigned> &bind_nodes,
+                   uint32_t cores_per_node);
     ~BuddyAllocator();
     /***allocate pages according to gfp_mask***/
     Page *allocate_pages(Zone *zone, unsigned order);
-    Page *allocate_pages(unsigned int gfp_mask, unsigned order = 0);
+    // cpu_id: the faulting core the NUMA policy places the pages for, -1
+    // for allocations of the system
+    Page *allocate_pages(unsigned int gfp_mask, unsigned order = 0,
+                         int cpu_id = -1);
+    // from node node_id, or the next nodes when it is full, whatever the
+    // NUMA policy: the kernel places its own pages, such as page tables
+    Page *allocate_pages_on(unsigned node_id, unsigned order = 0);
     Address get_free_pages(unsigned int gfp_mask, unsigned order = 0);
     Address get_dma_pages(unsigned int gfp_mask, unsigned order = 0);
 
     unsigned allocate_bulk(Zone *zone, unsigned int order, uint64_t count,
-                           std::list<Page *> &list);
+                           PageList &list);
     /***free pages from specified zone***/
     void free_one_page(Zone *zone, uint64_t page_no, unsigned order);
     void free_one_page(uint64_t page_no);
@@ -43,13 +60,34 @@ class BuddyAllocator {
     /***per cpu pageset allocate***/
     Page *buffered_rmqueue(unsigned int gfp_mask, Zone *zone, unsigned order,
                            unsigned cpu_id);
+    // a page for a fault of core cpu_id, from its page cache
+    Page *allocate_page(unsigned cpu_id, unsigned int gfp_mask = 0);
     /***--per cpu pageset free--***/
+    void free_page(Page *page, unsigned cpu_id) {
+        free_hot_cold_page(page, cpu_id, false);
+    }
+
+    /***--memory nodes--***/
+    unsigned get_node_num() { return nodes.size(); }
+    MemoryNode *get_node(unsigned node_id) { return nodes[node_id]; }
+    MemoryNode *node_of(uint64_t page_no) {
+        uint64_t node_id = page_no / node_pages;
+        return nodes[node_id < nodes.size() ? node_id : nodes.size() - 1];
+    }
+    Page *get_page_ptr(uint64_t page_no) {
+        return node_of(page_no)->get_page_ptr(page_no);
+    }
+    // the node holding the memory of core cpu_id
+    unsigned home_node(unsigned cpu_id) {
+        return (cpu_id / cores_per_node) % nodes.size();
+    }
 
     /***--memory system status related--***/
     uint64_t get_total_memory_size() { return total_memsize; }
 
-    inline uint64_t get_free_memory_size();
+    uint64_t get_free_memory_size();
     static void InitMemoryNode(MemoryNode *node);
+    void calculate_stats(std::ofstream &vmof);
 
   private:
     uint64_t find_buddy_index(uint64_t page_no, unsigned order);
@@ -63,13 +101,30 @@ class BuddyAllocator {
                 uint64_t page_id, unsigned low_order, unsigned high_order);
 
     void free_hot_cold_page(Page *page, unsigned cpu_id, bool cold);
-    inline Zone *gfp_zone(unsigned int flags);
+    // fallback: node_id is not the node the allocation tried first
+    Page *allocate_node_pages(unsigned node_id, unsigned gfp_mask,
+                              unsigned order, bool fallback);
+    inline Zone *gfp_zone(unsigned int flags, MemoryNode *mem_node);
+    Zone *page_zone(Page *page) {
+        return nodes[page->node_id]->page_zone(page);
+    }
+    // the node an allocation tries first, cpu_id -1 if no core faulted
+    unsigned preferred_node(int cpu_id);
+    // the i-th node to try after first, -1 once all are tried
+    int fallback_node(unsigned first, unsigned i);
 
   private:
     uint64_t total_memsize;
     PagingStyle mode;
     uint64_t free_page_num;
-    MemoryNode *mem_node;
-    lock_t buddy_lock;
+    g_vector<MemoryNode *> nodes;
+    uint64_t node_pages; // frames of a node
+    NumaPolicy policy;
+    g_vector<unsigned> bind_nodes;
+    uint32_t cores_per_node;
+    uint64_t interleave_next;
+    // stats, per node
+    g_vector<uint64_t> allocated_pages;
+    g_vector<uint64_t> fallback_pages; // not on the node tried first
 };
 #endif
@@ -7,30 +7,33 @@
 #ifndef _PAGE_H_
 #define _PAGE_H_
 /*------basic descriptor for page--------*/
-// forward declarition
-class Zone;
-class MemoryNode;
+/*
+ * Descriptors live in the sparse memmap of their MemoryNode, one per frame,
+ * so they are kept small: buddy metadata and the zone/node links are packed
+ * into a few bytes next to the list link.
+ */
 struct Page {
     Page(uint64_t page_no)
-        : count(0), pageNo(page_no), map_count(-1), next(NULL), overlap(0) {}
+        : pageNo(page_no), next(NULL), count(0), overlap(0), order(0),
+          buddy(0), zone_id(0), node_id(0) {}
     void inc_reference() { count++; }
     // set zone for page
-    void set_page_zone(Zone *zone) { this->zone = zone; }
+    void set_page_zone(unsigned zone_type) { zone_id = zone_type; }
     // set node for page
-    void set_page_node(MemoryNode *node) { this->node = node; }
+    void set_page_node(unsigned node) { node_id = node; }
 
     void set_overlap(unsigned access_counter) { overlap = access_counter; }
 
     unsigned get_overlap() { return overlap; }
 
-    unsigned count; // how many processes this page mapped to
     Address pageNo; // page no
-    int map_count;
-    Zone *zone;
-    MemoryNode *node;
     Page *next;
+    unsigned count; // how many processes this page mapped to
     unsigned overlap;
-    unsigned private_; // order in buddy system
+    uint8_t order;   // order in buddy system
+    uint8_t buddy;   // heads a free block of the buddy system
+    uint8_t zone_id; // ZoneType of the zone holding it
+    uint8_t node_id;
 };
 
 #endif
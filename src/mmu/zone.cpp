@@ -6,12 +6,14 @@
  */
 
 #include "mmu/zone.h"
+#include "mmu/common_memory_ops.h"
 #include "zsim.h"
 // init zone
 Zone::Zone(ZoneType type, uint64_t start_pfn, uint64_t end_pfn)
     : zone_type(type), zone_start_pfn(start_pfn) {
     assert(start_pfn < end_pfn);
     free_pages = end_pfn - start_pfn;
+    futex_init(&lock);
     // init per cpu pageset
     setup_zone_pageset();
 }
@@ -39,7 +41,13 @@ void Zone::free_area_init_zone(MemoryNode *mem_node) {
     uint64_t page_index = zone_start_pfn;
     uint64_t page_number = free_pages;
     // std::cout<<"page_number:"<<page_number<<std::endl;
-    for (int i = MAXORDER; i > 0 && page_number > 0; i--) {
+    // MAXORDER blocks are released to the free list as allocations need them
+    deferred_start_pfn = page_index;
+    deferred_blocks = page_number >> MAXORDER;
+    free_area[MAXORDER].nr_free = deferred_blocks;
+    page_number -= deferred_blocks << MAXORDER;
+    page_index += deferred_blocks << MAXORDER;
+    for (int i = MAXORDER - 1; i > 0 && page_number > 0; i--) {
         max_block_num = (page_number) / (1 << i);
         // std::cout<<"order "<<i<<" block num is:"<<max_block_num<<std::endl;
         if (max_block_num > 0) {
@@ -48,13 +56,25 @@ void Zone::free_area_init_zone(MemoryNode *mem_node) {
             for (unsigned long j = 0; j < max_block_num; j++) {
                 free_area[i].block_list->push_block_back(
                     mem_node->get_page_ptr(page_index));
+                set_page_order(mem_node, page_index, i);
                 page_index += (1 << i);
             }
         }
     }
-    info("Maxorder list size: %d", free_area[MAXORDER].block_list->get_size());
+    info("Maxorder blocks deferred: %lu", deferred_blocks);
     info("Free area init finished");
 }
+
+bool Zone::release_deferred_block(MemoryNode *mem_node) {
+    if (!deferred_blocks)
+        return false;
+    free_area[MAXORDER].block_list->push_block_back(
+        mem_node->get_page_ptr(deferred_start_pfn));
+    set_page_order(mem_node, deferred_start_pfn, MAXORDER);
+    deferred_start_pfn += 1ULL << MAXORDER;
+    deferred_blocks--;
+    return true;
+}
 //######init per_cpu_pageset for zone
 unsigned int Zone::zone_batchsize() {
     int batch;
@@ -67,7 +87,8 @@ unsigned int Zone::zone_batchsize() {
         batch /= 4;
     if (batch < 1)
         batch = 1;
-    batch = log2((uint16_t)(batch + batch / 2)) - 1;
+    // rounddown_pow_of_two(batch + batch / 2) - 1, as Linux sizes it
+    batch = (1 << (int)log2(batch + batch / 2)) - 1;
     return batch;
 }
 
@@ -86,8 +107,12 @@ void Zone::zone_pageset_init(PerCpuPageset *ps) {
     PerCpuPages *cold_pps = &ps->pcp[1];
     hot_pps->count = 0;
     cold_pps->count = 0;
+    hot_pps->low = 0;
+    cold_pps->low = 0;
     hot_pps->page_list.clear();
     cold_pps->page_list.clear();
+    futex_init(&hot_pps->lock);
+    futex_init(&cold_pps->lock);
 
     if (zinfo->percpu_pagelist_fraction) {
         unsigned int high =
@@ -111,8 +136,8 @@ void Zone::zone_pageset_init(PerCpuPageset *ps) {
 }
 
 /***--------Memory node related----------***/
-MemoryNode::MemoryNode(unsigned id, Address start_addr = 0)
-    : node_id(id), node_start_pfn(start_addr >> zinfo->page_shift),
+MemoryNode::MemoryNode(unsigned id, Address start_addr, Address end_addr)
+    : nr_zones(0), node_id(id), node_start_pfn(start_addr >> zinfo->page_shift),
       lowmem_kbytes(0), min_free_kbytes(0) {
     debug_printf("create memory node");
     memset(zone_lowest_possible, 0, sizeof(zone_lowest_possible));
@@ -128,13 +153,26 @@ MemoryNode::MemoryNode(unsigned id, Address start_addr = 0)
             "zone lowest possible %d:%lld , zone highest possible %d: %lld", i,
             zone_lowest_possible[i], i, zone_highest_possible[i]);
     }
+    // a node of a NUMA system holds the part of the zones in its range
+    if (end_addr) {
+        uint64_t end_pfn = end_addr >> zinfo->page_shift;
+        for (unsigned i = 0; i < MAX_NR_ZONES; i++) {
+            zone_lowest_possible[i] =
+                Min(Max(zone_lowest_possible[i], node_start_pfn), end_pfn);
+            zone_highest_possible[i] =
+                Min(Max(zone_highest_possible[i], node_start_pfn), end_pfn);
+        }
+    }
     // calculate total page number of a node
     node_page_num = calculate_total_pages();
     present_pages = node_page_num;
-    // allocate node_mem_map
+    // only the section table is allocated, sections come on first touch
     debug_printf("memory node: allocate node mem map , page num: %lld",
                  node_page_num);
-    // allocate_node_mem_map(0,node_page_num);
+    futex_init(&memmap_lock);
+    uint64_t sections = (node_page_num + (1ULL << SECTION_PAGE_BITS) - 1) >>
+                        SECTION_PAGE_BITS;
+    mem_sections.resize(sections, NULL);
     init_zones();
     // init water value for per zone
     setup_per_zone_wmarks();
@@ -142,7 +180,36 @@ MemoryNode::MemoryNode(unsigned id, Address start_addr = 0)
 
 // you are very important for delete some allocated objects
 // such as zones
-MemoryNode::~MemoryNode() {}
+MemoryNode::~MemoryNode() {
+    for (uint64_t i = 0; i < mem_sections.size(); i++)
+        if (mem_sections[i])
+            gm_free(mem_sections[i]);
+}
+
+Page *MemoryNode::populate_section(uint64_t section_id) {
+    futex_lock(&memmap_lock);
+    Page *section = mem_sections[section_id];
+    if (!section) {
+        uint64_t section_pages = 1ULL << SECTION_PAGE_BITS;
+        uint64_t first_pfn = node_start_pfn + (section_id << SECTION_PAGE_BITS);
+        section = gm_memalign<Page>(CACHE_LINE_BYTES, section_pages);
+        unsigned zone = 0;
+        for (uint64_t i = 0; i < section_pages; i++) {
+            Page *page = new (&section[i]) Page(first_pfn + i);
+            // set the zone and node links once, like set_page_links()
+            while (zone < MAX_NR_ZONES - 1 &&
+                   first_pfn + i >= zone_highest_possible[zone])
+                zone++;
+            page->set_page_zone(zone);
+            page->set_page_node(node_id);
+        }
+        // lookups read the section without the lock, publish it last
+        __sync_synchronize();
+        mem_sections[section_id] = section;
+    }
+    futex_unlock(&memmap_lock);
+    return section;
+}
 
 uint64_t MemoryNode::calculate_total_pages() {
     uint64_t total_page = 0;
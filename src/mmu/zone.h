@@ -10,6 +10,8 @@
 #include "common/common_structures.h"
 #include "common/global_const.h"
 #include "g_std/g_multimap.h"
+#include "g_std/g_vector.h"
+#include "locks.h"
 #include "math.h"
 #include "memory_hierarchy.h"
 #include "mmu/page.h"
@@ -23,7 +25,8 @@ struct FreeArea {
 };
 
 /***-#--------cpu page cache -------#-***/
-typedef std::list<Page *> PageList;
+// free pages are linked through their descriptors, no allocation
+typedef FlexiList<Page> PageList;
 struct PerCpuPages {
     unsigned int count; // number of page in page cache
     unsigned int low;   // low bound,need complement pages to page cache
@@ -31,6 +34,8 @@ struct PerCpuPages {
     unsigned int
         batch; // number of pages need to be deleted from or added to page cache
     PageList page_list; // page list in page cache
+    // only its core's faults use the cache, the lock is uncontended
+    lock_t lock;
 };
 
 struct PerCpuPageset {
@@ -63,6 +68,12 @@ class Zone {
     }
 
     void free_area_init_zone(MemoryNode *mem_node);
+    /*
+     *@function: hand the next deferred MAXORDER block to the free list,
+     *setting up its descriptors
+     *@return: false if there are none left
+     */
+    bool release_deferred_block(MemoryNode *mem_node);
     /*#########------------------##########*/
     // number of free pages of zone
     uint64_t free_pages;
@@ -78,6 +89,13 @@ class Zone {
     uint64_t zone_start_pfn;
     // buddy allocator related
     FreeArea free_area[MAXORDER + 1];
+    // guards the free areas, zones are allocated from independently
+    lock_t lock;
+    // MAXORDER blocks from deferred_start_pfn on are free but not on the
+    // free list yet, like deferred struct page init: startup touches no
+    // descriptors and the memmap grows with the memory handed out
+    uint64_t deferred_start_pfn;
+    uint64_t deferred_blocks;
     // active &&inactive page list
     Page *active_page_head;
     Page *inactive_page_head;
@@ -104,7 +122,8 @@ typedef std::map<ZoneType, Zone *>::iterator NodeZonePtr;
 // UMA memory system , there only has a node(contig_page_data)
 class MemoryNode {
   public:
-    MemoryNode(unsigned id, Address start_addr);
+    // end_addr 0: the node holds the zones up to their end
+    MemoryNode(unsigned id, Address start_addr = 0, Address end_addr = 0);
     ~MemoryNode();
     bool zone_exists(std::string zone_name) {
         if (node_zones[string_to_zonetype(zone_name)])
@@ -118,27 +137,34 @@ class MemoryNode {
         return false;
     }
 
+    // O(1) lookup in the sparse memmap, the section is set up on first touch
     Page *get_page_ptr(uint64_t page_id) {
-        if (page_id >= node_page_num)
+        uint64_t index = page_id - node_start_pfn;
+        if (index >= node_page_num)
             std::cout << "page_id:" << page_id << " page_num:" << node_page_num
                       << std::endl;
-        assert(page_id < node_page_num);
-        if (node_mem_map.count(page_id))
-            return node_mem_map[page_id];
-        else {
-            Page *tmp_page = gm_memalign<Page>(CACHE_LINE_BYTES, 1);
-            node_mem_map[page_id] = new (tmp_page) Page(page_id);
-            return tmp_page;
-        }
+        assert(index < node_page_num);
+        Page *section = mem_sections[index >> SECTION_PAGE_BITS];
+        if (unlikely(!section))
+            section = populate_section(index >> SECTION_PAGE_BITS);
+        return &section[index & ((1ULL << SECTION_PAGE_BITS) - 1)];
     }
 
+    Zone *page_zone(Page *page) { return node_zones[page->zone_id]; }
+
+    // a section holds the descriptors of a MAXORDER block
+    static const unsigned SECTION_PAGE_BITS = MAXORDER;
+
   private:
     uint64_t calculate_total_pages();
     void init_zones();
     void setup_per_zone_wmarks();
+    Page *populate_section(uint64_t section_id);
 
   private:
-    g_map<Address, Page *> node_mem_map;
+    // sparse memmap: descriptors of a section of frames, NULL until touched
+    g_vector<Page *> mem_sections;
+    lock_t memmap_lock;
 
   public:
     uint64_t zone_lowest_possible[MAX_NR_ZONES];
@@ -207,6 +207,11 @@ void OOOCore::flushTlb(){
     l1d->flushTlb();
 }
 
+void OOOCore::switchTlbContext(uint32_t procIdx){
+    l1i->switchTlbContext(procIdx);
+    l1d->switchTlbContext(procIdx);
+}
+
 //InstrFuncPtrs OOOCore::GetFuncPtrs() {return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, FPTR_ANALYSIS, {0}};}
 InstrFuncPtrs OOOCore::GetFuncPtrs() {
     return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, OffloadBegin, OffloadEnd, FPTR_ANALYSIS, {0} };
@@ -488,6 +488,7 @@ class OOOCore : public Core {
         void cSimEnd();
 
         void flushTlb();
+        void switchTlbContext(uint32_t procIdx);
         BaseTlb* getInsTlb();
 		BaseTlb* getDataTlb();
         BaseCache* getInsCache() {return (BaseCache*)(l1i);}
@@ -0,0 +1,290 @@
+/*
+ * Chained hashed page table with clustered buckets
+ */
+#include "page-table/baseline_hash/chained_hash_page_table.h"
+#include "bithacks.h"
+#include "log.h"
+#include "mmu/memory_management.h"
+#include "page-table/parallel_probe.h"
+
+// 8B entries, a bucket is one 64B line
+static const uint64_t CLUSTER = 8;
+static const uint64_t NO_BUCKET = (uint64_t)-1;
+
+ChainedHashPaging::BucketTable::BucketTable(uint64_t buckets)
+    : buckets(buckets), chunk(MAX(buckets / 8, 1)), overflow_used(0),
+      live(0) {
+    parts.push_back(new PageTable(buckets * CLUSTER));
+    part_frames.push_back(new HashedTableFrames(buckets * CLUSTER));
+    next.resize(buckets, NO_BUCKET);
+}
+
+ChainedHashPaging::BucketTable::~BucketTable() {
+    for (uint32_t i = 0; i < parts.size(); i++) {
+        delete parts[i];
+        delete part_frames[i];
+    }
+}
+
+PageTable *ChainedHashPaging::BucketTable::part(uint64_t bucket,
+                                                uint64_t &first_slot) {
+    if (bucket < buckets) {
+        first_slot = bucket * CLUSTER;
+        return parts[0];
+    }
+    uint64_t overflow = bucket - buckets;
+    first_slot = (overflow % chunk) * CLUSTER;
+    return parts[1 + overflow / chunk];
+}
+
+Address ChainedHashPaging::BucketTable::bucket_addr(uint64_t bucket) {
+    if (bucket < buckets)
+        return part_frames[0]->entry_addr(bucket * CLUSTER);
+    uint64_t overflow = bucket - buckets;
+    return part_frames[1 + overflow / chunk]->entry_addr(
+        (overflow % chunk) * CLUSTER);
+}
+
+uint64_t ChainedHashPaging::BucketTable::add_overflow_bucket(uint64_t tail) {
+    // the overflow area grows a chunk at a time, chains never fail
+    if (overflow_used == chunk * (parts.size() - 1)) {
+        parts.push_back(new PageTable(chunk * CLUSTER));
+        part_frames.push_back(new HashedTableFrames(chunk * CLUSTER));
+    }
+    uint64_t bucket = buckets + overflow_used++;
+    next.push_back(NO_BUCKET);
+    next[tail] = bucket;
+    return bucket;
+}
+
+uint64_t ChainedHashPaging::BucketTable::capacity() {
+    return buckets * CLUSTER;
+}
+
+ChainedHashPaging::ChainedHashPaging(PagingStyle select)
+    : mode(select), old(NULL), migrate_pos(0), moves(zinfo->hdc_moves),
+      threshold(zinfo->hdc_threshold), scale(zinfo->hdc_scale), resizes(0),
+      migrated(0), rehash_accesses(0), overflow_buckets(0), walks(0),
+      walk_lines(0), resizing_walks(0) {
+    if (scale <= 1)
+        panic("Hashed page tables grow on resizes, scale is %f", scale);
+    // hdc.size counts entries, like for Hash_Normal
+    current = new BucketTable(MAX(zinfo->hdc_size / CLUSTER, 1));
+    uint64_t seed = 0;
+    hasher = new PgtHashEngine(zinfo->hdc_hash, 1, &seed);
+    futex_init(&table_lock);
+}
+
+ChainedHashPaging::~ChainedHashPaging() {
+    remove_root_directory();
+    delete hasher;
+}
+
+ChainedHashPaging::BucketTable *ChainedHashPaging::table_of(Address vpn) {
+    if (old && home(old, vpn) >= migrate_pos)
+        return old;
+    return current;
+}
+
+bool ChainedHashPaging::find(BucketTable *table, Address vpn,
+                             g_vector<uint64_t> &pgt_addrs, PageTable *&part,
+                             uint64_t &slot_id) {
+    for (uint64_t b = home(table, vpn); b != NO_BUCKET; b = table->next[b]) {
+        uint64_t first;
+        PageTable *p = table->part(b, first);
+        pgt_addrs.push_back(table->bucket_addr(b));
+        for (uint64_t k = 0; k < CLUSTER; k++) {
+            BasePDTEntry entry = (*p)[first + k];
+            if (entry->is_present() && entry->get_vpn() == vpn) {
+                part = p;
+                slot_id = first + k;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+uint64_t ChainedHashPaging::insert(BucketTable *table, const PteSlot &slot,
+                                   PageTable *&part, uint64_t &slot_id) {
+    uint64_t lines = 0;
+    uint64_t tail = NO_BUCKET;
+    for (uint64_t b = home(table, slot.vpn); b != NO_BUCKET;
+         b = table->next[b]) {
+        uint64_t first;
+        PageTable *p = table->part(b, first);
+        lines++;
+        for (uint64_t k = 0; k < CLUSTER; k++) {
+            if (!(*p)[first + k]->is_present()) {
+                p->put_slot(first + k, slot);
+                table->live++;
+                part = p;
+                slot_id = first + k;
+                return lines;
+            }
+        }
+        tail = b;
+    }
+    // the chain is full, link an overflow bucket behind it
+    uint64_t b = table->add_overflow_bucket(tail);
+    overflow_buckets++;
+    part = table->part(b, slot_id);
+    part->put_slot(slot_id, slot);
+    table->live++;
+    return lines + 1;
+}
+
+uint64_t ChainedHashPaging::migrate_buckets(uint64_t count) {
+    uint64_t lines = 0;
+    for (uint64_t i = 0; i < count && old; i++) {
+        for (uint64_t b = migrate_pos; b != NO_BUCKET; b = old->next[b]) {
+            uint64_t first;
+            PageTable *p = old->part(b, first);
+            lines++;
+            for (uint64_t k = 0; k < CLUSTER; k++) {
+                if (!(*p)[first + k]->is_present())
+                    continue;
+                PteSlot slot = p->take_slot(first + k);
+                old->live--;
+                PageTable *part;
+                uint64_t slot_id;
+                lines += insert(current, slot, part, slot_id);
+                migrated++;
+            }
+        }
+        migrate_pos++;
+        if (migrate_pos == old->buckets) {
+            delete old;
+            old = NULL;
+        }
+    }
+    return lines;
+}
+
+int ChainedHashPaging::map_page_table(Address addr, Page *pg_ptr) {
+    BasePDTEntry entry;
+    return map_page_table(addr, pg_ptr, entry);
+}
+
+int ChainedHashPaging::map_page_table(uint32_t req_id, Address addr,
+                                      Page *pg_ptr, bool is_write) {
+    BasePDTEntry entry;
+    int latency = map_page_table(addr, pg_ptr, entry);
+    if (entry) {
+        entry->set_lrequester(req_id);
+        entry->set_accessed();
+        if (is_write)
+            entry->set_dirty();
+    }
+    return latency;
+}
+
+int ChainedHashPaging::map_page_table(Address addr, Page *pg_ptr,
+                                      BasePDTEntry &mapped_entry) {
+    Address vpageno = get_bits(addr, 12, 47);
+    uint64_t rehash_lines = 0;
+    if (old)
+        rehash_lines += migrate_buckets(moves);
+    // the new table fills up before the old one empties, catch up
+    if (old && (double)(old->live + current->live + 1) >
+                   threshold * current->capacity())
+        rehash_lines += migrate_buckets(old->buckets);
+    if (!old && (double)(current->live + 1) > threshold * current->capacity()) {
+        old = current;
+        current = new BucketTable((uint64_t)(old->buckets * scale));
+        migrate_pos = 0;
+        resizes++;
+        rehash_lines += migrate_buckets(moves);
+    }
+    rehash_accesses += rehash_lines;
+    PageTable *part;
+    uint64_t slot_id;
+    uint64_t lines = insert(table_of(vpageno), make_page_slot(pg_ptr, vpageno),
+                            part, slot_id);
+    mapped_entry = (*part)[slot_id];
+    return zinfo->mem_access_time * (lines + rehash_lines);
+}
+
+bool ChainedHashPaging::unmap_page_table(Address addr) {
+    Address vpageno = get_bits(addr, 12, 47);
+    BucketTable *table = table_of(vpageno);
+    g_vector<uint64_t> lines;
+    PageTable *part;
+    uint64_t slot_id;
+    if (!find(table, vpageno, lines, part, slot_id))
+        return false;
+    // the slot is reused by the next insert to its chain
+    invalidate_page(part, slot_id);
+    table->live--;
+    return true;
+}
+
+Address ChainedHashPaging::access(MemReq &req) {
+    assert(0); // shouldn't come here
+    return 0;
+}
+
+Address ChainedHashPaging::access(MemReq &req, g_vector<MemObject *> &parents,
+                                  g_vector<uint32_t> &parentRTTs,
+                                  BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                                  bool sendPTW) {
+    Address addr = req.lineAddr << lineBits;
+    Address vpageno = get_bits(addr, 12, 47);
+    g_vector<uint64_t> pgt_addrs;
+    PageTable *part;
+    uint64_t slot_id;
+    bool found = find(table_of(vpageno), vpageno, pgt_addrs, part, slot_id);
+    if (sendPTW) {
+        walks++;
+        walk_lines += pgt_addrs.size();
+        if (old)
+            resizing_walks++;
+        // every bucket of a chain is found through the one before it
+        req.cycle = loadSequentialProbes(req, pgt_addrs, parents, parentRTTs);
+    }
+    if (!found)
+        return PAGE_FAULT_SIG;
+    BasePDTEntry pte = (*part)[slot_id];
+    // update page table flags
+    pte->set_lrequester(req.srcId, req.triggerPageShared);
+    pte->set_accessed();
+    if (req.type == PUTS) {
+        if (!pte->is_dirty())
+            req.triggerPageDirty = true;
+        pte->set_dirty();
+    }
+    req.pageDirty = pte->is_dirty();
+    req.pageShared = pte->is_shared();
+    return pte->get_page()->pageNo;
+}
+
+void ChainedHashPaging::remove_root_directory() {
+    BucketTable *tables[2] = {current, old};
+    for (uint32_t t = 0; t < 2; t++) {
+        if (!tables[t])
+            continue;
+        // stop at the last live entry instead of sweeping the whole table
+        uint64_t used = tables[t]->buckets + tables[t]->overflow_used;
+        for (uint64_t b = 0; tables[t]->live && b < used; b++) {
+            uint64_t first;
+            PageTable *p = tables[t]->part(b, first);
+            for (uint64_t k = 0; k < CLUSTER; k++) {
+                if (is_present(p, first + k)) {
+                    invalidate_page(p, first + k);
+                    tables[t]->live--;
+                }
+            }
+        }
+        delete tables[t];
+    }
+    current = old = NULL;
+}
+
+void ChainedHashPaging::calculate_stats(std::ofstream &vmof) {
+    vmof << "chained hash walks:" << walks << "\t buckets read:" << walk_lines
+         << "\t during resizes:" << resizing_walks << std::endl;
+    vmof << "chained hash resizes:" << resizes
+         << "\t entries migrated:" << migrated
+         << "\t rehash memory accesses:" << rehash_accesses
+         << "\t overflow buckets:" << overflow_buckets << std::endl;
+}
@@ -0,0 +1,114 @@
+/*
+ * Chained hashed page table with clustered buckets
+ */
+#ifndef _CHAINED_HASH_PAGE_TABLE_H
+#define _CHAINED_HASH_PAGE_TABLE_H
+#include "common/common_functions.h"
+#include "common/global_const.h"
+#include "g_std/g_vector.h"
+#include "locks.h"
+#include "memory_hierarchy.h"
+#include "page-table/comm_page_table_op.h"
+#include "page-table/hash_engine.h"
+#include "page-table/hashed_table.h"
+#include "page-table/page_table_entry.h"
+
+/*
+ * Hash_Chain: a hashed page table in the way of the PowerPC HPT. A vpn
+ * hashes to a bucket of entries filling one cache line, buckets that
+ * overflow chain to buckets of an overflow area, and a walk reads the home
+ * bucket and then the chain behind it. Resizing is incremental like in
+ * HashPaging: past the threshold every insert moves the chains of hdc.moves
+ * home buckets to a table scale times larger. A vpn lives in the old table
+ * until its home bucket is moved, so a walk reads one of them only.
+ */
+class ChainedHashPaging : public BasePaging {
+  public:
+    ChainedHashPaging(PagingStyle selection);
+    ~ChainedHashPaging();
+    virtual PagingStyle get_paging_style() { return mode; }
+    virtual PageTable *get_root_directory() {
+        return current ? current->parts[0] : NULL;
+    }
+    virtual Address access(MemReq &req);
+    virtual Address access(MemReq &req, g_vector<MemObject *> &parents,
+                           g_vector<uint32_t> &parentRTTs,
+                           BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                           bool sendPTW);
+    virtual bool unmap_page_table(Address addr);
+    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry &mapped_entry);
+    virtual int map_page_table(Address addr, Page *pg_ptr);
+    virtual int map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
+                               bool is_write);
+    virtual bool allocate_page_table(Address addr, Address size) {
+        return true;
+    }
+    virtual void remove_root_directory();
+    virtual bool remove_page_table(Address addr, Address size) {
+        return true;
+    }
+    virtual void calculate_stats(std::ofstream &vmof);
+    virtual void calculate_stats() {}
+    virtual void lock() { futex_lock(&table_lock); }
+    virtual void unlock() { futex_unlock(&table_lock); }
+
+  private:
+    // home buckets, and the overflow buckets chained behind them
+    class BucketTable : public GlobAlloc {
+      public:
+        explicit BucketTable(uint64_t buckets);
+        ~BucketTable();
+        // the entries of bucket start at first_slot of the part returned
+        PageTable *part(uint64_t bucket, uint64_t &first_slot);
+        Address bucket_addr(uint64_t bucket);
+        // chain a fresh overflow bucket behind tail, @return its id
+        uint64_t add_overflow_bucket(uint64_t tail);
+        uint64_t capacity();
+
+        uint64_t buckets;
+        uint64_t chunk; // buckets of an overflow part
+        uint64_t overflow_used;
+        uint64_t live;
+        // home buckets first, then the overflow area a chunk at a time
+        g_vector<PageTable *> parts;
+        g_vector<HashedTableFrames *> part_frames;
+        g_vector<uint64_t> next; // chain link of every bucket
+    };
+
+    uint64_t home(BucketTable *table, Address vpn) {
+        return hasher->hash(vpn, 0) % table->buckets;
+    }
+    // the table vpn lives in, old until its home bucket is moved
+    BucketTable *table_of(Address vpn);
+    /*
+     *@function: look vpn up in the chain of its home bucket, adding the
+     *buckets read to pgt_addrs
+     */
+    bool find(BucketTable *table, Address vpn, g_vector<uint64_t> &pgt_addrs,
+              PageTable *&part, uint64_t &slot_id);
+    // @return buckets read and written
+    uint64_t insert(BucketTable *table, const PteSlot &slot, PageTable *&part,
+                    uint64_t &slot_id);
+    // move the chains of up to count home buckets, @return buckets accessed
+    uint64_t migrate_buckets(uint64_t count);
+
+    PagingStyle mode;
+    PgtHashEngine *hasher;
+    BucketTable *current;
+    BucketTable *old; // being drained while resizing, NULL otherwise
+    uint64_t migrate_pos; // home buckets of old moved so far
+    lock_t table_lock;
+    uint64_t moves;
+    double threshold;
+    double scale;
+    // stats
+    uint64_t resizes;
+    uint64_t migrated;
+    uint64_t rehash_accesses;
+    uint64_t overflow_buckets;
+    uint64_t walks;
+    uint64_t walk_lines;
+    uint64_t resizing_walks;
+};
+
+#endif
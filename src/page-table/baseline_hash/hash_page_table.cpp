@@ -16,6 +16,7 @@
 #include "mmu/memory_management.h"
 #include "pad.h"
 #include "page-table/page_table_entry.h"
+#include "page-table/parallel_probe.h"
 #include "timing_event.h"
 #include "page-table/baseline_hash/city.h"
 #include "zsim.h"
@@ -26,78 +27,151 @@
 /*-----------Hash Paging--------------*/
 
 HashPaging::HashPaging(PagingStyle select)
-    : mode(select) {
-    PageTable *table = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
+    : mode(select), old_hptr(NULL), old_frames(NULL), migrate_pos(0),
+      old_live(0), rehash_count(0), migrated(0), rehash_accesses(0),
+      walks(0), walk_lines(0), old_table_walks(0) {
     assert(zinfo);
-    if (zinfo->buddy_allocator) {
-        Page *page = zinfo->buddy_allocator->allocate_pages(0);
-        if (page) {
-            table_size = zinfo->hdc_size;
-            hptr = new (table) PageTable(table_size, page);//page table size is DDDD PTEs
-        } else {
-            panic("Cannot allocate a page for page directory!");
-        }
-    } else {
-        hptr = new (table) PageTable(zinfo->hdc_size);
-    }
+    table_size = zinfo->hdc_size;
+    hptr = new PageTable(table_size);
+    frames = new HashedTableFrames(table_size);
+    // one way, the function of sys.hdc.hash with a fixed seed
+    uint64_t seed = 0;
+    hasher = new PgtHashEngine(zinfo->hdc_hash, 1, &seed);
     futex_init(&table_lock);
     cur_pte_num = 0;
     threshold = zinfo->hdc_threshold;
     scale = zinfo->hdc_scale;
+    moves = zinfo->hdc_moves;
+    if (scale <= 1)
+        panic("Hashed page tables grow on resizes, scale is %f", scale);
+    if (threshold <= 0 || threshold >= 1)
+        panic("Hashed page table threshold must be in (0, 1), is %f",
+              threshold);
 }
 
-HashPaging::~HashPaging() { remove_root_directory(); }
+HashPaging::~HashPaging() {
+    remove_root_directory();
+    delete hasher;
+}
 
 /*****-----functional interface of Hash-Paging----*****/
-//cityhash for the hash function in hash table
+//the hash function comes from the engine of sys.hdc.hash
 uint64_t HashPaging::hash_function(Address address) {
-    uint64_t mask=0;
-    for(uint64_t i=0 ;i<64 ;i++){
-        mask+=(uint64_t)pow(2,i);
+    return hasher->hash(address, 0);
+}
+
+uint64_t HashPaging::probe(PageTable *table, HashedTableFrames *table_frames,
+                           Address vpn, g_vector<uint64_t> &pgt_addrs,
+                           bool &found) {
+    uint64_t size = table->map_count;
+    uint64_t pt_id = hash_function(vpn) % size;
+    found = false;
+    for (uint64_t i = 0; i < size; i++) {
+        // slots sharing a line are compared with one read of it, only
+        // probing on to the next line costs another
+        Address pgt_addr = table_frames->entry_addr(pt_id);
+        if (pgt_addrs.empty() ||
+            (pgt_addr >> lineBits) != (pgt_addrs.back() >> lineBits))
+            pgt_addrs.push_back(pgt_addr);
+        BasePDTEntry entry = (*table)[pt_id];
+        if (!entry->is_present())
+            return pt_id;
+        if (entry->get_vpn() == vpn) {
+            found = true;
+            return pt_id;
+        }
+        pt_id = (pt_id + 1) % size;
     }
-    char*  new_address = (char*) address;
-    uint64_t result=CityHash64((const char*)&address,8) & (mask);
-    return result;
+    return -1; // hash table is full. no idle entry left.
+}
+
+uint64_t HashPaging::insert(const PteSlot &slot, uint64_t &pt_id) {
+    g_vector<uint64_t> lines;
+    bool found;
+    pt_id = probe(hptr, frames, slot.vpn, lines, found);
+    // resizes keep the table below the threshold, there is always room
+    assert(pt_id != (uint64_t)-1 && !found);
+    hptr->put_slot(pt_id, slot);
+    cur_pte_num++;
+    return lines.size();
+}
+
+void HashPaging::start_resize() {
+    assert(!old_hptr);
+    old_hptr = hptr;
+    old_frames = frames;
+    old_live = cur_pte_num;
+    migrate_pos = 0;
+    table_size = (uint64_t)(table_size * scale);
+    hptr = new PageTable(table_size);
+    frames = new HashedTableFrames(table_size);
+    cur_pte_num = 0;
+    rehash_count++;
+}
+
+void HashPaging::drop_old_table() {
+    // the entries left behind are copies, their pages belong to hptr now
+    delete old_hptr;
+    delete old_frames;
+    old_hptr = NULL;
+    old_frames = NULL;
+    old_live = 0;
 }
 
-//find idle entry in hash table, using open addressing
-uint64_t HashPaging::allocate_table_entry(uint64_t hash_id) {
-    uint64_t i = 0;
-    while(i < table_size){
-        BasePDTEntry *entry = (*hptr)[hash_id];
-        if(!entry->is_present()) return hash_id;
-        hash_id=(hash_id+1)%table_size;
-        i++;
+uint64_t HashPaging::migrate_slots(uint64_t count) {
+    uint64_t lines = 0;
+    uint64_t slots_per_line = (1ULL << lineBits) / ENTRY_SIZE_512;
+    for (uint64_t i = 0; i < count && old_hptr; i++) {
+        if (migrate_pos % slots_per_line == 0)
+            lines++;
+        // copy, not move: the old slot stays occupied so the probe
+        // sequences running through it still reach the entries behind
+        PteSlot slot = old_hptr->get_slot(migrate_pos);
+        if (slot.is_present()) {
+            uint64_t pt_id;
+            lines += insert(slot, pt_id);
+            old_live--;
+            migrated++;
+        }
+        migrate_pos++;
+        if (!old_live || migrate_pos == old_hptr->map_count)
+            drop_old_table();
     }
-    return -1;// hash table is full. no idle entry left.
+    return lines;
 }
 
-uint64_t HashPaging::reallocate_table_entry(uint64_t hash_id) {
-    uint64_t i = 0;
-    while(i < new_hptr->map_count){
-        BasePDTEntry *entry = (*new_hptr)[hash_id];
-        if(!entry->is_present()) return hash_id;
-        hash_id=(hash_id+1)%new_hptr->map_count;
-        i++;
+void HashPaging::remove_entry(PageTable *table, uint64_t pt_id) {
+    uint64_t size = table->map_count;
+    uint64_t gap = pt_id;
+    uint64_t next = pt_id;
+    while (true) {
+        next = (next + 1) % size;
+        if (!(*table)[next]->is_present())
+            return;
+        uint64_t home = hash_function((*table)[next]->get_vpn()) % size;
+        // entries whose home lies cyclically in (gap, next] are still
+        // reachable, anything else probed past the gap and moves into it
+        bool reachable = gap <= next ? (gap < home && home <= next)
+                                     : (gap < home || home <= next);
+        if (reachable)
+            continue;
+        table->put_slot(gap, table->take_slot(next));
+        gap = next;
     }
-    return -1;// hash table is full. no idle entry left.
 }
 
 int HashPaging::map_page_table(Address addr, Page *pg_ptr) {
-    BasePDTEntry *entry;
+    BasePDTEntry entry;
     return map_page_table(addr, pg_ptr, entry);
 }
 
 int HashPaging::map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                    bool is_write) {
-    BasePDTEntry *entry;
+    BasePDTEntry entry;
     int latency = map_page_table(addr, pg_ptr, entry);
-    if (entry != NULL) {
-        cur_pte_num++;
-        // cout <<"allocated pte num: "<<cur_pte_num<<endl;
+    if (entry) {
         entry->set_lrequester(req_id);
         entry->set_accessed();
-        entry->set_vpn(get_bits(addr, 12, 47));
         if (is_write)
             entry->set_dirty();
     }
@@ -105,31 +179,41 @@ int HashPaging::map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
 }
            
 int HashPaging::map_page_table(Address addr, Page *pg_ptr,
-                                   BasePDTEntry *&mapped_entry) {
-    mapped_entry = NULL;
-    int latency = 0;
-    // std::cout<<"map:"<<std::hex<<addr<<std::endl;
+                                   BasePDTEntry &mapped_entry) {
     uint64_t vpageno =  get_bits(addr, 12, 47);
     assert((vpageno != (unsigned)(-1)));
-    int alloc_time = 0;
-    uint64_t hash_id = hash_function(vpageno)%table_size;
-    uint64_t pt_id = allocate_table_entry(hash_id);
-    assert(pt_id != (unsigned)(-1));
-    validate_page(hptr, pt_id, pg_ptr);
-    assert(is_valid(hptr, pt_id));
-    mapped_entry = (*hptr)[pt_id];
-    // std::cout<<"footprint rate: "<<(double)(cur_pte_num)/(double)(hptr->map_count)<<std::endl;
-    if((double)(cur_pte_num)/(double)(hptr->map_count) > threshold) {
-        std::cout<< "rehashing" << std::endl;
-        rehash();
-        //rehash_gruadual(d);
+    // every insert moves a few slots of the old table along, the new one
+    // must not fill up before it has all of them
+    uint64_t rehash_lines = 0;
+    if (old_hptr)
+        rehash_lines += migrate_slots(moves);
+    if (old_hptr && (double)(cur_pte_num + old_live + 1) >
+                        threshold * table_size)
+        rehash_lines += migrate_slots(old_hptr->map_count);
+    if (!old_hptr && (double)(cur_pte_num + 1) > threshold * table_size) {
+        start_resize();
+        rehash_lines += migrate_slots(moves);
     }
-    latency = zinfo->mem_access_time * (1 + alloc_time);
-    return latency;
+    rehash_accesses += rehash_lines;
+    uint64_t pt_id;
+    uint64_t lines = insert(make_page_slot(pg_ptr, vpageno), pt_id);
+    mapped_entry = (*hptr)[pt_id];
+    return zinfo->mem_access_time * (lines + rehash_lines);
 }
 
 bool HashPaging::unmap_page_table(Address addr) {
-    //need to implement
+    Address vpageno = get_bits(addr, 12, 47);
+    // deletions shift entries back, which a half moved table can't follow
+    if (old_hptr)
+        rehash_accesses += migrate_slots(old_hptr->map_count);
+    g_vector<uint64_t> lines;
+    bool found;
+    uint64_t pt_id = probe(hptr, frames, vpageno, lines, found);
+    if (!found)
+        return false;
+    invalidate_page(hptr, pt_id);
+    remove_entry(hptr, pt_id);
+    cur_pte_num--;
     return true;
 }
 
@@ -138,98 +222,31 @@ Address HashPaging::access(MemReq &req) {
     return 0;
 }
 
-uint64_t HashPaging::loadPageTables(MemReq &req,
-                                        g_vector<uint64_t> &pgt_addrs,
-                                        g_vector<MemObject *> &parents,
-                                        g_vector<uint32_t> &parentRTTs,
-                                        bool sendPTW) {
-    if (!sendPTW)
-        return req.cycle;
-
-    uint64_t startCycle = req.cycle;
-    uint64_t respCycle = req.cycle;
-    TimingRecord first_ptwTR;
-    first_ptwTR.clear();
-    // Link all reqs in a page table walk
-    for (int i = 0; i < pgt_addrs.size(); i++) {
-        uint64_t lineAddr = pgt_addrs[i] >> lineBits;
-        uint32_t parentId = getParentId(lineAddr, parents.size());
-        MESIState dummyState = MESIState::I;
-        MemReq pgt_req = {lineAddr,    GETS,       req.childId,
-                          &dummyState, startCycle, req.childLock,
-                          dummyState,  req.srcId,  req.flags};
-        pgt_req.threadId = req.threadId;
-        pgt_req.isPIMInst = req.isPIMInst;
-        if (i == 0) {
-            pgt_req.isFirstPTW = true;
-            if (pgt_addrs.size() > 1)
-                pgt_req.isLastPTW = false;
-        } else {
-            pgt_req.isFirstPTW = false;
-            pgt_req.isLastPTW = false;
-        }
-        if (i == (pgt_addrs.size() - 1)) {
-            pgt_req.isLastPTW = true;
-        }
-        uint64_t nextLevelLat = parents[parentId]->access(pgt_req) - startCycle;
-        uint32_t netLat = parentRTTs[parentId];
-        respCycle += nextLevelLat + netLat;
-        startCycle = respCycle;
-
-        if (zinfo->eventRecorders[req.srcId]->hasRecord()) {
-            TimingRecord c_tr = zinfo->eventRecorders[req.srcId]->popRecord();
-            if (!first_ptwTR.isValid() && c_tr.isValid()) {
-                assert(c_tr.endEvent);
-                first_ptwTR = c_tr;
-            } else {
-                assert(c_tr.isPTW);
-                // Exist a previous page table memory access
-                first_ptwTR.endEvent->addChild(
-                    c_tr.startEvent, zinfo->eventRecorders[req.srcId]);
-                first_ptwTR.endEvent = c_tr.startEvent;
-            }
-        }
-    }
-    // reinsert event
-    if (first_ptwTR.isValid())
-        zinfo->eventRecorders[req.srcId]->pushRecord(first_ptwTR);
-    return respCycle;
-}
-
-inline uint64_t HashPaging::getPGTAddr(uint64_t pageNo, uint32_t entry_id) {
-    uint64_t pgAddr = pageNo << zinfo->page_shift;
-    pgAddr |= (ENTRY_SIZE_512 * entry_id);
-    return pgAddr;
-}
-
 Address HashPaging::access(MemReq &req, g_vector<MemObject *> &parents,
                                g_vector<uint32_t> &parentRTTs,
-                               BaseCoreRecorder *cRec, bool sendPTW) {
+                               BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                               bool sendPTW) {
     g_vector<uint64_t> pgt_addrs;
     Address addr = req.lineAddr << lineBits;
     Address vpageno = get_bits(addr, 12, 47);
-    // std::cout <<"accessing vpn: "<<vpageno<<std::endl;
-    uint64_t hash_id = hash_function(vpageno) % table_size;
-    pgt_addrs.push_back(getPGTAddr(hptr->get_page_no(), hash_id%512));
-    BasePDTEntry *ht_ptr = (*(PageTable *)hptr)[hash_id];
-    //@BUXIN: this is open addressing codes, from 204 to 214
-    void *ptr = NULL;
-    while(ht_ptr->is_page_assigned() && hash_id < table_size) {
-        if(ht_ptr->get_vpn() == vpageno) {
-            ptr = get_next_level_address<void>(hptr, hash_id);
-            break;
-        }
-            
-        hash_id++;
-        ht_ptr = (*(PageTable *)hptr)[hash_id];
-        pgt_addrs.push_back(getPGTAddr(hptr->get_page_no(), hash_id%512));
+    bool found;
+    PageTable *table = hptr;
+    uint64_t pt_id = probe(hptr, frames, vpageno, pgt_addrs, found);
+    // entries not moved yet are only in the old table
+    if (!found && old_hptr) {
+        table = old_hptr;
+        pt_id = probe(old_hptr, old_frames, vpageno, pgt_addrs, found);
+        if (sendPTW)
+            old_table_walks++;
     }
-    ptr = get_next_level_address<void>(hptr, hash_id);
-    if (!ptr) { //PTE accessed don't get the page ptr
-        req.cycle =
-            loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
-        return PAGE_FAULT_SIG;
+    if (sendPTW) {
+        walks++;
+        walk_lines += pgt_addrs.size();
+        req.cycle = loadSequentialProbes(req, pgt_addrs, parents, parentRTTs);
     }
+    if (!found) //PTE accessed don't get the page ptr
+        return PAGE_FAULT_SIG;
+    BasePDTEntry ht_ptr = (*table)[pt_id];
     // update page table flags
     ht_ptr->set_lrequester(req.srcId, req.triggerPageShared);
     ht_ptr->set_accessed();
@@ -240,33 +257,7 @@ Address HashPaging::access(MemReq &req, g_vector<MemObject *> &parents,
     }
     req.pageDirty = ht_ptr->is_dirty();
     req.pageShared = ht_ptr->is_shared();
-    req.cycle = loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
-    return ((Page *)ptr)->pageNo;
-}
-
-void HashPaging::rehash() {
-    rehash_count++;
-    PageTable *new_table = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
-    new_hptr = new (new_table) PageTable((uint64_t)(hptr->map_count * scale), hptr->get_page());
-    for(int i = 0; i < hptr->map_count; i++) {
-        BasePDTEntry *entry = (*hptr)[i];
-        if(entry->is_present()) {
-            uint64_t vpageno = entry->get_vpn();
-            // std::cout<<"vpn: "<<vpageno<<std::endl;
-            Page *pg_ptr = entry->get_page();
-            uint64_t hash_id = hash_function(vpageno)%new_hptr->map_count;
-            hash_id = reallocate_table_entry(hash_id);//@buxin: get the idle entry in new hash table
-            BasePDTEntry *new_entry = (*new_hptr)[hash_id];
-            new_entry->set_vpn(vpageno);
-            vpageno = new_entry->get_vpn();
-            validate_page(new_hptr, hash_id, pg_ptr);
-            // std::cout<<"vpn: "<<vpageno<<std::endl;
-            assert(is_valid(new_hptr, hash_id));
-        }
-    }
-    table_size = new_hptr->map_count;
-    hptr = new_hptr;
-    new_hptr = NULL;
+    return ht_ptr->get_page()->pageNo;
 }
 
 // allocate
@@ -278,14 +269,29 @@ bool HashPaging::allocate_page_table(Address addr, Address size) {
 
 // remove
 void HashPaging::remove_root_directory() {
+    // scans stop at the last live entry, tables stay at least
+    // threshold / scale full so that is in proportion to the mapping
+    if (old_hptr) {
+        for (uint64_t i = migrate_pos; old_live && i < old_hptr->map_count;
+             i++) {
+            if (is_present(old_hptr, i)) {
+                invalidate_page(old_hptr, i);
+                old_live--;
+            }
+        }
+        drop_old_table();
+    }
     if (hptr) {
-        for (unsigned i = 0; i < 67108864; i++) {
+        for (uint64_t i = 0; cur_pte_num && i < hptr->map_count; i++) {
             if (is_present(hptr, i)) {
                 invalidate_page(hptr, i);
+                cur_pte_num--;
             }
         }
         delete hptr;
+        delete frames;
         hptr = NULL;
+        frames = NULL;
     }
 }
 
@@ -294,5 +300,11 @@ bool HashPaging::remove_page_table(Address addr, Address size) {
     return true;
 }
 
-
-
+void HashPaging::calculate_stats(std::ofstream &vmof) {
+    vmof << "hashed page table walks:" << walks << "\t lines read:"
+         << walk_lines << "\t probing the old table too:" << old_table_walks
+         << std::endl;
+    vmof << "hashed page table resizes:" << rehash_count
+         << "\t entries migrated:" << migrated
+         << "\t rehash memory accesses:" << rehash_accesses << std::endl;
+}
@@ -16,10 +16,19 @@
 #include "page-table/baseline_hash/city.h"
 #include "memory_hierarchy.h"
 #include "page-table/comm_page_table_op.h"
+#include "page-table/hash_engine.h"
+#include "page-table/hashed_table.h"
 #include "page-table/page_table_entry.h"
 #include <iterator>
 #include <map>
 /*#----Hash-Paging(supports 4KB&&2MB&&1GB)---#*/
+/*
+ * Open addressing hashed page table with linear probing. Resizing is
+ * incremental: past the threshold a table scale times larger takes over,
+ * and every insert moves hdc.moves slots of the old one to it, so no fault
+ * pays for the whole rehash. Until the old table drains, walks that miss
+ * the new table probe on in the old one.
+ */
 class HashPaging : public BasePaging {
   public:
     HashPaging(PagingStyle selection);
@@ -29,64 +38,69 @@ class HashPaging : public BasePaging {
     virtual Address access(MemReq &req);
     virtual Address access(MemReq &req, g_vector<MemObject *> &parents,
                            g_vector<uint32_t> &parentRTTs,
-                           BaseCoreRecorder *cRec, bool sendPTW);
+                           BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                           bool sendPTW);
     virtual bool unmap_page_table(Address addr);
-    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry *&mapped_entry);
+    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry &mapped_entry);
     virtual int map_page_table(Address addr, Page *pg_ptr);
     virtual int map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                bool is_write);
     virtual bool allocate_page_table(Address addr, Address size);
     virtual void remove_root_directory();
     virtual bool remove_page_table(Address addr, Address size);
-    virtual void calculate_stats(std::ofstream &vmof) {//Need to implement
-        // long unsigned overhead =
-        //     (long unsigned)(cur_pt_num + cur_pd_num + cur_pdp_num) * PAGE_SIZE;
-        // vmof << "Error migrated pages:" << error_migrated_pages << std::endl;
-        // vmof << "page directory pointer number:" << cur_pdp_num << std::endl;
-        // vmof << "page directory number:" << cur_pd_num << std::endl;
-        // vmof << "page table number:" << cur_pt_num << std::endl;
-        // vmof << "overhead of page table storage:"
-        //      << (double)overhead / (double)(1024 * 1024) << " MB" << std::endl;
-    }
-    virtual void calculate_stats() {//Need to implement
-        // long unsigned overhead =
-        //     (long unsigned)(cur_pt_num + cur_pd_num + cur_pdp_num) * PAGE_SIZE;
-        // info("Error migrated pages:%d", error_migrated_pages);
-        // info("page directory pointer number:%d", cur_pdp_num);
-        // info("page directory number:%d", cur_pd_num);
-        // info("page table number:%d", cur_pt_num);
-        // info("overhead of page table storage:%f MB",
-        //      (double)overhead / (double)(1024 * 1024));
-    }
+    virtual void calculate_stats(std::ofstream &vmof);
+    virtual void calculate_stats() {}
     virtual void lock() { futex_lock(&table_lock); }
     virtual void unlock() { futex_unlock(&table_lock); }
-    virtual void rehash();
+
   protected:
-  //TUBUXIN: hash table functions can be implemented here, including allocate, remove, and so on.
-    uint64_t allocate_table_entry(uint64_t hash_id);
-    uint64_t reallocate_table_entry(uint64_t hash_id);
-    //allocate
-    // remove
+    /*
+     *@function: look vpn up in table by linear probing from its home slot,
+     *adding the lines read to pgt_addrs
+     *@return: the slot of vpn if found, else the empty slot that ended the
+     *probe, -1 if there is none
+     */
+    uint64_t probe(PageTable *table, HashedTableFrames *table_frames,
+                   Address vpn, g_vector<uint64_t> &pgt_addrs, bool &found);
+    // insert into the new table, @return lines read
+    uint64_t insert(const PteSlot &slot, uint64_t &pt_id);
+    void start_resize();
+    // move up to count slots of the old table, @return lines read
+    uint64_t migrate_slots(uint64_t count);
+    /*
+     *@function: close the gap left by the entry just invalidated at pt_id,
+     *shifting the rest of its probe sequence back so lookups still find it
+     */
+    void remove_entry(PageTable *table, uint64_t pt_id);
+    void drop_old_table();
 
   private:
     uint64_t hash_function(Address address);
-    uint64_t loadPageTables(MemReq &req, g_vector<uint64_t> &pgt_addrs,
-                            g_vector<MemObject *> &parents,
-                            g_vector<uint32_t> &parentRTTs, bool sendPTW);
-    inline uint64_t getPGTAddr(uint64_t pageNo, uint32_t entry_id)
-        __attribute__((always_inline));
 
   public:
     PageTable *hptr;
-    PageTable *new_hptr;
+    PgtHashEngine *hasher;
   private:
     PagingStyle mode;
+    HashedTableFrames *frames;
+    // the table being drained while resizing, NULL otherwise
+    PageTable *old_hptr;
+    HashedTableFrames *old_frames;
+    uint64_t migrate_pos; // slots of the old table moved so far
+    uint64_t old_live;    // entries of the old table not moved yet
     uint64_t cur_pte_num;
     lock_t table_lock;
     uint64_t table_size;
-    uint64_t rehash_count;
+    uint64_t moves;
     double threshold;
     double scale;
+    // stats
+    uint64_t rehash_count;
+    uint64_t migrated;
+    uint64_t rehash_accesses;
+    uint64_t walks;
+    uint64_t walk_lines;
+    uint64_t old_table_walks;
 };
 
 // class PagingFactory
@@ -110,6 +110,11 @@ inline unsigned get_pml4_off(Address addr, PagingStyle mode) {
         return (unsigned)(-1);
 }
 
+// LA57: the PML5 index, VA bits 48-56
+inline unsigned get_pml5_off(Address addr) {
+    return get_bit_value<unsigned>(addr, 48, 56);
+}
+
 inline void get_domains(Address addr, unsigned &pml4, unsigned &pdp,
                         unsigned &pd, unsigned &pt, PagingStyle mode) {
     pml4 = (unsigned)(-1);
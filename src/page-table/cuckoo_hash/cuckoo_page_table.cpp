@@ -16,6 +16,8 @@
 #include "mmu/memory_management.h"
 #include "pad.h"
 #include "page-table/page_table_entry.h"
+#include "page-table/parallel_probe.h"
+#include "page-table/pw_cache.h"
 #include "timing_event.h"
 #include "page-table/baseline_hash/city.h"
 #include "zsim.h"
@@ -29,16 +31,16 @@
 #define hsize(n) (1 << (n))
 #define MAX_ALLOCATE 32
 CuckooPaging::CuckooPaging(PagingStyle select)
-    : mode(select) {
+    : walks(0), probes(0), skipped_probes(0), mode(select) {
     PageTable *table = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
     assert(zinfo);
     hptr.resize(zinfo->cuckoo_d, NULL);
     rehash_count.resize(zinfo->cuckoo_d, 0);
     cur_pte_num.resize(zinfo->cuckoo_d, 0);
-    keys = (uint64_t *)malloc(zinfo->cuckoo_d * sizeof(uint64_t));
+    keys = (uint64_t *)calloc(zinfo->cuckoo_d, sizeof(uint64_t));
     ways = zinfo->cuckoo_d;
+    assert(ways <= 64); // the CWT holds a bitmap of ways
     scale = zinfo->cuckoo_scale;
-    hash_func = "blake2";
     if (zinfo->buddy_allocator) {
         for(int i=0; i<zinfo->cuckoo_d; i++) {
             Page *page = zinfo->buddy_allocator->allocate_pages(0);
@@ -53,27 +55,17 @@ CuckooPaging::CuckooPaging(PagingStyle select)
     } else {
         hptr[0] = new (table) PageTable(zinfo->cuckoo_size);
     }
+    hasher = new PgtHashEngine(zinfo->cuckoo_hash, ways, keys);
     futex_init(&table_lock);
 }
 
 CuckooPaging::~CuckooPaging() { remove_root_directory(); }
 
 /*****-----functional interface of Hash-Paging----*****/
-//cityhash for the hash function in hash table
+//the hash of each way comes from the engine of sys.cuckoo.hash
 
 uint64_t CuckooPaging::hash_function(Address address, unsigned d) {
-    uint64_t result = 0;
-    if(hash_func == "blake2") {
-        blake2b(&result, 8, &address, 8, &keys[d], 8);
-    }
-    else if(hash_func == "city") {
-        result = CityHash64WithSeed((const char *)&address, 8, keys[d]);
-        result = result & hmask(64);
-    }
-    else {//default
-        blake2b(&result, 8, &address, 8, &keys[d], 8);
-    }
-    return result;
+    return hasher->hash(address, d);
 }
 
 //find idle entry in cuckoo tables
@@ -82,12 +74,13 @@ uint64_t CuckooPaging::allocate_table_entry(uint64_t vpageno, uint64_t &pt_id, P
     while(d < ways) {
         uint64_t hash_id = hash_function(vpageno, d)%hptr[d]->map_count;
         // std::cout<<"Virtual page id: "<<vpageno<<" hash_id: "<<hash_id<<std::endl;
-        BasePDTEntry *entry = (*hptr[d])[hash_id];
+        BasePDTEntry entry = (*hptr[d])[hash_id];
         // std::cout<<"virtual page id in the slot: "<<entry->get_vpn()<<std::endl;
         // std::cout<<"the entry is present: "<<entry->is_present()<<std::endl;
         if(!entry->is_present()) {
             validate_page(hptr[d], hash_id, pg_ptr);
             entry->set_vpn(vpageno);
+            cwt_update(vpageno, d, 1);
             pt_id = hash_id;
             cur_pte_num[d]++;
             return d;
@@ -99,9 +92,11 @@ uint64_t CuckooPaging::allocate_table_entry(uint64_t vpageno, uint64_t &pt_id, P
             uint64_t cuckoo_vpn = entry->get_vpn();
             uint64_t cuckoo_id = -1;
             //recursion: allocate the entry in the d-th table to the (d+1)th table
+            cwt_update(cuckoo_vpn, d, -1);
             walk_time = allocate_table_entry(cuckoo_vpn, cuckoo_id, cuckoo_pg_ptr, d+1);
             validate_page(hptr[d], hash_id, pg_ptr);
             entry->set_vpn(vpageno);
+            cwt_update(vpageno, d, 1);
             pt_id = hash_id;
             return walk_time;
         }
@@ -110,16 +105,36 @@ uint64_t CuckooPaging::allocate_table_entry(uint64_t vpageno, uint64_t &pt_id, P
     return -1;
 }
 
+void CuckooPaging::cwt_update(Address vpn, unsigned d, int delta) {
+    g_vector<uint32_t> &pages = cwt[vpn >> CWT_REGION_SHIFT];
+    if (pages.empty())
+        pages.resize(ways, 0);
+    assert(delta > 0 || pages[d]);
+    pages[d] += delta;
+}
+
+uint64_t CuckooPaging::cwt_ways(Address vpn) {
+    g_unordered_map<Address, g_vector<uint32_t>>::iterator it =
+        cwt.find(vpn >> CWT_REGION_SHIFT);
+    uint64_t way_bits = 0;
+    if (it != cwt.end()) {
+        for (unsigned i = 0; i < ways; i++)
+            if (it->second[i])
+                way_bits |= 1ULL << i;
+    }
+    return way_bits;
+}
+
 int CuckooPaging::map_page_table(Address addr, Page *pg_ptr) {
-    BasePDTEntry *entry;
+    BasePDTEntry entry;
     return map_page_table(addr, pg_ptr, entry);
 }
 
 int CuckooPaging::map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                    bool is_write) {
-    BasePDTEntry *entry;
+    BasePDTEntry entry;
     int latency = map_page_table(addr, pg_ptr, entry);
-    if (entry != NULL) {
+    if (entry) {
         entry->set_lrequester(req_id);
         entry->set_accessed();
         if (is_write)
@@ -129,8 +144,8 @@ int CuckooPaging::map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
 }
 
 int CuckooPaging::map_page_table(Address addr, Page *pg_ptr,
-                                   BasePDTEntry *&mapped_entry) {
-    mapped_entry = NULL;
+                                   BasePDTEntry &mapped_entry) {
+    mapped_entry = BasePDTEntry();
     int latency = 0;
     // std::cout<<"map:"<<std::hex<<addr<<std::endl;
     uint64_t vpageno = get_bits(addr, 12, 47);
@@ -160,67 +175,6 @@ Address CuckooPaging::access(MemReq &req) {
     return 0;
 }
 
-uint64_t CuckooPaging::loadPageTables(MemReq &req,
-                                        g_vector<uint64_t> &pgt_addrs,
-                                        g_vector<MemObject *> &parents,
-                                        g_vector<uint32_t> &parentRTTs,
-                                        bool sendPTW) {
-    if (!sendPTW)
-        return req.cycle;
-    uint64_t startCycle = req.cycle;
-    uint64_t respCycle = req.cycle;
-    uint64_t lookupLat = 0;
-    TimingRecord first_ptwTR;
-    first_ptwTR.clear();
-    // Link all reqs in a page table walk
-    for (int i = 0; i < pgt_addrs.size(); i++) {
-        uint64_t lineAddr = pgt_addrs[i] >> lineBits;
-        uint32_t parentId = getParentId(lineAddr, parents.size());
-        MESIState dummyState = MESIState::I;
-        MemReq pgt_req = {lineAddr,    GETS,       req.childId,
-                          &dummyState, startCycle, req.childLock,
-                          dummyState,  req.srcId,  req.flags};
-        pgt_req.threadId = req.threadId;
-        pgt_req.isPIMInst = req.isPIMInst;
-        if (i == 0) {
-            pgt_req.isFirstPTW = true;
-            if (pgt_addrs.size() > 1)
-                pgt_req.isLastPTW = false;
-        } else {
-            pgt_req.isFirstPTW = false;
-            pgt_req.isLastPTW = false;
-        }
-        if (i == (pgt_addrs.size() - 1)) {
-            pgt_req.isLastPTW = true;
-        }
-        uint64_t nextLevelLat = parents[parentId]->access(pgt_req) - startCycle;
-        uint32_t netLat = parentRTTs[parentId];
-        uint64_t Lat = nextLevelLat + netLat;
-        lookupLat = lookupLat < Lat? Lat : lookupLat;
-        if (zinfo->eventRecorders[req.srcId]->hasRecord()) {
-            // std::cout << i <<"hasRecord"<<std::endl;
-            TimingRecord c_tr = zinfo->eventRecorders[req.srcId]->popRecord();
-            if (!first_ptwTR.isValid() && c_tr.isValid()) {
-                // std::cout << i <<" first_ptwTR is not valid & c_tr is valid"<<std::endl;
-                assert(c_tr.endEvent);
-                first_ptwTR = c_tr;
-            } else {
-                // std::cout << i <<"first_ptwTR is valid"<<std::endl;
-                assert(c_tr.isPTW);
-                // Exist a previous page table memory access
-                first_ptwTR.endEvent->addChild(
-                    c_tr.startEvent, zinfo->eventRecorders[req.srcId]);
-                first_ptwTR.endEvent = c_tr.startEvent;
-            }
-        }
-    }
-    respCycle += lookupLat;
-    // reinsert event
-    if (first_ptwTR.isValid())
-        zinfo->eventRecorders[req.srcId]->pushRecord(first_ptwTR);
-    return respCycle;
-}
-
 inline uint64_t CuckooPaging::getPGTAddr(uint64_t pageNo, uint32_t entry_id) {
     uint64_t pgAddr = pageNo << zinfo->page_shift;
     pgAddr |= (ENTRY_SIZE_512 * entry_id);
@@ -229,25 +183,34 @@ inline uint64_t CuckooPaging::getPGTAddr(uint64_t pageNo, uint32_t entry_id) {
 
 Address CuckooPaging::access(MemReq &req, g_vector<MemObject *> &parents,
                                g_vector<uint32_t> &parentRTTs,
-                               BaseCoreRecorder *cRec, bool sendPTW) {
+                               BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                               bool sendPTW) {
     g_vector<uint64_t> pgt_addrs;
-    vector<uint64_t> hash_ids;
     Address addr = req.lineAddr << lineBits;
-    std::cout<<get_bits(addr, 12, 47)<<std::hex<<std::endl;
     Address vpageno = get_bits(addr, 12, 47);
+    uint64_t hashes[PgtHashEngine::MAX_WAYS];
+    hasher->hash_ways(vpageno, hashes);
+    // the walker probes all ways at once, or only the ones the cuckoo walk
+    // cache says hold pages of the region
+    uint64_t probe_ways = ~0ULL;
+    if (pwc && sendPTW) {
+        bool hit;
+        req.cycle += pwc->cuckoo_access(vpageno >> CWT_REGION_SHIFT, hit);
+        if (hit)
+            probe_ways = cwt_ways(vpageno);
+    }
     void *ptr = NULL;
     for(int i = 0; i < ways; i++) {
+        if (!(probe_ways & (1ULL << i))) {
+            skipped_probes++;
+            continue;
+        }
         //get the hash ids in d-ary cuckoo hash table:
-        hash_ids.push_back(hash_function(vpageno, i)%hptr[i]->map_count);
-        // std::cout<<"hash_function works, the hash ids are pushed" << std::endl;
-        //fetch PTE in these d tables, haven't implemented the Cuckoo walk table & cache now:
-        BasePDTEntry *ht_ptr = (*(PageTable *)hptr[i])[hash_ids[i]];
-        pgt_addrs.push_back(getPGTAddr(hptr[i]->get_page_no(), hash_ids[i]));
-        // std::cout<<"vpn in hstable: "<<ht_ptr->get_vpn()<<" vpn accessed: "<<vpageno<<std::endl;
-        if(ht_ptr->is_page_assigned() && ht_ptr->get_vpn() == vpageno) {
-            // std::cout<<"VPN: " << vpageno << " in " << i << "-ary table." <<std::endl;
+        uint64_t hash_id = hashes[i] % hptr[i]->map_count;
+        pgt_addrs.push_back(getPGTAddr(hptr[i]->get_page_no(), hash_id));
+        BasePDTEntry ht_ptr = (*(PageTable *)hptr[i])[hash_id];
+        if(!ptr && ht_ptr->is_page_assigned() && ht_ptr->get_vpn() == vpageno) {
             // update page table flags
-            // std::cout<<"VPN: " << vpageno << " in " << i << "-ary table." <<std::endl;
             ht_ptr->set_lrequester(req.srcId, req.triggerPageShared);
             ht_ptr->set_accessed();
             if (req.type == PUTS) {
@@ -257,22 +220,25 @@ Address CuckooPaging::access(MemReq &req, g_vector<MemObject *> &parents,
             }
             req.pageDirty = ht_ptr->is_dirty();
             req.pageShared = ht_ptr->is_shared();
-            ptr = get_next_level_address<void*>(hptr[i], hash_ids[i]);
-            break;
+            ptr = get_next_level_address<void*>(hptr[i], hash_id);
         }
     }
-    if (!ptr) { //PTE accessed don't get the page ptr
-        // std::cout << "No found the PPN, Now handle the access to d-ary cuckoo tables:" << std::endl;
-        req.cycle =
-            loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
-        return PAGE_FAULT_SIG;
+    if (sendPTW) {
+        walks++;
+        probes += pgt_addrs.size();
+        req.cycle = loadParallelProbes(req, pgt_addrs, parents, parentRTTs);
     }
-    // std::cout << "Get the PPN, Now handle the access to d-ary cuckoo tables:" << std::endl;
-    std::cout << ((Page *)ptr)->pageNo << std::endl;
-    req.cycle = loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
+    if (!ptr) //PTE accessed don't get the page ptr
+        return PAGE_FAULT_SIG;
     return ((Page *)ptr)->pageNo;
 }
 
+void CuckooPaging::calculate_stats(std::ofstream &vmof) {
+    vmof << "cuckoo walks:" << walks << "\t probes:" << probes
+         << "\t probes skipped by the walk cache:" << skipped_probes
+         << std::endl;
+}
+
 // allocate
 
 bool CuckooPaging::allocate_page_table(Address addr, Address size) {
@@ -290,6 +256,7 @@ void CuckooPaging::remove_root_directory() {
             }
         }
         hptr.clear();
+        cwt.clear();
     }
 }
 
@@ -307,15 +274,16 @@ void CuckooPaging::rehash(unsigned d) {
     PageTable *new_table = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
     new_table = new PageTable((uint64_t)(hptr[d]->map_count * scale), hptr[d]->get_page());
     _rdrand64_step((unsigned long long *)&keys[d]);
+    hasher->reseed(d, keys[d]);
     for(int i = 0; i < hptr[d]->map_count; i++) {
-        BasePDTEntry *entry = (*hptr[d])[i];
+        BasePDTEntry entry = (*hptr[d])[i];
         if(entry->is_present()) {
             uint64_t vpageno = entry->get_vpn();
             // std::cout<<"vpn: "<<vpageno<<std::endl;
             Page *pg_ptr = entry->get_page();
             uint64_t hash_id = hash_function(vpageno, d)%new_table->map_count;
             validate_page(new_table, hash_id, pg_ptr);
-            BasePDTEntry *new_entry = (*new_table)[hash_id];
+            BasePDTEntry new_entry = (*new_table)[hash_id];
             new_entry->set_vpn(vpageno);
             vpageno = new_entry->get_vpn();
             // std::cout<<"vpn: "<<vpageno<<std::endl;
@@ -337,15 +305,16 @@ void CuckooPaging::rehash_gradual(unsigned d) {
     PageTable *new_table = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
     new_table = new PageTable((uint64_t)(hptr[d]->map_count * scale), hptr[d]->get_page());
     _rdrand64_step((unsigned long long *)&keys[d]);
+    hasher->reseed(d, keys[d]);
     for(int i = 0; i < hptr[d]->map_count; i++) {
-        BasePDTEntry *entry = (*hptr[d])[i];
+        BasePDTEntry entry = (*hptr[d])[i];
         if(entry->is_present()) {
             uint64_t vpageno = entry->get_vpn();
             // std::cout<<"vpn: "<<vpageno<<std::endl;
             Page *pg_ptr = entry->get_page();
             uint64_t hash_id = hash_function(vpageno, d)%new_table->map_count;
             validate_page(new_table, hash_id, pg_ptr);
-            BasePDTEntry *new_entry = (*new_table)[hash_id];
+            BasePDTEntry new_entry = (*new_table)[hash_id];
             new_entry->set_vpn(vpageno);
             vpageno = new_entry->get_vpn();
             // std::cout<<"vpn: "<<vpageno<<std::endl;
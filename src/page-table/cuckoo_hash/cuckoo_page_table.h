@@ -12,12 +12,15 @@
 #define _CUCKOO_PAGE_TABLE_H
 #include "common/common_functions.h"
 #include "common/global_const.h"
+#include "g_std/g_unordered_map.h"
+#include "g_std/g_vector.h"
 #include "blake2-impl.h"
 #include "blake2.h"
 #include "locks.h"
 #include "page-table/baseline_hash/city.h"
 #include "memory_hierarchy.h"
 #include "page-table/comm_page_table_op.h"
+#include "page-table/hash_engine.h"
 #include "page-table/page_table_entry.h"
 #include <iterator>
 #include <map>
@@ -32,16 +35,17 @@ class CuckooPaging : public BasePaging {
     virtual Address access(MemReq &req);
     virtual Address access(MemReq &req, g_vector<MemObject *> &parents,
                            g_vector<uint32_t> &parentRTTs,
-                           BaseCoreRecorder *cRec, bool sendPTW);
+                           BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                           bool sendPTW);
     virtual bool unmap_page_table(Address addr);
-    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry *&mapped_entry);
+    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry &mapped_entry);
     virtual int map_page_table(Address addr, Page *pg_ptr);
     virtual int map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                bool is_write);
     virtual bool allocate_page_table(Address addr, Address size);
     virtual void remove_root_directory();
     virtual bool remove_page_table(Address addr, Address size);
-    virtual void calculate_stats(std::ofstream &vmof) {}
+    virtual void calculate_stats(std::ofstream &vmof);
     virtual void calculate_stats() {}
     virtual void lock() { futex_lock(&table_lock); }
     virtual void unlock() { futex_unlock(&table_lock); }
@@ -49,14 +53,15 @@ class CuckooPaging : public BasePaging {
     virtual void rehash_gradual(unsigned d);
   protected:
     uint64_t allocate_table_entry(uint64_t hash_id, uint64_t &pt_id, Page *pg_ptr, unsigned d);
+    // count a page of the region of vpn in (delta > 0) or out of way d
+    void cwt_update(Address vpn, unsigned d, int delta);
+    // bitmap of the ways holding pages of the region of vpn
+    uint64_t cwt_ways(Address vpn);
     //allocate
     // remove
 
   private:
     uint64_t hash_function(Address address, unsigned d);
-    uint64_t loadPageTables(MemReq &req, g_vector<uint64_t> &pgt_addrs,
-                            g_vector<MemObject *> &parents,
-                            g_vector<uint32_t> &parentRTTs, bool sendPTW);
     inline uint64_t getPGTAddr(uint64_t pageNo, uint32_t entry_id)
         __attribute__((always_inline));
 
@@ -65,8 +70,20 @@ class CuckooPaging : public BasePaging {
     vector<uint64_t> rehash_count;
     vector<uint64_t> cur_pte_num;
     uint64_t* keys;
-    string hash_func;
+    PgtHashEngine *hasher;
+    // pages of a cuckoo walk table entry cover 2MB of virtual memory
+    static const unsigned CWT_REGION_SHIFT = 9;
+
   private:
+    /*
+     * The cuckoo walk table (CWT): pages of each region in each way. Walk
+     * caches hold its entries, a walk that hits probes only the ways with
+     * pages of the region
+     */
+    g_unordered_map<Address, g_vector<uint32_t>> cwt;
+    uint64_t walks;
+    uint64_t probes;
+    uint64_t skipped_probes;
     PagingStyle mode;
     lock_t table_lock;
     double scale;
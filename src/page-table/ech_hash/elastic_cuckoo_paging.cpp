@@ -0,0 +1,293 @@
+/*
+ * Elastic cuckoo paging (Skarlatos et al., ASPLOS'20)
+ */
+#include "page-table/ech_hash/elastic_cuckoo_paging.h"
+#include "common/common_functions.h"
+#include "log.h"
+#include "mmu/memory_management.h"
+#include "page-table/parallel_probe.h"
+#include <immintrin.h>
+
+ElasticCuckooPaging::CuckooWays::CuckooWays(uint32_t d, uint64_t size,
+                                            PgtHashKind hash)
+    : size(size) {
+    uint64_t keys[PgtHashEngine::MAX_WAYS];
+    for (uint32_t i = 0; i < d; i++) {
+        ways.push_back(new PageTable(size));
+        frames.push_back(new HashedTableFrames(size));
+        entries.push_back(0);
+        rehashed.push_back(0);
+        _rdrand64_step((unsigned long long *)&keys[i]);
+    }
+    hasher = new PgtHashEngine(hash, d, keys);
+}
+
+ElasticCuckooPaging::CuckooWays::~CuckooWays() {
+    for (uint32_t i = 0; i < ways.size(); i++) {
+        delete ways[i];
+        delete frames[i];
+    }
+    delete hasher;
+}
+
+double ElasticCuckooPaging::CuckooWays::occupancy() {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < entries.size(); i++)
+        total += entries[i];
+    return (double)total / (double)(size * entries.size());
+}
+
+ElasticCuckooPaging::ElasticCuckooPaging(PagingStyle select)
+    : mode(select), migrate(NULL), d(zinfo->cuckoo_d),
+      scale(zinfo->cuckoo_scale), threshold(zinfo->cuckoo_threshold),
+      swaps(zinfo->cuckoo_swaps), gradual(zinfo->cuckoo_gradual),
+      resizes(0), forced_resizes(0), migrated(0), rehash_accesses(0),
+      walks(0), resizing_walks(0) {
+    if (d < 2 || d > PgtHashEngine::MAX_WAYS)
+        panic("Elastic cuckoo paging needs 2 to %u ways, %u configured",
+              PgtHashEngine::MAX_WAYS, d);
+    if (scale <= 1)
+        panic("Elastic cuckoo tables grow on resizes, scale is %f", scale);
+    current = new CuckooWays(d, zinfo->cuckoo_size, zinfo->cuckoo_hash);
+    futex_init(&table_lock);
+}
+
+ElasticCuckooPaging::~ElasticCuckooPaging() { remove_root_directory(); }
+
+void ElasticCuckooPaging::locate(Address vpn, uint32_t way,
+                                 CuckooWays *&table, uint64_t &slot_id) {
+    table = current;
+    slot_id = current->slot(vpn, way);
+    if (migrate && slot_id < current->rehashed[way]) {
+        table = migrate;
+        slot_id = migrate->slot(vpn, way);
+    }
+}
+
+BasePDTEntry ElasticCuckooPaging::lookup(Address vpn) {
+    for (uint32_t i = 0; i < d; i++) {
+        CuckooWays *table;
+        uint64_t slot_id;
+        locate(vpn, i, table, slot_id);
+        BasePDTEntry entry = (*table->ways[i])[slot_id];
+        if (entry->is_page_assigned() && entry->get_vpn() == vpn)
+            return entry;
+    }
+    return BasePDTEntry();
+}
+
+uint32_t ElasticCuckooPaging::random_way(uint32_t except) {
+    uint16_t way;
+    do {
+        _rdrand16_step(&way);
+        way %= d;
+    } while (way == except);
+    return way;
+}
+
+uint32_t ElasticCuckooPaging::insert(PteSlot &slot, uint32_t way) {
+    for (uint32_t tries = 1; tries <= MAX_RETRIES; tries++) {
+        CuckooWays *table;
+        uint64_t slot_id;
+        locate(slot.vpn, way, table, slot_id);
+        PteSlot old = table->ways[way]->take_slot(slot_id);
+        table->ways[way]->put_slot(slot_id, slot);
+        if (!old.is_present()) {
+            table->entries[way]++;
+            return tries;
+        }
+        slot = old;
+        way = random_way(way);
+    }
+    return 0;
+}
+
+void ElasticCuckooPaging::place(PteSlot slot, uint32_t way,
+                                uint64_t &accesses) {
+    while (true) {
+        uint32_t tries = insert(slot, way);
+        accesses += tries ? tries : MAX_RETRIES;
+        if (tries)
+            return;
+        // no place within MAX_RETRIES displacements: grow the table at
+        // once, then find the entry left over a place in the larger one
+        forced_resizes++;
+        if (!migrate)
+            migrate = new CuckooWays(d, current->size * scale,
+                                     zinfo->cuckoo_hash);
+        finish_resize(accesses);
+        way = random_way(d);
+    }
+}
+
+void ElasticCuckooPaging::rehash(uint64_t swaps, uint64_t &accesses) {
+    for (uint64_t i = 0; i < swaps && migrate; i++) {
+        // a random way with slots left to move
+        uint32_t way = random_way(d);
+        while (current->rehashed[way] == current->size)
+            way = (way + 1) % d;
+        uint64_t slot_id = current->rehashed[way]++;
+        PteSlot slot = current->ways[way]->take_slot(slot_id);
+        accesses++;
+        if (slot.is_present()) {
+            current->entries[way]--;
+            migrated++;
+            // slot_id is below the pointer now, so the entry goes to
+            // migrate
+            place(slot, way, accesses);
+        }
+        bool done = true;
+        for (uint32_t w = 0; w < d && done; w++)
+            done = current->rehashed[w] == current->size;
+        if (done && migrate) {
+            delete current;
+            current = migrate;
+            migrate = NULL;
+            resizes++;
+        }
+    }
+}
+
+void ElasticCuckooPaging::finish_resize(uint64_t &accesses) {
+    while (migrate)
+        rehash(current->size * d, accesses);
+}
+
+void ElasticCuckooPaging::evaluate_elasticity(uint64_t &accesses) {
+    if (!migrate && current->occupancy() > threshold)
+        migrate = new CuckooWays(d, current->size * scale, zinfo->cuckoo_hash);
+    if (!migrate)
+        return;
+    if (gradual)
+        rehash(swaps, accesses);
+    else
+        finish_resize(accesses);
+    // the new table fills up before the old one empties, catch up
+    if (migrate && migrate->occupancy() > threshold)
+        finish_resize(accesses);
+}
+
+int ElasticCuckooPaging::map_page_table(Address addr, Page *pg_ptr) {
+    BasePDTEntry entry;
+    return map_page_table(addr, pg_ptr, entry);
+}
+
+int ElasticCuckooPaging::map_page_table(uint32_t req_id, Address addr,
+                                        Page *pg_ptr, bool is_write) {
+    BasePDTEntry entry;
+    int latency = map_page_table(addr, pg_ptr, entry);
+    if (entry) {
+        entry->set_lrequester(req_id);
+        entry->set_accessed();
+        if (is_write)
+            entry->set_dirty();
+    }
+    return latency;
+}
+
+int ElasticCuckooPaging::map_page_table(Address addr, Page *pg_ptr,
+                                        BasePDTEntry &mapped_entry) {
+    Address vpageno = get_bits(addr, 12, 47);
+    uint64_t accesses = 0;
+    place(make_page_slot(pg_ptr, vpageno), random_way(d), accesses);
+    uint64_t insert_accesses = accesses;
+    evaluate_elasticity(accesses);
+    rehash_accesses += accesses - insert_accesses;
+    // the resize may have moved the entry
+    mapped_entry = lookup(vpageno);
+    assert(mapped_entry);
+    // every slot the fault handler reads or writes is a memory access,
+    // including the ones of the resize it drives
+    return zinfo->mem_access_time * accesses;
+}
+
+bool ElasticCuckooPaging::unmap_page_table(Address addr) {
+    Address vpageno = get_bits(addr, 12, 47);
+    for (uint32_t i = 0; i < d; i++) {
+        CuckooWays *table;
+        uint64_t slot_id;
+        locate(vpageno, i, table, slot_id);
+        BasePDTEntry entry = (*table->ways[i])[slot_id];
+        if (entry->is_page_assigned() && entry->get_vpn() == vpageno) {
+            invalidate_page(table->ways[i], slot_id);
+            table->entries[i]--;
+            return true;
+        }
+    }
+    return false;
+}
+
+Address ElasticCuckooPaging::access(MemReq &req) {
+    assert(0); // shouldn't come here
+    return 0;
+}
+
+Address ElasticCuckooPaging::access(MemReq &req,
+                                    g_vector<MemObject *> &parents,
+                                    g_vector<uint32_t> &parentRTTs,
+                                    BaseCoreRecorder *cRec,
+                                    PageWalkCache *pwc, bool sendPTW) {
+    Address addr = req.lineAddr << lineBits;
+    Address vpageno = get_bits(addr, 12, 47);
+    uint64_t hashes[PgtHashEngine::MAX_WAYS];
+    uint64_t migrate_hashes[PgtHashEngine::MAX_WAYS];
+    current->hasher->hash_ways(vpageno, hashes);
+    if (migrate)
+        migrate->hasher->hash_ways(vpageno, migrate_hashes);
+    // one probe per way, in current or migrate after its rehashing pointer
+    g_vector<uint64_t> pgt_addrs;
+    BasePDTEntry pte;
+    for (uint32_t i = 0; i < d; i++) {
+        CuckooWays *table = current;
+        uint64_t slot_id = hashes[i] % current->size;
+        if (migrate && slot_id < current->rehashed[i]) {
+            table = migrate;
+            slot_id = migrate_hashes[i] % migrate->size;
+        }
+        pgt_addrs.push_back(table->slot_addr(i, slot_id));
+        BasePDTEntry entry = (*table->ways[i])[slot_id];
+        if (!pte && entry->is_page_assigned() && entry->get_vpn() == vpageno)
+            pte = entry;
+    }
+    if (sendPTW) {
+        walks++;
+        if (migrate)
+            resizing_walks++;
+        req.cycle = loadParallelProbes(req, pgt_addrs, parents, parentRTTs);
+    }
+    if (!pte)
+        return PAGE_FAULT_SIG;
+    // update page table flags
+    pte->set_lrequester(req.srcId, req.triggerPageShared);
+    pte->set_accessed();
+    if (req.type == PUTS) {
+        if (!pte->is_dirty())
+            req.triggerPageDirty = true;
+        pte->set_dirty();
+    }
+    req.pageDirty = pte->is_dirty();
+    req.pageShared = pte->is_shared();
+    return pte->get_page()->pageNo;
+}
+
+void ElasticCuckooPaging::remove_root_directory() {
+    CuckooWays *tables[2] = {current, migrate};
+    for (uint32_t t = 0; t < 2; t++) {
+        if (!tables[t])
+            continue;
+        for (uint32_t i = 0; i < d; i++)
+            for (uint64_t j = 0; j < tables[t]->size; j++)
+                invalidate_page(tables[t]->ways[i], j);
+        delete tables[t];
+    }
+    current = migrate = NULL;
+}
+
+void ElasticCuckooPaging::calculate_stats(std::ofstream &vmof) {
+    vmof << "elastic cuckoo walks:" << walks
+         << "\t during resizes:" << resizing_walks << std::endl;
+    vmof << "elastic cuckoo resizes:" << resizes
+         << "\t forced by failed inserts:" << forced_resizes
+         << "\t entries migrated:" << migrated
+         << "\t rehash memory accesses:" << rehash_accesses << std::endl;
+}
@@ -0,0 +1,120 @@
+/*
+ * Elastic cuckoo paging (Skarlatos et al., ASPLOS'20)
+ */
+#ifndef __ELASTIC_CUCKOO_PAGING__
+#define __ELASTIC_CUCKOO_PAGING__
+#include "common/global_const.h"
+#include "g_std/g_vector.h"
+#include "locks.h"
+#include "memory_hierarchy.h"
+#include "page-table/comm_page_table_op.h"
+#include "page-table/hash_engine.h"
+#include "page-table/hashed_table.h"
+#include "page-table/page_table_entry.h"
+#include "zsim.h"
+
+/*
+ * A d-ary cuckoo page table that resizes gradually, after the reference
+ * elastic cuckoo hashing of elastic_cuckoo_page_table.cpp. Past the
+ * occupancy threshold a table scale times larger (migrate) is built next
+ * to the one in use (current), and every insert then moves a few slots of
+ * current to it, so no fault pays for the whole rehash. The slots of each
+ * way below its rehashing pointer have moved: a VPN whose slot in current
+ * is below the pointer lives in migrate, and walks follow the pointers
+ * into either table, one probe per way. Once every slot has moved migrate
+ * becomes current.
+ */
+class ElasticCuckooPaging : public BasePaging {
+  public:
+    ElasticCuckooPaging(PagingStyle selection);
+    ~ElasticCuckooPaging();
+    virtual PagingStyle get_paging_style() { return mode; }
+    // NULL once remove_root_directory() has freed the ways
+    virtual PageTable *get_root_directory() {
+        return current ? current->ways[0] : NULL;
+    }
+    virtual Address access(MemReq &req);
+    virtual Address access(MemReq &req, g_vector<MemObject *> &parents,
+                           g_vector<uint32_t> &parentRTTs,
+                           BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                           bool sendPTW);
+    virtual bool unmap_page_table(Address addr);
+    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry &mapped_entry);
+    virtual int map_page_table(Address addr, Page *pg_ptr);
+    virtual int map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
+                               bool is_write);
+    virtual bool allocate_page_table(Address addr, Address size) {
+        return true;
+    }
+    virtual void remove_root_directory();
+    virtual bool remove_page_table(Address addr, Address size) {
+        return true;
+    }
+    virtual void calculate_stats(std::ofstream &vmof);
+    virtual void calculate_stats() {}
+    virtual void lock() { futex_lock(&table_lock); }
+    virtual void unlock() { futex_unlock(&table_lock); }
+
+  private:
+    // the ways of one cuckoo table
+    class CuckooWays : public GlobAlloc {
+      public:
+        CuckooWays(uint32_t d, uint64_t size, PgtHashKind hash);
+        ~CuckooWays();
+        uint64_t slot(Address vpn, uint32_t way) {
+            return hasher->hash(vpn, way) % size;
+        }
+        Address slot_addr(uint32_t way, uint64_t slot) {
+            return frames[way]->entry_addr(slot);
+        }
+        double occupancy();
+
+        g_vector<PageTable *> ways;
+        g_vector<HashedTableFrames *> frames;
+        uint64_t size;              // slots per way
+        g_vector<uint64_t> entries; // entries in each way
+        g_vector<uint64_t> rehashed; // rehashing pointer of each way
+        PgtHashEngine *hasher;
+    };
+
+    // table and slot of vpn in way
+    void locate(Address vpn, uint32_t way, CuckooWays *&table,
+                uint64_t &slot_id);
+    BasePDTEntry lookup(Address vpn);
+    /*
+     *@function: insert slot into way, displacing residents along a random
+     *walk of ways like insert_elastic
+     *@return: table accesses, 0 if the walk gave up; slot then holds the
+     *entry left without a place
+     */
+    uint32_t insert(PteSlot &slot, uint32_t way);
+    // insert, growing the table when the walk gives up
+    void place(PteSlot slot, uint32_t way, uint64_t &accesses);
+    // like evaluate_elasticity: start a resize past the threshold, or
+    // move swaps slots of the one in progress
+    void evaluate_elasticity(uint64_t &accesses);
+    void rehash(uint64_t swaps, uint64_t &accesses);
+    void finish_resize(uint64_t &accesses);
+    uint32_t random_way(uint32_t except);
+
+    static const uint32_t MAX_RETRIES = 64;
+
+    PagingStyle mode;
+    lock_t table_lock;
+    CuckooWays *current;
+    CuckooWays *migrate; // NULL unless resizing
+    uint32_t d;
+    double scale;
+    double threshold;
+    uint64_t swaps;
+    bool gradual;
+    // stats
+    uint64_t resizes;
+    uint64_t forced_resizes;
+    uint64_t migrated;
+    uint64_t rehash_accesses;
+    uint64_t walks;
+    uint64_t resizing_walks;
+};
+
+#endif
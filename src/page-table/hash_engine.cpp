@@ -0,0 +1,177 @@
+/*
+ * Hash functions of hashed page tables
+ */
+#include "page-table/hash_engine.h"
+#include "log.h"
+#include "page-table/baseline_hash/city.h"
+#include "page-table/cuckoo_hash/blake2.h"
+
+static inline uint64_t rotl64(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// XXH64 of an 8-byte input
+static inline uint64_t xxhash64(uint64_t val, uint64_t seed) {
+    static const uint64_t P1 = 11400714785074694791ULL;
+    static const uint64_t P2 = 14029467366897019727ULL;
+    static const uint64_t P3 = 1609587929392839161ULL;
+    static const uint64_t P4 = 9650029242287828579ULL;
+    static const uint64_t P5 = 2870177450012600261ULL;
+    uint64_t h = seed + P5 + 8;
+    h ^= rotl64(val * P2, 31) * P1;
+    h = rotl64(h, 27) * P1 + P4;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// CRC32C lookup table, for hosts without the SSE4.2 crc32 instruction
+static uint32_t crcTable[256];
+
+static void init_crc_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (uint32_t b = 0; b < 8; b++)
+            c = (c >> 1) ^ (0x82F63B78 & (0 - (c & 1)));
+        crcTable[i] = c;
+    }
+}
+
+static inline uint32_t crc32c_sw(uint32_t crc, uint64_t val) {
+    for (uint32_t b = 0; b < 8; b++) {
+        crc = crcTable[(crc ^ val) & 0xff] ^ (crc >> 8);
+        val >>= 8;
+    }
+    return crc;
+}
+
+__attribute__((target("sse4.2"))) static inline uint64_t
+crc64_hw(uint64_t val, uint64_t seed) {
+    uint64_t lo = __builtin_ia32_crc32di((uint32_t)seed, val);
+    uint64_t hi = __builtin_ia32_crc32di(seed >> 32, val);
+    return (hi << 32) | lo;
+}
+
+// two CRC32Cs with the halves of the seed as initial values
+static inline uint64_t crc64_sw(uint64_t val, uint64_t seed) {
+    uint64_t lo = crc32c_sw((uint32_t)seed, val);
+    uint64_t hi = crc32c_sw(seed >> 32, val);
+    return (hi << 32) | lo;
+}
+
+// splitmix64, fills the H3 matrix from a seed
+static inline uint64_t next_random(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+PgtHashEngine::PgtHashEngine(PgtHashKind kind, uint32_t ways,
+                             const uint64_t *init_seeds)
+    : kind(kind), ways(ways), h3Table(NULL), crcInsn(false) {
+    if (!ways || ways > MAX_WAYS)
+        panic("A hashed page table needs 1 to %u ways, %u configured",
+              MAX_WAYS, ways);
+    seeds = gm_calloc<uint64_t>(ways);
+    for (uint32_t w = 0; w < ways; w++)
+        seeds[w] = init_seeds[w];
+    if (kind == PgtHash_H3) {
+        h3Table = gm_calloc<uint64_t>(8 * 256 * ways);
+        for (uint32_t w = 0; w < ways; w++)
+            fill_h3(w);
+    } else if (kind == PgtHash_CRC) {
+        crcInsn = __builtin_cpu_supports("sse4.2");
+        if (!crcInsn)
+            init_crc_table();
+    }
+}
+
+PgtHashEngine::~PgtHashEngine() {
+    gm_free(seeds);
+    if (h3Table)
+        gm_free(h3Table);
+}
+
+void PgtHashEngine::fill_h3(uint32_t way) {
+    uint64_t state = seeds[way];
+    for (uint32_t byte = 0; byte < 8; byte++) {
+        uint64_t rows[8];
+        for (uint32_t b = 0; b < 8; b++)
+            rows[b] = next_random(state);
+        for (uint32_t v = 0; v < 256; v++) {
+            uint64_t h = 0;
+            for (uint32_t b = 0; b < 8; b++)
+                if (v & (1 << b))
+                    h ^= rows[b];
+            h3Table[(byte * 256 + v) * ways + way] = h;
+        }
+    }
+}
+
+void PgtHashEngine::reseed(uint32_t way, uint64_t seed) {
+    assert(way < ways);
+    seeds[way] = seed;
+    if (h3Table)
+        fill_h3(way);
+}
+
+uint64_t PgtHashEngine::hash(uint64_t vpn, uint32_t way) {
+    assert(way < ways);
+    uint64_t result = 0;
+    switch (kind) {
+    case PgtHash_City:
+        return CityHash64WithSeed((const char *)&vpn, 8, seeds[way]);
+    case PgtHash_XXHash:
+        return xxhash64(vpn, seeds[way]);
+    case PgtHash_CRC:
+        return crcInsn ? crc64_hw(vpn, seeds[way])
+                       : crc64_sw(vpn, seeds[way]);
+    case PgtHash_H3:
+        for (uint32_t byte = 0; byte < 8; byte++, vpn >>= 8)
+            result ^= h3Table[(byte * 256 + (vpn & 0xff)) * ways + way];
+        return result;
+    case PgtHash_Blake2:
+        blake2b(&result, 8, &vpn, 8, &seeds[way], 8);
+        return result;
+    }
+    return result;
+}
+
+void PgtHashEngine::hash_ways(uint64_t vpn, uint64_t *hashes) {
+    uint32_t w;
+    switch (kind) {
+    case PgtHash_XXHash:
+        for (w = 0; w < ways; w++)
+            hashes[w] = xxhash64(vpn, seeds[w]);
+        break;
+    case PgtHash_CRC:
+        // independent crc32s of the ways pipeline in the unit
+        if (crcInsn) {
+            for (w = 0; w < ways; w++)
+                hashes[w] = crc64_hw(vpn, seeds[w]);
+        } else {
+            for (w = 0; w < ways; w++)
+                hashes[w] = crc64_sw(vpn, seeds[w]);
+        }
+        break;
+    case PgtHash_H3:
+        // every byte XORs its row into all ways at once, the inner loop
+        // vectorizes
+        for (w = 0; w < ways; w++)
+            hashes[w] = 0;
+        for (uint32_t byte = 0; byte < 8; byte++, vpn >>= 8) {
+            const uint64_t *row = &h3Table[(byte * 256 + (vpn & 0xff)) * ways];
+            for (w = 0; w < ways; w++)
+                hashes[w] ^= row[w];
+        }
+        break;
+    default:
+        for (w = 0; w < ways; w++)
+            hashes[w] = hash(vpn, w);
+        break;
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * Hash functions of hashed page tables
+ */
+#ifndef __HASH_ENGINE__
+#define __HASH_ENGINE__
+#include "common/global_const.h"
+#include "galloc.h"
+#include <stdint.h>
+
+/*
+ * The hash engine of a hashed or cuckoo page table: one function per way,
+ * drawn from the kind the table is configured with (sys.hdc.hash,
+ * sys.cuckoo.hash). Walkers hash a VPN for every way at once, so the
+ * engine does too: the functions of all ways run side by side, and H3
+ * hashes them with one pass of XORs over the VPN bytes, the way a hardware
+ * XOR tree would.
+ */
+class PgtHashEngine : public GlobAlloc {
+  public:
+    static const uint32_t MAX_WAYS = 64;
+
+    /*
+     *@param seeds: seed of the function of each way
+     */
+    PgtHashEngine(PgtHashKind kind, uint32_t ways, const uint64_t *seeds);
+    ~PgtHashEngine();
+
+    PgtHashKind get_kind() { return kind; }
+    // hash of vpn in way
+    uint64_t hash(uint64_t vpn, uint32_t way);
+    // hashes of vpn in all ways, hashes holds one per way
+    void hash_ways(uint64_t vpn, uint64_t *hashes);
+    // draw a new function for way, after a rehash of it
+    void reseed(uint32_t way, uint64_t seed);
+
+  private:
+    void fill_h3(uint32_t way);
+
+    PgtHashKind kind;
+    uint32_t ways;
+    uint64_t *seeds;
+    // H3: XOR of the matrix rows of every value of every VPN byte, with
+    // the columns of all ways side by side
+    uint64_t *h3Table;
+    bool crcInsn;
+};
+
+#endif
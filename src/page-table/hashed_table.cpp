@@ -0,0 +1,31 @@
+/*
+ * Physical memory of hashed page tables
+ */
+#include "page-table/hashed_table.h"
+#include "log.h"
+#include "mmu/memory_management.h"
+
+HashedTableFrames::HashedTableFrames(uint64_t entries) {
+    if (!zinfo->buddy_allocator)
+        panic("Hashed page tables need the buddy allocator");
+    unsigned frame_entry_bits = zinfo->page_shift - ENTRY_SHIFT_512;
+    uint64_t frames = ((entries - 1) >> frame_entry_bits) + 1;
+    order = 0;
+    while ((1ULL << order) < frames && order < MAXORDER - 1)
+        order++;
+    blockEntryBits = order + frame_entry_bits;
+    uint64_t num_blocks = ((frames - 1) >> order) + 1;
+    for (uint64_t i = 0; i < num_blocks; i++) {
+        Page *page = zinfo->buddy_allocator->allocate_pages(0U, order);
+        if (!page)
+            panic("Cannot allocate %lu frames for a hashed page table!",
+                  1UL << order);
+        blocks.push_back(page->pageNo);
+    }
+}
+
+HashedTableFrames::~HashedTableFrames() {
+    for (uint64_t i = 0; i < blocks.size(); i++)
+        for (uint64_t f = 0; f < (1ULL << order); f++)
+            zinfo->buddy_allocator->free_one_page(blocks[i] + f);
+}
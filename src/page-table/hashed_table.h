@@ -0,0 +1,37 @@
+/*
+ * Physical memory of hashed page tables
+ */
+#ifndef __HASHED_TABLE__
+#define __HASHED_TABLE__
+#include "common/global_const.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "memory_hierarchy.h"
+#include "zsim.h"
+
+/*
+ * A hashed page table is one array of entries, so it lives in contiguous
+ * physical frames: blocks as large as the buddy allocator hands out, each
+ * holding a run of the entries. Walks read an entry at the address this
+ * gives it, so tables larger than a page spread over as many lines as they
+ * would in hardware.
+ */
+class HashedTableFrames : public GlobAlloc {
+  public:
+    explicit HashedTableFrames(uint64_t entries);
+    ~HashedTableFrames();
+
+    Address entry_addr(uint64_t entry_id) {
+        Address frame = blocks[entry_id >> blockEntryBits];
+        uint64_t offset = entry_id & ((1ULL << blockEntryBits) - 1);
+        return (frame << zinfo->page_shift) + ENTRY_SIZE_512 * offset;
+    }
+    uint64_t frames() { return blocks.size() << order; }
+
+  private:
+    g_vector<Address> blocks; // first frame of every block
+    unsigned order;           // frames of a block, log2
+    unsigned blockEntryBits;  // entries of a block, log2
+};
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * Nested (2D) paging of a virtualized guest
+ */
+#include "page-table/nested_page_table.h"
+#include "log.h"
+
+NestedPaging::NestedPaging(PagingStyle selection, LongModePaging *host_paging)
+    : LongModePaging(selection), host(host_paging), host_walks(0),
+      host_reads(0), nested_hits(0), ept_violations(0) {
+    assert(host);
+}
+
+void NestedPaging::translate_frame(MemReq &req, Page *frame,
+                                   PageWalkCache *pwc,
+                                   g_vector<uint64_t> &pgt_addrs,
+                                   bool sendPTW) {
+    if (!sendPTW)
+        return;
+    PageWalkCache *host_pwc = NULL;
+    if (pwc) {
+        bool hit;
+        req.cycle += pwc->nested_access(frame->pageNo, hit);
+        if (hit) {
+            __sync_fetch_and_add(&nested_hits, 1);
+            return;
+        }
+        host_pwc = pwc->get_host();
+    }
+    Address gpa = frame->pageNo << zinfo->page_shift;
+    size_t guest_reads = pgt_addrs.size();
+    BasePDTEntry host_entry;
+    if (!host->walk(req, gpa, host_pwc, pgt_addrs, host_entry, sendPTW)) {
+        // EPT violation: the hypervisor backs the frame, mapping it again
+        // is harmless if another walk got there first
+        host->lock();
+        req.cycle += host->map_page_table(gpa, frame);
+        host->unlock();
+        __sync_fetch_and_add(&ept_violations, 1);
+    }
+    __sync_fetch_and_add(&host_walks, 1);
+    __sync_fetch_and_add(&host_reads, pgt_addrs.size() - guest_reads);
+}
+
+void NestedPaging::calculate_stats(std::ofstream &vmof) {
+    LongModePaging::calculate_stats(vmof);
+    vmof << "nested walks, frames translated by the nested TLB:"
+         << nested_hits << "\t by host walks:" << host_walks
+         << "\t host table reads:" << host_reads
+         << "\t EPT violations:" << ept_violations << std::endl;
+}
@@ -0,0 +1,45 @@
+/*
+ * Nested (2D) paging of a virtualized guest
+ */
+#ifndef __NESTED_PGT__
+#define __NESTED_PGT__
+#include "common/global_const.h"
+#include "memory_hierarchy.h"
+#include "mmu/page.h"
+#include "page-table/page_table.h"
+#include "page-table/pw_cache.h"
+#include "zsim.h"
+
+/*
+ * The guest page table of a process running in a virtual machine. Its table
+ * pages and data pages are guest-physical frames, so every one the walk
+ * touches is first translated through the host page table (EPT) the whole
+ * VM shares: a 4-level guest walk over a 4-level host takes up to 24
+ * references. The walker's nested TLB and host page walk caches (see
+ * PageWalkCache) cut them down.
+ *
+ * Guest RAM is one memory slot at host-physical 0, so a guest frame is backed
+ * by the host frame of the same number; the EPT is filled on the first walk
+ * that touches a frame (an EPT violation) and only decides the cost of the
+ * walks. Functional walks thus need no host translation.
+ */
+class NestedPaging : public LongModePaging {
+  public:
+    NestedPaging(PagingStyle selection, LongModePaging *host_paging);
+
+    LongModePaging *get_host() { return host; }
+
+    virtual void calculate_stats(std::ofstream &vmof);
+
+  protected:
+    virtual void translate_frame(MemReq &req, Page *frame, PageWalkCache *pwc,
+                                 g_vector<uint64_t> &pgt_addrs, bool sendPTW);
+
+  private:
+    LongModePaging *host;
+    uint64_t host_walks;     // frames the nested TLB did not translate
+    uint64_t host_reads;     // host table reads of those walks
+    uint64_t nested_hits;    // frames the nested TLB translated
+    uint64_t ept_violations; // frames the host mapped on first touch
+};
+#endif
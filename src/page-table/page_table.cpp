@@ -49,13 +49,13 @@ NormalPaging::~NormalPaging() {}
 
 /*****-----functional interface of Legacy-Paging----*****/
 int NormalPaging::map_page_table(Address addr, Page *pg_ptr) {
-    BasePDTEntry *entry;
+    BasePDTEntry entry;
     return map_page_table(addr, pg_ptr, entry);
 }
 
 int NormalPaging::map_page_table(Address addr, Page *pg_ptr,
-                                 BasePDTEntry *&mapped_entry) {
-    mapped_entry = NULL;
+                                 BasePDTEntry &mapped_entry) {
+    mapped_entry = BasePDTEntry();
     int latency = 0;
     // update page table
     unsigned pd_entry_id = get_page_directory_off(addr, mode);
@@ -281,13 +281,13 @@ PAEPaging::~PAEPaging() {
 
 /*****-----functional interface of paging----*****/
 int PAEPaging::map_page_table(Address addr, Page *pg_ptr) {
-    BasePDTEntry *entry;
+    BasePDTEntry entry;
     return map_page_table(addr, pg_ptr, entry);
 }
 
 int PAEPaging::map_page_table(Address addr, Page *pg_ptr,
-                              BasePDTEntry *&mapped_entry) {
-    mapped_entry = NULL;
+                              BasePDTEntry &mapped_entry) {
+    mapped_entry = BasePDTEntry();
     int latency = 0;
     // page directory pointer offset
     unsigned pdp_id = get_page_directory_pointer_off(addr, mode);
@@ -668,19 +668,22 @@ bool PAEPaging::remove_page_table(unsigned pdpt_num, unsigned pd_num) {
 /*-----------LongMode Paging--------------*/
 // PageTable* LongModePaging::pml4;
 LongModePaging::LongModePaging(PagingStyle select)
-    : mode(select), cur_pdp_num(0), cur_pd_num(0), cur_pt_num(0) {
-    PageTable *table = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
+    : pml4(NULL), pml5(NULL), style(select), mode(la57_to_4level(select)),
+      cur_pml4_num(0), cur_pdp_num(0), cur_pd_num(0), cur_pt_num(0),
+      numa_tables(false), table_policy(Numa_Local), replicate(false),
+      interleave_next(0), replica_frames(0), replica_writes(0),
+      local_reads(0), remote_reads(0) {
     assert(zinfo);
-    if (zinfo->buddy_allocator) {
-        Page *page = zinfo->buddy_allocator->allocate_pages(0);
-        if (page) {
-            pml4 = new (table) PageTable(512, page);
-        } else {
-            panic("Cannot allocate a page for page directory!");
-        }
-    } else {
-        pml4 = new (table) PageTable(512);
-    }
+    PageTable *root = create_table(gm_memalign<PageTable>(CACHE_LINE_BYTES, 1),
+                                   "page directory");
+    // LA57 walks start at a PML5 table, whose entries point to PML4 tables
+    if (style != mode)
+        pml5 = root;
+    else
+        pml4 = root;
+    levels = pml5 ? 5 : 4;
+    for (unsigned l = 0; l < PWC_LEVELS + 1; l++)
+        level_reads[l] = 0;
     // if (select == LongMode_Normal) //4KB
     // {
     // 	zinfo->page_size = 4 * power(2, 10);
@@ -698,21 +701,106 @@ LongModePaging::LongModePaging(PagingStyle select)
     // }
     futex_init(&table_lock);
     error_migrated_pages = 0;
+    table_seq = 0;
+    walk_retries = 0;
+    thp = false;
+    thp_fault = false;
+    huge_pages = 0;
+    thp_fault_alloc = 0;
+    thp_fault_fallback = 0;
+    thp_collapse_alloc = 0;
+    thp_collapse_fallback = 0;
 }
 
 LongModePaging::~LongModePaging() { remove_root_directory(); }
 
+void LongModePaging::place_tables(NumaPolicy policy, bool replicas) {
+    assert(zinfo->buddy_allocator && policy != Numa_Bind);
+    numa_tables = true;
+    table_policy = policy;
+    if (replicas && !replicate) {
+        replicate = true;
+        add_replicas(get_root_directory());
+    }
+}
+
+PageTable *LongModePaging::create_table(PageTable *mem, const char *name,
+                                        int cpu) {
+    BuddyAllocator *buddy = zinfo->buddy_allocator;
+    if (!buddy)
+        return new (mem) PageTable(ENTRY_512);
+    Page *page = NULL;
+    if (!numa_tables) {
+        page = buddy->allocate_pages(0);
+    } else if (table_policy == Numa_Interleave) {
+        page = buddy->allocate_pages_on(
+            __sync_fetch_and_add(&interleave_next, 1) % buddy->get_node_num());
+    } else {
+        // tables built outside a fault go to node 0
+        page = buddy->allocate_pages_on(cpu < 0 ? 0 : buddy->home_node(cpu));
+    }
+    if (!page)
+        panic("Cannot allocate a page for %s!", name);
+    PageTable *table = new (mem) PageTable(ENTRY_512, page);
+    if (replicate)
+        add_replicas(table);
+    return table;
+}
+
+void LongModePaging::add_replicas(PageTable *table) {
+    BuddyAllocator *buddy = zinfo->buddy_allocator;
+    unsigned nodes = buddy->get_node_num();
+    Page **replicas = gm_calloc<Page *>(nodes);
+    for (unsigned n = 0; n < nodes; n++) {
+        if (table->page->node_id == n) {
+            replicas[n] = table->page;
+            continue;
+        }
+        replicas[n] = buddy->allocate_pages_on(n);
+        if (!replicas[n])
+            panic("Cannot allocate a replica of a page table on node %u!", n);
+        __sync_fetch_and_add(&replica_frames, 1);
+    }
+    table->replica_num = nodes;
+    table->replicas = replicas;
+}
+
+int LongModePaging::update_latency(int writes) {
+    int latency = zinfo->mem_access_time * writes;
+    if (!replicate)
+        return latency;
+    // the kernel writes the other copies one after another
+    uint64_t copies = zinfo->buddy_allocator->get_node_num() - 1;
+    __sync_fetch_and_add(&replica_writes, writes * copies);
+    return latency + zinfo->mem_access_time * writes * copies;
+}
+
+PageTable *LongModePaging::get_pml4_table(Address addr, int *alloc_time,
+                                          int cpu) {
+    if (!pml5)
+        return pml4;
+    unsigned pml5_id = get_pml5_off(addr);
+    if (!alloc_time || is_present(pml5, pml5_id))
+        return get_next_level_address<PageTable>(pml5, pml5_id);
+    PageTable *table = create_table(
+        gm_memalign<PageTable>(CACHE_LINE_BYTES, 1), "pml4 table", cpu);
+    validate_entry(pml5, pml5_id, table);
+    cur_pml4_num++;
+    (*alloc_time)++;
+    return table;
+}
+
 /*****-----functional interface of LongMode-Paging----*****/
 int LongModePaging::map_page_table(Address addr, Page *pg_ptr) {
-    BasePDTEntry *entry;
+    BasePDTEntry entry;
     return map_page_table(addr, pg_ptr, entry);
 }
 
 int LongModePaging::map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                    bool is_write) {
-    BasePDTEntry *entry;
-    int latency = map_page_table(addr, pg_ptr, entry);
-    if (entry != NULL) {
+    BasePDTEntry entry;
+    int latency = map_page_table(addr, pg_ptr, entry, req_id);
+    if (entry) {
         entry->set_lrequester(req_id);
         entry->set_accessed();
         if (is_write)
@@ -722,8 +810,8 @@ int LongModePaging::map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
 }
 
 int LongModePaging::map_page_table(Address addr, Page *pg_ptr,
-                                   BasePDTEntry *&mapped_entry) {
-    mapped_entry = NULL;
+                                   BasePDTEntry &mapped_entry, int cpu) {
+    mapped_entry = BasePDTEntry();
     int latency = 0;
     // std::cout<<"map:"<<std::hex<<addr<<std::endl;
     unsigned pml4, pdp, pd, pt;
@@ -731,9 +819,12 @@ int LongModePaging::map_page_table(Address addr, Page *pg_ptr,
     assert((pml4 != (unsigned)(-1)) && (pdp != (unsigned)(-1)));
     PageTable *table;
     int alloc_time = 0;
+    int pml4_alloc_time = 0;
+    PageTable *pml4_table = get_pml4_table(addr, &pml4_alloc_time, cpu);
     if (mode == LongMode_Normal) {
         assert((pd != (unsigned)(-1)) && (pt != (unsigned)(-1)));
-        table = allocate_page_table(pml4, pdp, pd, alloc_time);
+        table =
+            allocate_page_table(pml4_table, pml4, pdp, pd, alloc_time, cpu);
         if (!table) {
             // debug_printf("allocate page table for LongMode_Normal failed!");
             panic("allocate page table for LongMode_Normal failed!");
@@ -743,7 +834,8 @@ int LongModePaging::map_page_table(Address addr, Page *pg_ptr,
         assert(is_valid(table, pt));
         mapped_entry = (*table)[pt];
     } else if (mode == LongMode_Middle) {
-        table = allocate_page_directory(pml4, pdp, alloc_time);
+        table =
+            allocate_page_directory(pml4_table, pml4, pdp, alloc_time, cpu);
         if (!table) {
             // debug_printf("allocate page directory for LongMode_Middle
             // failed!");
@@ -754,7 +846,8 @@ int LongModePaging::map_page_table(Address addr, Page *pg_ptr,
         assert(is_valid(table, pd));
         mapped_entry = (*table)[pd];
     } else if (mode == LongMode_Huge) {
-        table = allocate_page_directory_pointer(pml4, alloc_time);
+        table = allocate_page_directory_pointer(pml4_table, pml4, alloc_time,
+                                                cpu);
         if (!table) {
             // debug_printf("allocate page directory pointer for LongMode_Huge
             // failed!");
@@ -765,17 +858,141 @@ int LongModePaging::map_page_table(Address addr, Page *pg_ptr,
         assert(is_valid(table, pdp));
         mapped_entry = (*table)[pdp];
     }
-    latency = zinfo->mem_access_time * (1 + alloc_time);
+    // the leaf and an entry per table allocated
+    latency = update_latency(1 + alloc_time + pml4_alloc_time);
     return latency;
 }
 
+int LongModePaging::map_huge_page(uint32_t req_id, Address addr,
+                                  bool is_write, Page *&head) {
+    if (!thp_fault || !zinfo->buddy_allocator)
+        return -1;
+    unsigned pml4_id, pdp_id, pd_id, pt_id;
+    get_domains(addr, pml4_id, pdp_id, pd_id, pt_id, mode);
+    int alloc_time = 0;
+    int pml4_alloc_time = 0;
+    PageTable *pml4_table = get_pml4_table(addr, &pml4_alloc_time, req_id);
+    PageTable *pd_table = allocate_page_directory(pml4_table, pml4_id, pdp_id,
+                                                  alloc_time, req_id);
+    if (!pd_table)
+        panic("allocate page directory for a huge page failed!");
+    // part of the region is mapped with base pages already
+    if (is_present(pd_table, pd_id))
+        return -1;
+    // placed for the faulting core, like its base pages
+    head =
+        zinfo->buddy_allocator->allocate_pages(0U, HUGE_PAGE_ORDER, req_id);
+    if (!head) {
+        thp_fault_fallback++;
+        return -1;
+    }
+    BasePDTEntry entry = (*pd_table)[pd_id];
+    entry->enable_large_page();
+    entry->validate_page(head);
+    entry->set_lrequester(req_id);
+    entry->set_accessed();
+    if (is_write)
+        entry->set_dirty();
+    huge_pages++;
+    thp_fault_alloc++;
+    return update_latency(1 + alloc_time + pml4_alloc_time);
+}
+
+uint32_t LongModePaging::collapse_huge_pages(uint32_t max_regions,
+                                             uint32_t threshold,
+                                             g_vector<Address> &collapsed) {
+    if (!thp || !zinfo->buddy_allocator)
+        return 0;
+    uint32_t done = 0;
+    bool fragmented = false;
+    lock();
+    table_seq++;
+    __sync_synchronize();
+    unsigned roots = pml5 ? ENTRY_512 : 1;
+    for (unsigned r = 0; r < roots; r++) {
+        PageTable *pml4_table =
+            pml5 ? get_next_level_address<PageTable>(pml5, r) : pml4;
+        if (!pml4_table)
+            continue;
+        for (unsigned i = 0; i < ENTRY_512; i++) {
+            PageTable *pdp_table =
+                get_next_level_address<PageTable>(pml4_table, i);
+            if (!pdp_table)
+                continue;
+            for (unsigned j = 0; j < ENTRY_512; j++) {
+                PageTable *pd_table =
+                    get_next_level_address<PageTable>(pdp_table, j);
+                if (!pd_table)
+                    continue;
+                for (unsigned k = 0; k < ENTRY_512; k++) {
+                    if (!is_present(pd_table, k) ||
+                        (*pd_table)[k]->is_largepage())
+                        continue;
+                    PageTable *pt_table =
+                        get_next_level_address<PageTable>(pd_table, k);
+                    uint32_t accessed = 0;
+                    for (unsigned e = 0; e < ENTRY_512; e++)
+                        if (is_present(pt_table, e) &&
+                            (*pt_table)[e]->is_accessed())
+                            accessed++;
+                    Page *head = NULL;
+                    if (accessed >= threshold && done < max_regions &&
+                        !fragmented) {
+                        head = zinfo->buddy_allocator->allocate_pages(
+                            0U, HUGE_PAGE_ORDER);
+                        if (!head) {
+                            thp_collapse_fallback++;
+                            fragmented = true;
+                        }
+                    }
+                    if (!head) {
+                        // age the region for the next pass
+                        for (unsigned e = 0; e < ENTRY_512; e++)
+                            if (is_present(pt_table, e))
+                                (*pt_table)[e]->set_unaccessed();
+                        continue;
+                    }
+                    // copy the base pages into the huge page and free them
+                    bool dirty = false;
+                    for (unsigned e = 0; e < ENTRY_512; e++) {
+                        if (is_present(pt_table, e) &&
+                            (*pt_table)[e]->is_dirty())
+                            dirty = true;
+                        invalidate_page(pt_table, e);
+                    }
+                    retire_table(pd_table, k);
+                    cur_pt_num--;
+                    BasePDTEntry entry = (*pd_table)[k];
+                    entry->enable_large_page();
+                    entry->validate_page(head);
+                    entry->set_accessed();
+                    if (dirty)
+                        entry->set_dirty();
+                    huge_pages++;
+                    thp_collapse_alloc++;
+                    done++;
+                    collapsed.push_back(
+                        ((((Address)r * ENTRY_512 + i) * ENTRY_512 + j) *
+                             ENTRY_512 +
+                         k)
+                        << HUGE_PAGE_ORDER);
+                }
+            }
+        }
+    }
+    __sync_synchronize();
+    table_seq++;
+    unlock();
+    return done;
+}
+
 inline PageTable *
-LongModePaging::get_tables(unsigned level,
+LongModePaging::get_tables(PageTable *pml4_table, unsigned level,
                            std::vector<unsigned> entry_id_list) {
     assert(level >= 1);
     PageTable *table;
     unsigned i = 0;
-    table = get_next_level_address<PageTable>(pml4, entry_id_list[i]);
+    table = get_next_level_address<PageTable>(pml4_table, entry_id_list[i]);
     level--;
     i++;
     while (level > 0) {
@@ -798,23 +1015,35 @@ bool LongModePaging::unmap_page_table(Address addr) {
     entry_id_vec[1] = pdp_id;
     entry_id_vec[2] = pd_id;
     PageTable *table = NULL;
+    PageTable *pml4_table = get_pml4_table(addr);
+    if (!pml4_table) {
+        debug_printf("didn't find entry indexed with %ld !", addr);
+        return false;
+    }
     // point to page directory pointer table
     if (mode == LongMode_Normal) {
-        table = get_tables(3, entry_id_vec);
+        table = get_tables(pml4_table, 2, entry_id_vec);
+        // unmapping part of a huge page drops all of it, faults map it again
+        if (table && is_present(table, pd_id) &&
+            (*table)[pd_id]->is_largepage()) {
+            remove_huge_page(table, pd_id);
+            return true;
+        }
+        table = get_tables(pml4_table, 3, entry_id_vec);
         if (!table) {
             debug_printf("didn't find entry indexed with %ld !", addr);
             return false;
         }
         invalidate_page(table, pt_id);
     } else if (mode == LongMode_Middle) {
-        table = get_tables(2, entry_id_vec);
+        table = get_tables(pml4_table, 2, entry_id_vec);
         if (!table) {
             debug_printf("didn't find entry indexed with %ld !", addr);
             return false;
         }
         invalidate_page(table, pd_id);
     } else if (mode == LongMode_Huge) {
-        table = get_tables(1, entry_id_vec);
+        table = get_tables(pml4_table, 1, entry_id_vec);
         if (!table) {
             debug_printf("didn't find entry indexed with %ld !", addr);
             return false;
@@ -824,12 +1053,62 @@ bool LongModePaging::unmap_page_table(Address addr) {
     return false;
 }
 
+uint32_t LongModePaging::read_leaf_ptes(Address vpn, Address *ppns,
+                                        uint32_t n, uint32_t &shared_mask,
+                                        uint32_t &dirty_mask) {
+    // only 4KB leaves live n to a page table line
+    if (mode != LongMode_Normal || n > ENTRY_512)
+        return 0;
+    shared_mask = dirty_mask = 0;
+    for (uint32_t i = 0; i < n; i++)
+        ppns[i] = INVALID_PAGE_ADDR;
+    Address first = vpn & ~(Address)(n - 1);
+    unsigned pml4_id, pdp_id, pd_id, pt_id;
+    get_domains(first << zinfo->page_shift, pml4_id, pdp_id, pd_id, pt_id,
+                mode);
+    PageTable *pml4_table = get_pml4_table(first << zinfo->page_shift);
+    if (!pml4_table)
+        return n;
+    PageTable *pdp_ptr = get_next_level_address<PageTable>(pml4_table, pml4_id);
+    if (!pdp_ptr)
+        return n;
+    PageTable *pd_ptr = get_next_level_address<PageTable>(pdp_ptr, pdp_id);
+    if (!pd_ptr)
+        return n;
+    // a huge page has no PTEs to read
+    if (is_present(pd_ptr, pd_id) && (*pd_ptr)[pd_id]->is_largepage())
+        return 0;
+    PageTable *pt_ptr = get_next_level_address<PageTable>(pd_ptr, pd_id);
+    if (!pt_ptr)
+        return n;
+    // the group is aligned, so it never crosses a page table
+    for (uint32_t i = 0; i < n; i++) {
+        BasePDTEntry pte = (*pt_ptr)[pt_id + i];
+        Page *page = (Page *)pte->get_next_level_address();
+        if (!page)
+            continue;
+        ppns[i] = page->pageNo;
+        if (pte->is_shared())
+            shared_mask |= 1 << i;
+        if (pte->is_dirty())
+            dirty_mask |= 1 << i;
+    }
+    return n;
+}
+
 Address LongModePaging::access(MemReq &req) {
     Address addr = req.lineAddr;
     unsigned pml4_id, pdp_id, pd_id, pt_id;
     get_domains(addr, pml4_id, pdp_id, pd_id, pt_id, mode);
+    PageTable *pml4_table = get_pml4_table(addr);
+    if (!pml4_table) {
+        return PAGE_FAULT_SIG;
+    }
+    // the PML5 read of LA57 walks
+    if (pml5)
+        req.cycle += zinfo->mem_access_time;
     // point to page table pointer table
-    PageTable *pdp_ptr = get_next_level_address<PageTable>(pml4, pml4_id);
+    PageTable *pdp_ptr = get_next_level_address<PageTable>(pml4_table, pml4_id);
     if (!pdp_ptr) {
         return PAGE_FAULT_SIG;
     }
@@ -853,11 +1132,16 @@ Address LongModePaging::access(MemReq &req) {
         assert(pd_id != (unsigned)(-1));
         assert(pt_id != (unsigned)(-1));
         // point to page table
+        BasePDTEntry pde = (*(PageTable *)ptr)[pd_id];
         ptr = get_next_level_address<void>((PageTable *)ptr, pd_id);
         req.cycle += (zinfo->mem_access_time * 4);
         if (!ptr) {
             return PAGE_FAULT_SIG;
         }
+        if (thp && pde->is_largepage()) {
+            req.pageShift = zinfo->page_shift + HUGE_PAGE_ORDER;
+            return ((Page *)ptr)->pageNo | (pt_id & (ENTRY_512 - 1));
+        }
         // point to page
         ptr = get_next_level_address<void>((PageTable *)ptr, pt_id);
         if (!ptr) {
@@ -963,118 +1247,124 @@ inline uint64_t LongModePaging::getPGTAddr(uint64_t pageNo, uint32_t entry_id) {
     return pgAddr;
 }
 
+Page *LongModePaging::walk(MemReq &req, Address addr, PageWalkCache *pwc,
+                           g_vector<uint64_t> &pgt_addrs,
+                           BasePDTEntry &leaf_entry, bool sendPTW,
+                           WalkReads *reads) {
+    WalkReads own;
+    if (!reads) {
+        memset(&own, 0, sizeof(own));
+        reads = &own;
+    }
+    // entry of each level, from the PML5 (LA57 only) down to the leaf
+    unsigned ids[PWC_LEVELS + 1];
+    ids[PWC_PML5] = get_pml5_off(addr);
+    get_domains(addr, ids[PWC_PML4], ids[PWC_PDPT], ids[PWC_PD],
+                ids[PWC_LEVELS], mode);
+    unsigned top = pml5 ? PWC_PML5 : PWC_PML4;
+    unsigned leaf = (mode == LongMode_Huge)     ? PWC_PDPT
+                    : (mode == LongMode_Middle) ? PWC_PD
+                                                : PWC_LEVELS;
+    // translation caches hold the upper levels above first
+    unsigned first = top;
+    if (pwc && pwc->skips())
+        req.cycle += pwc->probe(addr, top, leaf, first);
+    // the node of the walking core, whose copy of replicated tables it reads
+    unsigned node =
+        numa_tables ? zinfo->buddy_allocator->home_node(req.srcId) : 0;
+    PageTable *table = pml5 ? pml5 : pml4;
+    void *ptr = NULL;
+    for (unsigned l = top; l <= leaf; l++) {
+        Page *frame = table->get_page(node);
+        Address pgAddr = getPGTAddr(frame->pageNo, ids[l]);
+        bool cached = false;
+        if (pwc && l < leaf) {
+            if (pwc->skips())
+                cached = l < first;
+            else
+                req.cycle += pwc->access((PwcLevel)l, pgAddr >> lineBits,
+                                         cached);
+        }
+        if (!cached) {
+            translate_frame(req, frame, pwc, pgt_addrs, sendPTW);
+            pgt_addrs.push_back(pgAddr);
+            if (sendPTW) {
+                reads->level[l]++;
+                if (numa_tables)
+                    (frame->node_id == node ? reads->local : reads->remote)++;
+            }
+        }
+        BasePDTEntry entry = (*table)[ids[l]];
+        // a transparent huge page ends the walk at its PD entry
+        bool huge = thp && l == PWC_PD && entry->is_largepage();
+        if (l == leaf || huge)
+            leaf_entry = entry;
+        ptr = get_next_level_address<void>(table, ids[l]);
+        if (!ptr)
+            break;
+        if (huge)
+            break;
+        if (pwc && pwc->skips() && l < leaf && !cached)
+            pwc->fill((PwcLevel)l, addr);
+        table = (PageTable *)ptr;
+    }
+    if (reads == &own)
+        count_reads(own);
+    if (!ptr)
+        return NULL;
+    translate_frame(req, (Page *)ptr, pwc, pgt_addrs, sendPTW);
+    return (Page *)ptr;
+}
+
+void LongModePaging::count_reads(const WalkReads &reads) {
+    for (unsigned l = 0; l <= PWC_LEVELS; l++)
+        if (reads.level[l])
+            __sync_fetch_and_add(&level_reads[l], reads.level[l]);
+    if (reads.local)
+        __sync_fetch_and_add(&local_reads, reads.local);
+    if (reads.remote)
+        __sync_fetch_and_add(&remote_reads, reads.remote);
+}
+
 Address LongModePaging::access(MemReq &req, g_vector<MemObject *> &parents,
                                g_vector<uint32_t> &parentRTTs,
-                               BaseCoreRecorder *cRec, bool sendPTW) {
+                               BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                               bool sendPTW) {
     g_vector<uint64_t> pgt_addrs;
-    Address addr = req.lineAddr << lineBits;
-    unsigned pml4_id, pdp_id, pd_id, pt_id;
-    Address pgAddr;
-    uint64_t lineAddr;
-    get_domains(addr, pml4_id, pdp_id, pd_id, pt_id, mode);
-    pgAddr = getPGTAddr(pml4->get_page_no(), pml4_id);
-    lineAddr = pgAddr >> lineBits;
-    MESIState dummyState = MESIState::I;
-    MemReq pwc_req = {lineAddr,    GETS,       req.childId,
-                        &dummyState, req.cycle, req.childLock,
-                        dummyState,  req.srcId,  req.flags};
-    pwc_req.threadId = req.threadId;
-    pwc_req.isPIMInst = req.isPIMInst;
-    // access translation cache
-    if(zinfo->pwc_enable) {
-        // std::cout<<"into PWC group access"<<std::endl;
-        req.cycle += pwc->access(pwc_req, "pwl4");
-        if(!pwc_req.pwc_hit) {
-            pgt_addrs.push_back(pgAddr);
-            pwc->miss_count["pwl4"]++;
-        }
-    }
-    else pgt_addrs.push_back(pgAddr);
-    // point to page table pointer table
-    PageTable *pdp_ptr = get_next_level_address<PageTable>(pml4, pml4_id);
-    BasePDTEntry *pdt_ptr = NULL;
-    if (!pdp_ptr) {
+    BasePDTEntry pdt_ptr;
+    Page *page = NULL;
+    WalkReads reads;
+    // a walk that overlapped a table removal is not charged
+    uint64_t start_cycle = req.cycle;
+    PageWalkCache::StatMark pwc_mark;
+    if (pwc)
+        pwc->mark_stats(pwc_mark);
+retry:
+    // walks may overlap a table removal when they run unlocked; wait for
+    // one under way rather than walk tables that are going away
+    uint64_t seq;
+    while ((seq = table_seq) & 1)
+        _mm_pause();
+    __sync_synchronize();
+    pgt_addrs.clear();
+    memset(&reads, 0, sizeof(reads));
+    req.pageShift = zinfo->page_shift;
+    page = walk(req, req.lineAddr << lineBits, pwc, pgt_addrs, pdt_ptr,
+                sendPTW, &reads);
+    __sync_synchronize();
+    if (seq != table_seq) {
+        __sync_fetch_and_add(&walk_retries, 1);
+        req.cycle = start_cycle;
+        if (pwc)
+            pwc->rewind_stats(pwc_mark);
+        goto retry;
+    }
+    count_reads(reads);
+    if (!page) {
         req.cycle =
             loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
         return PAGE_FAULT_SIG;
     }
-    if (mode == LongMode_Huge) {
-        pt_id = pdp_id;
-        pdt_ptr = (*(PageTable *)pdp_ptr)[pdp_id];
-    }
-    // point to page or page directory
-    void *ptr = get_next_level_address<void>(pdp_ptr, pdp_id);
-    if (!ptr) {
-        req.cycle =
-            loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
-        return PAGE_FAULT_SIG;
-    }
-    if (mode == LongMode_Middle) {
-        assert(pd_id != (unsigned)(-1));
-        pgAddr = getPGTAddr(pdp_ptr->get_page_no(), pd_id);
-        lineAddr = pgAddr >> lineBits;
-        pwc_req.lineAddr = lineAddr;
-        pwc_req.pwc_hit = false;
-        if(zinfo->pwc_enable) {
-            req.cycle += pwc->access(pwc_req, "pwl3");
-            if(!pwc_req.pwc_hit) {
-                pgt_addrs.push_back(pgAddr);
-                pwc->miss_count["pwl3"]++;
-            }
-        }
-        else pgt_addrs.push_back(pgAddr);
-        // point to page
-        pdt_ptr = (*(PageTable *)ptr)[pd_id];
-        ptr = get_next_level_address<void>((PageTable *)ptr, pd_id);
-        if (!ptr) {
-            req.cycle =
-                loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
-            return PAGE_FAULT_SIG;
-        }
-        pt_id = pd_id;
-    } else if (mode == LongMode_Normal) {
-        assert(pd_id != (unsigned)(-1));
-        assert(pt_id != (unsigned)(-1));
-        pgAddr = getPGTAddr(pdp_ptr->get_page_no(), pd_id);
-        lineAddr = pgAddr >> lineBits;
-        pwc_req.lineAddr = lineAddr;
-        pwc_req.pwc_hit = false;
-        if(zinfo->pwc_enable) {
-            req.cycle += pwc->access(pwc_req, "pwl3");
-            if(!pwc_req.pwc_hit) {
-                pgt_addrs.push_back(pgAddr);
-                pwc->miss_count["pwl3"]++;
-            }
-        }
-        else pgt_addrs.push_back(pgAddr);
-        ptr = get_next_level_address<void>((PageTable *)ptr, pd_id);
-        if (!ptr) {
-            req.cycle =
-                loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
-            return PAGE_FAULT_SIG;
-        }
-        pgAddr = getPGTAddr(((PageTable *)ptr)->get_page_no(), pt_id);
-        lineAddr = pgAddr >> lineBits;
-        pwc_req.lineAddr = lineAddr;
-        pwc_req.pwc_hit = false;
-        if(zinfo->pwc_enable) {
-            req.cycle += pwc->access(pwc_req, "pwl2");
-            if(!pwc_req.pwc_hit) {
-                pgt_addrs.push_back(pgAddr);
-                pwc->miss_count["pwl2"]++;
-            }
-        }
-        else pgt_addrs.push_back(pgAddr);
-        // point to page
-        pdt_ptr = (*(PageTable *)ptr)[pt_id];
-        ptr = get_next_level_address<void>((PageTable *)ptr, pt_id);
-        if (!ptr) {
-            req.cycle =
-                loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
-            return PAGE_FAULT_SIG;
-        }
-    }
-
     // update page table flags
     pdt_ptr->set_lrequester(req.srcId, req.triggerPageShared);
     pdt_ptr->set_accessed();
@@ -1083,7 +1373,7 @@ Address LongModePaging::access(MemReq &req, g_vector<MemObject *> &parents,
             req.triggerPageDirty = true;
         pdt_ptr->set_dirty();
     }
-    if (req.triggerPageShared && pdt_ptr->remapped_times)
+    if (req.triggerPageShared && pdt_ptr->get_remapped_times())
         error_migrated_pages++;
     req.pageDirty = pdt_ptr->is_dirty();
     req.pageShared = pdt_ptr->is_shared();
@@ -1097,42 +1387,43 @@ Address LongModePaging::access(MemReq &req, g_vector<MemObject *> &parents,
     }
     return get_block_id(req,ptr, write_back ,access_counter); */
     req.cycle = loadPageTables(req, pgt_addrs, parents, parentRTTs, sendPTW);
-    return ((Page *)ptr)->pageNo;
+    if (thp && pdt_ptr->is_largepage()) {
+        // the base page inside the huge page, as the TLBs expect
+        req.pageShift = zinfo->page_shift + HUGE_PAGE_ORDER;
+        Address vpn = req.lineAddr >> (zinfo->page_shift - lineBits);
+        return page->pageNo | (vpn & (ENTRY_512 - 1));
+    }
+    return page->pageNo;
 }
 
 // allocate
 PageTable *
-LongModePaging::allocate_page_directory_pointer(unsigned pml4_entry_id,
-                                                int &allocate_time) {
+LongModePaging::allocate_page_directory_pointer(PageTable *pml4_table,
+                                                unsigned pml4_entry_id,
+                                                int &allocate_time, int cpu) {
     // allocate_time = 0;
-    assert(pml4_entry_id < 512 && cur_pdp_num < ENTRY_512);
-    if (!is_present(pml4, pml4_entry_id)) {
-        PageTable *table_tmp = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
-        PageTable *table = NULL;
-        if (zinfo->buddy_allocator) {
-            Page *page = zinfo->buddy_allocator->allocate_pages(0);
-            if (page)
-                table = new (table_tmp) PageTable(ENTRY_512, page);
-            else
-                panic("Cannot allocate a page for page directory!");
-        } else {
-            table = new (table_tmp) PageTable(ENTRY_512);
-        }
-        validate_entry(pml4, pml4_entry_id, table);
+    assert(pml4_entry_id < 512);
+    if (!is_present(pml4_table, pml4_entry_id)) {
+        PageTable *table =
+            create_table(gm_memalign<PageTable>(CACHE_LINE_BYTES, 1),
+                         "page directory", cpu);
+        validate_entry(pml4_table, pml4_entry_id, table);
         allocate_time++;
         cur_pdp_num++;
         return table;
     }
     PageTable *pg_dir_p =
-        get_next_level_address<PageTable>(pml4, pml4_entry_id);
+        get_next_level_address<PageTable>(pml4_table, pml4_entry_id);
     return pg_dir_p;
 }
 
-bool LongModePaging::allocate_page_directory_pointer(entry_list pml4_entry) {
+bool LongModePaging::allocate_page_directory_pointer(PageTable *pml4_table,
+                                                     entry_list pml4_entry) {
     bool succeed = true;
     int allocate_time;
     for (entry_list_ptr it = pml4_entry.begin(); it != pml4_entry.end(); it++) {
-        if (allocate_page_directory_pointer(*it, allocate_time) == NULL) {
+        if (allocate_page_directory_pointer(pml4_table, *it, allocate_time) ==
+            NULL) {
             succeed = false;
             debug_printf("allocate page directory pointer for entry %d of pml4 "
                          "table failed",
@@ -1142,13 +1433,14 @@ bool LongModePaging::allocate_page_directory_pointer(entry_list pml4_entry) {
     return succeed;
 }
 
-bool LongModePaging::allocate_page_directory(pair_list high_level_entry) {
+bool LongModePaging::allocate_page_directory(PageTable *pml4_table,
+                                             pair_list high_level_entry) {
     bool succeed = true;
     int allocate_time;
     for (pair_list_ptr it = high_level_entry.begin();
          it != high_level_entry.end(); it++) {
-        if (allocate_page_directory((*it).first, (*it).second, allocate_time) ==
-            NULL) {
+        if (allocate_page_directory(pml4_table, (*it).first, (*it).second,
+                                    allocate_time) == NULL) {
             debug_printf("allocate (pml4_entry_id , page directory pointer "
                          "entry id)---(%d,%d) failed",
                          (*it).first, (*it).second);
@@ -1158,24 +1450,18 @@ bool LongModePaging::allocate_page_directory(pair_list high_level_entry) {
     return succeed;
 }
 
-PageTable *LongModePaging::allocate_page_directory(unsigned pml4_entry_id,
+PageTable *LongModePaging::allocate_page_directory(PageTable *pml4_table,
+                                                   unsigned pml4_entry_id,
                                                    unsigned pdpt_entry_id,
-                                                   int &allocate_time) {
+                                                   int &allocate_time,
+                                                   int cpu) {
     PageTable *pdp_table =
-        get_next_level_address<PageTable>(pml4, pml4_entry_id);
+        get_next_level_address<PageTable>(pml4_table, pml4_entry_id);
     if (pdp_table) {
         if (!is_present(pdp_table, pdpt_entry_id)) {
-            PageTable *table_tmp = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
-            PageTable *pd_table = NULL;
-            if (zinfo->buddy_allocator) {
-                Page *page = zinfo->buddy_allocator->allocate_pages(0);
-                if (page)
-                    pd_table = new (table_tmp) PageTable(ENTRY_512, page);
-                else
-                    panic("Cannot allocate a page for page directory!");
-            } else {
-                pd_table = new (table_tmp) PageTable(ENTRY_512);
-            }
+            PageTable *pd_table =
+                create_table(gm_memalign<PageTable>(CACHE_LINE_BYTES, 1),
+                             "page directory", cpu);
             validate_entry(pdp_table, pdpt_entry_id, pd_table);
             cur_pd_num++;
             allocate_time++;
@@ -1186,20 +1472,13 @@ PageTable *LongModePaging::allocate_page_directory(unsigned pml4_entry_id,
             return table;
         }
     } else {
-        if (allocate_page_directory_pointer(pml4_entry_id, allocate_time)) {
+        if (allocate_page_directory_pointer(pml4_table, pml4_entry_id,
+                                            allocate_time, cpu)) {
             PageTable *pdpt_table =
-                get_next_level_address<PageTable>(pml4, pml4_entry_id);
-            PageTable *table_tmp = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
-            PageTable *pd_table = NULL;
-            if (zinfo->buddy_allocator) {
-                Page *page = zinfo->buddy_allocator->allocate_pages(0);
-                if (page)
-                    pd_table = new (table_tmp) PageTable(ENTRY_512, page);
-                else
-                    panic("Cannot allocate a page for page directory!");
-            } else {
-                pd_table = new (table_tmp) PageTable(ENTRY_512);
-            }
+                get_next_level_address<PageTable>(pml4_table, pml4_entry_id);
+            PageTable *pd_table =
+                create_table(gm_memalign<PageTable>(CACHE_LINE_BYTES, 1),
+                             "page directory", cpu);
             validate_entry(pdpt_table, pdpt_entry_id, pd_table);
             allocate_time++;
             cur_pd_num++;
@@ -1209,25 +1488,28 @@ PageTable *LongModePaging::allocate_page_directory(unsigned pml4_entry_id,
     return NULL;
 }
 
-bool LongModePaging::allocate_page_table(triple_list high_level_entry) {
+bool LongModePaging::allocate_page_table(PageTable *pml4_table,
+                                         triple_list high_level_entry) {
     bool succeed = true;
     int time;
     for (triple_list_ptr it = high_level_entry.begin();
          it != high_level_entry.end(); it++) {
-        if (!allocate_page_table((*it).first, (*it).second, (*it).third, time))
+        if (!allocate_page_table(pml4_table, (*it).first, (*it).second,
+                                 (*it).third, time))
             succeed = false;
     }
     return succeed;
 }
 
-PageTable *LongModePaging::allocate_page_table(unsigned pml4_entry_id,
+PageTable *LongModePaging::allocate_page_table(PageTable *pml4_table,
+                                               unsigned pml4_entry_id,
                                                unsigned pdpt_entry_id,
                                                unsigned pdt_entry_id,
-                                               int &alloc_time) {
+                                               int &alloc_time, int cpu) {
     alloc_time = 0;
     assert(mode == LongMode_Normal);
     PageTable *pdp_table =
-        get_next_level_address<PageTable>(pml4, pml4_entry_id);
+        get_next_level_address<PageTable>(pml4_table, pml4_entry_id);
     if (pdp_table) {
         PageTable *pd_table =
             get_next_level_address<PageTable>(pdp_table, pdpt_entry_id);
@@ -1237,18 +1519,9 @@ PageTable *LongModePaging::allocate_page_table(unsigned pml4_entry_id,
                     get_next_level_address<PageTable>(pd_table, pdt_entry_id);
                 return table;
             } else {
-                PageTable *table_tmp =
-                    gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
-                PageTable *table = NULL;
-                if (zinfo->buddy_allocator) {
-                    Page *page = zinfo->buddy_allocator->allocate_pages(0);
-                    if (page)
-                        table = new (table_tmp) PageTable(ENTRY_512, page);
-                    else
-                        panic("Cannot allocate a page for page table!");
-                } else {
-                    table = new (table_tmp) PageTable(ENTRY_512);
-                }
+                PageTable *table =
+                    create_table(gm_memalign<PageTable>(CACHE_LINE_BYTES, 1),
+                                 "page table", cpu);
                 validate_entry(pd_table, pdt_entry_id, table);
                 cur_pt_num++;
                 alloc_time++;
@@ -1257,22 +1530,14 @@ PageTable *LongModePaging::allocate_page_table(unsigned pml4_entry_id,
         }
         // page_direcory doesn't exist allocate
         else {
-            if (allocate_page_directory(pml4_entry_id, pdpt_entry_id,
-                                        alloc_time)) {
+            if (allocate_page_directory(pml4_table, pml4_entry_id,
+                                        pdpt_entry_id, alloc_time, cpu)) {
                 // get page directory
                 PageTable *page_dir =
                     get_next_level_address<PageTable>(pdp_table, pdpt_entry_id);
-                PageTable *table = gm_memalign<PageTable>(CACHE_LINE_BYTES, 1);
-                PageTable *pg_table = NULL;
-                if (zinfo->buddy_allocator) {
-                    Page *page = zinfo->buddy_allocator->allocate_pages(0);
-                    if (page)
-                        pg_table = new (table) PageTable(ENTRY_512, page);
-                    else
-                        panic("Cannot allocate a page for page table!");
-                } else {
-                    pg_table = new (table) PageTable(ENTRY_512);
-                }
+                PageTable *pg_table =
+                    create_table(gm_memalign<PageTable>(CACHE_LINE_BYTES, 1),
+                                 "page table", cpu);
                 validate_entry(page_dir, pdt_entry_id, pg_table);
                 cur_pt_num++;
                 alloc_time++;
@@ -1281,35 +1546,10 @@ PageTable *LongModePaging::allocate_page_table(unsigned pml4_entry_id,
         }
     } else {
         PageTable *g_tables = gm_memalign<PageTable>(CACHE_LINE_BYTES, 3);
-        PageTable *pdp_table = NULL;
-        PageTable *pd_table = NULL;
-        PageTable *pg_table = NULL;
-        if (zinfo->buddy_allocator) {
-            Page *page1 = zinfo->buddy_allocator->allocate_pages(0);
-            if (page1) {
-                pdp_table = new (&g_tables[0]) PageTable(ENTRY_512, page1);
-                Page *page2 = zinfo->buddy_allocator->allocate_pages(0);
-                if (page2) {
-                    pd_table = new (&g_tables[1]) PageTable(ENTRY_512, page2);
-                    Page *page3 = zinfo->buddy_allocator->allocate_pages(0);
-                    if (page3) {
-                        pg_table =
-                            new (&g_tables[2]) PageTable(ENTRY_512, page3);
-                    } else {
-                        panic("Cannot allocate a page for page table!");
-                    }
-                } else {
-                    panic("Cannot allocate a page for page table!");
-                }
-            } else {
-                panic("Cannot allocate a page for page table!");
-            }
-        } else {
-            pdp_table = new (&g_tables[0]) PageTable(ENTRY_512);
-            pd_table = new (&g_tables[1]) PageTable(ENTRY_512);
-            pg_table = new (&g_tables[2]) PageTable(ENTRY_512);
-        }
-        validate_entry(pml4, pml4_entry_id, pdp_table);
+        PageTable *pdp_table = create_table(&g_tables[0], "page table", cpu);
+        PageTable *pd_table = create_table(&g_tables[1], "page table", cpu);
+        PageTable *pg_table = create_table(&g_tables[2], "page table", cpu);
+        validate_entry(pml4_table, pml4_entry_id, pdp_table);
         cur_pdp_num++;
         validate_entry(pdp_table, pdpt_entry_id, pd_table);
         cur_pd_num++;
@@ -1332,103 +1572,161 @@ bool LongModePaging::allocate_page_table(Address addr, Address size) {
     unsigned pdp_entry = get_page_directory_pointer_off(addr, mode);
     unsigned pd_entry = get_page_directory_off(addr, mode);
     unsigned page_table_num = (size + 0x1fffff) >> 21;
-    int time;
+    int time = 0;
+    PageTable *pml4_table = get_pml4_table(addr, &time);
     for (unsigned i = 0; i < page_table_num; i++) {
-        if (allocate_page_table(pml4_entry, pdp_entry, pd_entry + i, time) ==
-            NULL)
+        if (allocate_page_table(pml4_table, pml4_entry, pdp_entry,
+                                pd_entry + i, time) == NULL)
             succeed = false;
     }
     return succeed;
 }
 
 // remove
+void LongModePaging::retire_table(PageTable *table, unsigned entry_id) {
+    PageTable *retired = get_next_level_address<PageTable>(table, entry_id);
+    ((*table)[entry_id])->invalidate_page_table<PageTable>(false);
+    retired_tables.push_back(retired);
+}
+
+void LongModePaging::free_table(PageTable *table) {
+    if (table && table->replicas)
+        __sync_fetch_and_sub(&replica_frames, table->replica_num - 1);
+    delete table;
+}
+
+void LongModePaging::remove_huge_page(PageTable *pd_table,
+                                      unsigned pd_entry_id) {
+    Page *head = get_next_level_address<Page>(pd_table, pd_entry_id);
+    for (unsigned i = 1; i < ENTRY_512; i++)
+        zinfo->buddy_allocator->free_one_page(head->pageNo + i);
+    invalidate_page(pd_table, pd_entry_id);
+    huge_pages--;
+}
+
+void LongModePaging::remove_pml4_table(PageTable *pml4_table) {
+    for (unsigned i = 0; i < ENTRY_512; i++) {
+        if (is_present(pml4_table, i)) {
+            remove_page_directory_pointer(pml4_table, i);
+        }
+    }
+}
+
 void LongModePaging::remove_root_directory() {
-    if (pml4) {
-        for (unsigned i = 0; i < ENTRY_512; i++) {
-            if (is_present(pml4, i)) {
-                remove_page_directory_pointer(i);
+    if (pml4 || pml5) {
+        table_seq++;
+        __sync_synchronize();
+        if (pml5) {
+            for (unsigned i = 0; i < ENTRY_512; i++) {
+                if (is_present(pml5, i)) {
+                    remove_pml4_table(
+                        get_next_level_address<PageTable>(pml5, i));
+                    retire_table(pml5, i);
+                    cur_pml4_num--;
+                }
             }
+        } else {
+            remove_pml4_table(pml4);
         }
-        delete pml4;
-        pml4 = NULL;
+        // no walk can be running once the root goes away
+        for (PageTable *table : retired_tables)
+            free_table(table);
+        retired_tables.clear();
+        free_table(pml4);
+        free_table(pml5);
+        pml4 = pml5 = NULL;
+        __sync_synchronize();
+        table_seq++;
     }
 }
 
-bool LongModePaging::remove_page_directory_pointer(unsigned pml4_entry_id) {
+bool LongModePaging::remove_page_directory_pointer(PageTable *pml4_table,
+                                                   unsigned pml4_entry_id) {
     bool succeed = true;
     PageTable *pdp_table =
-        get_next_level_address<PageTable>(pml4, pml4_entry_id);
+        get_next_level_address<PageTable>(pml4_table, pml4_entry_id);
     if (pdp_table) {
         if (mode != LongMode_Huge) {
             for (unsigned i = 0; i < ENTRY_512; i++) {
                 if (is_present(pdp_table, i)) {
-                    if (remove_page_directory(pml4_entry_id, i) == false)
+                    if (remove_page_directory(pml4_table, pml4_entry_id, i) ==
+                        false)
                         succeed = false;
                 }
             }
         }
-        invalidate_entry<PageTable>(pml4, pml4_entry_id);
+        retire_table(pml4_table, pml4_entry_id);
         cur_pdp_num--;
     }
     return succeed;
 }
 
-bool LongModePaging::remove_page_directory_pointer(entry_list pml4_entry) {
+bool LongModePaging::remove_page_directory_pointer(PageTable *pml4_table,
+                                                   entry_list pml4_entry) {
     bool succeed = true;
     for (entry_list_ptr it = pml4_entry.begin(); it != pml4_entry.end(); it++) {
-        if (remove_page_directory_pointer(*it))
+        if (remove_page_directory_pointer(pml4_table, *it))
             succeed = false;
     }
     return succeed;
 }
 
-bool LongModePaging::remove_page_directory(unsigned pml4_entry_id,
+bool LongModePaging::remove_page_directory(PageTable *pml4_table,
+                                           unsigned pml4_entry_id,
                                            unsigned pdp_entry_id) {
     assert(mode != LongMode_Huge && pml4_entry_id < 512 && pdp_entry_id < 512);
     PageTable *pdp_table = NULL;
-    if ((pdp_table = get_next_level_address<PageTable>(pml4, pml4_entry_id))) {
+    if ((pdp_table =
+             get_next_level_address<PageTable>(pml4_table, pml4_entry_id))) {
         PageTable *pd_table = NULL;
         if ((pd_table =
                  get_next_level_address<PageTable>(pdp_table, pdp_entry_id))) {
             if (mode == LongMode_Normal) {
                 for (unsigned i = 0; i < ENTRY_512; i++)
                     if (is_present(pd_table, i))
-                        remove_page_table(pml4_entry_id, pdp_entry_id, i);
+                        remove_page_table(pml4_table, pml4_entry_id,
+                                          pdp_entry_id, i);
             }
-            invalidate_entry<PageTable>(pdp_table, pdp_entry_id);
+            retire_table(pdp_table, pdp_entry_id);
             cur_pd_num--;
         }
     }
     return true;
 }
 
-bool LongModePaging::remove_page_directory(pair_list high_level_entry) {
+bool LongModePaging::remove_page_directory(PageTable *pml4_table,
+                                           pair_list high_level_entry) {
     for (pair_list_ptr it = high_level_entry.begin();
          it != high_level_entry.end(); it++) {
-        remove_page_directory((*it).first, (*it).second);
+        remove_page_directory(pml4_table, (*it).first, (*it).second);
     }
     return true;
 }
 
-bool LongModePaging::remove_page_table(unsigned pml4_entry_id,
+bool LongModePaging::remove_page_table(PageTable *pml4_table,
+                                       unsigned pml4_entry_id,
                                        unsigned pdp_entry_id,
                                        unsigned pd_entry_id) {
     assert(mode == LongMode_Normal);
     PageTable *pdp_table = NULL;
-    if ((pdp_table = get_next_level_address<PageTable>(pml4, pml4_entry_id))) {
+    if ((pdp_table =
+             get_next_level_address<PageTable>(pml4_table, pml4_entry_id))) {
         PageTable *pd_table = NULL;
         if ((pd_table =
                  get_next_level_address<PageTable>(pdp_table, pdp_entry_id))) {
             PageTable *pg_table = NULL;
-            if ((pg_table = get_next_level_address<PageTable>(pd_table,
-                                                              pd_entry_id))) {
+            if (is_present(pd_table, pd_entry_id) &&
+                (*pd_table)[pd_entry_id]->is_largepage()) {
+                remove_huge_page(pd_table, pd_entry_id);
+            } else if ((pg_table = get_next_level_address<PageTable>(
+                            pd_table, pd_entry_id))) {
                 if (mode == LongMode_Normal) {
                     for (unsigned i = 0; i < ENTRY_512;
                          i++) // also reclaim the pages pointed by entries of
                               // the page table
                         invalidate_page(pg_table, i);
                 }
-                invalidate_entry<PageTable>(pd_table, pd_entry_id);
+                retire_table(pd_table, pd_entry_id);
                 cur_pt_num--;
             }
         }
@@ -1445,15 +1743,23 @@ bool LongModePaging::remove_page_table(Address addr, Address size) {
     unsigned pml4_entry, pdp_entry, pd_entry, pt_entry;
     get_domains(addr, pml4_entry, pdp_entry, pd_entry, pt_entry, mode);
     unsigned page_table_num = (size + 0x1fffff) >> 21;
+    PageTable *pml4_table = get_pml4_table(addr);
+    if (!pml4_table)
+        return true;
+    table_seq++;
+    __sync_synchronize();
     for (unsigned i = 0; i < page_table_num; i++)
-        remove_page_table(pml4_entry, pdp_entry, pd_entry + i);
+        remove_page_table(pml4_table, pml4_entry, pdp_entry, pd_entry + i);
+    __sync_synchronize();
+    table_seq++;
     return true;
 }
 
-bool LongModePaging::remove_page_table(triple_list high_level_entry) {
+bool LongModePaging::remove_page_table(PageTable *pml4_table,
+                                       triple_list high_level_entry) {
     for (triple_list_ptr it = high_level_entry.begin();
          it != high_level_entry.end(); it++)
-        remove_page_table((*it).first, (*it).second, (*it).third);
+        remove_page_table(pml4_table, (*it).first, (*it).second, (*it).third);
     return true;
 }
 
@@ -1465,8 +1771,80 @@ PageTable::~PageTable() {
     // reclaim the page assigned to this page table
     if (page)
         zinfo->buddy_allocator->free_one_page(page->pageNo);
-    for (unsigned i = 0; i < map_count; i++) {
-        delete entry_array[i];
+    if (replicas) {
+        for (unsigned i = 0; i < replica_num; i++)
+            if (replicas[i] != page)
+                zinfo->buddy_allocator->free_one_page(replicas[i]->pageNo);
+        gm_free(replicas);
+    }
+    free_ptes(ptes, map_count);
+    gm_free(requesters);
+    gm_free(remaps);
+    if (vpns)
+        gm_free(vpns);
+}
+
+void PageTable::init(uint64_t size, Page *_page) {
+    assert(size > 0);
+    map_count = size;
+    cur_pte_num = 0;
+    page = _page;
+    replicas = NULL;
+    replica_num = 0;
+    ptes = alloc_ptes(size);
+    requesters = gm_memalign<uint32_t>(CACHE_LINE_BYTES, size);
+    remaps = gm_memalign<uint16_t>(CACHE_LINE_BYTES, size);
+    vpns = NULL;
+    // all pages can be read and written, and accessed in user mode
+    for (uint64_t i = 0; i < size; i++) {
+        ptes[i] = (uint64_t)(RW | PERMISSION) << PTE_FLAG_SHIFT;
+        requesters[i] = -1;
+        remaps[i] = 0;
     }
-    entry_array.clear();
-}
\ No newline at end of file
+}
+
+volatile uint64_t *PageTable::alloc_ptes(uint64_t size) {
+    if (size == ENTRY_512 && zinfo->pte_arena)
+        return zinfo->pte_arena->alloc();
+    return gm_memalign<uint64_t>(CACHE_LINE_BYTES, size);
+}
+
+void PageTable::free_ptes(volatile uint64_t *block, uint64_t size) {
+    if (size == ENTRY_512 && zinfo->pte_arena)
+        zinfo->pte_arena->free(block);
+    else
+        gm_free((void *)block);
+}
+
+PteArena::PteArena()
+    : free_list(NULL), slab_cur(NULL), slab_end(NULL), slabs(0),
+      blocks_in_use(0) {
+    futex_init(&arena_lock);
+}
+
+volatile uint64_t *PteArena::alloc() {
+    futex_lock(&arena_lock);
+    volatile uint64_t *block = free_list;
+    if (block) {
+        free_list = (volatile uint64_t *)block[0];
+    } else {
+        if (slab_cur == slab_end) {
+            slab_cur = gm_memalign<char>(BLOCK_BYTES, SLAB_BYTES);
+            slab_end = slab_cur + SLAB_BYTES;
+            slabs++;
+        }
+        block = (volatile uint64_t *)slab_cur;
+        slab_cur += BLOCK_BYTES;
+    }
+    blocks_in_use++;
+    futex_unlock(&arena_lock);
+    return block;
+}
+
+void PteArena::free(volatile uint64_t *block) {
+    futex_lock(&arena_lock);
+    block[0] = (uint64_t)free_list;
+    free_list = block;
+    blocks_in_use--;
+    futex_unlock(&arena_lock);
+}
@@ -30,7 +30,7 @@ class NormalPaging : public BasePaging {
     NormalPaging(PagingStyle select);
     ~NormalPaging();
 
-    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry *&mapped_entry);
+    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry &mapped_entry);
     virtual int map_page_table(Address addr, Page *pg_ptr);
     virtual int map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                bool is_write) {
@@ -41,7 +41,8 @@ class NormalPaging : public BasePaging {
     virtual Address access(MemReq &req);
     virtual Address access(MemReq &req, g_vector<MemObject *> &parents,
                            g_vector<uint32_t> &parentRTTs,
-                           BaseCoreRecorder *cRec, bool sendPTW) {
+                           BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                           bool sendPTW) {
         return access(req);
     }
     virtual void remove_root_directory();
@@ -96,10 +97,11 @@ class PAEPaging : public BasePaging {
     virtual Address access(MemReq &req);
     virtual Address access(MemReq &req, g_vector<MemObject *> &parents,
                            g_vector<uint32_t> &parentRTTs,
-                           BaseCoreRecorder *cRec, bool sendPTW) {
+                           BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                           bool sendPTW) {
         return access(req);
     }
-    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry *&mapped_entry);
+    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry &mapped_entry);
     virtual int map_page_table(Address addr, Page *pg_ptr);
     virtual int map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                bool is_write) {
@@ -169,40 +171,91 @@ class PAEPaging : public BasePaging {
 };
 
 /*#----LongMode-Paging(supports 4KB&&2MB&&1GB)---#*/
-class PWCache;
 class LongModePaging : public BasePaging {
   public:
     LongModePaging(PagingStyle selection);
     ~LongModePaging();
-    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry *&mapped_entry);
+    // cpu: the faulting core the new tables are placed for, -1 if none
+    int map_page_table(Address addr, Page *pg_ptr, BasePDTEntry &mapped_entry,
+                       int cpu = -1);
     virtual int map_page_table(Address addr, Page *pg_ptr);
     virtual int map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                bool is_write);
+    virtual int map_huge_page(uint32_t req_id, Address addr, bool is_write,
+                              Page *&head);
     virtual bool unmap_page_table(Address addr);
     // access
     virtual Address access(MemReq &req);
     virtual Address access(MemReq &req, g_vector<MemObject *> &parents,
                            g_vector<uint32_t> &parentRTTs,
-                           BaseCoreRecorder *cRec, bool sendPTW);
+                           BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                           bool sendPTW);
     virtual bool allocate_page_table(Address addr, Address size);
     virtual void remove_root_directory();
     virtual bool remove_page_table(Address addr, Address size);
+    virtual uint32_t read_leaf_ptes(Address vpn, Address *ppns, uint32_t n,
+                                    uint32_t &shared_mask,
+                                    uint32_t &dirty_mask);
     
-    virtual PagingStyle get_paging_style() { return mode; }
-    virtual void setPTW(BasePageTableWalker* _ptw) {ptw = _ptw; pwc = ptw->Getpwc();}
+    virtual PagingStyle get_paging_style() { return style; }
+    virtual void setPTW(BasePageTableWalker* _ptw) {ptw = _ptw;}
      
+    // 4, or 5 with a PML5 root (LA57)
+    unsigned get_levels() { return levels; }
+
+    /*
+     * Transparent huge pages (4KB paging only): faults map a whole aligned
+     * 2MB region with a PS-bit PD entry when its page table does not exist
+     * yet and an order-9 block is free, and collapse_huge_pages() promotes
+     * the hot 4KB regions later, like khugepaged. Other regions keep 4KB
+     * pages, so one page table mixes both sizes.
+     *@param on_fault: false leaves huge pages to collapse_huge_pages()
+     */
+    void enable_thp(bool on_fault) {
+        assert(mode == LongMode_Normal);
+        thp = true;
+        thp_fault = on_fault;
+    }
+    bool thp_enabled() { return thp; }
+
+    /*
+     * NUMA placement of the page tables (sys.numa.pgtPolicy): the frames of
+     * new tables come from the node of the faulting core (Numa_Local) or
+     * round robin over the nodes (Numa_Interleave). With replicas, every
+     * table also has a copy on each other node, like Mitosis: walks read the
+     * copy on the node of their core, and faults write the entries they set
+     * to all the copies. Accessed and dirty bits stay in the table itself,
+     * Mitosis ORs them over the copies when the OS reads them.
+     */
+    void place_tables(NumaPolicy policy, bool replicas);
+
+    /*
+     *@function: collapse the page tables with at least threshold accessed
+     *PTEs into huge pages, at most max_regions of them, and clear the
+     *accessed bits of the others so the next pass sees recent accesses only.
+     *The pass stops collapsing when no order-9 block is free
+     *@param collapsed: the first VPN of each region collapsed, the TLBs still
+     *hold its base pages
+     *@return: regions collapsed
+     */
+    uint32_t collapse_huge_pages(uint32_t max_regions, uint32_t threshold,
+                                 g_vector<Address> &collapsed);
+
     unsigned get_page_table_num() { return cur_pt_num; }
 
     unsigned get_page_directory_num() { return cur_pd_num; }
 
     unsigned get_page_directory_pointer_num() { return cur_pdp_num; }
 
-    virtual PageTable *get_root_directory() { return pml4; }
+    virtual PageTable *get_root_directory() { return pml5 ? pml5 : pml4; }
 
     virtual void calculate_stats() {
-        long unsigned overhead =
-            (long unsigned)(cur_pt_num + cur_pd_num + cur_pdp_num) * PAGE_SIZE;
+        long unsigned overhead = (long unsigned)(cur_pt_num + cur_pd_num +
+                                                 cur_pdp_num + cur_pml4_num) *
+                                 PAGE_SIZE;
         info("Error migrated pages:%d", error_migrated_pages);
+        if (pml5)
+            info("pml4 table number:%lu", cur_pml4_num);
         info("page directory pointer number:%d", cur_pdp_num);
         info("page directory number:%d", cur_pd_num);
         info("page table number:%d", cur_pt_num);
@@ -210,43 +263,157 @@ class LongModePaging : public BasePaging {
              (double)overhead / (double)(1024 * 1024));
     }
     virtual void calculate_stats(std::ofstream &vmof) {
-        long unsigned overhead =
-            (long unsigned)(cur_pt_num + cur_pd_num + cur_pdp_num) * PAGE_SIZE;
+        long unsigned overhead = (long unsigned)(cur_pt_num + cur_pd_num +
+                                                 cur_pdp_num + cur_pml4_num) *
+                                 PAGE_SIZE;
+        static const char *level_names[PWC_LEVELS + 1] = {"PML5", "PML4",
+                                                          "PDPT", "PD", "PT"};
         vmof << "Error migrated pages:" << error_migrated_pages << std::endl;
+        vmof << "walks retried after a table removal:" << walk_retries
+             << std::endl;
+        // reads that missed the PWCs and went to the memory hierarchy
+        vmof << levels << "-level walk reads by level:";
+        for (unsigned l = pml5 ? PWC_PML5 : PWC_PML4; l <= PWC_LEVELS; l++)
+            vmof << "\t " << level_names[l] << ":" << level_reads[l];
+        vmof << std::endl;
+        if (pml5)
+            vmof << "pml4 table number:" << cur_pml4_num << std::endl;
         vmof << "page directory pointer number:" << cur_pdp_num << std::endl;
         vmof << "page directory number:" << cur_pd_num << std::endl;
         vmof << "page table number:" << cur_pt_num << std::endl;
         vmof << "overhead of page table storage:"
              << (double)overhead / (double)(1024 * 1024) << " MB" << std::endl;
+        if (thp)
+            vmof << "transparent huge pages mapped:" << huge_pages
+                 << "\t fault allocations:" << thp_fault_alloc
+                 << "\t fault fallbacks:" << thp_fault_fallback
+                 << "\t collapses:" << thp_collapse_alloc
+                 << "\t collapse fallbacks:" << thp_collapse_fallback
+                 << std::endl;
+        if (numa_tables) {
+            vmof << "page table walk reads on the node of the core:"
+                 << local_reads << "\t remote:" << remote_reads << std::endl;
+            if (replicate)
+                vmof << "page table replica frames:" << replica_frames
+                     << "\t overhead:"
+                     << (double)replica_frames * PAGE_SIZE / (1024 * 1024)
+                     << " MB\t entry writes to replicas:" << replica_writes
+                     << std::endl;
+        }
+        if (zinfo->pte_arena)
+            vmof << "host memory of PTE arena (all processes):"
+                 << (double)zinfo->pte_arena->get_host_bytes() /
+                        (double)(1024 * 1024)
+                 << " MB\t tables in use:"
+                 << zinfo->pte_arena->get_blocks_in_use() << std::endl;
     }
     virtual void lock() { futex_lock(&table_lock); }
     virtual void unlock() { futex_unlock(&table_lock); }
+    /*
+     * Walks read the tables without table_lock; only faults (and other
+     * mutations) take it. Tables are published once built, and removed
+     * tables are retired rather than freed until the root is removed, so a
+     * walk never follows a dangling pointer. Removals bump table_seq;
+     * walks wait while one is under way and start over, without charging
+     * the abandoned walk, if one overlapped them (seqlock-style). Page walk
+     * caches belong to the walker, so they need no lock either.
+     */
+    virtual bool concurrent_walks() { return true; }
+
+    // table reads of one walk, counted once the walk is known to be good
+    struct WalkReads {
+        uint64_t level[PWC_LEVELS + 1];
+        uint64_t local;
+        uint64_t remote;
+    };
+
+    /*
+     *@function: timing walk of addr from the root down to its leaf, appending
+     *the page table lines it reads (the ones pwc does not hold) to pgt_addrs
+     *@param leaf_entry: set to the leaf entry once the walk gets there
+     *@param reads: if given, the reads are added there instead of to the
+     *stats
+     *@return: the page mapped, NULL on a page fault
+     */
+    Page *walk(MemReq &req, Address addr, PageWalkCache *pwc,
+               g_vector<uint64_t> &pgt_addrs, BasePDTEntry &leaf_entry,
+               bool sendPTW, WalkReads *reads = NULL);
 
   protected:
+    /*
+     *@function: the walk is about to read a table in frame, or has found
+     *the data page frame. Native frames are host-physical, nested paging
+     *translates them through the host page table first
+     */
+    virtual void translate_frame(MemReq &req, Page *frame, PageWalkCache *pwc,
+                                 g_vector<uint64_t> &pgt_addrs,
+                                 bool sendPTW) {}
+
+    /*
+     *@function: the PML4 table that maps addr: the root, or with LA57 the
+     *one its PML5 entry points to
+     *@param alloc_time: if given, a missing PML4 table is allocated and
+     *counted here; otherwise NULL is returned for it
+     *@param cpu: the core a missing table is placed for, see create_table()
+     */
+    PageTable *get_pml4_table(Address addr, int *alloc_time = NULL,
+                              int cpu = -1);
+
+    // the functions below index into pml4_table by entry ids, and place the
+    // tables they allocate for core cpu
     // allocate multiple
-    PageTable *allocate_page_directory_pointer(unsigned pml4_entry_id,
-                                               int &alloc_time);
-    bool allocate_page_directory_pointer(entry_list pml4_entry);
-
-    PageTable *allocate_page_directory(unsigned pml4_entry_id,
-                                       unsigned pdpt_entry_id, int &alloc_time);
-    bool allocate_page_directory(pair_list high_level_entry);
-
-    PageTable *allocate_page_table(unsigned pml4_entry_id,
+    PageTable *allocate_page_directory_pointer(PageTable *pml4_table,
+                                               unsigned pml4_entry_id,
+                                               int &alloc_time, int cpu = -1);
+    bool allocate_page_directory_pointer(PageTable *pml4_table,
+                                         entry_list pml4_entry);
+
+    PageTable *allocate_page_directory(PageTable *pml4_table,
+                                       unsigned pml4_entry_id,
+                                       unsigned pdpt_entry_id, int &alloc_time,
+                                       int cpu = -1);
+    bool allocate_page_directory(PageTable *pml4_table,
+                                 pair_list high_level_entry);
+
+    PageTable *allocate_page_table(PageTable *pml4_table,
+                                   unsigned pml4_entry_id,
                                    unsigned pdpt_entry_id,
-                                   unsigned pdt_entry_id, int &alloc_time);
-    bool allocate_page_table(triple_list high_level_entry);
+                                   unsigned pdt_entry_id, int &alloc_time,
+                                   int cpu = -1);
+    bool allocate_page_table(PageTable *pml4_table,
+                             triple_list high_level_entry);
 
     // remove
-    bool remove_page_directory_pointer(unsigned pml4_entry_id);
-    bool remove_page_directory_pointer(entry_list pml4_entry);
-    bool remove_page_directory(unsigned pml4_entry_id, unsigned pdp_entry_id);
-    bool remove_page_directory(pair_list high_level_entry);
-    bool remove_page_table(unsigned pml4_entry_id, unsigned pdp_entry_id,
-                           unsigned pd_entry_id);
-    inline bool remove_page_table(triple_list high_level_entry);
-
-    PageTable *get_tables(unsigned level, std::vector<unsigned> entry_id_vec);
+    void remove_pml4_table(PageTable *pml4_table);
+    bool remove_page_directory_pointer(PageTable *pml4_table,
+                                       unsigned pml4_entry_id);
+    bool remove_page_directory_pointer(PageTable *pml4_table,
+                                       entry_list pml4_entry);
+    bool remove_page_directory(PageTable *pml4_table, unsigned pml4_entry_id,
+                               unsigned pdp_entry_id);
+    bool remove_page_directory(PageTable *pml4_table,
+                               pair_list high_level_entry);
+    bool remove_page_table(PageTable *pml4_table, unsigned pml4_entry_id,
+                           unsigned pdp_entry_id, unsigned pd_entry_id);
+    inline bool remove_page_table(PageTable *pml4_table,
+                                  triple_list high_level_entry);
+
+    PageTable *get_tables(PageTable *pml4_table, unsigned level,
+                          std::vector<unsigned> entry_id_vec);
+    // unlink the table entry_id of table points to, freed with the root
+    void retire_table(PageTable *table, unsigned entry_id);
+    // free the frames of a table and of its replicas
+    void free_table(PageTable *table);
+    // free the frames of the huge page a PD entry maps and clear the entry
+    void remove_huge_page(PageTable *pd_table, unsigned pd_entry_id);
+
+    // construct a table in mem, its frame placed by the NUMA policy for the
+    // faulting core cpu (node 0 for -1, tables built outside a fault)
+    PageTable *create_table(PageTable *mem, const char *name, int cpu = -1);
+    // a copy of table on every other memory node
+    void add_replicas(PageTable *table);
+    // latency of a fault writing entries, to every copy of the tables
+    int update_latency(int writes);
 
   private:
     uint64_t loadPageTable(MemReq &req, uint64_t startCycle, uint64_t pageNo,
@@ -260,19 +427,49 @@ class LongModePaging : public BasePaging {
         __attribute__((always_inline));
 
   public:
+    // the root of 4-level paging, NULL with LA57
     PageTable *pml4;
+    // the root of 5-level paging (LA57), NULL otherwise
+    PageTable *pml5;
 
   private:
+    // the configured style, and its 4-level equivalent the walk code uses
+    PagingStyle style;
     PagingStyle mode;
-    // number of page directory pointer at most 512
+    unsigned levels;
+    // PML4 tables below the PML5 root
+    uint64_t cur_pml4_num;
+    // number of page directory pointer at most 512 per PML4 table
     uint64_t cur_pdp_num;
     uint64_t cur_pd_num;
     uint64_t cur_pt_num;
-    pwc_group *pwc;
     BasePageTableWalker* ptw;
-    bool pwc_enable;
     lock_t table_lock;
     uint64_t error_migrated_pages;
+    // odd while tables are being removed
+    volatile uint64_t table_seq;
+    uint64_t walk_retries;
+    void count_reads(const WalkReads &reads);
+    // timing walk reads per level, indexed by PwcLevel (PT last)
+    uint64_t level_reads[PWC_LEVELS + 1];
+    g_vector<PageTable *> retired_tables;
+    // transparent huge pages
+    bool thp;
+    bool thp_fault;
+    uint64_t huge_pages;            // mapped now
+    uint64_t thp_fault_alloc;       // faults that mapped a huge page
+    uint64_t thp_fault_fallback;    // eligible faults with no free block
+    uint64_t thp_collapse_alloc;    // regions collapsed
+    uint64_t thp_collapse_fallback; // hot regions with no free block
+    // NUMA placement and replication of the tables
+    bool numa_tables;
+    NumaPolicy table_policy;
+    bool replicate;
+    uint64_t interleave_next;
+    uint64_t replica_frames; // held by the tables in use
+    uint64_t replica_writes;
+    uint64_t local_reads;  // walk reads of a frame on the core's node
+    uint64_t remote_reads; // and on another node
 };
 
 // class PagingFactory
@@ -20,257 +20,319 @@
 #include "mmu/page.h"
 #include "pad.h"
 #include <vector>
+
+/*
+ * Page table entries are packed 8 bytes each, like hardware PTEs: the low 48
+ * bits point to the next level (a PageTable or a Page) and the high 16 bits
+ * hold the PageTableEntryBits. A walk reads one word per level, and a table
+ * of 512 entries fills exactly one 4KB host page. Simulation-only metadata
+ * (last requester, remap count, and the VPN kept by hashed page tables) lives
+ * in side arrays of the PageTable.
+ */
+static const unsigned PTE_FLAG_SHIFT = 48;
+static const uint64_t PTE_ADDR_MASK = (1ULL << PTE_FLAG_SHIFT) - 1;
+// the entry maps a page (as opposed to a table); not a hardware bit
+static const unsigned PTE_ASSIGNED = 0x800;
+
+class PageTable;
 /*-----commmon flag of page table entry related----*/
 /*----basic page table entry mapping maintaince-----*/
 /*
  *@function: simulation of page directory entry,
  *			 such as PDE,PDPE-PAE,PDE-PAE,PML4E-Long Mode
  *			 PDPE-Long Mode,PDE-Long Mode,and PTE
+ *
+ * A BasePDTEntry is a handle to one packed entry of a PageTable: it is
+ * passed by value, and -> works on it like on the entry pointers it replaced.
+ * A default-constructed handle refers to no entry and tests false.
  */
-class PageTable;
-class BasePDTEntry : public GlobAlloc {
+class BasePDTEntry {
   public:
-    BasePDTEntry() {
-        entry_bits = 0;
-        next_level_ptr = NULL;
-        set_read_write(); // all page can read and write both
-        set_user();       // default user can access all page
-                    // default is cache write
-                    // back,cacheable,unaccessed,clear,page_size is 4KB, local
-                    // page
-        page_assigned = false;
-        last_requester = -1;
-        remapped_times = 0;
-    }
-    BasePDTEntry(void *ppt) : next_level_ptr(ppt) {
-        entry_bits = 0;
-        page_assigned = false;
-        last_requester = -1;
-        remapped_times = 0;
-    }
-    virtual ~BasePDTEntry(){};
+    BasePDTEntry() : table(NULL), id(0) {}
+    BasePDTEntry(PageTable *table, unsigned entry_id)
+        : table(table), id(entry_id) {}
+
+    explicit operator bool() const { return table != NULL; }
+    BasePDTEntry *operator->() { return this; }
 
     void reclaim_page(Page *page);
 
+    // walks may read entries without the paging lock: the next level must be
+    // fully built before it is published, which a single store guarantees
     void validate_page(Page *next_level_addr) {
         assert(next_level_addr != NULL);
-        entry_bits |= P;
-        next_level_ptr = (void *)next_level_addr;
-        page_assigned = true;
-        set_private();
+        unsigned bits = (get_bits() | P | PTE_ASSIGNED) & ~SHAR;
+        __sync_synchronize();
+        store(next_level_addr, bits);
     }
 
     void validate_page_table(PageTable *next_level_addr) {
         assert(next_level_addr != NULL);
-        entry_bits |= P;
-        next_level_ptr = (void *)next_level_addr;
-        page_assigned = true;
+        __sync_synchronize();
+        store(next_level_addr, get_bits() | P | PTE_ASSIGNED);
     }
 
     void validate(void *next_level_addr) {
         assert(next_level_addr != NULL);
-        entry_bits |= P;
-        next_level_ptr = next_level_addr;
+        __sync_synchronize();
+        store(next_level_addr, get_bits() | P);
     }
+
     void invalidate_page() {
         assert(is_present());
-        entry_bits = 0;
-        set_user();
-        set_read_write();
-        assert(next_level_ptr);
-        reclaim_page((Page *)next_level_ptr);
-        next_level_ptr = NULL;
-        page_assigned = false;
-        last_requester = -1;
-        set_private();
+        assert(get_next_level_address());
+        reclaim_page((Page *)get_next_level_address());
+        store(NULL, RW | PERMISSION);
+        set_lrequester_raw(-1);
     }
 
-    template <class T> void invalidate_page_table() {
-        T *next_level_table = (T *)next_level_ptr;
+    // free_table=false only unlinks the table, its owner frees it later
+    template <class T> void invalidate_page_table(bool free_table = true) {
+        T *next_level_table = (T *)get_next_level_address();
         assert(is_present());
-        assert(next_level_ptr);
-        delete next_level_table;
-        next_level_ptr = NULL;
-        entry_bits = 0;
-        set_user();
-        set_read_write();
-        page_assigned = false;
+        assert(next_level_table);
+        if (free_table)
+            delete next_level_table;
+        store(NULL, RW | PERMISSION);
     }
 
-    void set_next_level_address(void *ppt) { next_level_ptr = ppt; }
+    void set_next_level_address(void *ppt) { store(ppt, get_bits()); }
 
-    void *get_next_level_address() { return next_level_ptr; }
+    void *get_next_level_address() const {
+        return (void *)(load() & PTE_ADDR_MASK);
+    }
 
     //---get information through entry_bits ---
     // page present in memory
-    bool is_present() { return (entry_bits)&P; }
+    bool is_present() const { return get_bits() & P; }
 
     // page read only
-    bool read_only() { return !(entry_bits & RW); }
+    bool read_only() const { return !(get_bits() & RW); }
 
     // can write page
-    bool can_write() { return !(entry_bits & RW); }
+    bool can_write() const { return !(get_bits() & RW); }
 
     // can access page in user-mode
-    bool user_can_access() { return (entry_bits & PERMISSION); }
+    bool user_can_access() const { return (get_bits() & PERMISSION); }
 
     // cache write through data of pages
-    bool page_write_through() { return (entry_bits & PWT); }
+    bool page_write_through() const { return (get_bits() & PWT); }
 
-    bool page_cache_disable() { return (entry_bits & PCD); }
+    bool page_cache_disable() const { return (get_bits() & PCD); }
 
     // page is accessed?
-    bool is_accessed() { return (entry_bits & A); }
+    bool is_accessed() const { return (get_bits() & A); }
 
     // page table is dirty
-    bool is_dirty() { return (entry_bits & D); }
+    bool is_dirty() const { return (get_bits() & D); }
 
     // page size is 4KB?
-    bool is_4KB() { return !(entry_bits & PS); }
+    bool is_4KB() const { return !(get_bits() & PS); }
 
     // page size is 2MB/4MB/1GB
-    bool is_largepage() { return (entry_bits & PS); }
+    bool is_largepage() const { return (get_bits() & PS); }
 
     // page is global
-    bool is_global() { return (entry_bits & G); }
+    bool is_global() const { return (get_bits() & G); }
 
     // set page read only through setting RW
-    void set_read_only() { entry_bits &= (~RW); }
+    void set_read_only() { clear_bits(RW); }
 
-    void set_read_write() { entry_bits |= RW; }
+    void set_read_write() { set_bits(RW); }
 
-    void set_supervisor() { entry_bits &= (~PERMISSION); }
+    void set_supervisor() { clear_bits(PERMISSION); }
 
-    void set_user() { entry_bits |= PERMISSION; }
+    void set_user() { set_bits(PERMISSION); }
     // cache write through
-    void set_pwt() { entry_bits |= PWT; }
+    void set_pwt() { set_bits(PWT); }
     // cache write back
-    void set_cache_writeback() { entry_bits &= (~PWT); }
+    void set_cache_writeback() { clear_bits(PWT); }
 
     // table or physical page is uncacheable
-    void set_uncacheable() { entry_bits |= PCD; }
+    void set_uncacheable() { set_bits(PCD); }
     // default, cacheable
-    void set_cacheable() { entry_bits &= (~PCD); }
+    void set_cacheable() { clear_bits(PCD); }
 
-    void set_accessed() { entry_bits |= A; }
+    // set by concurrent walks: only write (atomically) when the bit changes
+    void set_accessed() { set_bits(A); }
 
-    void set_unaccessed() { entry_bits &= (~A); }
+    void set_unaccessed() { clear_bits(A); }
 
-    void set_dirty() { entry_bits |= D; }
+    void set_dirty() { set_bits(D); }
 
-    void clear_dirty() { entry_bits &= (~D); }
+    void clear_dirty() { clear_bits(D); }
 
     // ps is 0,4KB page
-    void enable_4KB() { entry_bits &= (~PS); }
+    void enable_4KB() { clear_bits(PS); }
     // ps is 1, large page
-    void enable_large_page() { entry_bits |= PS; }
+    void enable_large_page() { set_bits(PS); }
     // G=1,global
-    void set_page_global() { entry_bits |= G; }
-    void set_page_local() { entry_bits &= (~G); }
-    void set_page_assigned() { page_assigned = true; }
-    bool is_page_assigned() { return page_assigned; }
-
-    void set_shared() { entry_bits |= SHAR; }
-    void set_private() { entry_bits &= (~SHAR); }
-    bool is_shared() { return entry_bits & SHAR; }
-    void set_dramcached() { entry_bits |= DC; }
-    bool is_dramcached() { return entry_bits & DC; }
+    void set_page_global() { set_bits(G); }
+    void set_page_local() { clear_bits(G); }
+    void set_page_assigned() { set_bits(PTE_ASSIGNED); }
+    bool is_page_assigned() const { return get_bits() & PTE_ASSIGNED; }
+
+    void set_shared() { set_bits(SHAR); }
+    void set_private() { clear_bits(SHAR); }
+    bool is_shared() const { return get_bits() & SHAR; }
+    void set_dramcached() { set_bits(DC); }
+    bool is_dramcached() const { return get_bits() & DC; }
     void set_lrequester(uint32_t req_id) {
-        if (last_requester != -1 && last_requester != req_id) {
-            entry_bits |= SHAR;
-        }
-        last_requester = req_id;
+        uint32_t last = get_lrequester();
+        if (last == req_id)
+            return;
+        if (last != (uint32_t)-1)
+            set_bits(SHAR);
+        set_lrequester_raw(req_id);
     }
     void set_lrequester(uint32_t req_id, bool &changed_to_shared) {
-        if (last_requester != -1 && last_requester != req_id) {
-            if (!(entry_bits & SHAR))
+        uint32_t last = get_lrequester();
+        if (last == req_id)
+            return;
+        if (last != (uint32_t)-1) {
+            if (!is_shared())
                 changed_to_shared = true;
-            entry_bits |= SHAR;
+            set_bits(SHAR);
         }
-        last_requester = req_id;
+        set_lrequester_raw(req_id);
     }
-    void set_vpn(Address addr) { vpn = addr; }
-    Address get_vpn() { return vpn; }
-    Page* get_page() { return (Page*)next_level_ptr; }
-    uint32_t get_lrequester() { return last_requester; }
+    inline void set_vpn(Address addr);
+    inline Address get_vpn() const;
+    Page *get_page() const { return (Page *)get_next_level_address(); }
+    inline uint32_t get_lrequester() const;
+    inline uint32_t get_remapped_times() const;
+    inline void add_remapped_time();
 
   private:
-    unsigned get_bits_offset(unsigned bits) {
-        unsigned offset = 0;
-        unsigned m = 0x1;
-        while (!(bits & m)) {
-            offset++;
-            bits >>= 1;
-        }
-        return offset;
+    inline volatile uint64_t &word() const;
+    uint64_t load() const { return word(); }
+    unsigned get_bits() const { return load() >> PTE_FLAG_SHIFT; }
+    void store(void *ptr, unsigned bits) {
+        assert(((uint64_t)ptr & ~PTE_ADDR_MASK) == 0);
+        word() = (uint64_t)ptr | ((uint64_t)bits << PTE_FLAG_SHIFT);
+    }
+    inline void set_bits(unsigned bits) {
+        if ((get_bits() & bits) != bits)
+            __sync_fetch_and_or(&word(), (uint64_t)bits << PTE_FLAG_SHIFT);
+    }
+    inline void clear_bits(unsigned bits) {
+        if (get_bits() & bits)
+            __sync_fetch_and_and(&word(),
+                                 ~((uint64_t)bits << PTE_FLAG_SHIFT));
     }
+    inline void set_lrequester_raw(uint32_t req_id);
 
+    PageTable *table;
+    unsigned id;
+};
+
+/*
+ * Arena for the PTE blocks of 512-entry tables: 4KB blocks carved from 2MB
+ * slabs of the global heap and recycled through a free list, so tables cost
+ * no allocator headers and never fragment the heap.
+ */
+class PteArena : public GlobAlloc {
   public:
-    void *next_level_ptr;
-    unsigned entry_bits;
-    unsigned last_requester;
-    bool page_assigned;
-    unsigned remapped_times;
-    Address vpn;
+    PteArena();
+    volatile uint64_t *alloc();
+    void free(volatile uint64_t *block);
+    uint64_t get_host_bytes() { return slabs * SLAB_BYTES; }
+    uint64_t get_blocks_in_use() { return blocks_in_use; }
+
+    static const uint64_t BLOCK_BYTES = ENTRY_512 * sizeof(uint64_t);
+    static const uint64_t SLAB_BYTES = 2 * 1024 * 1024;
+
+  private:
+    lock_t arena_lock;
+    volatile uint64_t *free_list; // linked through the first word of blocks
+    char *slab_cur;
+    char *slab_end;
+    uint64_t slabs;
+    uint64_t blocks_in_use;
 };
 
 /*---------structure of page table--------*/
-class PageTable {
+// an entry with its side array state, moved between the slots of hashed
+// page tables
+struct PteSlot {
+    uint64_t pte;
+    uint32_t requester;
+    uint16_t remaps;
+    Address vpn;
+
+    bool is_present() const { return (pte >> PTE_FLAG_SHIFT) & P; }
+};
+
+// a present entry mapping page, the way validate_page leaves a fresh one
+inline PteSlot make_page_slot(Page *page, Address vpn) {
+    assert(page);
+    PteSlot slot = {(uint64_t)page | ((uint64_t)(RW | PERMISSION | P |
+                                                 PTE_ASSIGNED)
+                                      << PTE_FLAG_SHIFT),
+                    (uint32_t)-1, 0, vpn};
+    return slot;
+}
+
+class PageTable : public GlobAlloc {
   public:
-    PageTable(uint64_t size) {
-        assert(size > 0);
-        // init page table with page table entry
-        map_count = size;
-        entry_array.resize(map_count, NULL);
-        BasePDTEntry *pg_table =
-            gm_memalign<BasePDTEntry>(CACHE_LINE_BYTES, size);
-        for (uint64_t i = 0; i < size; i++) {
-            entry_array[i] = new (&pg_table[i]) BasePDTEntry();
-        }
-        page = NULL;
-    }
+    PageTable(uint64_t size) { init(size, NULL); }
 
     PageTable(uint64_t size, Page *_page) {
-        assert(size > 0);
-        // init page table with page table entry
-        map_count = size;
-        entry_array.resize(map_count, NULL);
-        BasePDTEntry *pg_table =
-            gm_memalign<BasePDTEntry>(CACHE_LINE_BYTES, size);
-        for (uint64_t i = 0; i < size; i++) {
-            entry_array[i] = new (&pg_table[i]) BasePDTEntry();
-        }
         assert(_page != NULL);
-        page = _page;
+        init(size, _page);
     }
 
     ~PageTable();
 
-    BasePDTEntry *operator[](unsigned entry_id) {
+    BasePDTEntry operator[](unsigned entry_id) {
         assert(entry_id < map_count);
-        BasePDTEntry *tmp = entry_array[entry_id];
-        return tmp;
+        return BasePDTEntry(this, entry_id);
     }
 
     bool is_present(unsigned entry_id) {
-        bool present = entry_array[entry_id]->is_present();
-        return present;
+        return (ptes[entry_id] >> PTE_FLAG_SHIFT) & P;
     }
 
     // template<class U, class S>
     void *get_next_level_address(unsigned entry_id) {
         if (entry_id < map_count) {
-            if (!is_present(entry_id))
+            // one load, so the pointer and its present bit agree
+            uint64_t pte = ptes[entry_id];
+            if (!((pte >> PTE_FLAG_SHIFT) & P))
                 return NULL;
-            void *ptr = (entry_array[entry_id])->next_level_ptr;
-            return ptr;
+            return (void *)(pte & PTE_ADDR_MASK);
         }
         return NULL;
     }
 
     void enable_large_page() {
         for (unsigned i = 0; i < map_count; i++)
-            entry_array[i]->enable_large_page();
+            (*this)[i]->enable_large_page();
+    }
+
+    PteSlot get_slot(unsigned entry_id) {
+        assert(entry_id < map_count);
+        PteSlot slot = {ptes[entry_id], requesters[entry_id],
+                        remaps[entry_id], vpns ? vpns[entry_id] : 0};
+        return slot;
+    }
+    // move the entry out, it is left empty
+    PteSlot take_slot(unsigned entry_id) {
+        PteSlot slot = get_slot(entry_id);
+        ptes[entry_id] = (uint64_t)(RW | PERMISSION) << PTE_FLAG_SHIFT;
+        requesters[entry_id] = -1;
+        remaps[entry_id] = 0;
+        return slot;
+    }
+    void put_slot(unsigned entry_id, const PteSlot &slot) {
+        assert(entry_id < map_count);
+        if (!vpns)
+            vpns = gm_calloc<Address>(map_count);
+        requesters[entry_id] = slot.requester;
+        remaps[entry_id] = slot.remaps;
+        vpns[entry_id] = slot.vpn;
+        __sync_synchronize();
+        ptes[entry_id] = slot.pte;
     }
 
     inline Address get_page_no() {
@@ -282,10 +344,75 @@ class PageTable {
         return page;
     }
 
+    // the copy of a replicated table on memory node node_id, the table's
+    // own frame if it has no replicas
+    inline Page *get_page(unsigned node_id) {
+        return replicas ? replicas[node_id] : page;
+    }
+    inline Address get_page_no(unsigned node_id) {
+        return get_page(node_id)->pageNo;
+    }
+
+  private:
+    void init(uint64_t size, Page *_page);
+    // PTE storage of 512-entry tables comes from a shared arena of 4KB
+    // blocks, other sizes (hashed page tables) from the global heap
+    static volatile uint64_t *alloc_ptes(uint64_t size);
+    static void free_ptes(volatile uint64_t *block, uint64_t size);
+
   public:
-    g_vector<BasePDTEntry *> entry_array;
+    volatile uint64_t *ptes;
+    uint32_t *requesters;
+    uint16_t *remaps;
+    Address *vpns; // only hashed page tables keep VPNs, allocated on first use
     unsigned map_count;
     unsigned cur_pte_num;
     Page *page; // the Page allocated to this page table
+    Page **replicas; // a frame per memory node if replicated, NULL otherwise
+    unsigned replica_num;
+};
+
+inline volatile uint64_t &BasePDTEntry::word() const {
+    return table->ptes[id];
+}
+inline uint32_t BasePDTEntry::get_lrequester() const {
+    return table->requesters[id];
+}
+inline void BasePDTEntry::set_lrequester_raw(uint32_t req_id) {
+    table->requesters[id] = req_id;
+}
+inline uint32_t BasePDTEntry::get_remapped_times() const {
+    return table->remaps[id];
+}
+inline void BasePDTEntry::add_remapped_time() {
+    if (table->remaps[id] < UINT16_MAX)
+        table->remaps[id]++;
+}
+inline void BasePDTEntry::set_vpn(Address addr) {
+    if (!table->vpns)
+        table->vpns = gm_calloc<Address>(table->map_count);
+    table->vpns[id] = addr;
+}
+inline Address BasePDTEntry::get_vpn() const {
+    return table->vpns ? table->vpns[id] : 0;
+}
+
+// reverse mapping of a physical page: the entry that maps it and its VPN
+struct Content : public GlobAlloc {
+  public:
+    Content(BasePDTEntry entry = BasePDTEntry(), Address page_no = 0)
+        : pgt_entry(entry), vpn(page_no) {}
+    Content(Content &forbid_copy) {
+        pgt_entry = forbid_copy.get_pgt_entry();
+        vpn = forbid_copy.get_vpn();
+    };
+    ~Content() { printf("vpn %ld deleted\n", vpn); }
+
+    Address get_vpn() { return vpn; }
+    BasePDTEntry get_pgt_entry() { return pgt_entry; }
+
+  private:
+    BasePDTEntry pgt_entry;
+    Address vpn;
 };
 #endif
@@ -0,0 +1,103 @@
+/*
+ * Parallel probes of hashed page table walks
+ */
+#include "page-table/parallel_probe.h"
+#include "event_recorder.h"
+#include "page-table/comm_page_table_op.h"
+#include "timing_event.h"
+#include "zsim.h"
+
+uint64_t loadParallelProbes(MemReq &req, const g_vector<uint64_t> &pgt_addrs,
+                            g_vector<MemObject *> &parents,
+                            g_vector<uint32_t> &parentRTTs) {
+    EventRecorder *evRec = zinfo->eventRecorders[req.srcId];
+    uint64_t respCycle = req.cycle;
+    g_vector<TimingRecord> probeTRs;
+    for (uint32_t i = 0; i < pgt_addrs.size(); i++) {
+        uint64_t lineAddr = pgt_addrs[i] >> lineBits;
+        uint32_t parentId = getParentId(lineAddr, parents.size());
+        MESIState dummyState = MESIState::I;
+        MemReq pgt_req = {lineAddr,    GETS,      req.childId,
+                          &dummyState, req.cycle, req.childLock,
+                          dummyState,  req.srcId, req.flags};
+        pgt_req.threadId = req.threadId;
+        pgt_req.isPIMInst = req.isPIMInst;
+        // the walk is one TLB miss: only the first probe starts and ends it
+        pgt_req.isFirstPTW = (i == 0);
+        pgt_req.isLastPTW = (i == 0);
+        uint64_t probeCycle = parents[parentId]->access(pgt_req) +
+                              parentRTTs[parentId];
+        respCycle = MAX(respCycle, probeCycle);
+        if (evRec->hasRecord()) {
+            TimingRecord tr = evRec->popRecord();
+            if (tr.isValid())
+                probeTRs.push_back(tr);
+        }
+    }
+    if (probeTRs.size() == 1) {
+        evRec->pushRecord(probeTRs[0]);
+    } else if (probeTRs.size() > 1) {
+        // fork the probes from one event and join them in another, the
+        // walk ends with the slowest
+        DelayEvent *startEv = new (evRec) DelayEvent(0);
+        DelayEvent *endEv = new (evRec) DelayEvent(0);
+        startEv->setMinStartCycle(req.cycle);
+        endEv->setMinStartCycle(req.cycle);
+        for (uint32_t i = 0; i < probeTRs.size(); i++) {
+            TimingRecord &tr = probeTRs[i];
+            assert(tr.reqCycle >= req.cycle && tr.endEvent);
+            DelayEvent *dEv = new (evRec) DelayEvent(tr.reqCycle - req.cycle);
+            dEv->setMinStartCycle(req.cycle);
+            startEv->addChild(dEv, evRec)->addChild(tr.startEvent, evRec);
+            tr.endEvent->addChild(endEv, evRec);
+        }
+        TimingRecord walkTR = probeTRs[0];
+        walkTR.reqCycle = req.cycle;
+        walkTR.respCycle = respCycle;
+        walkTR.startEvent = startEv;
+        walkTR.endEvent = endEv;
+        walkTR.isPTW = true;
+        evRec->pushRecord(walkTR);
+    }
+    return respCycle;
+}
+
+uint64_t loadSequentialProbes(MemReq &req,
+                              const g_vector<uint64_t> &pgt_addrs,
+                              g_vector<MemObject *> &parents,
+                              g_vector<uint32_t> &parentRTTs) {
+    EventRecorder *evRec = zinfo->eventRecorders[req.srcId];
+    uint64_t respCycle = req.cycle;
+    TimingRecord first_ptwTR;
+    first_ptwTR.clear();
+    // Link all reqs in a page table walk
+    for (uint32_t i = 0; i < pgt_addrs.size(); i++) {
+        uint64_t lineAddr = pgt_addrs[i] >> lineBits;
+        uint32_t parentId = getParentId(lineAddr, parents.size());
+        MESIState dummyState = MESIState::I;
+        MemReq pgt_req = {lineAddr,    GETS,      req.childId,
+                          &dummyState, respCycle, req.childLock,
+                          dummyState,  req.srcId, req.flags};
+        pgt_req.threadId = req.threadId;
+        pgt_req.isPIMInst = req.isPIMInst;
+        pgt_req.isFirstPTW = (i == 0);
+        pgt_req.isLastPTW = (i == pgt_addrs.size() - 1);
+        respCycle = parents[parentId]->access(pgt_req) + parentRTTs[parentId];
+        if (evRec->hasRecord()) {
+            TimingRecord c_tr = evRec->popRecord();
+            if (!first_ptwTR.isValid() && c_tr.isValid()) {
+                assert(c_tr.endEvent);
+                first_ptwTR = c_tr;
+            } else {
+                assert(c_tr.isPTW);
+                // Exist a previous page table memory access
+                first_ptwTR.endEvent->addChild(c_tr.startEvent, evRec);
+                first_ptwTR.endEvent = c_tr.endEvent;
+            }
+        }
+    }
+    // reinsert event
+    if (first_ptwTR.isValid())
+        evRec->pushRecord(first_ptwTR);
+    return respCycle;
+}
@@ -0,0 +1,36 @@
+/*
+ * Parallel probes of hashed page table walks
+ */
+#ifndef __PARALLEL_PROBE__
+#define __PARALLEL_PROBE__
+#include "g_std/g_vector.h"
+#include "memory_hierarchy.h"
+
+/*
+ * A hashed page table walk knows every slot it has to probe up front (one
+ * per way of a cuckoo table), so the walker issues them all at once and the
+ * walk takes as long as the slowest probe, not the sum of them. Probes of
+ * open addressing and chained tables depend on the line read before them
+ * and go one after another.
+ */
+
+/*
+ *@function: read the page table lines of pgt_addrs in parallel, all issued
+ *at req.cycle; the first probe marks the walk for the TLB miss stats
+ *@return: cycle the last of them completes
+ */
+uint64_t loadParallelProbes(MemReq &req, const g_vector<uint64_t> &pgt_addrs,
+                            g_vector<MemObject *> &parents,
+                            g_vector<uint32_t> &parentRTTs);
+
+/*
+ *@function: read the page table lines of pgt_addrs one after another,
+ *each issued when the one before completes
+ *@return: cycle the last of them completes
+ */
+uint64_t loadSequentialProbes(MemReq &req,
+                              const g_vector<uint64_t> &pgt_addrs,
+                              g_vector<MemObject *> &parents,
+                              g_vector<uint32_t> &parentRTTs);
+
+#endif
@@ -1,61 +1,224 @@
-#include "memory_hierarchy.h"
-#include "g_std/g_vector.h"
-#include "ramulator_mem_ctrl.h"
-#include "stats.h"
-#include <unordered_map>
-#include <unordered_set>
 #include "pw_cache.h"
+#include "bithacks.h"
+#include "log.h"
+#include "pad.h"
 
-//pwc_Array codes
+// PwcArray codes
 
-pwc_Array::pwc_Array(uint32_t _numLines, uint32_t _assoc) 
-    : numLines(_numLines), assoc(_assoc) {
-    numSets = numLines / assoc;
+PwcArray::PwcArray(uint32_t num_lines, uint32_t ways)
+    : clock(0), numLines(num_lines), ways(ways) {
+    if (ways == 0 || numLines % ways != 0)
+        panic("page walk cache of %u entries cannot be %u-way", numLines,
+              ways);
+    uint32_t numSets = numLines / ways;
+    if (!isPow2(numSets))
+        panic("page walk cache of %u entries, %u-way, needs a power-of-two "
+              "number of sets",
+              numLines, ways);
     setMask = numSets - 1;
-    lru_order.resize(numSets);
+    tags = gm_memalign<Address>(CACHE_LINE_BYTES, numLines);
+    stamps = gm_memalign<uint64_t>(CACHE_LINE_BYTES, numLines);
+    clear();
 }
 
-pwc_Array::~pwc_Array() {
-    lineMap.clear();
+void PwcArray::clear() {
+    for (uint32_t i = 0; i < numLines; i++) {
+        tags[i] = INVALID_TAG;
+        stamps[i] = 0;
+    }
 }
 
-bool pwc_Array::lookup(Address lineAddr) {
-    uint32_t set_id = get_set_id(lineAddr);
-    auto it = lineMap[set_id].find(lineAddr);
-    if(it != lineMap[set_id].end()) {
-        LRUupdate(set_id, lineAddr);
-        return true;
+bool PwcArray::lookup(Address tag) {
+    uint32_t first = (tag & setMask) * ways;
+    for (uint32_t id = first; id < first + ways; id++) {
+        if (tags[id] == tag) {
+            stamps[id] = ++clock;
+            return true;
+        }
     }
     return false;
 }
 
-void pwc_Array::evict(uint32_t set_id) {
-    Address lineAddr = lru_order[set_id].back();
-    lru_order[set_id].pop_back();
-    lineMap[set_id].erase(lineAddr);
+void PwcArray::insert(Address tag) {
+    // invalid ways have stamp 0, so they go first
+    uint32_t first = (tag & setMask) * ways;
+    uint32_t victim = first;
+    for (uint32_t id = first + 1; id < first + ways; id++)
+        if (stamps[id] < stamps[victim])
+            victim = id;
+    tags[victim] = tag;
+    stamps[victim] = ++clock;
 }
 
-void pwc_Array::insert(Address lineAddr) {
-    uint32_t set_id = get_set_id(lineAddr);
-    if(lineMap[set_id].size() == assoc) {
-        evict(set_id);
+// PageWalkCache codes
+
+PageWalkCache::PageWalkCache(const g_string &name, bool unified, bool skip,
+                             const g_vector<unsigned> &sizes,
+                             const g_vector<unsigned> &ways, uint32_t acc_lat,
+                             uint32_t miss_lat)
+    : name(name), unified(unified), skip(skip), accLat(acc_lat),
+      missLat(miss_lat), host(NULL), nestedTlb(NULL), nestedLat(0),
+      cuckooCache(NULL), cuckooLat(0) {
+    for (uint32_t i = 0; i < PWC_LEVELS; i++)
+        arrays[i] = NULL;
+    if (unified) {
+        if (sizes.size() != 1 || ways.size() != 1)
+            panic("%s: a unified page walk cache needs 1 array, %lu "
+                  "configured",
+                  name.c_str(), sizes.size());
+        PwcArray *a = new PwcArray(sizes[0], ways[0]);
+        for (uint32_t i = 0; i < PWC_LEVELS; i++)
+            arrays[i] = a;
+        return;
     }
-    lineMap[set_id].insert(lineAddr);
-    LRUupdate(set_id, lineAddr);
+    // split arrays are given from the top level down and end at PD
+    if (sizes.size() != ways.size() || sizes.size() > PWC_LEVELS ||
+        (!sizes.empty() && sizes.size() < PWC_LEVELS - 1))
+        panic("%s: a split page walk cache needs %u or %u arrays, %lu "
+              "configured",
+              name.c_str(), PWC_LEVELS - 1, PWC_LEVELS, sizes.size());
+    uint32_t top = PWC_LEVELS - sizes.size();
+    for (uint32_t i = 0; i < sizes.size(); i++)
+        arrays[top + i] = new PwcArray(sizes[i], ways[i]);
 }
 
-// pw_cache codes
+uint64_t PageWalkCache::access(PwcLevel level, Address lineAddr, bool &hit) {
+    assert(!skip);
+    PwcArray *a = array(level);
+    hit = a && a->lookup(lineAddr);
+    if (hit) {
+        hits[level].inc();
+        return accLat;
+    }
+    misses[level].inc();
+    if (a)
+        a->insert(lineAddr);
+    return accLat + missLat;
+}
 
-pw_cache::pw_cache(uint32_t _numLines, uint32_t assoc, uint32_t _accLat, uint32_t _invLat, const string& _name) 
-    : numLines(_numLines), accLat(_accLat), invLat(_invLat), name(_name), access_count(0), miss_count(0) {
-        array = new pwc_Array(numLines, assoc);
+uint64_t PageWalkCache::probe(Address vaddr, unsigned top, unsigned leaf,
+                              unsigned &first) {
+    assert(skip && top <= leaf && leaf <= PWC_LEVELS);
+    // all levels are probed in parallel, the deepest hit wins
+    first = top;
+    for (unsigned l = top; l < leaf; l++) {
+        PwcLevel level = (PwcLevel)l;
+        PwcArray *a = array(level);
+        if (a && a->lookup(vtag(level, vaddr))) {
+            hits[level].inc();
+            first = l + 1;
+        } else {
+            misses[level].inc();
+        }
     }
-uint64_t pw_cache::access(MemReq &req) {
-    req.pwc_hit = false;
-    if(array->lookup(req.lineAddr)) {
-        req.pwc_hit = true;
-        return accLat;
+    skippedReads.inc(first - top);
+    return first == leaf ? accLat : accLat + missLat;
+}
+
+void PageWalkCache::fill(PwcLevel level, Address vaddr) {
+    assert(skip);
+    if (array(level))
+        array(level)->insert(vtag(level, vaddr));
+}
+
+void PageWalkCache::mark_stats(StatMark &mark) {
+    for (uint32_t l = 0; l < PWC_LEVELS; l++) {
+        mark.hits[l] = hits[l].get();
+        mark.misses[l] = misses[l].get();
+    }
+    mark.skipped = skippedReads.get();
+}
+
+void PageWalkCache::rewind_stats(const StatMark &mark) {
+    for (uint32_t l = 0; l < PWC_LEVELS; l++) {
+        hits[l].set(mark.hits[l]);
+        misses[l].set(mark.misses[l]);
+    }
+    skippedReads.set(mark.skipped);
+}
+
+void PageWalkCache::switch_context() {
+    if (cuckooCache)
+        cuckooCache->clear();
+    if (!skip)
+        return;
+    for (uint32_t i = 0; i < PWC_LEVELS; i++)
+        if (arrays[i] && (i == 0 || arrays[i] != arrays[i - 1]))
+            arrays[i]->clear();
+}
+
+void PageWalkCache::set_nested(PageWalkCache *host_pwc, uint32_t ntlb_entries,
+                               uint32_t ntlb_ways, uint32_t ntlb_lat) {
+    host = host_pwc;
+    if (ntlb_entries)
+        nestedTlb = new PwcArray(ntlb_entries, ntlb_ways);
+    nestedLat = ntlb_lat;
+}
+
+uint64_t PageWalkCache::nested_access(Address gpfn, bool &hit) {
+    if (!nestedTlb) {
+        hit = false;
+        return 0;
+    }
+    hit = nestedTlb->lookup(gpfn);
+    if (hit) {
+        nestedHits.inc();
+    } else {
+        nestedMisses.inc();
+        nestedTlb->insert(gpfn);
+    }
+    return nestedLat;
+}
+
+void PageWalkCache::set_cuckoo(uint32_t cwc_entries, uint32_t cwc_ways,
+                               uint32_t cwc_lat) {
+    if (cwc_entries)
+        cuckooCache = new PwcArray(cwc_entries, cwc_ways);
+    cuckooLat = cwc_lat;
+}
+
+uint64_t PageWalkCache::cuckoo_access(Address region, bool &hit) {
+    if (!cuckooCache) {
+        hit = false;
+        return 0;
+    }
+    hit = cuckooCache->lookup(region);
+    if (hit) {
+        cuckooHits.inc();
+    } else {
+        cuckooMisses.inc();
+        cuckooCache->insert(region);
+    }
+    return cuckooLat;
+}
+
+void PageWalkCache::initStats(AggregateStat *parentStat) {
+    static const char *hitNames[PWC_LEVELS] = {"pml5Hits", "pml4Hits",
+                                               "pdptHits", "pdHits"};
+    static const char *missNames[PWC_LEVELS] = {"pml5Misses", "pml4Misses",
+                                                "pdptMisses", "pdMisses"};
+    AggregateStat *pwcStat = new AggregateStat();
+    pwcStat->init(name.c_str(), "Page walk cache stats");
+    for (uint32_t l = 0; l < PWC_LEVELS; l++) {
+        hits[l].init(hitNames[l], "Lookups that hit at this level");
+        misses[l].init(missNames[l], "Lookups that missed at this level");
+        pwcStat->append(&hits[l]);
+        pwcStat->append(&misses[l]);
+    }
+    skippedReads.init("skippedReads",
+                      "Page table reads skipped by translation caches");
+    pwcStat->append(&skippedReads);
+    if (nestedTlb) {
+        nestedHits.init("ntlbHits", "Nested TLB lookups that hit");
+        nestedMisses.init("ntlbMisses", "Nested TLB lookups that missed");
+        pwcStat->append(&nestedHits);
+        pwcStat->append(&nestedMisses);
+    }
+    if (cuckooCache) {
+        cuckooHits.init("cwcHits", "Cuckoo walk cache lookups that hit");
+        cuckooMisses.init("cwcMisses", "Cuckoo walk cache lookups that missed");
+        pwcStat->append(&cuckooHits);
+        pwcStat->append(&cuckooMisses);
     }
-    array->insert(req.lineAddr);
-    return invLat + accLat;
+    parentStat->append(pwcStat);
 }
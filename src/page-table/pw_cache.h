@@ -1,92 +1,167 @@
-
-
 #ifndef PW_CACHE_H_
 #define PW_CACHE_H_
 
-#include "memory_hierarchy.h"
+#include "g_std/g_string.h"
 #include "g_std/g_vector.h"
-#include "ramulator_mem_ctrl.h"
+#include "galloc.h"
+#include "memory_hierarchy.h"
 #include "stats.h"
-#include "zsim.h"
-#include <unordered_map>
-#include <unordered_set>
-/* Extends Cache with an L0 direct-mapped cache, optimized to hell for hits
+
+/*
+ * Page walk caches (PWC) of a page table walker hold entries of the upper
+ * levels of the radix page table, so walks need not fetch them from the
+ * memory hierarchy; PTEs (the leaves) are cached by the TLBs. Every walker
+ * has its own, like every core has its own MMU.
+ *
+ * The caches are either split, one array per level like Intel's paging
+ * structure caches, or unified, one array for all levels like AMD's PWC.
+ * They cache entries in one of two ways (Barr et al., ISCA'10):
+ * - page table caches are tagged with the physical line of the entry: the
+ *   walk looks every level up in turn and reads the ones that miss
+ * - translation caches (skip) are tagged with the virtual address bits that
+ *   select the entry: all levels are probed at once, and the walk skips
+ *   straight to the table the deepest hit points to
  *
- * L1 lookups are dominated by several kinds of overhead (grab the cache locks,
- * several virtual functions for the replacement policy, etc.). This
- * specialization of Cache solves these issues by having a filter array that
- * holds the most recently used line in each set. Accesses check the filter array,
- * and then go through the normal access path. Because there is one line per set,
- * it is fine to do this without grabbing a lock.
+ * Walkers of nested (virtualized) paging also cache host translations: a
+ * nested TLB of guest-physical to host-physical frames, and the walk caches
+ * of the host page table (EPT).
+ *
+ * Walkers of cuckoo page tables have a cuckoo walk cache (CWC, Skarlatos et
+ * al., ASPLOS'20) instead: it caches which ways of the table hold the pages
+ * of a virtual region, so a walk probes only those ways, not all of them.
  */
-class pwc_Array : public GlobAlloc {// default set-associative cache array
-    protected:
+
+// upper levels of a 5-level radix table, the ones a PWC holds; 4-level
+// walks start at PWC_PML4
+enum PwcLevel { PWC_PML5 = 0, PWC_PML4, PWC_PDPT, PWC_PD, PWC_LEVELS };
+
+// set-associative array of tags with LRU replacement
+class PwcArray : public GlobAlloc {
+  public:
+    PwcArray(uint32_t num_lines, uint32_t ways);
+    // a hit becomes MRU
+    bool lookup(Address tag);
+    void insert(Address tag);
+    void clear();
+
+  private:
+    static const Address INVALID_TAG = ~0ULL;
+
+    Address *tags;
+    uint64_t *stamps;
+    uint64_t clock;
     uint32_t numLines;
-    uint32_t numSets;
-    uint32_t assoc;
+    uint32_t ways;
     uint32_t setMask;
-    unordered_map<uint32_t, unordered_set<Address>> lineMap;
-    vector<list<Address>> lru_order;
-    public:
-    pwc_Array(uint32_t _numLines, uint32_t _assoc);
-    virtual bool lookup(const Address lineAddr);
-    virtual void insert(const Address lineAddr);
-    virtual void evict(uint32_t set_id);
-    private:
-    virtual void LRUupdate(uint32_t set_id, Address lineAddr);
-    virtual uint32_t get_set_id(Address lineAddr);
-
-    virtual ~pwc_Array();
 };
 
-inline void pwc_Array::LRUupdate(uint32_t set_id, Address lineAddr) {
-    lru_order[set_id].remove(lineAddr);
-    lru_order[set_id].push_front(lineAddr);
-}
-
-inline uint32_t pwc_Array::get_set_id(Address lineAddr) {
-    return lineAddr & setMask;
-}
-
-class pw_cache : public MemObject {
-    public:
-        pwc_Array* array;
-        uint32_t numLines;
-        uint32_t access_count;
-        string name;
-        uint32_t miss_count;
-    protected:
-        uint32_t accLat;
-        uint32_t invLat;
-    public:
-        pw_cache(uint32_t _numLines,  uint32_t assoc, uint32_t _accLat, uint32_t _invLat, const string& _name);
-        virtual uint64_t access(MemReq& req);
-};
+class PageWalkCache : public GlobAlloc {
+  public:
+    /*
+     *@param sizes, ways: one array per level (PML4 first, or PML5 first for
+     *LA57 walks) if split, a single one if unified. Without a PML5 array
+     *that level is never cached, without any array no level is
+     *@param acc_lat: latency of a lookup, or of a probe of all levels
+     *@param miss_lat: extra latency of a lookup that misses
+     */
+    PageWalkCache(const g_string &name, bool unified, bool skip,
+                  const g_vector<unsigned> &sizes,
+                  const g_vector<unsigned> &ways, uint32_t acc_lat,
+                  uint32_t miss_lat);
+
+    // translation-skip caching, see probe()
+    bool skips() { return skip; }
+
+    /*
+     *@function: look up (and fill on a miss) the entry of level in the
+     *page table line lineAddr
+     *@return: latency of the lookup
+     */
+    uint64_t access(PwcLevel level, Address lineAddr, bool &hit);
+
+    /*
+     *@function: probe the translation caches of the levels from top (the
+     *root) to just above leaf for vaddr
+     *@param first: set to the first level the walk has to read, the levels
+     *above it are cached
+     *@return: latency of the probe
+     */
+    uint64_t probe(Address vaddr, unsigned top, unsigned leaf,
+                   unsigned &first);
+    // cache the translation of level for vaddr, the walk just read it
+    void fill(PwcLevel level, Address vaddr);
+
+    // translations are tagged with virtual addresses, drop them when the
+    // walker changes address space
+    void switch_context();
+
+    /*
+     *@function: cache host translations for nested walks
+     *@param host_pwc: walk caches of the host page table, NULL if none
+     *@param ntlb_entries: entries of the nested TLB, 0 if there is none
+     */
+    void set_nested(PageWalkCache *host_pwc, uint32_t ntlb_entries,
+                    uint32_t ntlb_ways, uint32_t ntlb_lat);
+    PageWalkCache *get_host() { return host; }
+    /*
+     *@function: look the guest frame gpfn up in the nested TLB (and fill it
+     *on a miss); it never hits without one
+     *@return: latency of the lookup
+     */
+    uint64_t nested_access(Address gpfn, bool &hit);
+
+    // cuckoo walk cache of cwc_entries, none if 0
+    void set_cuckoo(uint32_t cwc_entries, uint32_t cwc_ways, uint32_t cwc_lat);
+    bool has_cuckoo() { return cuckooCache != NULL; }
+    /*
+     *@function: look the virtual region up in the cuckoo walk cache (and
+     *fill it on a miss); it never hits without one
+     *@return: latency of the lookup
+     */
+    uint64_t cuckoo_access(Address region, bool &hit);
+
+    uint64_t get_hits(PwcLevel level) { return hits[level].get(); }
+    uint64_t get_misses(PwcLevel level) { return misses[level].get(); }
+
+    // lookup counts, so a walk that starts over can take its lookups back
+    struct StatMark {
+        uint64_t hits[PWC_LEVELS];
+        uint64_t misses[PWC_LEVELS];
+        uint64_t skipped;
+    };
+    void mark_stats(StatMark &mark);
+    void rewind_stats(const StatMark &mark);
+    void initStats(AggregateStat *parentStat);
+
+  private:
+    // NULL for a level that is not cached
+    inline PwcArray *array(PwcLevel level) { return arrays[level]; }
+    // tag of the translation of level for vaddr, the level is part of it
+    // so unified arrays can hold every level. It goes in the top bits, the
+    // low ones pick the set
+    inline Address vtag(PwcLevel level, Address vaddr) {
+        return ((Address)level << 62) | (vaddr >> (48 - 9 * level));
+    }
 
-class pwc_group : public MemObject {
-    public:
-        unordered_map<string, pw_cache*> caches;
-        unordered_map<string, uint32_t> access_count;
-        unordered_map<string, uint32_t> miss_count;
-    protected:  
-        uint32_t accLat;
-        uint32_t invLat;
-    
-    public:
-        pwc_group(std::initializer_list<pw_cache*> cache_list) {
-            for (auto cache : cache_list) {
-                caches[cache->name] = cache;
-                access_count[cache->name] = 0;
-                miss_count[cache->name] = 0;
-            }
-            accLat = zinfo->pwc_accLat;
-            invLat = zinfo->pwc_invLat;
-        }
-        virtual uint64_t access(MemReq& req){return req.lineAddr;};
-        virtual uint64_t access(MemReq& req, const string& name) { 
-            access_count[name]++;
-            return caches[name]->access(req); 
-        };
+    g_string name;
+    bool unified;
+    bool skip;
+    // unified caches point every level to the same array
+    PwcArray *arrays[PWC_LEVELS];
+    uint32_t accLat;
+    uint32_t missLat;
+    Counter hits[PWC_LEVELS];
+    Counter misses[PWC_LEVELS];
+    Counter skippedReads;
+    PageWalkCache *host;
+    PwcArray *nestedTlb;
+    uint32_t nestedLat;
+    Counter nestedHits;
+    Counter nestedMisses;
+    PwcArray *cuckooCache;
+    uint32_t cuckooLat;
+    Counter cuckooHits;
+    Counter cuckooMisses;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -12,7 +12,7 @@
 // addr: virtual address
 // pg_ptr: point to page table
 int ReversedPaging::map_page_table(Address addr, Page *pg_ptr) {
-    BasePDTEntry *mapped_entry = NULL;
+    BasePDTEntry mapped_entry;
     int latency = paging->map_page_table(addr, pg_ptr, mapped_entry);
     Address vpn = addr >> (zinfo->page_shift);
     Address ppn = ((Page *)pg_ptr)->pageNo;
@@ -28,7 +28,7 @@ int ReversedPaging::map_page_table(Address addr, Page *pg_ptr) {
 
 int ReversedPaging::map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
                                    bool is_write) {
-    BasePDTEntry *mapped_entry;
+    BasePDTEntry mapped_entry;
     int latency = paging->map_page_table(addr, pg_ptr, mapped_entry);
     Address vpn = addr >> (zinfo->page_shift);
     Address ppn = ((Page *)pg_ptr)->pageNo;
@@ -50,8 +50,8 @@ int ReversedPaging::map_page_table(uint32_t req_id, Address addr, Page *pg_ptr,
 uint64_t ReversedPaging::remap_page_table(Address ppn, Address dst_ppn) {
     void *page_ptr = NULL;
     void *dst_ptr = NULL;
-    page_ptr = (void *)zinfo->memory_node->get_page_ptr(ppn);
-    dst_ptr = zinfo->memory_node->get_page_ptr(dst_ppn);
+    page_ptr = (void *)zinfo->buddy_allocator->get_page_ptr(ppn);
+    dst_ptr = zinfo->buddy_allocator->get_page_ptr(dst_ppn);
     assert(page_ptr);
     assert(dst_ptr);
     uint64_t latency = 0;
@@ -67,7 +67,7 @@ uint64_t ReversedPaging::remap_page_table(Address ppn, Address dst_ppn) {
         (reversed_pgt[dst_ppn])
             ->get_pgt_entry()
             ->set_next_level_address(dst_ptr);
-        (reversed_pgt[dst_ppn])->get_pgt_entry()->remapped_times++;
+        (reversed_pgt[dst_ppn])->get_pgt_entry()->add_remapped_time();
         reversed_pgt.erase(ppn);
 
         //(reversed_pgt[ppn])->get_pgt_entry()->clear_dirty();
@@ -47,8 +47,9 @@ class ReversedPaging : public BasePaging {
     }
     virtual Address access(MemReq &req, g_vector<MemObject *> &parents,
                            g_vector<uint32_t> &parentRTTs,
-                           BaseCoreRecorder *cRec, bool sendPTW) {
-        return paging->access(req, parents, parentRTTs, cRec, sendPTW);
+                           BaseCoreRecorder *cRec, PageWalkCache *pwc,
+                           bool sendPTW) {
+        return paging->access(req, parents, parentRTTs, cRec, pwc, sendPTW);
     }
     // /****important: find vpn according to ppn****/
     // virtual Address get_vpn( Address ppn )
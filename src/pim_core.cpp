@@ -103,6 +103,11 @@ void PIMCore::flushTlb(){
     l1d->flushTlb();
 }
 
+void PIMCore::switchTlbContext(uint32_t procIdx){
+    l1i->switchTlbContext(procIdx);
+    l1d->switchTlbContext(procIdx);
+}
+
 void PIMCore::updateTlb(Address ppn, Address new_ppn){
     if(l1i)
         l1i->updateTlb(ppn,new_ppn);
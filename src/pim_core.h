@@ -77,6 +77,7 @@ class PIMCore : public Core {
         void cSimEnd() {curCycle = cRec.cSimEnd(curCycle);}
 
         void flushTlb();
+        void switchTlbContext(uint32_t procIdx);
         void updateTlb(Address ppn, Address new_ppn);
         BaseTlb* getInsTlb();
 		BaseTlb* getDataTlb();
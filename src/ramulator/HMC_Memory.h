@@ -158,6 +158,7 @@ public:
         RoBgBaCuVaChCl,
         RoBgBaChCuVaCl,
         RoChBaBgCuVaCl,
+        CuVaRoBgBaCl, // vaults own contiguous ranges, pages can be placed
         MAX,
     } type = Type::RoChBgBaCuVaCl;
 
@@ -165,7 +166,8 @@ public:
       {"RoChBgBaCuVaCl", Type::RoChBgBaCuVaCl},
       {"RoBgBaCuVaChCl", Type::RoBgBaCuVaChCl},
       {"RoBgBaChCuVaCl", Type::RoBgBaChCuVaCl},
-      {"RoChBaBgCuVaCl", Type::RoChBaBgCuVaCl}};
+      {"RoChBaBgCuVaCl", Type::RoChBaBgCuVaCl},
+      {"CuVaRoBgBaCl", Type::CuVaRoBgBaCl}};
 
     vector<list<int>> tags_pools;
 
@@ -1464,6 +1466,26 @@ public:
                 slice_lower_bits(addr, addr_bits[int(HMC::Level::Row)]);
           }
           break;
+          case int(Type::CuVaRoBgBaCl): {
+            int max_block_col_bits =
+                spec->maxblock_entry.flit_num_bits - tx_bits;
+            addr_vec[int(HMC::Level::Column)] =
+                slice_lower_bits(addr, max_block_col_bits);
+            int column_MSB_bits =
+              slice_lower_bits(
+                  addr, addr_bits[int(HMC::Level::Column)] - max_block_col_bits);
+            addr_vec[int(HMC::Level::Column)] =
+              addr_vec[int(HMC::Level::Column)] | (column_MSB_bits << max_block_col_bits);
+            addr_vec[int(HMC::Level::Bank)] =
+                slice_lower_bits(addr, addr_bits[int(HMC::Level::Bank)]);
+            addr_vec[int(HMC::Level::BankGroup)] =
+                slice_lower_bits(addr, addr_bits[int(HMC::Level::BankGroup)]);
+            addr_vec[int(HMC::Level::Row)] =
+                slice_lower_bits(addr, addr_bits[int(HMC::Level::Row)]);
+            addr_vec[int(HMC::Level::Vault)] =
+                slice_lower_bits(addr, addr_bits[int(HMC::Level::Vault)] + cub_bits);
+          }
+          break;
           default:
               assert(false);
         }
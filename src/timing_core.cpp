@@ -108,6 +108,11 @@ void TimingCore::flushTlb(){
     l1d->flushTlb();
 }
 
+void TimingCore::switchTlbContext(uint32_t procIdx){
+    l1i->switchTlbContext(procIdx);
+    l1d->switchTlbContext(procIdx);
+}
+
 BaseTlb* TimingCore::getInsTlb(){return l1i->getTlb();}
 BaseTlb* TimingCore::getDataTlb(){return l1d->getTlb();}
 
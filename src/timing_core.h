@@ -77,6 +77,7 @@ class TimingCore : public Core {
         void cSimEnd() {curCycle = cRec.cSimEnd(curCycle);}
 
         void flushTlb();
+        void switchTlbContext(uint32_t procIdx);
         BaseTlb* getInsTlb();
 		BaseTlb* getDataTlb();
 		virtual BaseCache* getInsCache(){return (BaseCache*)(l1i);}
@@ -7,155 +7,196 @@
 /*
  * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
  */
-#define CLUSTER_TLB_H_
 #ifndef CLUSTER_TLB_H_
 #define CLUSTER_TLB_H_
-#include <set>
-#include <unordered_map>
+#include <fstream>
 
 #include "common/common_functions.h"
-#include "common/common_structures.h"
 #include "common/global_const.h"
-#include "common/trie.h"
-#include "g_std/g_list.h"
 #include "g_std/g_string.h"
-#include "g_std/g_unordered_map.h"
-#include "locks.h"
+#include "g_std/g_vector.h"
 #include "memory_hierarchy.h"
+#include "tlb/hotness_profiler.h"
+#include "tlb/private_tlb.h"
+#include "tlb/tlb_array.h"
+#include "tlb/tlb_entry.h"
+#include "tlb/tlb_shootdown.h"
 
-template <class T> class ClusterTlb : public BaseTlb {
+/*
+ * Clustered L2 TLB (Pham et al., "Increasing TLB reach by exploiting
+ * clustering in page translations", HPCA'14).
+ *
+ * Next to a regular array of page entries, a cluster array holds entries
+ * that each map an aligned group of 2^cluster_bits virtual pages whose
+ * frames fall in one aligned group of frames. On a miss the leaf PTEs that
+ * share a cache line with the missing one (read by the walk anyway) are
+ * checked: if at least min_pages of them map into the frame cluster of the
+ * missing page, they are coalesced into one cluster entry, otherwise the page
+ * goes to the regular array. Huge pages always go to the regular array.
+ *
+ * As in CommonTlb, only the owning core looks up, fills and flushes the
+ * arrays; shootdowns and updates from other cores go through the message
+ * queue of PrivateTlb. Entries of both arrays are tagged with the address
+ * space ID of their process.
+ */
+template <class T> class ClusterTlb : public PrivateTlb {
   public:
-    ClusterTlb(const g_string &name, bool enable_timing_mode, unsigned tlb_size,      
-        unsigned hit_lat, unsigned res_lat, unsigned line_shift,
-        unsigned page_shift, uint16_t cluster_size, EVICTSTYLE policy = CLUSTER)
-        : tlb_entry_num(tlb_size), hit_latency(hit_lat),
-          response_latency(res_lat), tlb_access_time(0), tlb_hit_time(0),
-          tlb_evict_time(0), tlb_name_(name),
-          enable_timing_mode(enable_timing_mode), line_shift(line_shift),
-          page_shift(page_shift), page_size(1 << page_shift),
-          evict_policy(policy), cluster_size(cluster_size) {
-        assert(tlb_size > 0);
-        tlb = gm_memalign<T *>(CACHE_LINE_BYTES, tlb_size);
-        tlb_trie.clear();
-        tlb_trie_pa.clear();
-        for (unsigned i = 0; i < tlb_size; i++) {
-            tlb[i] = new T;
-            free_entry_list.push_back(tlb[i]);
-        }
-        insert_num = 0;
-        futex_init(&tlb_lock);
+    /*
+     *@param cluster_bits: log2 of the pages a cluster entry maps, at most
+     *the PTEs of one cache line
+     *@param min_pages: pages a cluster must map to be worth an entry
+     */
+    ClusterTlb(const g_string &name, bool enable_timing_mode,
+               unsigned tlb_size, unsigned ways, unsigned cluster_entries,
+               unsigned cluster_ways, unsigned cluster_bits,
+               unsigned min_pages, unsigned hit_lat, unsigned res_lat,
+               unsigned line_shift, unsigned page_shift,
+               EVICTSTYLE policy = LRU, HashFamily *hf = NULL)
+        : enable_timing_mode(enable_timing_mode), hit_latency(hit_lat),
+          response_latency(res_lat), tlb_access_time(0), regular_hits(0),
+          cluster_hits(0), regular_fills(0), cluster_fills(0),
+          coalesced_pages(0), unclustered_lines(0), pending_hits(0),
+          pending_cycles(0), tlb_name_(name),
+          page_table_walker(NULL), next_level_tlb(NULL),
+          shootdown_engine(NULL), profiler(NULL), page_shift(page_shift),
+          line_shift(line_shift), cluster_bits(cluster_bits),
+          min_pages(min_pages), size_mask(0) {
+        assert(tlb_size > 0 && cluster_entries > 0);
+        if (cluster_bits == 0 ||
+            (1u << cluster_bits) > ClusterTlbEntry::MAX_CLUSTER)
+            panic("%s: a cluster maps 2 to %u pages, not %u", name.c_str(),
+                  ClusterTlbEntry::MAX_CLUSTER, 1u << cluster_bits);
+        regular =
+            new TlbArray<T>(tlb_size, ways ? ways : tlb_size, hf, policy);
+        clusters = new TlbArray<ClusterTlbEntry>(
+            cluster_entries, cluster_ways ? cluster_ways : cluster_entries,
+            hf, policy);
+        tlb_page_shifts(size_shift, page_shift);
     }
 
-    ~ClusterTlb() {
-        tlb_trie.clear();
-        tlb_trie_pa.clear();
-    }
     /*-------------drive simulation related---------*/
     uint64_t access(MemReq &req) {
-        tlb_access_time++;
-        Address virt_addr = req.lineAddr << line_shift;
-        Address offset = virt_addr & (page_size - 1);
-        Address vpn = virt_addr >> page_shift;
-        Address basic_vpn = vpn >> cluster_size;
-        tlb_address[basic_vpn]++;
-        T *entry = look_up(basic_vpn);//@buxin: look up the vpn in cluster TLB
+        Address vpn = (req.lineAddr << line_shift) >> page_shift;
+        if (profiler)
+            profiler->record(vpn);
         Address ppn;
-        // Cluster TLB Entry miss, look up in the regular TLB
-        if (!entry) {
-            debug_printf("cluster tlb miss: vaddr:%llx , cycle: %d ", virt_addr,
-                         req.cycle);
-            //@buxin: cluster TLB miss, now look up in the regular TLB:
-            ppn = regular_tlb->access(req);
-            //@buxin: initialize a cluster TLB Entry
-            ClusterTlbEntry new_entry(vpn, ppn);
-            insert_num++;
-            new_entry.set_valid();
-            if (req.pageShared)
-                new_entry.set_page_shared();
-            if (req.pageDirty)
-                new_entry.set_page_dirty();
-            // std::cout << "insert vpn: " << vpn << " ppn: " << ppn << std::endl;
-            insert(vpn, ppn);
-        } else // CLUSTER entry hit, now look up in the cluster entry
-        {
-            debug_printf("cluster tlb hit: vaddr:%llx , cycle: %d, look up in the entry", virt_addr,
-                         req.cycle);
-            if (enable_timing_mode)
+        bool shared, dirty;
+        unsigned shift;
+        uint64_t avail_cycle;
+        tlb_access_time++;
+        drain_messages();
+        if (find(vpn, ppn, shift, shared, dirty, avail_cycle)) {
+            if (enable_timing_mode) {
+                // the walk filling the entry is still in flight, wait for
+                // it instead of walking again
+                if (avail_cycle > req.cycle) {
+                    pending_hits++;
+                    pending_cycles += avail_cycle - req.cycle;
+                    req.cycle = avail_cycle;
+                }
                 req.cycle += hit_latency;
-            tlb_hit_time++;
-            Address ppn = -1;
-            ppn = entry->sub_look_up(vpn);
-            if(ppn != -1) ppn = (entry->basic_p_page_no << cluster_size) | ppn;
-            else {
-                //@buxin: Cluster entry hit, but the entry is not in the cluster entry
-                // now look up in the regular TLB
-                ppn = regular_tlb->access(req);
-                insert(vpn, ppn); //@buxin: update cluster TLB Entry
             }
+            req.pageShift = shift;
+            req.pageShared = shared;
+            req.pageDirty = dirty;
+        } else {
+            req.srcId = srcId;
+            req.flags = reqFlags;
+            // a shared last-level TLB walks for us on a miss
+            if (next_level_tlb)
+                ppn = next_level_tlb->access(req);
+            else
+                ppn = page_table_walker->access(req);
+            fill(req, vpn, ppn);
         }
         if (enable_timing_mode)
             req.cycle += response_latency;
-        Address plineaddr = ((ppn << page_shift) | offset) >> line_shift;
-        return plineaddr;
+        return ppn;
     }
 
-    uint32_t shootdown(Address vpn) {
-        T *entry = NULL;
-        entry = look_up(vpn);
-        if (entry) {
-            entry->set_invalid();
-            tlb_trie.erase(vpn);
-            tlb_trie_pa.erase(entry->basic_p_page_no);
-            free_entry_list.push_back(entry);
-        }
-        uint32_t shootdown_lat = 0;
-        if (enable_timing_mode)
-            shootdown_lat = hit_latency;
-        return shootdown_lat;
+    uint32_t shootdown(Address vpn, uint32_t procIdx = INVALID_PROC) {
+        post_message(TLB_MSG_SHOOTDOWN, procIdx, vpn);
+        return enable_timing_mode ? hit_latency : 0;
     }
 
-    uint32_t update_tlb_flags(Address ppn, bool shared, bool dirty) {
-        T *entry = NULL;
-        entry = look_up_pa(ppn);
-        if (entry) {
-            if (shared)
-                entry->set_page_shared();
-            if (dirty)
-                entry->set_page_dirty();
-        }
-        uint32_t set_lat = 0;
-        if (enable_timing_mode)
-            set_lat = hit_latency;
-        return set_lat;
+    uint32_t shootdown_range(Address vpn, Address pages,
+                             uint32_t procIdx = INVALID_PROC) {
+        post_message(TLB_MSG_RANGE, procIdx, vpn, pages);
+        return enable_timing_mode ? hit_latency : 0;
+    }
+
+    uint32_t update_entry(Address vpn, Address ppn,
+                          uint32_t procIdx = INVALID_PROC) {
+        post_message(TLB_MSG_UPDATE, procIdx, vpn, ppn);
+        return enable_timing_mode ? 2 * hit_latency : 0;
+    }
+
+    // owner only, like the lookups; other cores use post_flush()
+    bool flush_all() {
+        regular->clear();
+        clusters->clear();
+        size_mask = 0;
+        return true;
     }
 
-    uint32_t update_ppn(Address ppn, Address new_ppn) {
-        T *entry = NULL;
-        entry = look_up_pa(ppn);
-        if (entry) {
-            entry->update_ppn(new_ppn);
+    // drop every entry tagged with asid
+    void flush_asid(uint16_t asid) {
+        for (uint32_t i = 0; i < regular->get_num_lines(); i++) {
+            if (regular->is_valid(i) &&
+                tlb_tag_asid(regular->get_tag(i)) == asid)
+                regular->invalidate(i);
+        }
+        for (uint32_t i = 0; i < clusters->get_num_lines(); i++) {
+            if (clusters->is_valid(i) &&
+                tlb_tag_asid(clusters->get_tag(i)) == asid)
+                clusters->invalidate(i);
         }
-        uint32_t update_lat = 0;
-        if (enable_timing_mode)
-            if (entry)
-                update_lat = 2 * hit_latency;
-            else
-                update_lat = hit_latency;
-        return update_lat;
     }
-    uint32_t update_entry(Address vpn, Address ppn) {
-        T *entry = NULL;
-        entry = look_up(vpn);
-        if (entry) {
-            entry->update_ppn(ppn);
+
+    uint64_t calculate_stats(std::ofstream &vmof) {
+        uint64_t hits = regular_hits + cluster_hits;
+        uint64_t misses = tlb_access_time - hits;
+        vmof << tlb_name_ << " access time:" << tlb_access_time
+             << "\t hit time:" << hits << "\t miss time:" << misses
+             << "\t hit rate:" << (double)hits / (double)tlb_access_time
+             << std::endl;
+        // reach: base pages mapped by the entries valid at the end
+        uint64_t reach = 0, cluster_valid = 0;
+        for (uint32_t i = 0; i < regular->get_num_lines(); i++) {
+            if (regular->is_valid(i))
+                reach += 1ULL << (size_shift[tlb_tag_size(regular->get_tag(i))] -
+                                  page_shift);
         }
-        uint32_t update_lat = 0;
-        if (enable_timing_mode)
-            if (entry)
-                update_lat = 2 * hit_latency;
-            else
-                update_lat = hit_latency;
-        return update_lat;
+        for (uint32_t i = 0; i < clusters->get_num_lines(); i++) {
+            if (clusters->is_valid(i)) {
+                cluster_valid++;
+                reach += clusters->get_entry(i)->num_pages();
+            }
+        }
+        vmof << tlb_name_ << " regular hit time:" << regular_hits
+             << "\t cluster hit time:" << cluster_hits
+             << "\t regular fill time:" << regular_fills
+             << "\t cluster fill time:" << cluster_fills
+             << "\t pages per cluster fill:"
+             << (double)coalesced_pages / (double)cluster_fills
+             << "\t uncoalesced lines:" << unclustered_lines << std::endl;
+        if (pending_hits)
+            vmof << tlb_name_ << " hits on fills in flight:" << pending_hits
+                 << "\t cycles waited:" << pending_cycles << std::endl;
+        message_stats(vmof, tlb_name_);
+        vmof << tlb_name_ << " reach:" << reach << " pages"
+             << "\t entries:"
+             << regular->get_num_lines() + clusters->get_num_lines()
+             << "\t valid clusters:" << cluster_valid << std::endl;
+        regular->get_repl()->calculate_stats(vmof, tlb_name_ + " regular");
+        clusters->get_repl()->calculate_stats(vmof, tlb_name_ + " cluster");
+        return tlb_access_time;
+    }
+
+    void address_stats(std::ofstream &addrof) {
+        if (profiler)
+            profiler->report(addrof, tlb_name_.c_str());
+        addrof << "Total Virtual Page num: " << tlb_access_time << std::endl;
     }
 
     const char *getName() { return tlb_name_.c_str(); }
@@ -163,239 +204,279 @@ template <class T> class ClusterTlb : public BaseTlb {
     void set_parent(BasePageTableWalker *pg_table_walker) {
         page_table_walker = pg_table_walker;
     }
-    uint64_t get_access_time() { return tlb_access_time; }
     BasePageTableWalker *get_page_table_walker() { return page_table_walker; }
-
-    /*-------------TLB operation related------------*/
-    // TLB look up
-    /*
-     *@function: look up TLB entry from tlb according to virtual page NO. and
-     *update lru_sequence then
-     *@param vpage_no: vpage_no of entry searched;
-     *@param update_lru: default is true; when tlb hit/miss,whether update
-     *lru_sequence or not
-     *@return: poniter of found TLB entry; NULL represents that TLB miss
-     */
-    T *look_up(Address base_vpage_no) {
-        // debug_printf("look up tlb vpage_no: %llx",vpage_no);
-        // TLB hit,update lru_seq of tlb entry to the newest lru_seq
-        T *result_node = NULL;
-        futex_lock(&tlb_lock);
-        if (tlb_trie.count(base_vpage_no)) {
-            result_node = tlb_trie[base_vpage_no];
-        }
-        if (result_node && result_node->is_valid()) {
-            result_node->lru_seq = ++lru_seq;
-            result_node->update_priority();
-        }
-        futex_unlock(&tlb_lock);
-        return result_node;
+    void set_next_level_tlb(BaseTlb *tlb) { next_level_tlb = tlb; }
+    BaseTlb *get_next_level_tlb() { return next_level_tlb; }
+    void set_shootdown_engine(TlbShootdownEngine *engine) {
+        shootdown_engine = engine;
+    }
+    void set_profiler(HotnessProfiler *p) { profiler = p; }
+    uint64_t get_access_time() { return tlb_access_time; }
+    void setSourceId(uint32_t id) { srcId = id; }
+    void setFlags(uint32_t flags) { reqFlags = flags; }
+    void setLevel(int level) {
+        if (level != 2)
+            panic("%s: ClusterTlb can only be the L2 TLB", getName());
     }
 
-    T *look_up_pa(Address ppn) {
-        T *result_node = NULL;
-        futex_lock(&tlb_lock);
-        if (tlb_trie_pa.count(ppn)) {
-            result_node = tlb_trie_pa[ppn];
-        }
-        futex_unlock(&tlb_lock);
-        return result_node;
+  private:
+    uint32_t max_messages() {
+        return regular->get_num_lines() + clusters->get_num_lines();
     }
 
-    T *insert(Address vpage_no, Address ppage_no) {
-        futex_lock(&tlb_lock);
-        // insert a new entry in Cluster TLB
-        Address base_vpn = get_bits(vpage_no, cluster_size, 64);
-        Address base_ppn = get_bits(ppage_no, cluster_size, 64);
-        T entry(base_vpn, base_ppn);
-        debug_printf("insert tlb of vpage no %llx", vpage_no);
-        //@buxin: here are 3 situation: 
-        // 1. There's no base mapping in Cluster TLB: the entry can be clustered.
-        // 2. current base mapping is aligned to the entry: the entry can be clustered.
-        // 3. current base mapping is not aligned to the entry: the entry cannot be clustered, inserted into regular L2 TLB.
-        if(!tlb_trie.count(base_vpn)) {//@buxin: situation 1: no base mapping in Cluster TLB
-            // no free TLB entry
-            if (free_entry_list.empty()) {
-                tlb_evict_time++;
-                evict(); // default is CLUSTER(LRU+USABLE, refer the paper)
-            }
-            if (free_entry_list.empty() == false) {
-                T *new_entry = free_entry_list.front();
-                free_entry_list.pop_front();
-                *new_entry = entry;
-                new_entry->set_valid();
-                new_entry->lru_seq = ++lru_seq;
-                new_entry->upadte_priority();
-                tlb_trie[base_vpn] = new_entry;
-                tlb_trie_pa[base_ppn] = new_entry;
-                new_entry->update_priority();
-                // std::cout<<"insert "<<new_entry->p_page_no<<" to pa"<<std::endl;
-                futex_unlock(&tlb_lock);
-                return new_entry;
-            }
+    void apply_message(const TlbMsg &msg) {
+        uint16_t asid;
+        switch (msg.type) {
+        case TLB_MSG_SHOOTDOWN:
+            if (get_asid(msg.procIdx, asid))
+                drop_page(msg.addr, asid);
+            break;
+        case TLB_MSG_RANGE:
+            if (get_asid(msg.procIdx, asid))
+                drop_range(msg.addr, msg.new_addr, asid);
+            break;
+        case TLB_MSG_UPDATE:
+            if (get_asid(msg.procIdx, asid))
+                remap_page(msg.addr, msg.new_addr, asid);
+            break;
+        case TLB_MSG_FLUSH:
+            flush_all();
+            break;
+        default: // only posted to CommonTlb
+            break;
         }
-        else if(tlb_trie[base_vpn]->basic_p_page_no == base_ppn) {//@buxin: situation 2: base mapping is aligned to the entry
-            T *cur_entry = tlb_trie[base_vpn];
-            cur_entry->insert(vpage_no, ppage_no);
-            cur_entry->updatge_priority();
-            futex_unlock(&tlb_lock);
-            return cur_entry;
-        }
-        else {//@buxin: situation 3: base mapping is not aligned to the entry
-            regular_tlb->insert();
-            futex_unlock(&tlb_lock);
-            return NULL;
-        }
-        futex_unlock(&tlb_lock);
-        return NULL;
     }
 
-    bool is_full() {
-        if (free_entry_list->is_empty())
-            return true;
-        return false;
+    void drop_page(Address vpn, uint16_t asid) {
+        drop_regular(vpn, asid);
+        int32_t slot = find_cluster(vpn, asid);
+        if (slot >= 0) {
+            ClusterTlbEntry *entry = clusters->get_entry(slot);
+            entry->remove_page(cluster_index(vpn));
+            if (!entry->num_pages())
+                clusters->invalidate(slot);
+        }
     }
 
-    // flush all entry of TLB out
-    bool flush_all() {
-        free_entry_list.clear();
-        futex_lock(&tlb_lock);
-        tlb_trie_pa.clear();
-        tlb_trie.clear();
-        // get cleared tlb entry to free_entry_list
-        for (unsigned i = 0; i < tlb_entry_num; i++) {
-            tlb[i]->set_invalid();
-            free_entry_list.push_back(tlb[i]);
+    // one pass over the entries rather than a lookup per page
+    void drop_range(Address vpn, Address pages, uint16_t asid) {
+        for (uint32_t i = 0; i < regular->get_num_lines(); i++) {
+            Address tag = regular->get_tag(i);
+            if (regular->is_valid(i) && tlb_tag_asid(tag) == asid &&
+                tlb_tag_in_range(tag, size_shift[tlb_tag_size(tag)] - page_shift,
+                                 vpn, pages))
+                regular->invalidate(i);
+        }
+        for (uint32_t i = 0; i < clusters->get_num_lines(); i++) {
+            Address tag = clusters->get_tag(i);
+            if (!clusters->is_valid(i) || tlb_tag_asid(tag) != asid ||
+                !tlb_tag_in_range(tag, cluster_bits, vpn, pages))
+                continue;
+            ClusterTlbEntry *entry = clusters->get_entry(i);
+            Address first = tlb_tag_vpn(tag) << cluster_bits;
+            for (unsigned j = 0; j < (1u << cluster_bits); j++)
+                if (first + j >= vpn && first + j < vpn + pages)
+                    entry->remove_page(j);
+            if (!entry->num_pages())
+                clusters->invalidate(i);
         }
-        futex_unlock(&tlb_lock);
-        return true;
     }
 
-    // Cluster TLB uses the policy proposed in the paper.
-    // use update_priority() to update the priority of the entry
-    // the algorithm：priority = a * lru_seq + b * usefulness
-    virtual T *evict() {
-        T *tlb_entry = NULL;
-        if (evict_policy == CLUSTER) {
-            unsigned entry_num = cluster_evict();
-            tlb_entry = tlb[entry_num];
+    void remap_page(Address vpn, Address ppn, uint16_t asid) {
+        drop_regular(vpn, asid);
+        int32_t slot = find_cluster(vpn, asid);
+        if (slot >= 0) {
+            ClusterTlbEntry *entry = clusters->get_entry(slot);
+            unsigned i = cluster_index(vpn);
+            // the new frame may still belong to the cluster
+            if (entry->has_page(i) &&
+                (ppn >> cluster_bits) == entry->basic_p_page_no)
+                entry->add_page(i, ppn & cluster_mask(),
+                                entry->is_page_shared(i),
+                                entry->is_page_dirty(i));
+            else
+                entry->remove_page(i);
+            if (!entry->num_pages())
+                clusters->invalidate(slot);
         }
-        // evict entry in position of min_priority_entry
-        // remove handle from tlb_trie
-        assert(tlb_trie.count(tlb_entry->basic_v_page_no));
-        tlb_trie.erase(tlb_entry->basic_v_page_no);
-        tlb_trie_pa.erase(tlb_entry->basic_p_page_no);
-        // std::cout<<"tlb evict, vpn:"<<tlb_entry->v_page_no<<"
-        // ppn:"<<tlb_entry->p_page_no<<std::endl;
-        tlb_entry->set_invalid();
-        free_entry_list.push_back(tlb_entry);
-        return tlb_entry; // return physical address recorded in this tlb entry
     }
 
-    // evict entry according to priority sequence
-    unsigned cluster_evict() {
-        assert(free_entry_list.empty());
-        uint64_t min_priority_entry = 0;
-        // find the smallest lru_seq by accessing all TLB Entries' lru_seq
-        for (unsigned i = 1; i < tlb_entry_num; i++) {
-            if ((tlb[i]->is_valid()) && (tlb[i]->priority < tlb[min_priority_entry]->priority))
-                min_priority_entry = i;
-        }
-        return min_priority_entry; // return physical address recorded in this tlb
-                                // entry
+    inline Address cluster_mask() const { return (1ULL << cluster_bits) - 1; }
+    inline unsigned cluster_index(Address vpn) const {
+        return vpn & cluster_mask();
     }
 
-    bool delete_entry(Address basic_vpage_no) {
-        bool deleted = false;
-        // look up tlb entry first
-        T *delete_entry = look_up(basic_vpage_no);
-        if (delete_entry) {
-            tlb_trie.erase(delete_entry->basic_v_page_no);
-            tlb_trie_pa.erase(delete_entry->basic_p_page_no);
-            delete_entry->set_invalid();
-            free_entry_list.push_back(delete_entry);
-            deleted = true;
-        } else
-            warning("there has no entry whose virtual page num is %ld", tlb);
-        return deleted;
+    int32_t find_cluster(Address vpn, uint16_t asid) {
+        Address cvpn = vpn >> cluster_bits;
+        return clusters->lookup(tlb_tag(cvpn, TLB_4KB, asid), cvpn, false);
     }
 
-    void flush_all_noglobal() {
-        for (unsigned i = 0; i < tlb_entry_num; i++) {
-            if (!tlb[i]->global) {
-                if (tlb_trie.count(tlb[i]->basic_v_page_no))
-                    tlb_trie.erase(tlb[i]->basic_v_page_no);
-                if (tlb_trie_pa.count(tlb[i]->basic_p_page_no))
-                    tlb_trie_pa.erase(tlb[i]->basic_p_page_no);
+    // probe both arrays, both are read in parallel on hardware
+    bool find(Address vpn, Address &ppn, unsigned &shift, bool &shared,
+              bool &dirty, uint64_t &avail_cycle) {
+        Address cvpn = vpn >> cluster_bits;
+        int32_t slot =
+            clusters->lookup(tlb_tag(cvpn, TLB_4KB, cur_asid), cvpn);
+        unsigned i = cluster_index(vpn);
+        if (slot >= 0 && clusters->get_entry(slot)->has_page(i)) {
+            ClusterTlbEntry *entry = clusters->get_entry(slot);
+            ppn = entry->sub_look_up(i, cluster_bits);
+            shift = page_shift;
+            shared = entry->is_page_shared(i);
+            dirty = entry->is_page_dirty(i);
+            avail_cycle = entry->avail_cycle;
+            cluster_hits++;
+            return true;
+        }
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (!(size_mask & (1 << s)))
+                continue;
+            unsigned delta = size_shift[s] - page_shift;
+            Address spn = vpn >> delta;
+            slot = regular->lookup(tlb_tag(spn, s, cur_asid), spn);
+            if (slot >= 0) {
+                T *entry = regular->get_entry(slot);
+                ppn = (entry->p_page_no << delta) |
+                      (vpn & ((1ULL << delta) - 1));
+                shift = size_shift[s];
+                shared = entry->is_page_shared();
+                dirty = entry->is_page_dirty();
+                avail_cycle = entry->avail_cycle;
+                regular_hits++;
+                return true;
             }
         }
+        return false;
     }
 
-    uint64_t calculate_stats(std::ofstream &vmof) {
-        double tlb_hit_rate = (double)tlb_hit_time / (double)tlb_access_time;
-        double tlb_miss_rate = (double)insert_num / (double)tlb_access_time;
-        // info("%s access time:%lu \t hit time: %lu \t miss time: %lu \t evict
-        // time:%lu \t hit rate:%.3f",tlb_name_.c_str() , tlb_access_time,
-        // tlb_hit_time, (tlb_access_time - tlb_hit_time),tlb_evict_time,
-        // tlb_hit_rate);
-        vmof << tlb_name_ << " access time:" << tlb_access_time
-             << "\t hit time:" << tlb_hit_time
-             << "\t miss time:" << insert_num
-             << "\t evict time:" << tlb_evict_time
-             << "\t hit rate:" << tlb_hit_rate << std::endl;
-        return tlb_access_time;
+    void drop_regular(Address vpn, uint16_t asid) {
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (!(size_mask & (1 << s)))
+                continue;
+            Address spn = vpn >> (size_shift[s] - page_shift);
+            int32_t slot =
+                regular->lookup(tlb_tag(spn, s, asid), spn, false);
+            if (slot >= 0)
+                regular->invalidate(slot);
+        }
     }
 
-    void address_stats(std::ofstream &addrof) {
-        for (const auto& entry : tlb_address) {
-            addrof << "TLB Virtual Page: " << std::hex << entry.first << ", Count: " << std::dec <<entry.second << std::endl;
-        }
-        addrof << "Total Virtual Page num: " << tlb_access_time << std::endl;
+    void insert_regular(Address vpn, Address ppn, unsigned shift,
+                        bool shared, bool dirty, uint64_t avail_cycle) {
+        unsigned s = TLB_PAGE_SIZES;
+        for (unsigned i = 0; i < TLB_PAGE_SIZES; i++)
+            if (size_shift[i] == shift)
+                s = i;
+        if (s == TLB_PAGE_SIZES)
+            panic("%s: no TLB entries for pages of shift %u", getName(),
+                  shift);
+        unsigned delta = shift - page_shift;
+        Address spn = vpn >> delta;
+        Address tag = tlb_tag(spn, s, cur_asid);
+        if (regular->lookup(tag, spn, false) >= 0)
+            return;
+        T entry(spn, ppn >> delta);
+        entry.asid = cur_asid;
+        entry.avail_cycle = avail_cycle;
+        entry.set_valid();
+        if (shared)
+            entry.set_page_shared();
+        if (dirty)
+            entry.set_page_dirty();
+        regular->postinsert(tag, regular->preinsert(spn), entry);
+        size_mask |= 1 << s;
+        regular_fills++;
     }
 
-    void clear_counter() {
-        futex_lock(&tlb_lock);
-        for (unsigned i = 0; i < tlb_entry_num; i++) {
-            tlb[i]->clear_counter();
+    /*
+     *@function: install the translation of vpn the walk returned, coalesced
+     *with its neighbours in the PTE line when they cluster
+     */
+    void fill(MemReq &req, Address vpn, Address ppn) {
+        uint32_t n = 1 << cluster_bits;
+        Address ppns[ClusterTlbEntry::MAX_CLUSTER];
+        uint32_t shared_mask = 0, dirty_mask = 0;
+        uint32_t got = 0;
+        if (req.pageShift == page_shift)
+            got = page_table_walker->read_pte_line(vpn, ppns, n, shared_mask,
+                                                   dirty_mask);
+        // apply what was sent while we missed before filling
+        drain_messages();
+        Address cvpn = vpn >> cluster_bits;
+        Address pcluster = ppn >> cluster_bits;
+        ClusterTlbEntry entry(cvpn, pcluster);
+        entry.asid = cur_asid;
+        // the neighbours came with the same PTE line as the walked page
+        entry.avail_cycle = req.cycle;
+        if (got == n) {
+            for (uint32_t i = 0; i < n; i++) {
+                if (ppns[i] != INVALID_PAGE_ADDR &&
+                    (ppns[i] >> cluster_bits) == pcluster)
+                    entry.add_page(i, ppns[i] & cluster_mask(),
+                                   shared_mask & (1 << i),
+                                   dirty_mask & (1 << i));
+            }
+        }
+        // the walk result is authoritative for the missing page
+        entry.add_page(cluster_index(vpn), ppn & cluster_mask(),
+                       req.pageShared, req.pageDirty);
+        if (got == n && entry.num_pages() >= min_pages) {
+            entry.set_valid();
+            Address tag = tlb_tag(cvpn, TLB_4KB, cur_asid);
+            int32_t slot = clusters->lookup(tag, cvpn, false);
+            if (slot < 0)
+                slot = clusters->preinsert(cvpn);
+            clusters->postinsert(tag, slot, entry);
+            // the cluster supersedes a regular copy of the page
+            drop_regular(vpn, cur_asid);
+            cluster_fills++;
+            coalesced_pages += entry.num_pages();
+        } else {
+            if (got == n)
+                unclustered_lines++;
+            insert_regular(vpn, ppn, req.pageShift, req.pageShared,
+                           req.pageDirty, req.cycle);
+        }
+        if (shootdown_engine) {
+            // the core may hold any page of the cluster from now on
+            unsigned shift = MAX((unsigned)req.pageShift,
+                                 page_shift + cluster_bits);
+            Address delta = shift - page_shift;
+            shootdown_engine->record_fill(page_table_walker->GetProcIdx(),
+                                          (vpn >> delta) << delta,
+                                          1ULL << delta, srcId);
         }
-        futex_unlock(&tlb_lock);
     }
-    void setSourceId(uint32_t id) { srcId = id; }
-    void setFlags(uint32_t flags) { reqFlags = flags; }
 
-    // lock_t tlb_access_lock;
-    // lock_t tlb_lookup_lock;
-    // static lock_t pa_insert_lock;
     bool enable_timing_mode;
-    // number of tlb entries
-    unsigned tlb_entry_num;
     unsigned hit_latency;
     unsigned response_latency;
-    unsigned insert_num;
     // statistic data
     uint64_t tlb_access_time;
-    uint64_t tlb_hit_time;
-    uint64_t tlb_evict_time;
-    std::unordered_map<Address, uint64_t> tlb_address;
-    T **tlb;
-    g_list<T *> free_entry_list;
+    uint64_t regular_hits;
+    uint64_t cluster_hits;
+    uint64_t regular_fills;
+    uint64_t cluster_fills;
+    uint64_t coalesced_pages;   // pages mapped by the clusters filled
+    uint64_t unclustered_lines; // PTE lines too scattered to coalesce
+    uint64_t pending_hits;      // hits that merged with the walk filling them
+    uint64_t pending_cycles;
 
-    int lru_seq;
-    // tlb trie tree
-    g_unordered_map<Address, T *> tlb_trie;
-    g_unordered_map<Address, T *> tlb_trie_pa;
+    TlbArray<T> *regular;
+    TlbArray<ClusterTlbEntry> *clusters;
+    unsigned size_shift[TLB_PAGE_SIZES];
 
     g_string tlb_name_;
-    // page table walker
     BasePageTableWalker *page_table_walker;
-    // eviction policy
-    EVICTSTYLE evict_policy;
-    lock_t tlb_lock;
+    BaseTlb *next_level_tlb;
+    TlbShootdownEngine *shootdown_engine;
+    HotnessProfiler *profiler;
 
-    uint64_t page_size;
-    uint64_t page_shift;
+    unsigned page_shift;
     unsigned line_shift;
-    uint16_t cluster_size;
+    unsigned cluster_bits;
+    unsigned min_pages;
+    unsigned size_mask;
     uint32_t srcId; // should match the core
     uint32_t reqFlags;
 };
@@ -16,48 +16,87 @@
 #include "common/common_structures.h"
 #include "common/global_const.h"
 #include "common/trie.h"
-#include "g_std/g_list.h"
 #include "g_std/g_string.h"
 #include "g_std/g_unordered_map.h"
+#include "g_std/g_vector.h"
 #include "locks.h"
 #include "memory_hierarchy.h"
+#include "tlb/hotness_profiler.h"
+#include "tlb/private_tlb.h"
+#include "tlb/tlb_array.h"
+#include "tlb/tlb_prefetcher.h"
+#include "tlb/tlb_shootdown.h"
 
-template <class T> class CommonTlb : public BaseTlb {
+/*
+ * Private TLB of one core.
+ *
+ * Only the owning core looks entries up, fills and flushes them (access,
+ * insert, flush_all, switch_context). Other cores only invalidate or patch
+ * entries (shootdown, update_entry, update_ppn, update_tlb_flags) through
+ * the message queue of PrivateTlb.
+ */
+template <class T> class CommonTlb : public PrivateTlb {
   public:
+    /*
+     *@param ways: associativity of the TLB; 0 (or tlb_size) makes it fully
+     *associative
+     *@param hf: hash family used to index sets, NULL indexes sets with the
+     *low VPN bits
+     */
     CommonTlb(const g_string &name, bool enable_timing_mode, unsigned tlb_size,
-              unsigned hit_lat, unsigned res_lat, unsigned line_shift,
-              unsigned page_shift, EVICTSTYLE policy = LRU)
+              unsigned ways, unsigned hit_lat, unsigned res_lat,
+              unsigned line_shift, unsigned page_shift,
+              EVICTSTYLE policy = LRU, HashFamily *hf = NULL)
         : tlb_entry_num(tlb_size), hit_latency(hit_lat),
           response_latency(res_lat), tlb_access_time(0), tlb_hit_time(0),
-          tlb_evict_time(0), tlb_name_(name),
+          tlb_evict_time(0), pending_hits(0), pending_cycles(0), tlb_name_(name),
           enable_timing_mode(enable_timing_mode), line_shift(line_shift),
           page_shift(page_shift), page_size(1 << page_shift),
-          evict_policy(policy) {
+          evict_policy(policy), page_table_walker(NULL),
+          next_level_tlb(NULL), shootdown_engine(NULL), profiler(NULL),
+          prefetch_unit(NULL), demand_walks(0), walk_cycles(0), size_mask(0) {
         assert(tlb_size > 0);
-        tlb = gm_memalign<T *>(CACHE_LINE_BYTES, tlb_size);
-        tlb_trie.clear();
-        tlb_trie_pa.clear();
-        for (unsigned i = 0; i < tlb_size; i++) {
-            tlb[i] = new T;
-            free_entry_list.push_back(tlb[i]);
+        if (ways == 0)
+            ways = tlb_size;
+        tlb = new TlbArray<T>(tlb_size, ways, hf, policy);
+        // every page size shares the base array until it gets its own
+        tlb_page_shifts(size_shift, page_shift);
+        for (unsigned i = 0; i < TLB_PAGE_SIZES; i++) {
+            arrays[i] = tlb;
+            size_hit[i] = 0;
+            size_fill[i] = 0;
         }
+        tlb_trie_pa.clear();
         insert_num = 0;
-        futex_init(&tlb_lock);
     }
 
-    ~CommonTlb() {
-        tlb_trie.clear();
-        tlb_trie_pa.clear();
+    ~CommonTlb() { tlb_trie_pa.clear(); }
+
+    /*
+     *@function: give one page size a dedicated array instead of keeping it
+     *in the base (unified) array, e.g. the 32-entry 2MB L1 DTLB of Skylake
+     */
+    void add_page_size_array(TlbPageSize size, unsigned entries, unsigned ways,
+                             HashFamily *hf = NULL) {
+        assert(size < TLB_PAGE_SIZES && entries > 0);
+        if (ways == 0)
+            ways = entries;
+        arrays[size] = new TlbArray<T>(entries, ways, hf, evict_policy);
+        tlb_entry_num += entries;
     }
+
     /*-------------drive simulation related---------*/
     uint64_t access(MemReq &req) {
         // debug_printf("now comes to %d level tlb access\n", tlb_level);
         tlb_access_time++;
+        drain_messages();
         Address virt_addr = req.lineAddr << line_shift;
         Address offset = virt_addr & (page_size - 1);
         Address vpn = virt_addr >> page_shift;
-        tlb_address[vpn]++;
-        T *entry = look_up(vpn);
+        if (profiler)
+            profiler->record(vpn);
+        unsigned size;
+        T *entry = look_up(vpn, size, cur_asid);
         Address ppn;
         // TLB miss
         if (!entry) {
@@ -69,27 +108,73 @@ template <class T> class CommonTlb : public BaseTlb {
             } else if(tlb_level == 2) {
                 req.srcId = srcId;
                 req.flags = reqFlags;
-                // debug_printf("miss incurs in l2 tlb, now start PTW\n");
-                ppn = page_table_walker->access(req);
+                TlbPrefetchEntry pf;
+                if (prefetch_unit &&
+                    prefetch_unit->take(vpn, cur_asid, req.cycle, pf)) {
+                    // only wait for the prefetch walk if it is in flight
+                    if (enable_timing_mode && pf.ready_cycle > req.cycle)
+                        req.cycle = pf.ready_cycle;
+                    unsigned delta = pf.page_shift - page_shift;
+                    ppn = pf.ppn | (vpn & ((1ULL << delta) - 1));
+                    req.pageShift = pf.page_shift;
+                    req.pageShared = pf.shared;
+                    req.pageDirty = pf.dirty;
+                } else {
+                    uint64_t walk_start = req.cycle;
+                    // debug_printf("miss incurs in l2 tlb, now start PTW\n");
+                    // a shared last-level TLB walks for us on a miss
+                    if (next_level_tlb)
+                        ppn = next_level_tlb->access(req);
+                    else
+                        ppn = page_table_walker->access(req);
+                    demand_walks++;
+                    walk_cycles += req.cycle - walk_start;
+                }
+                if (prefetch_unit)
+                    issue_prefetches(req, vpn);
             }
-            // update TLB
-            T new_entry(vpn, ppn);
+            // apply what was sent while we missed before filling
+            drain_messages();
+            // update TLB, in the array of the page size the walk found
+            size = get_page_size(req.pageShift);
+            unsigned delta = size_shift[size] - page_shift;
+            T new_entry(vpn >> delta, ppn >> delta);
+            new_entry.asid = cur_asid;
+            new_entry.avail_cycle = req.cycle;
             insert_num++;
+            size_fill[size]++;
             new_entry.set_valid();
             if (req.pageShared)
                 new_entry.set_page_shared();
             if (req.pageDirty)
                 new_entry.set_page_dirty();
             // std::cout << "insert vpn: " << vpn << " ppn: " << ppn << std::endl;
-            insert(vpn, new_entry);
+            insert(vpn >> delta, new_entry, size, cur_asid);
+            // the core may hold the translation from now on
+            if (tlb_level == 2 && shootdown_engine)
+                shootdown_engine->record_fill(
+                    page_table_walker->GetProcIdx(), (vpn >> delta) << delta,
+                    1ULL << delta, srcId);
         } else // TLB hit
         {
             debug_printf("tlb hit: vaddr:%llx , cycle: %d ", virt_addr,
                          req.cycle);
-            if (enable_timing_mode)
+            if (enable_timing_mode) {
+                // the walk filling the entry is still in flight, wait for
+                // it instead of walking again
+                if (entry->avail_cycle > req.cycle) {
+                    pending_hits++;
+                    pending_cycles += entry->avail_cycle - req.cycle;
+                    req.cycle = entry->avail_cycle;
+                }
                 req.cycle += hit_latency;
+            }
             tlb_hit_time++;
-            ppn = entry->p_page_no;
+            size_hit[size]++;
+            // base page number inside the (possibly larger) page
+            unsigned delta = size_shift[size] - page_shift;
+            ppn = (entry->p_page_no << delta) | (vpn & ((1ULL << delta) - 1));
+            req.pageShift = size_shift[size];
             req.pageShared = entry->is_page_shared();
             req.pageDirty = entry->is_page_dirty();
         }
@@ -101,30 +186,30 @@ template <class T> class CommonTlb : public BaseTlb {
         else if(tlb_level == 2) return ppn;
     }
 
-    uint32_t shootdown(Address vpn) {
-        T *entry = NULL;
-        entry = look_up(vpn);
-        if (entry) {
-            entry->set_invalid();
-            tlb_trie.erase(vpn);
-            tlb_trie_pa.erase(entry->p_page_no);
-            free_entry_list.push_back(entry);
-        }
+    uint32_t shootdown(Address vpn, uint32_t procIdx = INVALID_PROC) {
+        post_message(TLB_MSG_SHOOTDOWN, procIdx, vpn);
         uint32_t shootdown_lat = 0;
         if (enable_timing_mode)
             shootdown_lat = hit_latency;
+        // the private L2 is invalidated through the L1s
+        if (tlb_level == 1 && next_level_tlb)
+            shootdown_lat =
+                MAX(shootdown_lat, next_level_tlb->shootdown(vpn, procIdx));
+        return shootdown_lat;
+    }
+
+    uint32_t shootdown_range(Address vpn, Address pages,
+                             uint32_t procIdx = INVALID_PROC) {
+        post_message(TLB_MSG_RANGE, procIdx, vpn, pages);
+        uint32_t shootdown_lat = enable_timing_mode ? hit_latency : 0;
+        if (tlb_level == 1 && next_level_tlb)
+            shootdown_lat = MAX(shootdown_lat, next_level_tlb->shootdown_range(
+                                                   vpn, pages, procIdx));
         return shootdown_lat;
     }
 
     uint32_t update_tlb_flags(Address ppn, bool shared, bool dirty) {
-        T *entry = NULL;
-        entry = look_up_pa(ppn);
-        if (entry) {
-            if (shared)
-                entry->set_page_shared();
-            if (dirty)
-                entry->set_page_dirty();
-        }
+        post_message(TLB_MSG_FLAGS, INVALID_PROC, ppn, 0, shared, dirty);
         uint32_t set_lat = 0;
         if (enable_timing_mode)
             set_lat = hit_latency;
@@ -132,32 +217,19 @@ template <class T> class CommonTlb : public BaseTlb {
     }
 
     uint32_t update_ppn(Address ppn, Address new_ppn) {
-        T *entry = NULL;
-        entry = look_up_pa(ppn);
-        if (entry) {
-            entry->update_ppn(new_ppn);
-        }
-        uint32_t update_lat = 0;
-        if (enable_timing_mode)
-            if (entry)
-                update_lat = 2 * hit_latency;
-            else
-                update_lat = hit_latency;
-        return update_lat;
-    }
-    uint32_t update_entry(Address vpn, Address ppn) {
-        T *entry = NULL;
-        entry = look_up(vpn);
-        if (entry) {
-            entry->update_ppn(ppn);
-        }
-        uint32_t update_lat = 0;
-        if (enable_timing_mode)
-            if (entry)
-                update_lat = 2 * hit_latency;
-            else
-                update_lat = hit_latency;
-        return update_lat;
+        post_message(TLB_MSG_UPDATE_PPN, INVALID_PROC, ppn, new_ppn);
+        // lookup and rewrite, whether or not the owner still holds it
+        return enable_timing_mode ? 2 * hit_latency : 0;
+    }
+
+    uint32_t update_entry(Address vpn, Address ppn,
+                          uint32_t procIdx = INVALID_PROC) {
+        uint32_t next_lat = 0;
+        if (tlb_level == 1 && next_level_tlb)
+            next_lat = next_level_tlb->update_entry(vpn, ppn, procIdx);
+        post_message(TLB_MSG_UPDATE, procIdx, vpn, ppn);
+        uint32_t update_lat = enable_timing_mode ? 2 * hit_latency : 0;
+        return MAX(update_lat, next_lat);
     }
 
     const char *getName() { return tlb_name_.c_str(); }
@@ -166,6 +238,14 @@ template <class T> class CommonTlb : public BaseTlb {
         page_table_walker = pg_table_walker;
     }
     void set_next_level_tlb(BaseTlb *tlb) { next_level_tlb = tlb;}
+    // optional hot page profile, NULL (off) by default
+    void set_profiler(HotnessProfiler *p) { profiler = p; }
+    // prefetch stage between this (L2) TLB and the walker, NULL for none
+    void set_prefetch_unit(TlbPrefetchUnit *unit) { prefetch_unit = unit; }
+    // sharer tracking for shootdowns, fed by the last private level
+    void set_shootdown_engine(TlbShootdownEngine *engine) {
+        shootdown_engine = engine;
+    }
     BaseTlb *get_next_level_tlb() { return next_level_tlb; }
     
     uint64_t get_access_time() { return tlb_access_time; }
@@ -176,139 +256,153 @@ template <class T> class CommonTlb : public BaseTlb {
     // TLB look up
     /*
      *@function: look up TLB entry from tlb according to virtual page NO. and
-     *update lru_sequence then
-     *@param vpage_no: vpage_no of entry searched;
+     *update its replacement state then
+     *@param vpage_no: vpage_no of entry searched, in base pages;
+     *@param size: page size of the entry that covers vpage_no
+     *@param asid: address space the translation belongs to
      *@param update_lru: default is true; when tlb hit/miss,whether update
-     *lru_sequence or not
+     *replacement state or not
      *@return: poniter of found TLB entry; NULL represents that TLB miss
      */
-    T *look_up(Address vpage_no, bool update_lru = true) {
+    T *look_up(Address vpage_no, unsigned &size, uint16_t asid,
+               bool update_lru = true) {
         // debug_printf("look up tlb vpage_no: %llx",vpage_no);
-        // TLB hit,update lru_seq of tlb entry to the newest lru_seq
         T *result_node = NULL;
-        futex_lock(&tlb_lock);
-        if (tlb_trie.count(vpage_no)) {
-            result_node = tlb_trie[vpage_no];
-        }
-        if (result_node && result_node->is_valid() && update_lru) {
-            result_node->lru_seq = ++lru_seq;
-        }
-        futex_unlock(&tlb_lock);
+        int32_t slot = find(vpage_no, size, update_lru, asid);
+        if (slot >= 0)
+            result_node = arrays[size]->get_entry(slot);
         return result_node;
     }
 
+    T *look_up(Address vpage_no, bool update_lru = true) {
+        unsigned size;
+        return look_up(vpage_no, size, cur_asid, update_lru);
+    }
+
     T *look_up_pa(Address ppn) {
         T *result_node = NULL;
-        futex_lock(&tlb_lock);
-        if (tlb_trie_pa.count(ppn)) {
-            result_node = tlb_trie_pa[ppn];
-        }
-        futex_unlock(&tlb_lock);
+        unsigned size;
+        int32_t slot = find_pa(ppn, size);
+        if (slot >= 0)
+            result_node = arrays[size]->get_entry(slot);
         return result_node;
     }
 
-    T *insert(Address vpage_no, T &entry) {
-        futex_lock(&tlb_lock);
+    /*
+     *@param vpage_no: page number in units of the page size
+     */
+    T *insert(Address vpage_no, T &entry, unsigned size = TLB_4KB,
+              uint16_t asid = 0) {
+        TlbArray<T> *array = arrays[size];
+        Address tag = tlb_tag(vpage_no, size, asid);
         // whether entry is already exists
         debug_printf("insert tlb of vpage no %llx in %s", vpage_no, tlb_name_.c_str());
-        assert(!tlb_trie.count(vpage_no));
-        // no free TLB entry
-        if (free_entry_list.empty()) {
+        assert(array->lookup(tag, vpage_no, false) < 0);
+        uint32_t slot = array->preinsert(vpage_no);
+        // no free TLB entry in the set
+        if (array->is_valid(slot)) {
             tlb_evict_time++;
-            evict(); // default is LRU
-        }
-        if (free_entry_list.empty() == false) {
-            T *new_entry = free_entry_list.front();
-            free_entry_list.pop_front();
-            *new_entry = entry;
-            new_entry->set_valid();
-            new_entry->lru_seq = ++lru_seq;
-            tlb_trie[vpage_no] = new_entry;
-            tlb_trie_pa[new_entry->p_page_no] = new_entry;
-            // std::cout<<"insert "<<new_entry->p_page_no<<" to pa"<<std::endl;
-            futex_unlock(&tlb_lock);
-            return new_entry;
+            evict(size, slot);
         }
-        futex_unlock(&tlb_lock);
-        return NULL;
+        array->postinsert(tag, slot, entry);
+        size_mask |= (1 << size);
+        T *new_entry = array->get_entry(slot);
+        new_entry->set_valid();
+        tlb_trie_pa[pa_key(new_entry->p_page_no, size)] = slot;
+        return new_entry;
     }
 
-    bool is_full() {
-        if (free_entry_list->is_empty())
-            return true;
-        return false;
-    }
-
-    // flush all entry of TLB out
+    // flush all entry of TLB out; owner only, other cores use post_flush()
     bool flush_all() {
-        free_entry_list.clear();
-        futex_lock(&tlb_lock);
+        if (prefetch_unit)
+            prefetch_unit->clear();
         tlb_trie_pa.clear();
-        tlb_trie.clear();
-        // get cleared tlb entry to free_entry_list
-        for (unsigned i = 0; i < tlb_entry_num; i++) {
-            tlb[i]->set_invalid();
-            free_entry_list.push_back(tlb[i]);
-        }
-        futex_unlock(&tlb_lock);
+        for (unsigned i = 0; i < TLB_PAGE_SIZES; i++)
+            if (i == TLB_4KB || arrays[i] != tlb)
+                arrays[i]->clear();
+        size_mask = 0;
         return true;
     }
 
-    // default is LRU
-    virtual T *evict() {
-        T *tlb_entry = NULL;
-        if (evict_policy == LRU) {
-            unsigned entry_num = lru_evict();
-            tlb_entry = tlb[entry_num];
-        }
-        // evict entry in position of min_lru_entry
-        // remove handle from tlb_trie
-        assert(tlb_trie.count(tlb_entry->v_page_no));
-        tlb_trie.erase(tlb_entry->v_page_no);
-        tlb_trie_pa.erase(tlb_entry->p_page_no);
+    /*
+     *@function: drop the entry in slot of the array holding page size
+     *size_hint; the entry's own size is taken from its tag, since arrays
+     *can be shared between page sizes
+     */
+    virtual T *evict(unsigned size_hint, uint32_t slot) {
+        TlbArray<T> *array = arrays[size_hint];
+        T *tlb_entry = array->get_entry(slot);
         // std::cout<<"tlb evict, vpn:"<<tlb_entry->v_page_no<<"
         // ppn:"<<tlb_entry->p_page_no<<std::endl;
-        tlb_entry->set_invalid();
-        free_entry_list.push_back(tlb_entry);
-        return tlb_entry; // return physical address recorded in this tlb entry
-    }
-
-    // evict entry according to lru sequence
-    unsigned lru_evict() {
-        assert(free_entry_list.empty());
-        uint64_t min_lru_entry = 0;
-        // find the smallest lru_seq by accessing all TLB Entries' lru_seq
-        for (unsigned i = 1; i < tlb_entry_num; i++) {
-            if ((tlb[i]->is_valid()) &&
-                (tlb[i]->lru_seq < tlb[min_lru_entry]->lru_seq))
-                min_lru_entry = i;
-        }
-        return min_lru_entry; // return physical address recorded in this tlb
-                              // entry
+        unlink_pa(tlb_entry->p_page_no, tlb_tag_size(array->get_tag(slot)), slot);
+        array->invalidate(slot);
+        return tlb_entry;
     }
 
-    bool delete_entry(Address vpage_no) {
+    bool delete_entry(Address vpage_no, uint16_t asid) {
         bool deleted = false;
-        // look up tlb entry first
-        T *delete_entry = look_up(vpage_no);
-        if (delete_entry) {
-            tlb_trie.erase(delete_entry->v_page_no);
-            tlb_trie_pa.erase(delete_entry->p_page_no);
-            delete_entry->set_invalid();
-            free_entry_list.push_back(delete_entry);
+        unsigned size;
+        int32_t slot = find(vpage_no, size, false, asid);
+        if (slot >= 0) {
+            evict(size, slot);
             deleted = true;
-        } else
-            warning("there has no entry whose virtual page num is %ld", tlb);
+        }
         return deleted;
     }
 
+    // one pass over the entries rather than a lookup per page
+    void delete_range(Address vpn, Address pages, uint16_t asid) {
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (s != TLB_4KB && arrays[s] == tlb)
+                continue;
+            TlbArray<T> *array = arrays[s];
+            for (unsigned i = 0; i < array->get_num_lines(); i++) {
+                Address tag = array->get_tag(i);
+                if (array->is_valid(i) && tlb_tag_asid(tag) == asid &&
+                    tlb_tag_in_range(tag,
+                                     size_shift[tlb_tag_size(tag)] - page_shift,
+                                     vpn, pages))
+                    evict(s, i);
+            }
+        }
+    }
+
     void flush_all_noglobal() {
-        for (unsigned i = 0; i < tlb_entry_num; i++) {
-            if (!tlb[i]->global) {
-                if (tlb_trie.count(tlb[i]->v_page_no))
-                    tlb_trie.erase(tlb[i]->v_page_no);
-                if (tlb_trie_pa.count(tlb[i]->p_page_no))
-                    tlb_trie_pa.erase(tlb[i]->p_page_no);
+        if (prefetch_unit)
+            prefetch_unit->clear();
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (s != TLB_4KB && arrays[s] == tlb)
+                continue;
+            TlbArray<T> *array = arrays[s];
+            for (unsigned i = 0; i < array->get_num_lines(); i++) {
+                if (array->is_valid(i) &&
+                    !array->get_entry(i)->is_page_global())
+                    evict(s, i);
+            }
+        }
+    }
+
+    void switch_context(uint32_t procIdx) {
+        if (tlb_level != 1 || !next_level_tlb) {
+            PrivateTlb::switch_context(procIdx);
+            return;
+        }
+        // counted once per core, by the L2 both L1 TLBs forward this to
+        change_context(procIdx);
+        next_level_tlb->switch_context(procIdx);
+    }
+
+    // drop every entry tagged with asid
+    void flush_asid(uint16_t asid) {
+        if (prefetch_unit)
+            prefetch_unit->clear();
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (s != TLB_4KB && arrays[s] == tlb)
+                continue;
+            TlbArray<T> *array = arrays[s];
+            for (unsigned i = 0; i < array->get_num_lines(); i++) {
+                if (array->is_valid(i) && tlb_tag_asid(array->get_tag(i)) == asid)
+                    evict(s, i);
             }
         }
     }
@@ -325,26 +419,217 @@ template <class T> class CommonTlb : public BaseTlb {
              << "\t miss time:" << insert_num
              << "\t evict time:" << tlb_evict_time
              << "\t hit rate:" << tlb_hit_rate << std::endl;
+        if (pending_hits)
+            vmof << tlb_name_ << " hits on fills in flight:" << pending_hits
+                 << "\t cycles waited:" << pending_cycles << std::endl;
+        if (prefetch_unit)
+            prefetch_unit->calculate_stats(vmof, tlb_name_);
+        message_stats(vmof, tlb_name_);
+        static const char *size_names[TLB_PAGE_SIZES] = {"4KB", "2MB", "1GB"};
+        tlb->get_repl()->calculate_stats(vmof, tlb_name_);
+        for (unsigned i = 0; i < TLB_PAGE_SIZES; i++) {
+            if (arrays[i] != tlb)
+                arrays[i]->get_repl()->calculate_stats(
+                    vmof, tlb_name_ + " " + size_names[i]);
+            if (!size_hit[i] && !size_fill[i])
+                continue;
+            vmof << tlb_name_ << " " << size_names[i]
+                 << (arrays[i] == tlb && i != TLB_4KB ? " (unified)" : "")
+                 << " hit time:" << size_hit[i]
+                 << "\t fill time:" << size_fill[i] << std::endl;
+        }
         return tlb_access_time;
     }
 
     void address_stats(std::ofstream &addrof) {
-        for (const auto& entry : tlb_address) {
-            addrof << "TLB Virtual Page: " << std::hex << entry.first << ", Count: " << std::dec <<entry.second << std::endl;
-        }
+        if (profiler)
+            profiler->report(addrof, tlb_name_.c_str());
         addrof << "Total Virtual Page num: " << tlb_access_time << std::endl;
     }
 
     void clear_counter() {
-        futex_lock(&tlb_lock);
-        for (unsigned i = 0; i < tlb_entry_num; i++) {
-            tlb[i]->clear_counter();
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (s != TLB_4KB && arrays[s] == tlb)
+                continue;
+            for (unsigned i = 0; i < arrays[s]->get_num_lines(); i++)
+                arrays[s]->get_entry(i)->clear_counter();
         }
-        futex_unlock(&tlb_lock);
     }
     void setSourceId(uint32_t id) { srcId = id; }
     void setFlags(uint32_t flags) { reqFlags = flags; }
     void setLevel(int level) { tlb_level = level; }
+
+  private:
+    uint32_t max_messages() { return tlb_entry_num; }
+
+    void apply_message(const TlbMsg &msg) {
+        uint16_t asid;
+        unsigned size;
+        int32_t slot;
+        // prefetched translations are dropped rather than patched
+        if (prefetch_unit) {
+            if (msg.type == TLB_MSG_SHOOTDOWN || msg.type == TLB_MSG_UPDATE)
+                prefetch_unit->invalidate_vpn(msg.addr);
+            else if (msg.type == TLB_MSG_RANGE)
+                prefetch_unit->invalidate_range(msg.addr, msg.new_addr);
+            else if (msg.type != TLB_MSG_FLUSH)
+                prefetch_unit->invalidate_ppn(msg.addr);
+        }
+        switch (msg.type) {
+        case TLB_MSG_SHOOTDOWN:
+            if (get_asid(msg.procIdx, asid))
+                delete_entry(msg.addr, asid);
+            break;
+        case TLB_MSG_RANGE:
+            if (get_asid(msg.procIdx, asid))
+                delete_range(msg.addr, msg.new_addr, asid);
+            break;
+        case TLB_MSG_UPDATE:
+            if (!get_asid(msg.procIdx, asid))
+                break;
+            slot = find(msg.addr, size, false, asid);
+            if (slot >= 0)
+                remap(size, slot, msg.new_addr);
+            break;
+        case TLB_MSG_UPDATE_PPN:
+            slot = find_pa(msg.addr, size);
+            if (slot >= 0)
+                remap(size, slot, msg.new_addr);
+            break;
+        case TLB_MSG_FLAGS:
+            slot = find_pa(msg.addr, size);
+            if (slot >= 0) {
+                T *entry = arrays[size]->get_entry(slot);
+                if (msg.shared)
+                    entry->set_page_shared();
+                if (msg.dirty)
+                    entry->set_page_dirty();
+            }
+            break;
+        case TLB_MSG_FLUSH:
+            flush_all();
+            break;
+        }
+    }
+
+    /*
+     *@function: walk the pages the prefetcher proposes after a miss on vpn,
+     *off the critical path, and park them in the prefetch buffer
+     */
+    void issue_prefetches(const MemReq &req, Address vpn) {
+        prefetch_candidates.clear();
+        prefetch_unit->train(vpn, prefetch_candidates);
+        // without timing a prefetch lands about one average walk after the
+        // miss
+        uint64_t walk_lat = demand_walks ? walk_cycles / demand_walks : 0;
+        unsigned addr_bits =
+            va_bits(page_table_walker->GetPaging()->get_paging_style());
+        for (Address cand : prefetch_candidates) {
+            unsigned size;
+            // strides may run off either end of the address space
+            if (cand >> (addr_bits - page_shift))
+                continue;
+            if (find(cand, size, false, cur_asid) >= 0 ||
+                prefetch_unit->contains(cand, cur_asid)) {
+                prefetch_unit->count_redundant();
+                continue;
+            }
+            MESIState state = MESIState::I;
+            MemReq pf_req = {(cand << page_shift) >> line_shift,
+                             GETS, 0, &state, req.cycle, NULL, state, srcId,
+                             reqFlags | MemReq::PREFETCH};
+            pf_req.threadId = req.threadId;
+            pf_req.isPIMInst = req.isPIMInst;
+            Address pf_ppn = page_table_walker->prefetch(pf_req);
+            if (pf_ppn == PAGE_FAULT_SIG) {
+                prefetch_unit->count_fault();
+                continue;
+            }
+            unsigned delta = pf_req.pageShift - page_shift;
+            TlbPrefetchEntry entry;
+            entry.vpn = (cand >> delta) << delta;
+            entry.ppn = (pf_ppn >> delta) << delta;
+            entry.ready_cycle =
+                pf_req.cycle > req.cycle ? pf_req.cycle : req.cycle + walk_lat;
+            entry.page_shift = pf_req.pageShift;
+            entry.asid = cur_asid;
+            entry.shared = pf_req.pageShared;
+            entry.dirty = pf_req.pageDirty;
+            prefetch_unit->fill(entry);
+            // buffered translations must be shot down too
+            if (shootdown_engine)
+                shootdown_engine->record_fill(page_table_walker->GetProcIdx(),
+                                              entry.vpn, 1ULL << delta, srcId);
+        }
+    }
+
+    // point the entry in slot to base page ppn
+    void remap(unsigned size, uint32_t slot, Address ppn) {
+        if (size_shift[size] != page_shift) {
+            // one base page of a larger page moved, the entry is stale
+            evict(size, slot);
+            return;
+        }
+        T *entry = arrays[size]->get_entry(slot);
+        unlink_pa(entry->p_page_no, size, slot);
+        entry->update_ppn(ppn);
+        tlb_trie_pa[pa_key(ppn, size)] = slot;
+    }
+
+    static inline Address pa_key(Address ppn, unsigned size) {
+        return (ppn << 2) | size;
+    }
+
+    inline unsigned get_page_size(unsigned shift) {
+        for (unsigned i = 0; i < TLB_PAGE_SIZES; i++)
+            if (size_shift[i] == shift)
+                return i;
+        panic("%s: no TLB array for pages of shift %u", tlb_name_.c_str(),
+              shift);
+    }
+
+    /*
+     *@function: probe every page size that has entries in the TLB
+     *@param vpn: virtual page number in base pages
+     */
+    int32_t find(Address vpn, unsigned &size, bool update_lru,
+                 uint16_t asid) {
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (!(size_mask & (1 << s)))
+                continue;
+            Address spn = vpn >> (size_shift[s] - page_shift);
+            int32_t slot =
+                arrays[s]->lookup(tlb_tag(spn, s, asid), spn, update_lru);
+            if (slot >= 0) {
+                size = s;
+                return slot;
+            }
+        }
+        return -1;
+    }
+
+    int32_t find_pa(Address ppn, unsigned &size) {
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (!(size_mask & (1 << s)))
+                continue;
+            auto it = tlb_trie_pa.find(
+                pa_key(ppn >> (size_shift[s] - page_shift), s));
+            if (it != tlb_trie_pa.end()) {
+                size = s;
+                return it->second;
+            }
+        }
+        return -1;
+    }
+
+    // drop the reverse mapping of ppn if it still refers to slot
+    inline void unlink_pa(Address ppn, unsigned size, uint32_t slot) {
+        auto it = tlb_trie_pa.find(pa_key(ppn, size));
+        if (it != tlb_trie_pa.end() && it->second == slot)
+            tlb_trie_pa.erase(it);
+    }
+
+  public:
     // lock_t tlb_access_lock;
     // lock_t tlb_lookup_lock;
     // static lock_t pa_insert_lock;
@@ -358,24 +643,34 @@ template <class T> class CommonTlb : public BaseTlb {
     uint64_t tlb_access_time;
     uint64_t tlb_hit_time;
     uint64_t tlb_evict_time;
-    std::unordered_map<Address, uint64_t> tlb_address;
-    T **tlb;
-    g_list<T *> free_entry_list;
-
-    int lru_seq;
-    // tlb trie tree
-    g_unordered_map<Address, T *> tlb_trie;
-    g_unordered_map<Address, T *> tlb_trie_pa;
+    uint64_t pending_hits; // hits that merged with the walk filling them
+    uint64_t pending_cycles;
+    uint64_t size_hit[TLB_PAGE_SIZES];
+    uint64_t size_fill[TLB_PAGE_SIZES];
+    // base set-associative tag/entry arrays
+    TlbArray<T> *tlb;
+    // array holding each page size, the base array unless split off
+    TlbArray<T> *arrays[TLB_PAGE_SIZES];
+    unsigned size_shift[TLB_PAGE_SIZES];
+    // page sizes that have been inserted, the only ones a lookup probes
+    unsigned size_mask;
+    // reverse (ppn -> slot) index for flag and ppn updates
+    g_unordered_map<Address, uint32_t> tlb_trie_pa;
 
     g_string tlb_name_;
     int tlb_level;
     // page table walker
     BasePageTableWalker *page_table_walker;
     BaseTlb *next_level_tlb;
+    TlbShootdownEngine *shootdown_engine;
+    HotnessProfiler *profiler;
+    TlbPrefetchUnit *prefetch_unit;
+    g_vector<Address> prefetch_candidates;
+    // demand walks and their latency, to time prefetch walks
+    uint64_t demand_walks;
+    uint64_t walk_cycles;
     // eviction policy
     EVICTSTYLE evict_policy;
-    lock_t tlb_lock;
-
     uint64_t page_size;
     uint64_t page_shift;
     unsigned line_shift;
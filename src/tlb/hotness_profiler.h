@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
+ */
+#ifndef HOTNESS_PROFILER_H_
+#define HOTNESS_PROFILER_H_
+#include <algorithm>
+#include <fstream>
+
+#include "bithacks.h"
+#include "common/global_const.h"
+#include "g_std/g_unordered_map.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "hash.h"
+#include "log.h"
+
+/*
+ * Bounded-memory profile of the hottest pages a TLB or page table walker
+ * translates.
+ *
+ * Every sample_period-th access is counted in a Count-Min sketch of depth x
+ * width counters (conservative update, so estimates only overcount by
+ * colliding pages), and a min-heap keeps the top_k pages by estimated count.
+ * Memory is fixed at construction, no matter how large the footprint is.
+ */
+class HotnessProfiler : public GlobAlloc {
+  public:
+    HotnessProfiler(uint32_t width, uint32_t depth, uint32_t top_k,
+                    uint32_t sample_period, uint64_t seed)
+        : width(width), depth(depth), top_k(top_k),
+          sample_period(sample_period), countdown(sample_period),
+          accesses(0), samples(0) {
+        if (!isPow2(width))
+            panic("hotness profiler width %u is not a power of two", width);
+        assert(depth > 0 && depth <= MAX_DEPTH);
+        assert(top_k > 0 && sample_period > 0);
+        hf = new H3HashFamily(depth, ilog2(width), seed);
+        counters = gm_calloc<uint64_t>((uint64_t)width * depth);
+        heap.reserve(top_k);
+    }
+
+    inline void record(Address page) {
+        accesses++;
+        if (--countdown)
+            return;
+        countdown = sample_period;
+        samples++;
+        uint64_t *row_counters[MAX_DEPTH];
+        uint64_t estimate = ~0ULL;
+        for (uint32_t d = 0; d < depth; d++) {
+            row_counters[d] =
+                &counters[d * width + (hf->hash(d, page) & (width - 1))];
+            estimate = MIN(estimate, *row_counters[d]);
+        }
+        // conservative update: only raise the counters at the minimum
+        estimate++;
+        for (uint32_t d = 0; d < depth; d++)
+            *row_counters[d] = MAX(*row_counters[d], estimate);
+        update_top(page, estimate);
+    }
+
+    // hot pages by decreasing estimated count (in sampled accesses)
+    void report(std::ofstream &out, const char *name) {
+        g_vector<HotPage> sorted = heap;
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const HotPage &a, const HotPage &b) {
+                      return a.count > b.count;
+                  });
+        out << name << " accesses:" << accesses << "\t sampled:" << samples
+            << " (1/" << sample_period << ")\t top " << sorted.size()
+            << " pages:" << std::endl;
+        for (const HotPage &p : sorted) {
+            out << "  page: " << std::hex << p.page << std::dec
+                << "\t count:" << p.count << "\t share:"
+                << (double)p.count / (double)samples << std::endl;
+        }
+    }
+
+  private:
+    struct HotPage {
+        Address page;
+        uint64_t count;
+    };
+
+    void update_top(Address page, uint64_t count) {
+        auto it = index.find(page);
+        if (it != index.end()) {
+            heap[it->second].count = count;
+            sift_down(it->second);
+        } else if (heap.size() < top_k) {
+            heap.push_back({page, count});
+            index[page] = heap.size() - 1;
+            sift_up(heap.size() - 1);
+        } else if (count > heap[0].count) {
+            index.erase(heap[0].page);
+            heap[0] = {page, count};
+            index[page] = 0;
+            sift_down(0);
+        }
+    }
+
+    void swap_slots(uint32_t a, uint32_t b) {
+        std::swap(heap[a], heap[b]);
+        index[heap[a].page] = a;
+        index[heap[b].page] = b;
+    }
+
+    void sift_up(uint32_t i) {
+        while (i && heap[(i - 1) / 2].count > heap[i].count) {
+            swap_slots(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void sift_down(uint32_t i) {
+        uint32_t n = heap.size();
+        while (true) {
+            uint32_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+            if (l < n && heap[l].count < heap[min].count)
+                min = l;
+            if (r < n && heap[r].count < heap[min].count)
+                min = r;
+            if (min == i)
+                return;
+            swap_slots(i, min);
+            i = min;
+        }
+    }
+
+    static const uint32_t MAX_DEPTH = 8;
+
+    uint32_t width;
+    uint32_t depth;
+    uint32_t top_k;
+    uint32_t sample_period;
+    uint32_t countdown;
+    HashFamily *hf;
+    uint64_t *counters;
+    g_vector<HotPage> heap; // min-heap on count
+    g_unordered_map<Address, uint32_t> index;
+    uint64_t accesses;
+    uint64_t samples;
+};
+#endif
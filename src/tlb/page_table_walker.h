@@ -15,6 +15,7 @@
 #include <unordered_map>
 
 #include "common/global_const.h"
+#include "event_recorder.h"
 #include "g_std/g_string.h"
 #include "locks.h"
 #include "memory_hierarchy.h"
@@ -25,15 +26,22 @@
 #include "mmu/memory_management.h"
 #include "tlb/common_tlb.h"
 #include "tlb/tlb_entry.h"
+#include "timing_event.h"
 #include "zsim.h"
 
 template <class T> class PageTableWalker : public BasePageTableWalker {
   public:
     // access memory
+    /*
+     *@param num_mshrs: walks that can be in flight at once (hardware page
+     *walkers); 0 does not limit them
+     */
     PageTableWalker(uint32_t line_shift, const g_string &name,
-                    PagingStyle style, bool enable_timing_mode)
+                    PagingStyle style, bool enable_timing_mode,
+                    uint32_t num_mshrs = 0)
         : line_shift(line_shift), pg_walker_name(name),
-          enable_timing_mode(enable_timing_mode), procIdx((uint32_t)(-1)) {
+          enable_timing_mode(enable_timing_mode), procIdx((uint32_t)(-1)), profiler(NULL), pwc(NULL),
+          num_mshrs(num_mshrs), mshrs(NULL) {
         mode = style;
         period = 0;
         dirty_evict = 0;
@@ -46,6 +54,16 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
         tlb_miss_overhead = 0;
         clflush_overhead = 0;
         extra_write = 0;
+        prefetch_walks = 0;
+        concurrent_walks = 0;
+        raced_faults = 0;
+        coalesced_walks = 0;
+        mshr_stall_cycles = 0;
+        if (num_mshrs) {
+            mshrs = gm_calloc<WalkMshr>(num_mshrs);
+            for (uint32_t i = 0; i < num_mshrs; i++)
+                mshrs[i].procIdx = INVALID_PROC;
+        }
         futex_init(&walker_lock);
     }
     ~PageTableWalker() {}
@@ -56,33 +74,143 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
         assert(paging);
         period++;
         Address addr = PAGE_FAULT_SIG;
+        // shootdowns of this core that were due or sent on its behalf
+        if (zinfo->tlb_shootdown_engine && req.srcId < zinfo->numCores) {
+            uint64_t stall =
+                zinfo->tlb_shootdown_engine->poll(req.srcId, req.cycle);
+            if (enable_timing_mode) {
+                tlb_shootdown_overhead += stall;
+                req.cycle += stall;
+            }
+        }
         Address init_cycle = req.cycle;
         req.childId = selfId;
         req.childLock = &walker_lock;
-        paging->lock();
+        // pagings that map larger leaves overwrite this on the walk
+        req.pageShift = zinfo->page_shift;
+        // walks of different cores only serialise on page faults if the
+        // paging allows it
+        bool concurrent = paging->concurrent_walks();
+        if (!concurrent)
+            paging->lock();
         futex_lock(&walker_lock);
         // addr = paging->access(req);
-        ptw_address[(req.lineAddr << line_shift)]++;
-        addr =
-            paging->access(req, parents, parentRTTs, cRec, enable_timing_mode);
+        Address vpn = (req.lineAddr << line_shift) >> zinfo->page_shift;
+        if (profiler)
+            profiler->record(vpn);
+        WalkMshr *mshr = NULL;
+        if (num_mshrs && enable_timing_mode) {
+            bool merge;
+            mshr = allocate_mshr(req, vpn, merge);
+            if (merge) {
+                // merge with the walk in flight: look the entry up
+                // functionally and finish when that walk does
+                addr = paging->access(req, parents, parentRTTs, cRec, NULL,
+                                      false);
+                req.cycle = mshr->done_cycle;
+                if (addr != PAGE_FAULT_SIG) {
+                    coalesced_walks++;
+                    mshr = NULL;
+                } else {
+                    // that walk faults too: walk again on a walker of its
+                    // own once it ends
+                    mshr = allocate_walker(req);
+                }
+            }
+        }
+        if (addr == PAGE_FAULT_SIG) {
+            uint64_t start_cycle = req.cycle;
+            addr = paging->access(req, parents, parentRTTs, cRec, pwc,
+                                  enable_timing_mode);
+            // the walker is released when the walk ends, not after a fault
+            if (mshr)
+                *mshr = {vpn, procIdx, start_cycle, req.cycle};
+        }
         tlb_miss_exclude_shootdown += (req.cycle - init_cycle);
         // page fault
         if (addr == PAGE_FAULT_SIG) {
-            addr = do_page_fault(req, DRAM_PAGE_FAULT);
+            if (concurrent)
+                addr = locked_page_fault(req);
+            else
+                addr = do_page_fault(req, DRAM_PAGE_FAULT);
             // std::cout<<"allocate page:"<<addr<<std::endl;
+        } else if (concurrent) {
+            concurrent_walks++;
         }
         if (req.triggerPageShared || req.triggerPageDirty) {
             update_tlb_flags(addr, req.triggerPageShared, req.triggerPageDirty);
         }
         futex_unlock(&walker_lock);
-        paging->unlock();
+        if (!concurrent)
+            paging->unlock();
         tlb_miss_overhead += (req.cycle - init_cycle);
         return addr; // find address
     }
 
+    /*
+     *@function: walk for a TLB prefetch. With timing the walk reads the page
+     *tables with PREFETCH requests, which only fill the caches they reach,
+     *and its timing record hangs off the record of the demand miss, so the
+     *core never waits for it while the weave phase still models its
+     *traffic. An unmapped page is not faulted in
+     *@return: ppn, PAGE_FAULT_SIG if vpn is not mapped; req.cycle is the
+     *cycle the walk ends
+     */
+    Address prefetch(MemReq &req) {
+        assert(paging && (req.flags & MemReq::PREFETCH));
+        req.childId = selfId;
+        req.childLock = &walker_lock;
+        req.pageShift = zinfo->page_shift;
+        EventRecorder *ev_rec = zinfo->eventRecorders[req.srcId];
+        bool timed = enable_timing_mode && ev_rec;
+        // the recorder holds one record: set the demand one aside
+        TimingRecord demand_tr;
+        demand_tr.clear();
+        if (timed && ev_rec->hasRecord())
+            demand_tr = ev_rec->popRecord();
+        uint64_t start_cycle = req.cycle;
+        bool concurrent = paging->concurrent_walks();
+        if (!concurrent)
+            paging->lock();
+        futex_lock(&walker_lock);
+        Address addr =
+            paging->access(req, parents, parentRTTs, cRec, NULL, timed);
+        prefetch_walks++;
+        futex_unlock(&walker_lock);
+        if (!concurrent)
+            paging->unlock();
+        if (timed)
+            hang_prefetch_record(ev_rec, demand_tr, start_cycle);
+        return addr;
+    }
+
+    /*
+     *@function: read the leaf PTEs sharing a cache line with the PTE of vpn.
+     *The walk of vpn has just fetched that line, so this costs no latency
+     *@param n: PTEs to read, the aligned group of n pages holding vpn
+     *@return: n, 0 if the paging cannot provide them
+     */
+    uint32_t read_pte_line(Address vpn, Address *ppns, uint32_t n,
+                           uint32_t &shared_mask, uint32_t &dirty_mask) {
+        assert(paging);
+        bool concurrent = paging->concurrent_walks();
+        if (!concurrent)
+            paging->lock();
+        uint32_t got =
+            paging->read_leaf_ptes(vpn, ppns, n, shared_mask, dirty_mask);
+        if (!concurrent)
+            paging->unlock();
+        return got;
+    }
+
     BasePaging *GetPaging() { return paging; }
+    uint32_t GetProcIdx() { return procIdx; }
+    // optional hot page profile of the walks, NULL (off) by default
+    void set_profiler(HotnessProfiler *p) { profiler = p; }
     void SetPaging(uint32_t proc_id, BasePaging *copied_paging) {
         futex_lock(&walker_lock);
+        if (pwc && proc_id != procIdx)
+            pwc->switch_context();
         procIdx = proc_id;
         paging = copied_paging;
         futex_unlock(&walker_lock);
@@ -132,23 +260,39 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
         vmof << pg_walker_name
              << " clflush overhead caused extra write:" << extra_write
              << std::endl;
+        if (prefetch_walks)
+            vmof << pg_walker_name << " prefetch walks:" << prefetch_walks
+                 << std::endl;
+        if (num_mshrs)
+            vmof << pg_walker_name << " walkers:" << num_mshrs
+                 << "\t misses merged with a walk in flight:"
+                 << coalesced_walks
+                 << "\t cycles waiting for a free walker:"
+                 << mshr_stall_cycles << std::endl;
+        if (concurrent_walks || raced_faults)
+            vmof << pg_walker_name << " unlocked walks:" << concurrent_walks
+                 << "\t faults already handled by another core:"
+                 << raced_faults << std::endl;
     }
     void address_stats(std::ofstream &addrof) {
-        for (const auto &entry : ptw_address) {
-            addrof << "PTW Virtual Page: " << entry.first << ", Count: "
-                   << entry.second << std::endl;
-        }
-        if(zinfo->pwc_enable) {
+        if (profiler)
+            profiler->report(addrof, pg_walker_name.c_str());
+        if (pwc) {
+            static const char *level_names[PWC_LEVELS] = {"L5", "L4", "L3",
+                                                          "L2"};
             addrof << "PTW Virtual Page num: " << period << std::endl;
-            addrof << "PWC L4 access time: " << pwc->access_count["pwl4"] << std::endl;
-            addrof << "PWC L3 access time: " << pwc->access_count["pwl3"] << std::endl;
-            addrof << "PWC L2 access time: " << pwc->access_count["pwl2"] << std::endl;
-            addrof << "PWC L4 miss time: " << pwc->miss_count["pwl4"] << std::endl;
-            addrof << "PWC L3 miss time: " << pwc->miss_count["pwl3"] << std::endl;
-            addrof << "PWC L2 miss time: " << pwc->miss_count["pwl2"] << std::endl;
-            addrof << "PWC L4 miss rate: " << (double)pwc->miss_count["pwl4"]/(double)pwc->access_count["pwl4"]*100 << std::endl;
-            addrof << "PWC L3 miss rate: " << (double)pwc->miss_count["pwl3"]/(double)pwc->access_count["pwl3"]*100 << std::endl;
-            addrof << "PWC L2 miss rate: " << (double)pwc->miss_count["pwl2"]/(double)pwc->access_count["pwl2"]*100 << std::endl;
+            for (unsigned l = 0; l < PWC_LEVELS; l++) {
+                uint64_t hits = pwc->get_hits((PwcLevel)l);
+                uint64_t misses = pwc->get_misses((PwcLevel)l);
+                // the PML5 level only exists in LA57 walks
+                if (l == PWC_PML5 && hits + misses == 0)
+                    continue;
+                addrof << "PWC " << level_names[l]
+                       << " access time: " << hits + misses
+                       << "\t miss time: " << misses << "\t miss rate: "
+                       << (double)misses / (double)(hits + misses) * 100
+                       << std::endl;
+            }
         }
     }
     Address do_page_fault(MemReq &req, PAGE_FAULT fault_type) {
@@ -157,10 +301,29 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
         Page *page = NULL;
         Address vAddr = req.lineAddr << line_shift;
         if (zinfo->buddy_allocator) {
-            page = zinfo->buddy_allocator->allocate_pages(0);
+            Address vpn = vAddr >> (zinfo->page_shift);
+            // a transparent huge page if the paging maps the region with one
+            if (!zinfo->enable_shared_memory) {
+                Page *head = NULL;
+                int overhead = paging->map_huge_page(
+                    req.srcId, vAddr, (req.type == PUTS) ? true : false, head);
+                if (overhead >= 0) {
+                    tlb_shootdown(req, vpn);
+                    if (enable_timing_mode) {
+                        dram_map_overhead += overhead;
+                        req.cycle += overhead;
+                    }
+                    req.pageShift = zinfo->page_shift + HUGE_PAGE_ORDER;
+                    req.pageDirty = (req.type == PUTS) ? true : false;
+                    allocated_page += ENTRY_512;
+                    return head->pageNo | (vpn & (ENTRY_512 - 1));
+                }
+            }
+            // from the page cache of the faulting core, the zone lock is
+            // only taken to refill it a batch at a time
+            page = zinfo->buddy_allocator->allocate_page(req.srcId);
             if (page) {
                 // TLB shootdown
-                Address vpn = vAddr >> (zinfo->page_shift);
                 tlb_shootdown(req, vpn);
                 if (zinfo->enable_shared_memory) {
                     if (!map_shared_region(req, page)) {
@@ -207,16 +370,20 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
             // instruction TLB shootdown
             tmp_tlb = zinfo->cores[i]->getInsTlb();
             if (tmp_tlb) {
-                uint32_t s_overhead = tmp_tlb->shootdown(vpn);
+                uint32_t s_overhead = tmp_tlb->shootdown(vpn, procIdx);
                 overhead = MAX(overhead, s_overhead);
             }
 
             tmp_tlb = zinfo->cores[i]->getDataTlb();
             if (tmp_tlb) {
-                uint32_t s_overhead = tmp_tlb->shootdown(vpn);
+                uint32_t s_overhead = tmp_tlb->shootdown(vpn, procIdx);
                 overhead = MAX(overhead, s_overhead);
             }
         }
+        for (BaseTlb *shared_tlb : zinfo->shared_tlbs) {
+            if (shared_tlb)
+                overhead = MAX(overhead, shared_tlb->shootdown(vpn, procIdx));
+        }
 
         if (enable_timing_mode) {
             tlb_shootdown_overhead += overhead;
@@ -226,23 +393,39 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
         return 0;
     }
 
-    uint64_t tlb_update(Address vpn, Address ppn) {
+    // srcId: the core remapping vpn
+    uint64_t tlb_update(uint32_t srcId, Address vpn, Address ppn) {
+        // only the cores that may cache vpn are interrupted
+        if (zinfo->tlb_shootdown_engine && srcId < zinfo->numCores) {
+            uint64_t overhead = zinfo->tlb_shootdown_engine->update(
+                srcId, procIdx, vpn, ppn);
+            if (enable_timing_mode) {
+                tlb_shootdown_overhead += overhead;
+                return overhead;
+            }
+            return 0;
+        }
         uint32_t overhead = 0;
         BaseTlb *tmp_tlb = NULL;
         for (uint64_t i = 0; i < zinfo->numCores; i++) {
             // instruction TLB shootdown
             tmp_tlb = zinfo->cores[i]->getInsTlb();
             if (tmp_tlb) {
-                uint32_t s_overhead = tmp_tlb->update_entry(vpn, ppn);
+                uint32_t s_overhead = tmp_tlb->update_entry(vpn, ppn, procIdx);
                 overhead = MAX(overhead, s_overhead);
             }
 
             tmp_tlb = zinfo->cores[i]->getDataTlb();
             if (tmp_tlb) {
-                uint32_t s_overhead = tmp_tlb->update_entry(vpn, ppn);
+                uint32_t s_overhead = tmp_tlb->update_entry(vpn, ppn, procIdx);
                 overhead = MAX(overhead, s_overhead);
             }
         }
+        for (BaseTlb *shared_tlb : zinfo->shared_tlbs) {
+            if (shared_tlb)
+                overhead = MAX(overhead,
+                               shared_tlb->update_entry(vpn, ppn, procIdx));
+        }
 
         if (enable_timing_mode) {
             tlb_shootdown_overhead += overhead;
@@ -253,6 +436,103 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
     }
 
   private:
+    // a walk in flight (or the last one) of a hardware page walker
+    struct WalkMshr {
+        Address vpn;
+        uint32_t procIdx;
+        uint64_t start_cycle;
+        uint64_t done_cycle;
+    };
+
+    /*
+     *@function: find the walk of vpn in flight at req.cycle or, if there is
+     *none, the walker that frees up first, delaying req until it does
+     *@param merge: set if the returned MSHR holds a walk of vpn to merge with
+     *@return: the MSHR of the walk to merge with or of the walker to use
+     */
+    WalkMshr *allocate_mshr(MemReq &req, Address vpn, bool &merge) {
+        merge = true;
+        for (uint32_t i = 0; i < num_mshrs; i++) {
+            WalkMshr *m = &mshrs[i];
+            if (m->vpn == vpn && m->procIdx == procIdx &&
+                m->start_cycle <= req.cycle && req.cycle < m->done_cycle)
+                return m;
+        }
+        merge = false;
+        return allocate_walker(req);
+    }
+
+    /*
+     *@function: take the walker that frees up first, delaying req until it
+     *does
+     *@return: the MSHR of the walker
+     */
+    WalkMshr *allocate_walker(MemReq &req) {
+        WalkMshr *first_free = &mshrs[0];
+        for (uint32_t i = 1; i < num_mshrs; i++) {
+            if (mshrs[i].done_cycle < first_free->done_cycle)
+                first_free = &mshrs[i];
+        }
+        if (first_free->done_cycle > req.cycle) {
+            mshr_stall_cycles += first_free->done_cycle - req.cycle;
+            req.cycle = first_free->done_cycle;
+        }
+        return first_free;
+    }
+
+    /*
+     *@function: hang the record a prefetch walk left, if any, off the end
+     *of the demand record as a branch nothing waits on, like writebacks.
+     *A miss served by the prefetch buffer has no demand record, so an empty
+     *PTW record at the prefetch's start carries the branch
+     */
+    void hang_prefetch_record(EventRecorder *ev_rec, TimingRecord &demand_tr,
+                              uint64_t start_cycle) {
+        if (ev_rec->hasRecord()) {
+            TimingRecord pf_tr = ev_rec->popRecord();
+            if (!demand_tr.isValid()) {
+                DelayEvent *ev = new (ev_rec) DelayEvent(0);
+                ev->setMinStartCycle(start_cycle);
+                demand_tr = {pf_tr.addr, start_cycle, start_cycle, GETS, ev,
+                             ev, pf_tr.tid, true};
+            }
+            TimingEvent *parent = demand_tr.endEvent;
+            if (pf_tr.reqCycle > demand_tr.respCycle) {
+                DelayEvent *gap = new (ev_rec)
+                    DelayEvent(pf_tr.reqCycle - demand_tr.respCycle);
+                gap->setMinStartCycle(demand_tr.respCycle);
+                parent = parent->addChild(gap, ev_rec);
+            }
+            parent->addChild(pf_tr.startEvent, ev_rec);
+        }
+        if (demand_tr.isValid())
+            ev_rec->pushRecord(demand_tr);
+    }
+
+    /*
+     *@function: page fault of an unlocked walk. Another core may have
+     *mapped the page between the walk and the lock, so walk again
+     *(functionally) before allocating a page
+     */
+    Address locked_page_fault(MemReq &req) {
+        paging->lock();
+        MemReq retry = req;
+        Address addr =
+            paging->access(retry, parents, parentRTTs, cRec, NULL, false);
+        if (addr == PAGE_FAULT_SIG) {
+            addr = do_page_fault(req, DRAM_PAGE_FAULT);
+        } else {
+            req.pageShift = retry.pageShift;
+            req.pageShared = retry.pageShared;
+            req.pageDirty = retry.pageDirty;
+            req.triggerPageShared = retry.triggerPageShared;
+            req.triggerPageDirty = retry.triggerPageDirty;
+            raced_faults++;
+        }
+        paging->unlock();
+        return addr;
+    }
+
     bool inline map_shared_region(MemReq &req, Page *page) {
         Address vaddr = req.lineAddr;
         // std::cout<<"find out shared region"<<std::endl;
@@ -334,22 +614,36 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
     }
 
     inline void tlb_shootdown(MemReq &req, Address vpn) {
+        // only interrupt the cores that may cache vpn, batched
+        if (zinfo->tlb_shootdown_engine && req.srcId < zinfo->numCores) {
+            uint64_t overhead = zinfo->tlb_shootdown_engine->shootdown(
+                req.srcId, procIdx, vpn, req.cycle);
+            if (enable_timing_mode) {
+                tlb_shootdown_overhead += overhead;
+                req.cycle += overhead;
+            }
+            return;
+        }
         uint32_t overhead = 0;
         BaseTlb *tmp_tlb = NULL;
         for (uint64_t i = 0; i < zinfo->numCores; i++) {
             // instruction TLB shootdown
             tmp_tlb = zinfo->cores[i]->getInsTlb();
             if (tmp_tlb) {
-                uint32_t s_overhead = tmp_tlb->shootdown(vpn);
+                uint32_t s_overhead = tmp_tlb->shootdown(vpn, procIdx);
                 overhead = MAX(overhead, s_overhead);
             }
 
             tmp_tlb = zinfo->cores[i]->getDataTlb();
             if (tmp_tlb) {
-                uint32_t s_overhead = tmp_tlb->shootdown(vpn);
+                uint32_t s_overhead = tmp_tlb->shootdown(vpn, procIdx);
                 overhead = MAX(overhead, s_overhead);
             }
         }
+        for (BaseTlb *shared_tlb : zinfo->shared_tlbs) {
+            if (shared_tlb)
+                overhead = MAX(overhead, shared_tlb->shootdown(vpn, procIdx));
+        }
 
         if (enable_timing_mode) {
             tlb_shootdown_overhead += overhead;
@@ -391,14 +685,8 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
         }
     }
 
-    void Setpwc(g_vector<unsigned>& size, g_vector<unsigned>& assoc, uint32_t accLat, uint32_t invLat) {
-            pw_cache *pwl4 = new pw_cache(size[0], assoc[0], accLat, invLat, "pwl4");
-            pw_cache *pwl3 = new pw_cache(size[1], assoc[1], accLat, invLat, "pwl3");
-            pw_cache *pwl2 = new pw_cache(size[2], assoc[2], accLat, invLat, "pwl2");
-            pwc = new pwc_group({pwl4, pwl3, pwl2});
-            // std::cout<<"pwc group is created: "<<pwc->caches.size()<<std::endl;
-    }
-    pwc_group* Getpwc() { return pwc; }
+    void Setpwc(PageWalkCache *_pwc) { pwc = _pwc; }
+    PageWalkCache *Getpwc() { return pwc; }
     void setCoreRecorder(BaseCoreRecorder *_cRec) { cRec = _cRec; }
 
   public:
@@ -409,10 +697,10 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
     BaseCoreRecorder *cRec; // the Core Recorder of corresponding core
     g_vector<MemObject *> parents;
     g_vector<uint32_t> parentRTTs;
-    pwc_group *pwc;
+    PageWalkCache *pwc; // NULL if the walker has no page walk cache
     uint32_t selfId;
     uint64_t period;
-    unordered_map<Address, uint64_t> ptw_address;
+    HotnessProfiler *profiler; // optional hot page profile of the walks
     unsigned long long tlb_shootdown_overhead;
     unsigned long long dram_map_overhead;
 
@@ -421,6 +709,11 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
 
     unsigned long long clflush_overhead;
     unsigned long long extra_write;
+    uint64_t prefetch_walks; // walks for TLB prefetches
+    uint64_t concurrent_walks; // walks that did not take the paging lock
+    uint64_t raced_faults;     // faults another core mapped first
+    uint64_t coalesced_walks;  // misses merged with a walk in flight
+    uint64_t mshr_stall_cycles; // cycles misses waited for a free walker
 
   private:
     uint32_t procIdx;
@@ -430,5 +723,7 @@ template <class T> class PageTableWalker : public BasePageTableWalker {
     Address total_evict;
     Address dirty_evict;
     lock_t walker_lock;
+    uint32_t num_mshrs;
+    WalkMshr *mshrs;
 };
 #endif
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
+ */
+#ifndef PRIVATE_TLB_H_
+#define PRIVATE_TLB_H_
+#include <fstream>
+
+#include "common/global_const.h"
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "locks.h"
+#include "memory_hierarchy.h"
+
+/*
+ * What the TLBs private to one core (CommonTlb, ClusterTlb) share: the
+ * queue other cores post invalidations to, and address space IDs.
+ *
+ * Only the owning core looks entries up, fills and flushes them, so that
+ * path takes no lock. Other cores only invalidate or patch entries: those
+ * requests are posted with post_message(), and the owner applies them in
+ * drain_messages() at its next access and before it fills an entry, so a
+ * translation removed by another core is never used nor reinstalled
+ * afterwards. flush_all() and switch_context() are owner-side too: they are
+ * called by the thread simulating the core, when it takes the core
+ * (setCid()) or through the core's flushTlb(); other cores use
+ * post_flush().
+ *
+ * With ASIDs (set_asid_bits()) entries are tagged with the address space
+ * they belong to, and context switches keep them.
+ */
+class PrivateTlb : public BaseTlb {
+  public:
+    PrivateTlb()
+        : asid_bits(0), cur_asid(0), asid_owner(NULL), cur_proc(INVALID_PROC),
+          context_switches(0), asid_flushes(0), msg_pending(0), remote_msgs(0), msg_overflows(0) {
+        futex_init(&msg_lock);
+    }
+
+    /*
+     *@function: tag entries with an address space ID of asid_bits bits
+     *taken from procIdx, so context switches keep them; 0 keeps flushing
+     *the TLB on every context switch
+     */
+    void set_asid_bits(unsigned bits) {
+        assert(bits <= 16);
+        asid_bits = bits;
+        if (bits) {
+            asid_owner = gm_calloc<uint32_t>(1 << bits);
+            for (unsigned i = 0; i < (1u << bits); i++)
+                asid_owner[i] = INVALID_PROC;
+        }
+    }
+
+    void switch_context(uint32_t procIdx) {
+        if (change_context(procIdx))
+            context_switches++;
+    }
+
+    // drop every entry tagged with asid
+    virtual void flush_asid(uint16_t asid) = 0;
+
+    // flush from another core, applied at the owner's next access
+    void post_flush() { post_message(TLB_MSG_FLUSH, INVALID_PROC, 0); }
+
+  protected:
+    enum TlbMsgType {
+        TLB_MSG_SHOOTDOWN,  // drop vpn addr of procIdx
+        TLB_MSG_RANGE,      // drop vpns [addr, addr + new_addr) of procIdx
+        TLB_MSG_UPDATE,     // remap vpn addr of procIdx to new_addr
+        TLB_MSG_UPDATE_PPN, // remap whatever maps ppn addr to new_addr
+        TLB_MSG_FLAGS,      // set the shared/dirty flags of ppn addr
+        TLB_MSG_FLUSH       // post_flush() or an overflow, drop everything
+    };
+
+    struct TlbMsg {
+        TlbMsgType type;
+        uint32_t procIdx;
+        Address addr;
+        Address new_addr;
+        bool shared;
+        bool dirty;
+    };
+
+    /*
+     *@function: flush the TLB, or switch ASID, to run procIdx; switch_context()
+     *without counting the switch
+     *@return: false if the TLB already runs procIdx, e.g. when the second L1
+     *TLB of a core forwards the switch to their L2
+     */
+    bool change_context(uint32_t procIdx) {
+        drain_messages();
+        if (procIdx == cur_proc)
+            return false;
+        cur_proc = procIdx;
+        if (!asid_bits) {
+            flush_all();
+            return true;
+        }
+        uint16_t asid = procIdx & ((1 << asid_bits) - 1);
+        // the ASID is recycled from another process, drop its entries
+        if (asid_owner[asid] != procIdx) {
+            if (asid_owner[asid] != INVALID_PROC) {
+                asid_flushes++;
+                flush_asid(asid);
+            }
+            asid_owner[asid] = procIdx;
+        }
+        cur_asid = asid;
+        return true;
+    }
+
+    // owner side: apply one message another core has posted
+    virtual void apply_message(const TlbMsg &msg) = 0;
+    // past this many queued messages a flush is cheaper than replaying them
+    virtual uint32_t max_messages() = 0;
+
+    void post_message(TlbMsgType type, uint32_t procIdx, Address addr,
+                      Address new_addr = 0, bool shared = false,
+                      bool dirty = false) {
+        futex_lock(&msg_lock);
+        remote_msgs++;
+        if (messages.size() >= max_messages()) {
+            if (messages.back().type != TLB_MSG_FLUSH) {
+                msg_overflows++;
+                messages.clear();
+                messages.push_back({TLB_MSG_FLUSH, INVALID_PROC, 0, 0, false,
+                                    false});
+            }
+        } else {
+            messages.push_back({type, procIdx, addr, new_addr, shared, dirty});
+        }
+        msg_pending = 1;
+        futex_unlock(&msg_lock);
+    }
+
+    // owner side: apply the messages other cores have posted, if any
+    inline void drain_messages() {
+        if (!msg_pending)
+            return;
+        futex_lock(&msg_lock);
+        drained.swap(messages);
+        msg_pending = 0;
+        futex_unlock(&msg_lock);
+        for (const TlbMsg &msg : drained)
+            apply_message(msg);
+        drained.clear();
+    }
+
+    /*
+     *@function: ASID procIdx runs with in this TLB
+     *@return: false if no entry can belong to procIdx
+     */
+    inline bool get_asid(uint32_t procIdx, uint16_t &asid) {
+        if (procIdx == INVALID_PROC || !asid_bits) {
+            asid = cur_asid;
+            return true;
+        }
+        asid = procIdx & ((1 << asid_bits) - 1);
+        return asid_owner[asid] == procIdx;
+    }
+
+    void message_stats(std::ofstream &vmof, const g_string &name) {
+        if (remote_msgs)
+            vmof << name << " remote invalidations:" << remote_msgs
+                 << "\t queue overflows:" << msg_overflows << std::endl;
+        if (asid_bits)
+            vmof << name << " context switches:" << context_switches
+                 << "\t ASID flushes:" << asid_flushes << std::endl;
+    }
+
+    // ASID tagging, see set_asid_bits()
+    unsigned asid_bits;
+    uint16_t cur_asid;
+    uint32_t *asid_owner; // process currently holding each ASID
+    uint32_t cur_proc;    // process of the last switch_context()
+    uint64_t context_switches;
+    uint64_t asid_flushes;
+
+  private:
+    // invalidations posted by other cores, see drain_messages()
+    lock_t msg_lock;
+    volatile uint32_t msg_pending;
+    g_vector<TlbMsg> messages;
+    g_vector<TlbMsg> drained; // owner-only, reused to avoid allocations
+    uint64_t remote_msgs;
+    uint64_t msg_overflows;
+};
+#endif
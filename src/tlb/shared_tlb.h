@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
+ */
+#ifndef SHARED_TLB_H_
+#define SHARED_TLB_H_
+#include <fstream>
+#include <sstream>
+
+#include "common/common_functions.h"
+#include "common/global_const.h"
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
+#include "locks.h"
+#include "memory_hierarchy.h"
+#include "tlb/tlb_array.h"
+
+/*
+ * Last-level TLB shared by a set of cores (a core group, an HMC stack or the
+ * whole system), sitting between their private L2 TLBs and the page table
+ * walkers.
+ *
+ * The entries are split over banks selected by the low VPN bits, and the
+ * bits above them index the sets of a bank; each bank has its own lock, so
+ * requesters only contend when they hit the same bank. A miss walks with the
+ * requester's page table walker, without holding the bank lock. Entries are
+ * tagged with the requester's process, so cores running different processes
+ * can share it and context switches never flush it. An entry is filled when
+ * the walk starts being simulated but only usable once it completes: a
+ * requester hitting it earlier waits for the walk instead of walking again.
+ */
+template <class T> class SharedTlb : public BaseTlb {
+  public:
+    SharedTlb(const g_string &name, bool enable_timing_mode, unsigned entries,
+              unsigned ways, unsigned num_banks, unsigned hit_lat,
+              unsigned net_lat, unsigned line_shift, unsigned page_shift,
+              uint32_t num_requesters, EVICTSTYLE policy = LRU,
+              HashFamily *hf = NULL)
+        : tlb_name_(name), enable_timing_mode(enable_timing_mode),
+          num_banks(num_banks), hit_latency(hit_lat),
+          interconnect_latency(net_lat), line_shift(line_shift),
+          page_shift(page_shift), num_requesters(num_requesters),
+          size_mask(0) {
+        assert(num_banks > 0 && entries % num_banks == 0);
+        unsigned bank_entries = entries / num_banks;
+        if (ways == 0)
+            ways = bank_entries;
+        banks = gm_memalign<Bank>(CACHE_LINE_BYTES, num_banks);
+        for (unsigned i = 0; i < num_banks; i++) {
+            banks[i].array = new TlbArray<T>(bank_entries, ways, hf, policy);
+            futex_init(&banks[i].lock);
+        }
+        tlb_page_shifts(size_shift, page_shift);
+        walkers = gm_calloc<BasePageTableWalker *>(num_requesters);
+        req_hits = gm_calloc<uint64_t>(num_requesters);
+        req_misses = gm_calloc<uint64_t>(num_requesters);
+        req_pending_hits = gm_calloc<uint64_t>(num_requesters);
+        req_pending_cycles = gm_calloc<uint64_t>(num_requesters);
+    }
+
+    // requester is the srcId of the L2 TLBs that miss into this TLB
+    void add_requester(uint32_t requester, BasePageTableWalker *walker) {
+        assert(requester < num_requesters);
+        walkers[requester] = walker;
+    }
+
+    /*-------------drive simulation related---------*/
+    uint64_t access(MemReq &req) {
+        uint32_t requester = req.srcId;
+        assert(requester < num_requesters && walkers[requester]);
+        BasePageTableWalker *walker = walkers[requester];
+        uint16_t asid = walker->GetProcIdx();
+        Address vpn = (req.lineAddr << line_shift) >> page_shift;
+        if (enable_timing_mode)
+            req.cycle += 2 * interconnect_latency + hit_latency;
+
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (!(size_mask & (1 << s)))
+                continue;
+            unsigned delta = size_shift[s] - page_shift;
+            Address spn = vpn >> delta;
+            Bank &bank = bank_of(spn);
+            futex_lock(&bank.lock);
+            int32_t slot =
+                bank.array->lookup(tlb_tag(spn, s, asid), set_key(spn));
+            if (slot >= 0) {
+                T *entry = bank.array->get_entry(slot);
+                Address ppn = (entry->p_page_no << delta) |
+                              (vpn & ((1ULL << delta) - 1));
+                req.pageShared = entry->is_page_shared();
+                req.pageDirty = entry->is_page_dirty();
+                uint64_t avail_cycle = entry->avail_cycle;
+                futex_unlock(&bank.lock);
+                // the walk filling the entry is still in flight
+                if (enable_timing_mode && avail_cycle > req.cycle) {
+                    req_pending_hits[requester]++;
+                    req_pending_cycles[requester] += avail_cycle - req.cycle;
+                    req.cycle = avail_cycle;
+                }
+                req.pageShift = size_shift[s];
+                req_hits[requester]++;
+                return ppn;
+            }
+            futex_unlock(&bank.lock);
+        }
+
+        req_misses[requester]++;
+        Address ppn = walker->access(req);
+        unsigned s = TLB_PAGE_SIZES;
+        for (unsigned i = 0; i < TLB_PAGE_SIZES; i++)
+            if (size_shift[i] == req.pageShift)
+                s = i;
+        if (s == TLB_PAGE_SIZES)
+            panic("%s: no TLB array for pages of shift %u", getName(),
+                  req.pageShift);
+        unsigned delta = size_shift[s] - page_shift;
+        Address spn = vpn >> delta;
+        T new_entry(spn, ppn >> delta);
+        new_entry.asid = asid;
+        new_entry.avail_cycle = req.cycle;
+        new_entry.set_valid();
+        if (req.pageShared)
+            new_entry.set_page_shared();
+        if (req.pageDirty)
+            new_entry.set_page_dirty();
+        Address tag = tlb_tag(spn, s, asid);
+        Bank &bank = bank_of(spn);
+        futex_lock(&bank.lock);
+        // another requester may have filled it while we walked
+        if (bank.array->lookup(tag, set_key(spn), false) < 0) {
+            uint32_t slot = bank.array->preinsert(set_key(spn));
+            bank.array->postinsert(tag, slot, new_entry);
+            __sync_fetch_and_or(&size_mask, 1 << s);
+        }
+        futex_unlock(&bank.lock);
+        return ppn;
+    }
+
+    uint32_t shootdown(Address vpn, uint32_t procIdx = INVALID_PROC) {
+        for (unsigned s = 0; s < TLB_PAGE_SIZES; s++) {
+            if (!(size_mask & (1 << s)))
+                continue;
+            Address spn = vpn >> (size_shift[s] - page_shift);
+            Bank &bank = bank_of(spn);
+            futex_lock(&bank.lock);
+            if (procIdx == INVALID_PROC) {
+                // no process given, drop the page in every address space
+                for (unsigned i = 0; i < bank.array->get_num_lines(); i++) {
+                    Address tag = bank.array->get_tag(i);
+                    if (bank.array->is_valid(i) &&
+                        tag == tlb_tag(spn, s, tlb_tag_asid(tag)))
+                        bank.array->invalidate(i);
+                }
+            } else {
+                int32_t slot = bank.array->lookup(
+                    tlb_tag(spn, s, (uint16_t)procIdx), set_key(spn), false);
+                if (slot >= 0)
+                    bank.array->invalidate(slot);
+            }
+            futex_unlock(&bank.lock);
+        }
+        return enable_timing_mode ? 2 * interconnect_latency + hit_latency : 0;
+    }
+
+    // one pass over each bank rather than a lookup per page
+    uint32_t shootdown_range(Address vpn, Address pages,
+                             uint32_t procIdx = INVALID_PROC) {
+        for (unsigned b = 0; b < num_banks; b++) {
+            TlbArray<T> *array = banks[b].array;
+            futex_lock(&banks[b].lock);
+            for (unsigned i = 0; i < array->get_num_lines(); i++) {
+                Address tag = array->get_tag(i);
+                if (array->is_valid(i) &&
+                    (procIdx == INVALID_PROC ||
+                     tlb_tag_asid(tag) == (uint16_t)procIdx) &&
+                    tlb_tag_in_range(tag,
+                                     size_shift[tlb_tag_size(tag)] - page_shift,
+                                     vpn, pages))
+                    array->invalidate(i);
+            }
+            futex_unlock(&banks[b].lock);
+        }
+        return enable_timing_mode ? 2 * interconnect_latency + hit_latency : 0;
+    }
+
+    uint32_t update_entry(Address vpn, Address ppn,
+                          uint32_t procIdx = INVALID_PROC) {
+        // cheaper to drop it than to find every copy, the next miss refills
+        return shootdown(vpn, procIdx);
+    }
+
+    bool flush_all() {
+        for (unsigned i = 0; i < num_banks; i++) {
+            futex_lock(&banks[i].lock);
+            banks[i].array->clear();
+            futex_unlock(&banks[i].lock);
+        }
+        return true;
+    }
+
+    // entries are tagged with their process, nothing to do
+    void switch_context(uint32_t procIdx) {}
+
+    uint64_t calculate_stats(std::ofstream &vmof) {
+        uint64_t hits = 0, misses = 0, pending_hits = 0, pending_cycles = 0;
+        for (uint32_t i = 0; i < num_requesters; i++) {
+            hits += req_hits[i];
+            misses += req_misses[i];
+            pending_hits += req_pending_hits[i];
+            pending_cycles += req_pending_cycles[i];
+        }
+        uint64_t accesses = hits + misses;
+        vmof << tlb_name_ << " access time:" << accesses
+             << "\t hit time:" << hits << "\t miss time:" << misses
+             << "\t hit rate:" << (double)hits / (double)accesses
+             << std::endl;
+        if (pending_hits)
+            vmof << tlb_name_ << " hits on fills in flight:" << pending_hits
+                 << "\t cycles waited:" << pending_cycles << std::endl;
+        for (uint32_t i = 0; i < num_requesters; i++) {
+            if (!req_hits[i] && !req_misses[i])
+                continue;
+            vmof << tlb_name_ << " requester " << i
+                 << " hit time:" << req_hits[i]
+                 << "\t miss time:" << req_misses[i] << std::endl;
+        }
+        for (unsigned i = 0; i < num_banks; i++) {
+            std::stringstream ss;
+            ss << tlb_name_ << " bank " << i;
+            banks[i].array->get_repl()->calculate_stats(
+                vmof, g_string(ss.str().c_str()));
+        }
+        return accesses;
+    }
+
+    const char *getName() { return tlb_name_.c_str(); }
+    void set_parent(BasePageTableWalker *base_pg_walker) {}
+    void setLevel(int level) {}
+
+  private:
+    struct Bank {
+        TlbArray<T> *array;
+        lock_t lock;
+    } ATTR_LINE_ALIGNED;
+
+    // the low bits of spn pick the bank, so the set inside the bank is
+    // indexed with the bits above them, or most sets would stay empty
+    inline Bank &bank_of(Address spn) { return banks[spn % num_banks]; }
+    inline Address set_key(Address spn) const { return spn / num_banks; }
+
+    g_string tlb_name_;
+    bool enable_timing_mode;
+    Bank *banks;
+    unsigned num_banks;
+    unsigned hit_latency;
+    // one-way latency between a core and this TLB
+    unsigned interconnect_latency;
+    unsigned line_shift;
+    unsigned page_shift;
+    unsigned size_shift[TLB_PAGE_SIZES];
+    volatile unsigned size_mask;
+    uint32_t num_requesters;
+    BasePageTableWalker **walkers;
+    uint64_t *req_hits;
+    uint64_t *req_misses;
+    uint64_t *req_pending_hits; // hits that merged with the walk filling them
+    uint64_t *req_pending_cycles;
+};
+#endif
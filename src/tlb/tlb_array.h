@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
+ */
+#ifndef TLB_ARRAY_H_
+#define TLB_ARRAY_H_
+
+#include "bithacks.h"
+#include "common/global_const.h"
+#include "g_std/g_unordered_map.h"
+#include "galloc.h"
+#include "hash.h"
+#include "log.h"
+#include "pad.h"
+#include "tlb/tlb_repl.h"
+
+// tags carry the page size, so a unified array can mix page sizes, and the
+// ASID above the 48 bits of virtual address
+static inline Address tlb_tag(Address vpn, unsigned size, uint16_t asid) {
+    return ((Address)asid << 48) | (vpn << 2) | size;
+}
+static inline unsigned tlb_tag_size(Address tag) { return tag & 0x3; }
+static inline uint16_t tlb_tag_asid(Address tag) { return tag >> 48; }
+static inline Address tlb_tag_vpn(Address tag) {
+    return (tag & ((1ULL << 48) - 1)) >> 2;
+}
+// whether the entry tagged tag, of pages of 2^delta base pages, maps a base
+// page of [vpn, vpn + pages)
+static inline bool tlb_tag_in_range(Address tag, unsigned delta, Address vpn,
+                                    Address pages) {
+    Address first = tlb_tag_vpn(tag) << delta;
+    return first < vpn + pages && vpn < first + (1ULL << delta);
+}
+
+// page shift of each TlbPageSize; legacy 4MB pages take the place of 2MB ones
+static inline void tlb_page_shifts(unsigned *shifts, unsigned page_shift) {
+    shifts[TLB_4KB] = PAGE_SHIFT;
+    shifts[TLB_2MB] =
+        (page_shift == PAGE_4MB_SHIFT) ? PAGE_4MB_SHIFT : PAGE_2MB_SHIFT;
+    shifts[TLB_1GB] = PAGE_1GB_SHIFT;
+}
+
+/*
+ * Set-associative storage for TLB entries.
+ *
+ * Tags, replacement state and entries live in separate flat, cache-line
+ * aligned arrays, so a lookup only touches the tags of one set and a
+ * replacement only looks at one set: both are O(ways), no matter
+ * how many entries the TLB holds. Sets are indexed with the low bits of the
+ * key (normally the VPN), or with an H3 hash of it when a hash family is
+ * given. Replacement is delegated to a TlbReplPolicy (tlb_repl.h).
+ *
+ * A fully-associative array (a single set) keeps a tag->slot index, so its
+ * lookups are O(1). Its fills are not: preinsert() and the replacement
+ * policy still scan every way, so a miss costs O(entries).
+ */
+template <class T> class TlbArray : public GlobAlloc {
+  public:
+    TlbArray(uint32_t num_lines, uint32_t num_ways, HashFamily *hash_family,
+             EVICTSTYLE policy = LRU)
+        : numLines(num_lines), ways(num_ways), hf(hash_family) {
+        assert(ways > 0 && ways <= numLines);
+        if (numLines % ways != 0)
+            panic("TLB with %u entries cannot be split into %u ways",
+                  numLines, ways);
+        numSets = numLines / ways;
+        if (!isPow2(numSets))
+            panic("TLB with %u entries and %u ways has %u sets, which is "
+                  "not a power of two", numLines, ways, numSets);
+        setMask = numSets - 1;
+        tags = gm_memalign<Address>(CACHE_LINE_BYTES, numLines);
+        entries = gm_memalign<T>(CACHE_LINE_BYTES, numLines);
+        for (uint32_t i = 0; i < numLines; i++) {
+            tags[i] = INVALID_TAG;
+            new (&entries[i]) T();
+        }
+        repl = CreateTlbReplPolicy(policy, numLines, ways);
+        faIndex = (numSets == 1) ? new g_unordered_map<Address, uint32_t>()
+                                 : NULL;
+    }
+
+    static const Address INVALID_TAG = INVALID_PAGE_ADDR;
+
+    /*
+     *@function: find the slot holding tag
+     *@param key: value the set is selected with (normally the VPN)
+     *@return: slot id, -1 on a miss
+     */
+    int32_t lookup(Address tag, Address key, bool update_lru = true) {
+        int32_t slot = -1;
+        if (faIndex) {
+            auto it = faIndex->find(tag);
+            if (it != faIndex->end())
+                slot = it->second;
+        } else {
+            uint32_t first = setOf(key) * ways;
+            for (uint32_t id = first; id < first + ways; id++) {
+                if (tags[id] == tag) {
+                    slot = id;
+                    break;
+                }
+            }
+        }
+        if (slot >= 0 && update_lru)
+            repl->update(slot);
+        return slot;
+    }
+
+    // pick the slot a new entry with this key goes to: an invalid way of the
+    // set if there is one, the replacement policy's victim otherwise
+    uint32_t preinsert(Address key) {
+        uint32_t first = setOf(key) * ways;
+        for (uint32_t id = first; id < first + ways; id++) {
+            if (tags[id] == INVALID_TAG)
+                return id;
+        }
+        return repl->replace(first);
+    }
+
+    void postinsert(Address tag, uint32_t slot, T &entry) {
+        assert(slot < numLines);
+        if (faIndex) {
+            if (tags[slot] != INVALID_TAG)
+                faIndex->erase(tags[slot]);
+            (*faIndex)[tag] = slot;
+        }
+        tags[slot] = tag;
+        entries[slot] = entry;
+        repl->inserted(slot);
+    }
+
+    void invalidate(uint32_t slot) {
+        if (tags[slot] == INVALID_TAG)
+            return;
+        if (faIndex)
+            faIndex->erase(tags[slot]);
+        tags[slot] = INVALID_TAG;
+        entries[slot].set_invalid();
+        repl->invalidated(slot);
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < numLines; i++) {
+            tags[i] = INVALID_TAG;
+            entries[i].set_invalid();
+        }
+        if (faIndex)
+            faIndex->clear();
+    }
+
+    bool is_valid(uint32_t slot) const { return tags[slot] != INVALID_TAG; }
+    Address get_tag(uint32_t slot) const { return tags[slot]; }
+    T *get_entry(uint32_t slot) { return &entries[slot]; }
+    uint32_t get_num_lines() const { return numLines; }
+    uint32_t get_ways() const { return ways; }
+    uint32_t get_sets() const { return numSets; }
+    TlbReplPolicy *get_repl() { return repl; }
+
+  private:
+    inline uint32_t setOf(Address key) const {
+        if (numSets == 1)
+            return 0;
+        return (hf ? hf->hash(0, key) : key) & setMask;
+    }
+
+    uint32_t numLines;
+    uint32_t ways;
+    uint32_t numSets;
+    uint32_t setMask;
+    HashFamily *hf;
+    TlbReplPolicy *repl;
+    Address *tags;
+    T *entries;
+    g_unordered_map<Address, uint32_t> *faIndex;
+};
+#endif
@@ -18,15 +18,20 @@ class BaseTlbEntry : public GlobAlloc {
     Address v_page_no;
     Address p_page_no;
     uint16_t flag;
-    uint64_t lru_seq; // keep track of LRU seq
+    uint16_t asid; // address space the translation belongs to
+    // cycle the walk that filled the entry completes, hits before it merge
+    // with the walk in flight (like FilterCache's availCycle)
+    uint64_t avail_cycle;
     BaseTlbEntry(Address vpn, Address ppn)
-        : v_page_no(vpn), p_page_no(ppn), flag(0), lru_seq(0) {}
-    BaseTlbEntry() {}
+        : v_page_no(vpn), p_page_no(ppn), flag(0), asid(0), avail_cycle(0) {}
+    BaseTlbEntry() : asid(0), avail_cycle(0) {}
 
     virtual void operator=(BaseTlbEntry &target_tlb) {
         v_page_no = target_tlb.v_page_no;
         p_page_no = target_tlb.p_page_no;
         flag = target_tlb.flag;
+        asid = target_tlb.asid;
+        avail_cycle = target_tlb.avail_cycle;
     }
 
     virtual ~BaseTlbEntry() {}
@@ -89,47 +94,55 @@ class TlbEntry : public BaseTlbEntry {
     void remap(Address ppn) {}
 };
 
-class TlbEntry;
+/*
+ * Clustered TLB entry (Pham et al., HPCA'14): maps an aligned cluster of
+ * virtual pages whose frames all fall in one aligned cluster of frames,
+ * keeping the low frame bits of each page that is present.
+ */
 class ClusterTlbEntry : public GlobAlloc {
-    public:
-    Address basic_v_page_no;
-    Address basic_p_page_no;
+  public:
+    static const unsigned MAX_CLUSTER = 16;
+    Address basic_v_page_no; // virtual cluster number
+    Address basic_p_page_no; // physical cluster number
     uint16_t flag;
-    uint16_t cluster_size;
-    uint64_t priority; // keep track of priority
-    uint64_t lru_seq; // keep track of LRU seq
-    std::vector<unsigned> low_bits;
-    ClusterTlbEntry(Address basic_vpn, Address basic_ppn)
-        : basic_v_page_no(basic_vpn), basic_p_page_no(basic_ppn),
-         flag(0), priority(0), cluster_size(cluster_size) {}
-    ClusterTlbEntry() {};
+    uint16_t asid;
+    uint16_t valid_mask; // pages of the cluster the entry maps
+    uint16_t shared_mask;
+    uint16_t dirty_mask;
+    uint8_t low_bits[MAX_CLUSTER];
+    uint64_t avail_cycle; // when the walk filling the entry completes
 
-    virtual void operator=(ClusterTlbEntry &target_tlb) {
-        basic_v_page_no = target_tlb.basic_v_page_no;
-        basic_p_page_no = target_tlb.basic_p_page_no;
-        flag = target_tlb.flag;
-    }
+    ClusterTlbEntry(Address basic_vpn, Address basic_ppn)
+        : basic_v_page_no(basic_vpn), basic_p_page_no(basic_ppn), flag(0),
+          asid(0), valid_mask(0), shared_mask(0), dirty_mask(0),
+          avail_cycle(0) {}
+    ClusterTlbEntry()
+        : basic_v_page_no(0), basic_p_page_no(0), flag(0), asid(0),
+          valid_mask(0), shared_mask(0), dirty_mask(0), avail_cycle(0) {}
 
     bool is_valid() { return (flag & TlbFlag::VALID); }
     void set_valid() { flag |= TlbFlag::VALID; }
-    void set_invalid() { flag = 0; }
-    void update_vpn(Address new_vpn) { basic_v_page_no = new_vpn; }
-    void update_ppn(Address new_ppn) { basic_p_page_no = new_ppn; }
-    // virtual void map(Address vpn, Address ppn) {
-    //     v_page_no = vpn;
-    //     p_page_no = ppn;
-    // }
-    virtual void insert(Address vpn, Address ppn) {
-        TlbEntry new_entry(vpn, ppn);
-        new_entry.set_valid();
-        low_bits.push_back(get_bits(vpn, 0, cluster_size - 1));
+    void set_invalid() {
+        flag = 0;
+        valid_mask = 0;
+    }
+
+    bool has_page(unsigned i) { return valid_mask & (1 << i); }
+    unsigned num_pages() { return __builtin_popcount(valid_mask); }
+    void add_page(unsigned i, Address low, bool shared, bool dirty) {
+        assert(i < MAX_CLUSTER);
+        valid_mask |= 1 << i;
+        low_bits[i] = low;
+        shared_mask = (shared_mask & ~(1 << i)) | (shared << i);
+        dirty_mask = (dirty_mask & ~(1 << i)) | (dirty << i);
     }
-    virtual void update_priority() {
-        uint16_t num = low_bits.size();
-        priority = lru_seq + 2 * num;
+    void remove_page(unsigned i) { valid_mask &= ~(1 << i); }
+    bool is_page_shared(unsigned i) { return shared_mask & (1 << i); }
+    bool is_page_dirty(unsigned i) { return dirty_mask & (1 << i); }
+    // frame of page i of the cluster, in base pages
+    Address sub_look_up(unsigned i, unsigned cluster_bits) {
+        return (basic_p_page_no << cluster_bits) | low_bits[i];
     }
-    virtual Address get_counter() { return INVALID_PAGE_ADDR; }
-    virtual Address sub_look_up(Address vpn) { return (basic_p_page_no << cluster_size) | low_bits[get_bits(vpn, 0, 2)];}
-    virtual void clear_counter() {}
+    void clear_counter() {}
 };
 #endif
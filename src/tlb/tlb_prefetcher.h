@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
+ */
+#ifndef TLB_PREFETCHER_H_
+#define TLB_PREFETCHER_H_
+#include <fstream>
+
+#include "common/global_const.h"
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "log.h"
+
+/*
+ * TLB prefetching between the L2 TLB and the page table walker.
+ *
+ * On every L2 TLB miss the prefetcher is trained with the missing VPN and
+ * proposes pages to prefetch. Those are walked off the critical path and
+ * parked in a small prefetch buffer; a later miss that finds its page there
+ * skips the walk (and waits for the prefetch if it is still in flight).
+ * Prefetched translations never enter the TLB until they are demanded, so a
+ * bad prefetcher cannot evict useful entries.
+ */
+class TlbPrefetcher : public GlobAlloc {
+  public:
+    virtual ~TlbPrefetcher() {}
+    // vpn missed in the L2 TLB, append the VPNs to prefetch to candidates
+    virtual void train(Address vpn, g_vector<Address> &candidates) = 0;
+    virtual const char *getName() = 0;
+};
+
+// next degree pages after every miss
+class SequentialTlbPrefetcher : public TlbPrefetcher {
+  public:
+    explicit SequentialTlbPrefetcher(uint32_t degree) : degree(degree) {}
+    void train(Address vpn, g_vector<Address> &candidates) {
+        for (uint32_t i = 1; i <= degree; i++)
+            candidates.push_back(vpn + i);
+    }
+    const char *getName() { return "Sequential"; }
+
+  private:
+    uint32_t degree;
+};
+
+/*
+ * Stride over the L2 miss stream: once the same stride (any distance, in
+ * either direction) is seen twice in a row, prefetch degree strides ahead.
+ */
+class StrideTlbPrefetcher : public TlbPrefetcher {
+  public:
+    explicit StrideTlbPrefetcher(uint32_t degree)
+        : degree(degree), last_vpn(INVALID_PAGE_ADDR), stride(0),
+          confidence(0) {}
+    void train(Address vpn, g_vector<Address> &candidates) {
+        if (last_vpn != INVALID_PAGE_ADDR) {
+            int64_t s = (int64_t)(vpn - last_vpn);
+            if (s == stride) {
+                confidence = MIN(confidence + 1, MAX_CONFIDENCE);
+            } else {
+                stride = s;
+                confidence = 0;
+            }
+        }
+        last_vpn = vpn;
+        if (stride && confidence >= THRESHOLD) {
+            for (uint32_t i = 1; i <= degree; i++)
+                candidates.push_back(vpn + stride * (int64_t)i);
+        }
+    }
+    const char *getName() { return "Stride"; }
+
+  private:
+    static const uint32_t THRESHOLD = 1;
+    static const uint32_t MAX_CONFIDENCE = 3;
+    uint32_t degree;
+    Address last_vpn;
+    int64_t stride;
+    uint32_t confidence;
+};
+
+/*
+ * Distance prefetching (Kandiraju and Sivasubramaniam, ISCA'02): a table
+ * indexed by the distance between two consecutive misses remembers the
+ * distances that followed it, and the next miss with that distance
+ * prefetches them. Catches repeating irregular patterns that a stride
+ * prefetcher cannot.
+ */
+class DistanceTlbPrefetcher : public TlbPrefetcher {
+  public:
+    DistanceTlbPrefetcher(uint32_t table_entries, uint32_t degree)
+        : num_rows(table_entries), degree(MIN(degree, (uint32_t)SLOTS)),
+          last_vpn(INVALID_PAGE_ADDR), last_distance(0), has_distance(false) {
+        assert(num_rows > 0);
+        rows = gm_calloc<Row>(num_rows);
+    }
+    void train(Address vpn, g_vector<Address> &candidates) {
+        if (last_vpn == INVALID_PAGE_ADDR) {
+            last_vpn = vpn;
+            return;
+        }
+        int64_t distance = (int64_t)(vpn - last_vpn);
+        last_vpn = vpn;
+        if (has_distance)
+            row_of(last_distance, true).push(distance);
+        Row &row = row_of(distance, false);
+        if (row.valid && row.distance == distance) {
+            for (uint32_t i = 0; i < degree && i < row.count; i++)
+                candidates.push_back(vpn + row.next[i]);
+        }
+        last_distance = distance;
+        has_distance = true;
+    }
+    const char *getName() { return "Distance"; }
+
+  private:
+    static const uint32_t SLOTS = 2;
+    struct Row {
+        int64_t distance;
+        int64_t next[SLOTS]; // most recent first
+        uint32_t count;
+        bool valid;
+        void push(int64_t d) {
+            uint32_t i = 0;
+            while (i < count && next[i] != d)
+                i++;
+            if (i == count && count < SLOTS)
+                count++;
+            for (i = MIN(i, SLOTS - 1); i > 0; i--)
+                next[i] = next[i - 1];
+            next[0] = d;
+        }
+    };
+
+    Row &row_of(int64_t distance, bool allocate) {
+        Row &row = rows[(uint64_t)distance % num_rows];
+        if (allocate && (!row.valid || row.distance != distance)) {
+            row.valid = true;
+            row.distance = distance;
+            row.count = 0;
+        }
+        return row;
+    }
+
+    Row *rows;
+    uint32_t num_rows;
+    uint32_t degree;
+    Address last_vpn;
+    int64_t last_distance;
+    bool has_distance;
+};
+
+struct TlbPrefetchEntry {
+    Address vpn; // first base page of the (possibly huge) page
+    Address ppn; // in base pages
+    uint64_t ready_cycle;
+    uint32_t page_shift;
+    uint16_t asid;
+    bool valid;
+    bool used;
+    bool shared;
+    bool dirty;
+};
+
+/*
+ * Prefetcher plus the FIFO prefetch buffer it fills, attached to an L2 TLB.
+ * Only the TLB's owning core touches it.
+ */
+class TlbPrefetchUnit : public GlobAlloc {
+  public:
+    TlbPrefetchUnit(TlbPrefetcher *prefetcher, uint32_t buffer_entries,
+                    unsigned base_shift)
+        : prefetcher(prefetcher), num_entries(buffer_entries), next_victim(0),
+          base_shift(base_shift), issued(0), dropped_faults(0),
+          redundant(0), useful(0), late(0), late_cycles(0), useless(0) {
+        assert(num_entries > 0);
+        buffer = gm_calloc<TlbPrefetchEntry>(num_entries);
+    }
+
+    // pages the prefetcher wants after a miss on vpn
+    void train(Address vpn, g_vector<Address> &candidates) {
+        prefetcher->train(vpn, candidates);
+    }
+
+    bool contains(Address vpn, uint16_t asid) {
+        return find(vpn, asid) >= 0;
+    }
+
+    void fill(const TlbPrefetchEntry &entry) {
+        TlbPrefetchEntry &victim = buffer[next_victim];
+        if (victim.valid && !victim.used)
+            useless++;
+        victim = entry;
+        victim.valid = true;
+        victim.used = false;
+        next_victim = (next_victim + 1) % num_entries;
+        issued++;
+    }
+
+    /*
+     *@function: demand miss on vpn; on a buffer hit, move the translation
+     *out of the buffer into entry
+     *@return: whether the buffer held vpn
+     */
+    bool take(Address vpn, uint16_t asid, uint64_t cycle,
+              TlbPrefetchEntry &entry) {
+        int32_t id = find(vpn, asid);
+        if (id < 0)
+            return false;
+        entry = buffer[id];
+        buffer[id].used = true;
+        buffer[id].valid = false;
+        useful++;
+        if (entry.ready_cycle > cycle) {
+            late++;
+            late_cycles += entry.ready_cycle - cycle;
+        }
+        return true;
+    }
+
+    // a prefetch walk found no mapping, or the page was already cached
+    void count_fault() { dropped_faults++; }
+    void count_redundant() { redundant++; }
+
+    void invalidate_vpn(Address vpn) {
+        for (uint32_t i = 0; i < num_entries; i++)
+            if (buffer[i].valid && covers(buffer[i], vpn))
+                buffer[i].valid = false;
+    }
+
+    // drop the prefetches of pages in [vpn, vpn + pages)
+    void invalidate_range(Address vpn, Address pages) {
+        for (uint32_t i = 0; i < num_entries; i++) {
+            unsigned delta = buffer[i].page_shift - base_shift;
+            Address first = (buffer[i].vpn >> delta) << delta;
+            if (buffer[i].valid && first < vpn + pages &&
+                vpn < first + (1ULL << delta))
+                buffer[i].valid = false;
+        }
+    }
+
+    void invalidate_ppn(Address ppn) {
+        for (uint32_t i = 0; i < num_entries; i++) {
+            unsigned delta = buffer[i].page_shift - base_shift;
+            if (buffer[i].valid &&
+                (buffer[i].ppn >> delta) == (ppn >> delta))
+                buffer[i].valid = false;
+        }
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < num_entries; i++)
+            buffer[i].valid = false;
+    }
+
+    void calculate_stats(std::ofstream &vmof, const g_string &name) {
+        // prefetches still in the buffer have not proven useless yet
+        vmof << name << " " << prefetcher->getName()
+             << " prefetches:" << issued << "\t useful:" << useful
+             << "\t late:" << late << "\t useless:" << useless
+             << "\t redundant:" << redundant
+             << "\t unmapped:" << dropped_faults
+             << "\t accuracy:" << (double)useful / (double)issued
+             << "\t cycles still exposed:" << late_cycles << std::endl;
+    }
+
+  private:
+    inline bool covers(const TlbPrefetchEntry &e, Address vpn) {
+        unsigned delta = e.page_shift - base_shift;
+        return (vpn >> delta) == (e.vpn >> delta);
+    }
+
+    int32_t find(Address vpn, uint16_t asid) {
+        for (uint32_t i = 0; i < num_entries; i++)
+            if (buffer[i].valid && buffer[i].asid == asid &&
+                covers(buffer[i], vpn))
+                return i;
+        return -1;
+    }
+
+    TlbPrefetcher *prefetcher;
+    TlbPrefetchEntry *buffer;
+    uint32_t num_entries;
+    uint32_t next_victim;
+    unsigned base_shift;
+    // statistics
+    uint64_t issued;
+    uint64_t dropped_faults;
+    uint64_t redundant; // candidates already in the TLB or the buffer
+    uint64_t useful;
+    uint64_t late;        // useful, but demanded before the walk finished
+    uint64_t late_cycles; // walk latency the late ones did not hide
+    uint64_t useless;     // replaced without being demanded
+};
+#endif
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
+ */
+#ifndef TLB_REPL_H_
+#define TLB_REPL_H_
+#include <fstream>
+
+#include "bithacks.h"
+#include "common/global_const.h"
+#include "g_std/g_string.h"
+#include "galloc.h"
+#include "log.h"
+#include "pad.h"
+
+/*
+ * Replacement policies of TlbArray, modelled on the cache ReplPolicy
+ * (repl_policies.h) but working on the slots of a TLB array directly:
+ * - update() is called when a lookup hits slot
+ * - inserted() is called once an entry was written to slot
+ * - victim() picks the way to replace in the set whose first slot is given,
+ *   only when every way of the set is valid (invalid ways are used first)
+ */
+class TlbReplPolicy : public GlobAlloc {
+  public:
+    TlbReplPolicy(uint32_t num_lines, uint32_t num_ways)
+        : numLines(num_lines), ways(num_ways), replacements(0) {}
+    virtual ~TlbReplPolicy() {}
+
+    virtual void update(uint32_t slot) = 0;
+    virtual void inserted(uint32_t slot) = 0;
+    virtual void invalidated(uint32_t slot) {}
+    virtual const char *getName() = 0;
+
+    uint32_t replace(uint32_t first) {
+        replacements++;
+        return victim(first);
+    }
+
+    virtual void calculate_stats(std::ofstream &vmof, const g_string &name) {
+        vmof << name << " " << getName()
+             << " replacements:" << replacements << std::endl;
+    }
+
+  protected:
+    virtual uint32_t victim(uint32_t first) = 0;
+
+    // zeroed per-slot state, cache-line aligned like the array's tags
+    template <typename S> S *alloc_state() {
+        S *state = gm_memalign<S>(CACHE_LINE_BYTES, numLines);
+        for (uint32_t i = 0; i < numLines; i++)
+            state[i] = 0;
+        return state;
+    }
+
+    uint32_t numLines;
+    uint32_t ways;
+    uint64_t replacements;
+};
+
+// exact LRU with 64-bit timestamps
+class LruTlbReplPolicy : public TlbReplPolicy {
+  public:
+    LruTlbReplPolicy(uint32_t num_lines, uint32_t num_ways)
+        : TlbReplPolicy(num_lines, num_ways), clock(0) {
+        stamps = alloc_state<uint64_t>();
+    }
+    void update(uint32_t slot) { stamps[slot] = ++clock; }
+    void inserted(uint32_t slot) { stamps[slot] = ++clock; }
+    const char *getName() { return "LRU"; }
+
+  protected:
+    uint32_t victim(uint32_t first) {
+        uint32_t best = first;
+        for (uint32_t id = first + 1; id < first + ways; id++)
+            if (stamps[id] < stamps[best])
+                best = id;
+        return best;
+    }
+
+    uint64_t *stamps;
+    uint64_t clock;
+};
+
+/*
+ * Tree pseudo-LRU: ways-1 bits per set, each pointing to the half of its
+ * subtree that was used less recently. Needs a power-of-two associativity.
+ */
+class TreePlruTlbReplPolicy : public TlbReplPolicy {
+  public:
+    TreePlruTlbReplPolicy(uint32_t num_lines, uint32_t num_ways)
+        : TlbReplPolicy(num_lines, num_ways) {
+        if (!isPow2(ways))
+            panic("tree-PLRU TLB replacement needs a power-of-two number of "
+                  "ways, not %u", ways);
+        // node n of a set is bits[set * ways + n], nodes 1..ways-1
+        bits = alloc_state<uint8_t>();
+    }
+    void update(uint32_t slot) { touch(slot); }
+    void inserted(uint32_t slot) { touch(slot); }
+    const char *getName() { return "TreePLRU"; }
+
+  protected:
+    uint32_t victim(uint32_t first) {
+        uint8_t *tree = &bits[first];
+        uint32_t node = 1;
+        while (node < ways)
+            node = 2 * node + tree[node];
+        return first + node - ways;
+    }
+
+    void touch(uint32_t slot) {
+        uint32_t first = slot - slot % ways;
+        uint8_t *tree = &bits[first];
+        // point every node on the path away from slot
+        for (uint32_t node = slot - first + ways; node > 1; node /= 2)
+            tree[node / 2] = !(node & 1);
+    }
+
+    uint8_t *bits;
+};
+
+/*
+ * SRRIP (Jaleel et al., ISCA'10) with 2-bit re-reference predictions: hits
+ * predict a near re-reference, fills an intermediate one, and the victim is
+ * a way predicted distant, aging the set until one is.
+ */
+class SrripTlbReplPolicy : public TlbReplPolicy {
+  public:
+    SrripTlbReplPolicy(uint32_t num_lines, uint32_t num_ways)
+        : TlbReplPolicy(num_lines, num_ways), agings(0) {
+        rrpv = alloc_state<uint8_t>();
+    }
+    void update(uint32_t slot) { rrpv[slot] = 0; }
+    void inserted(uint32_t slot) { rrpv[slot] = RRPV_MAX - 1; }
+    const char *getName() { return "SRRIP"; }
+
+    void calculate_stats(std::ofstream &vmof, const g_string &name) {
+        vmof << name << " " << getName()
+             << " replacements:" << replacements
+             << "\t aging rounds:" << agings << std::endl;
+    }
+
+  protected:
+    static const uint8_t RRPV_MAX = 3;
+
+    uint32_t victim(uint32_t first) {
+        while (true) {
+            for (uint32_t id = first; id < first + ways; id++)
+                if (rrpv[id] == RRPV_MAX)
+                    return id;
+            for (uint32_t id = first; id < first + ways; id++)
+                rrpv[id]++;
+            agings++;
+        }
+    }
+
+    uint8_t *rrpv;
+    uint64_t agings;
+};
+
+/*
+ * DRRIP: set dueling between SRRIP and BRRIP (which fills at a distant
+ * prediction but for one fill in 32). Sets 0 and 1 of every 32 lead for
+ * SRRIP and BRRIP; misses in them steer a 10-bit PSEL that the other sets
+ * follow. Needs at least two sets.
+ */
+class DrripTlbReplPolicy : public SrripTlbReplPolicy {
+  public:
+    DrripTlbReplPolicy(uint32_t num_lines, uint32_t num_ways)
+        : SrripTlbReplPolicy(num_lines, num_ways), psel(PSEL_MAX / 2 + 1),
+          brripFills(0), srLeaderMisses(0), brLeaderMisses(0),
+          followerFills(0), followerBrripFills(0) {
+        if (numLines / ways < 2)
+            panic("DRRIP TLB replacement needs at least 2 sets, use SRRIP on "
+                  "fully-associative TLBs");
+    }
+    void inserted(uint32_t slot) {
+        uint32_t leader = (slot / ways) % CONSTITUENCY;
+        bool brrip;
+        if (leader == 0) {
+            brrip = false;
+            if (psel < PSEL_MAX)
+                psel++;
+            srLeaderMisses++;
+        } else if (leader == 1) {
+            brrip = true;
+            if (psel)
+                psel--;
+            brLeaderMisses++;
+        } else {
+            // SRRIP leaders missing more than BRRIP ones push PSEL up
+            brrip = psel > PSEL_MAX / 2;
+            followerFills++;
+            if (brrip)
+                followerBrripFills++;
+        }
+        if (brrip && (++brripFills % BRRIP_PERIOD))
+            rrpv[slot] = RRPV_MAX;
+        else
+            rrpv[slot] = RRPV_MAX - 1;
+    }
+    const char *getName() { return "DRRIP"; }
+
+    void calculate_stats(std::ofstream &vmof, const g_string &name) {
+        vmof << name << " " << getName()
+             << " replacements:" << replacements
+             << "\t aging rounds:" << agings
+             << "\t SRRIP leader misses:" << srLeaderMisses
+             << "\t BRRIP leader misses:" << brLeaderMisses
+             << "\t follower BRRIP fills:" << followerBrripFills << "/"
+             << followerFills << "\t PSEL:" << psel << std::endl;
+    }
+
+  private:
+    static const uint32_t CONSTITUENCY = 32;
+    static const uint32_t PSEL_MAX = 1023;
+    static const uint32_t BRRIP_PERIOD = 32;
+
+    uint32_t psel;
+    uint64_t brripFills;
+    uint64_t srLeaderMisses;
+    uint64_t brLeaderMisses;
+    uint64_t followerFills;
+    uint64_t followerBrripFills;
+};
+
+/*
+ * Hotness-aware replacement: every entry counts its hits (saturating at
+ * 255) and the least hit way of the set is replaced, LRU among equals. The
+ * counters of the set are halved on each replacement, so pages that were
+ * hot once do not stay forever.
+ */
+class HotnessTlbReplPolicy : public LruTlbReplPolicy {
+  public:
+    HotnessTlbReplPolicy(uint32_t num_lines, uint32_t num_ways)
+        : LruTlbReplPolicy(num_lines, num_ways), victimHits(0),
+          coldVictims(0) {
+        hits = alloc_state<uint8_t>();
+    }
+    void update(uint32_t slot) {
+        LruTlbReplPolicy::update(slot);
+        if (hits[slot] < UINT8_MAX)
+            hits[slot]++;
+    }
+    void inserted(uint32_t slot) {
+        LruTlbReplPolicy::inserted(slot);
+        hits[slot] = 0;
+    }
+    const char *getName() { return "HOTNESSAware"; }
+
+    void calculate_stats(std::ofstream &vmof, const g_string &name) {
+        vmof << name << " " << getName()
+             << " replacements:" << replacements
+             << "\t victims never hit:" << coldVictims
+             << "\t hits per victim (aged):"
+             << (double)victimHits / (double)replacements << std::endl;
+    }
+
+  protected:
+    uint32_t victim(uint32_t first) {
+        uint32_t best = first;
+        for (uint32_t id = first + 1; id < first + ways; id++) {
+            if (hits[id] < hits[best] ||
+                (hits[id] == hits[best] && stamps[id] < stamps[best]))
+                best = id;
+        }
+        victimHits += hits[best];
+        if (!hits[best])
+            coldVictims++;
+        for (uint32_t id = first; id < first + ways; id++)
+            hits[id] >>= 1;
+        return best;
+    }
+
+  private:
+    uint8_t *hits;
+    uint64_t victimHits;
+    uint64_t coldVictims;
+};
+
+static inline TlbReplPolicy *CreateTlbReplPolicy(EVICTSTYLE policy,
+                                                 uint32_t num_lines,
+                                                 uint32_t ways) {
+    switch (policy) {
+    case TreePLRU:
+        return new TreePlruTlbReplPolicy(num_lines, ways);
+    case SRRIP:
+        return new SrripTlbReplPolicy(num_lines, ways);
+    case DRRIP:
+        return new DrripTlbReplPolicy(num_lines, ways);
+    case HOTNESSAware:
+        return new HotnessTlbReplPolicy(num_lines, ways);
+    // hot pages are monitored by the hotness profiler, the array is LRU
+    case HotMonitorTLBLRU:
+    case LRU:
+    default:
+        return new LruTlbReplPolicy(num_lines, ways);
+    }
+}
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
+ */
+#include "tlb/tlb_shootdown.h"
+#include "core.h"
+#include "zsim.h"
+
+TlbShootdownEngine::TlbShootdownEngine(uint32_t num_cores,
+                                       unsigned region_shift,
+                                       uint32_t batch_size,
+                                       uint64_t batch_epoch,
+                                       uint32_t ipi_latency,
+                                       uint32_t per_target_latency,
+                                       uint32_t ack_latency)
+    : num_cores(num_cores), region_shift(region_shift),
+      batch_size(batch_size), batch_epoch(batch_epoch),
+      ipi_latency(ipi_latency), per_target_latency(per_target_latency),
+      ack_latency(ack_latency), shootdowns(0), updates(0), rounds(0), ipis(0),
+      skipped_cores(0), core_flushes(0), stall_cycles(0) {
+    assert(batch_size > 0);
+    words = (num_cores + 63) / 64;
+    stripes = gm_memalign<SharerStripe>(CACHE_LINE_BYTES, NUM_STRIPES);
+    for (uint32_t i = 0; i < NUM_STRIPES; i++) {
+        new (&stripes[i]) SharerStripe();
+        futex_init(&stripes[i].lock);
+    }
+    batches = gm_memalign<Batch>(CACHE_LINE_BYTES, num_cores);
+    for (uint32_t i = 0; i < num_cores; i++) {
+        new (&batches[i]) Batch();
+        batches[i].targets = gm_calloc<uint64_t>(words);
+        batches[i].first_cycle = 0;
+        batches[i].owed = 0;
+    }
+    flush_gens = gm_calloc<uint64_t>(num_cores);
+    for (uint32_t i = 0; i < num_cores; i++)
+        flush_gens[i] = 1;
+}
+
+void TlbShootdownEngine::record_fill(uint32_t procIdx, Address vpn,
+                                     Address pages, uint32_t core) {
+    assert(core < num_cores);
+    Address first = vpn >> region_shift;
+    Address last = (vpn + pages - 1) >> region_shift;
+    for (Address region = first; region <= last; region++) {
+        Address key = region_key(procIdx, region);
+        SharerStripe &stripe = stripe_of(key);
+        futex_lock(&stripe.lock);
+        uint64_t *&gens = stripe.regions[key];
+        if (!gens)
+            gens = gm_calloc<uint64_t>(num_cores);
+        gens[core] = flush_gens[core];
+        futex_unlock(&stripe.lock);
+    }
+}
+
+void TlbShootdownEngine::record_flush(uint32_t core) {
+    assert(core < num_cores);
+    // the fills recorded so far are stale, no region needs to be visited
+    __sync_fetch_and_add(&flush_gens[core], 1);
+    __sync_fetch_and_add(&core_flushes, 1);
+}
+
+void TlbShootdownEngine::add_sharers(uint32_t procIdx, Address vpn,
+                                     uint64_t *targets) {
+    Address key = region_key(procIdx, vpn >> region_shift);
+    SharerStripe &stripe = stripe_of(key);
+    futex_lock(&stripe.lock);
+    auto it = stripe.regions.find(key);
+    if (it != stripe.regions.end()) {
+        for (uint32_t core = 0; core < num_cores; core++)
+            if (it->second[core] == flush_gens[core])
+                targets[core / 64] |= 1ULL << (core % 64);
+    }
+    futex_unlock(&stripe.lock);
+}
+
+uint64_t TlbShootdownEngine::ipi_cost(uint32_t num_targets,
+                                      uint64_t inv_latency) {
+    if (!zinfo->tlb_enable_timing_mode)
+        return 0;
+    if (!num_targets)
+        return inv_latency; // local invalidation only
+    return (uint64_t)per_target_latency * num_targets + ipi_latency +
+           inv_latency + ack_latency;
+}
+
+uint64_t TlbShootdownEngine::shootdown(uint32_t initiator, uint32_t procIdx,
+                                       Address vpn, uint64_t cycle) {
+    assert(initiator < num_cores);
+    Batch &batch = batches[initiator];
+    __sync_fetch_and_add(&shootdowns, 1);
+    if (batch.pending.empty())
+        batch.first_cycle = cycle;
+    batch.pending.push_back({procIdx, vpn});
+    add_sharers(procIdx, vpn, batch.targets);
+    if (batch.pending.size() >= batch_size ||
+        (batch_epoch && cycle - batch.first_cycle >= batch_epoch))
+        return flush(initiator);
+    return 0;
+}
+
+uint64_t TlbShootdownEngine::flush(uint32_t initiator) {
+    Batch &batch = batches[initiator];
+    if (batch.pending.empty())
+        return 0;
+    uint32_t remote = 0;
+    uint64_t inv_latency = 0;
+    for (uint32_t w = 0; w < words; w++) {
+        uint64_t bits = batch.targets[w];
+        while (bits) {
+            uint32_t core = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (core != initiator)
+                remote++;
+            // L1 TLBs forward the invalidation to their L2
+            BaseTlb *tlbs[2] = {zinfo->cores[core]->getInsTlb(),
+                                zinfo->cores[core]->getDataTlb()};
+            uint64_t core_latency = 0;
+            for (BaseTlb *tlb : tlbs) {
+                if (!tlb)
+                    continue;
+                uint64_t tlb_latency = 0;
+                for (const Pending &p : batch.pending)
+                    tlb_latency += tlb->shootdown(p.vpn, p.procIdx);
+                core_latency = MAX(core_latency, tlb_latency);
+            }
+            inv_latency = MAX(inv_latency, core_latency);
+        }
+        batch.targets[w] = 0;
+    }
+    for (BaseTlb *shared_tlb : zinfo->shared_tlbs) {
+        if (!shared_tlb)
+            continue;
+        uint64_t tlb_latency = 0;
+        for (const Pending &p : batch.pending)
+            tlb_latency += shared_tlb->shootdown(p.vpn, p.procIdx);
+        inv_latency = MAX(inv_latency, tlb_latency);
+    }
+    batch.pending.clear();
+
+    uint64_t cost = ipi_cost(remote, inv_latency);
+    __sync_fetch_and_add(&rounds, 1);
+    __sync_fetch_and_add(&ipis, remote);
+    __sync_fetch_and_add(&skipped_cores, num_cores - 1 - remote);
+    __sync_fetch_and_add(&stall_cycles, cost);
+    return cost;
+}
+
+uint64_t TlbShootdownEngine::poll(uint32_t core, uint64_t cycle) {
+    assert(core < num_cores);
+    Batch &batch = batches[core];
+    uint64_t cost = batch.owed;
+    batch.owed = 0;
+    if (batch_epoch && !batch.pending.empty() &&
+        cycle - batch.first_cycle >= batch_epoch)
+        cost += flush(core);
+    return cost;
+}
+
+void TlbShootdownEngine::flush_deferred(uint32_t core) {
+    assert(core < num_cores);
+    batches[core].owed += flush(core);
+}
+
+void TlbShootdownEngine::flush_all() {
+    for (uint32_t core = 0; core < num_cores; core++)
+        flush_deferred(core);
+}
+
+uint64_t TlbShootdownEngine::update(uint32_t initiator, uint32_t procIdx,
+                                    Address vpn, Address ppn) {
+    assert(initiator < num_cores);
+    g_vector<uint64_t> targets(words, 0);
+    add_sharers(procIdx, vpn, &targets[0]);
+    uint32_t remote = 0;
+    uint64_t inv_latency = 0;
+    for (uint32_t w = 0; w < words; w++) {
+        uint64_t bits = targets[w];
+        while (bits) {
+            uint32_t core = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (core != initiator)
+                remote++;
+            BaseTlb *tlbs[2] = {zinfo->cores[core]->getInsTlb(),
+                                zinfo->cores[core]->getDataTlb()};
+            for (BaseTlb *tlb : tlbs) {
+                if (tlb)
+                    inv_latency = MAX(inv_latency,
+                                      (uint64_t)tlb->update_entry(vpn, ppn,
+                                                                  procIdx));
+            }
+        }
+    }
+    for (BaseTlb *shared_tlb : zinfo->shared_tlbs) {
+        if (shared_tlb)
+            inv_latency = MAX(inv_latency, (uint64_t)shared_tlb->update_entry(
+                                               vpn, ppn, procIdx));
+    }
+    uint64_t cost = ipi_cost(remote, inv_latency);
+    __sync_fetch_and_add(&updates, 1);
+    __sync_fetch_and_add(&rounds, 1);
+    __sync_fetch_and_add(&ipis, remote);
+    __sync_fetch_and_add(&skipped_cores, num_cores - 1 - remote);
+    __sync_fetch_and_add(&stall_cycles, cost);
+    return cost;
+}
+
+void TlbShootdownEngine::calculate_stats(std::ofstream &vmof) {
+    vmof << "TLB shootdowns:" << shootdowns << "\t updates:" << updates
+         << "\t IPI rounds:" << rounds << "\t IPIs sent:" << ipis
+         << "\t cores skipped:" << skipped_cores
+         << "\t core flushes:" << core_flushes
+         << "\t initiator stall cycles:" << stall_cycles << std::endl;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2020 Chao Yu (yuchaocs@gmail.com)
+ */
+#ifndef TLB_SHOOTDOWN_H_
+#define TLB_SHOOTDOWN_H_
+#include <fstream>
+
+#include "common/global_const.h"
+#include "g_std/g_unordered_map.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "locks.h"
+#include "pad.h"
+
+/*
+ * TLB shootdown engine.
+ *
+ * Tracks, per process and per region of 2^region_shift base pages, which
+ * cores may hold translations, so a shootdown only visits those cores
+ * instead of every core in the system. A core becomes a sharer when its L2
+ * TLB is filled, and stops being one of every region when its TLBs are
+ * flushed at a context switch: each core has a flush generation, and a
+ * region remembers the generation each core filled it in. Entries evicted
+ * one by one leave the core a sharer, which only costs an extra IPI. Shootdowns issued by a core are batched: they are sent as one
+ * round of IPIs once batch_size of them are pending or batch_epoch cycles
+ * have passed since the first one, as Linux does for deferred flushes.
+ * Pending batches are also sent at context switches, phase ends and the end
+ * of the simulation, so no invalidation stays queued forever.
+ *
+ * The initiator is charged a simple IPI model instead of the TLB hit latency:
+ * per_target_latency for each remote target (sending is serial), then
+ * ipi_latency for delivery and handling, the slowest target's invalidation,
+ * and ack_latency for the acknowledgements to come back.
+ */
+class TlbShootdownEngine : public GlobAlloc {
+  public:
+    TlbShootdownEngine(uint32_t num_cores, unsigned region_shift,
+                       uint32_t batch_size, uint64_t batch_epoch,
+                       uint32_t ipi_latency, uint32_t per_target_latency,
+                       uint32_t ack_latency);
+
+    /*
+     *@function: core may cache the translations of pages [vpn, vpn+pages)
+     *of procIdx from now on
+     */
+    void record_fill(uint32_t procIdx, Address vpn, Address pages,
+                     uint32_t core);
+
+    // every TLB of core has been flushed, it holds no translation anymore
+    void record_flush(uint32_t core);
+
+    /*
+     *@function: invalidate vpn of procIdx in every TLB that may hold it; the
+     *invalidation may be deferred to batch it with later ones
+     *@return: cycles the initiator is stalled for
+     */
+    uint64_t shootdown(uint32_t initiator, uint32_t procIdx, Address vpn,
+                       uint64_t cycle);
+
+    /*
+     *@function: remap vpn of procIdx to ppn; never deferred, since TLBs
+     *would keep translating to the old frame
+     *@return: cycles the initiator is stalled for
+     */
+    uint64_t update(uint32_t initiator, uint32_t procIdx, Address vpn,
+                    Address ppn);
+
+    // send the pending shootdowns of initiator, returns its stall cycles
+    uint64_t flush(uint32_t initiator);
+
+    /*
+     *@function: send the batch of core once batch_epoch cycles have passed
+     *since its first shootdown, and collect what the batches sent on its
+     *behalf cost (see flush_deferred)
+     *@return: cycles core is stalled for
+     */
+    uint64_t poll(uint32_t core, uint64_t cycle);
+
+    /*
+     *@function: send the batch of core now, at a context switch, or of every
+     *core, at phase ends and the end of the simulation; the stall is charged
+     *to the core on its next poll
+     */
+    void flush_deferred(uint32_t core);
+    void flush_all();
+
+    void calculate_stats(std::ofstream &vmof);
+
+  private:
+    struct Pending {
+        uint32_t procIdx;
+        Address vpn;
+    };
+
+    // shootdowns one core has issued but not sent yet
+    struct Batch {
+        g_vector<Pending> pending;
+        uint64_t *targets; // union of the sharers of the pending pages
+        uint64_t first_cycle;
+        uint64_t owed; // stall of batches sent by flush_deferred
+    } ATTR_LINE_ALIGNED;
+
+    struct SharerStripe {
+        lock_t lock;
+        // (procIdx, region) -> flush generation of each core when it filled
+        // the region, 0 if it never did
+        g_unordered_map<Address, uint64_t *> regions;
+    } ATTR_LINE_ALIGNED;
+
+    inline Address region_key(uint32_t procIdx, Address region) {
+        return ((Address)procIdx << 40) | region;
+    }
+    inline SharerStripe &stripe_of(Address key) {
+        return stripes[(key ^ (key >> 17)) % NUM_STRIPES];
+    }
+    // or the sharers of vpn into targets
+    void add_sharers(uint32_t procIdx, Address vpn, uint64_t *targets);
+    // IPI cost of invalidating on num_targets remote cores
+    uint64_t ipi_cost(uint32_t num_targets, uint64_t inv_latency);
+
+    static const uint32_t NUM_STRIPES = 64;
+
+    uint32_t num_cores;
+    uint32_t words; // uint64_t per core bit vector
+    unsigned region_shift;
+    uint32_t batch_size;
+    uint64_t batch_epoch;
+    uint32_t ipi_latency;
+    uint32_t per_target_latency;
+    uint32_t ack_latency;
+
+    SharerStripe *stripes;
+    Batch *batches;
+    // bumped by each flush of the core, starts at 1
+    volatile uint64_t *flush_gens;
+
+    // statistics
+    uint64_t shootdowns;
+    uint64_t updates;
+    uint64_t rounds;        // IPI rounds sent (batches and updates)
+    uint64_t ipis;          // remote cores interrupted
+    uint64_t skipped_cores; // remote cores not interrupted thanks to tracking
+    uint64_t core_flushes;  // flushes that dropped a core from the sharers
+    uint64_t stall_cycles;
+};
+#endif
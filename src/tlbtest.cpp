@@ -0,0 +1,81 @@
+/*
+ * Self-check of the shared last-level TLB: a run of consecutive pages as
+ * large as the TLB must fit in it, so after filling it every page hits, and
+ * a range invalidation drops exactly the pages of the range.
+ * Exits with an error if any other page has to be walked again.
+ */
+
+#include <stdlib.h>
+#include "galloc.h"
+#include "log.h"
+#include "tlb/shared_tlb.h"
+#include "tlb/tlb_entry.h"
+#include "zsim.h"
+
+GlobSimInfo* zinfo;
+uint32_t lineBits = 6;
+
+// maps every page to a fixed offset and counts the walks
+class CountingWalker : public BasePageTableWalker {
+    public:
+        uint64_t walks;
+
+        CountingWalker() : walks(0) {}
+        uint64_t access(MemReq& req) {
+            walks++;
+            req.pageShift = zinfo->page_shift;
+            return ((req.lineAddr << lineBits) >> zinfo->page_shift) + (1 << 20);
+        }
+        uint32_t GetProcIdx() { return 0; }
+        uint64_t invalidate(const InvReq& req) { return 0; }
+        void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) {}
+        void setChildren(const g_vector<BaseCache*>& children, Network* network) {}
+};
+
+static uint64_t walkAll(SharedTlb<TlbEntry>* tlb, CountingWalker* walker, uint64_t pages) {
+    uint64_t before = walker->walks;
+    for (uint64_t vpn = 0; vpn < pages; vpn++) {
+        MESIState state = MESIState::I;
+        MemReq req = {(vpn << zinfo->page_shift) >> lineBits, GETS, 0, &state, 0, NULL, state, 0, 0};
+        Address ppn = tlb->access(req);
+        if (ppn != vpn + (1 << 20)) panic("vpn %lu translated to %lu", vpn, ppn);
+    }
+    return walker->walks - before;
+}
+
+int main(int argc, char *argv[]) {
+    InitLog(""); //no log header
+    if (argc > 4) {
+        info("Usage: %s [<entries> [<ways> [<banks>]]]", argv[0]);
+        exit(1);
+    }
+    // defaults of sys.tlbs.shared_tlb
+    uint32_t entries = (argc > 1)? atoi(argv[1]) : 4096;
+    uint32_t ways = (argc > 2)? atoi(argv[2]) : 16;
+    uint32_t banks = (argc > 3)? atoi(argv[3]) : 8;
+
+    gm_init(64<<20);
+    zinfo = gm_calloc<GlobSimInfo>();
+    zinfo->page_shift = 12;
+    zinfo->page_size = 1 << 12;
+
+    CountingWalker* walker = new CountingWalker();
+    SharedTlb<TlbEntry>* tlb = new SharedTlb<TlbEntry>("shared_tlb", false, entries, ways, banks, 0, 0, lineBits,
+            zinfo->page_shift, 1);
+    tlb->add_requester(0, walker);
+
+    uint64_t fills = walkAll(tlb, walker, entries);
+    uint64_t misses = walkAll(tlb, walker, entries);
+    info("%u entries, %u ways, %u banks: %lu fills, %lu misses on the second pass", entries, ways, banks, fills,
+            misses);
+    if (fills != entries) panic("filling %u pages took %lu walks", entries, fills);
+    if (misses) panic("%lu of %u pages missed after filling the TLB", misses, entries);
+
+    // drop the middle half, as the collapse of a huge page does
+    tlb->shootdown_range(entries / 4, entries / 2, 0);
+    uint64_t refills = walkAll(tlb, walker, entries);
+    info("%lu misses after dropping %u pages", refills, entries / 2);
+    if (refills != entries / 2) panic("dropping %u pages took %lu walks to refill", entries / 2, refills);
+    info("PASS");
+    return 0;
+}
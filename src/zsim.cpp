@@ -67,6 +67,7 @@
 #include "mmu/memory_management.h"
 #include "page-table/page_table.h"
 #include "memory_hierarchy.h"
+#include "tlb/tlb_shootdown.h"
 
 //#include <signal.h> //can't include this, conflicts with PIN's
 
@@ -142,8 +143,12 @@ static inline void setCid(uint32_t tid, uint32_t cid) {
     cores[tid] = zinfo->cores[cid];
     // std::cout<<"set core "<<cid<<" with proc "<< procIdx <<" thread "<< tid <<std::endl;
     if(cores[tid]->GetProcIdx() != procIdx){
-        cores[tid]->flushTlb();
+        cores[tid]->switchTlbContext(procIdx);
+        //without ASIDs that flushed every TLB of the core
+        if (zinfo->tlb_shootdown_engine && !zinfo->tlb_asid_bits) zinfo->tlb_shootdown_engine->record_flush(cid);
     }
+    //shootdowns the previous thread of the core left queued
+    if (zinfo->tlb_shootdown_engine) zinfo->tlb_shootdown_engine->flush_deferred(cid);
 	cores[tid]->SetProcIdx(procIdx);
     cores[tid]->SetThreadIdx(tid);
     cores[tid]->SetThreadBBLStatus(&(zinfo->sched->getBBLStatus(procIdx, tid)));
@@ -574,6 +579,7 @@ VOID EndOfPhaseActions() {
     }
 
     CheckForTermination();
+    if (zinfo->tlb_shootdown_engine) zinfo->tlb_shootdown_engine->flush_all();
     zinfo->contentionSim->simulatePhase(zinfo->globPhaseCycles + zinfo->phaseLength);
     zinfo->eventQueue->tick();
     zinfo->profSimTime->transition(PROF_BOUND);
@@ -1308,6 +1314,12 @@ VOID SimEnd() {
 				zinfo->paging_array[i]->calculate_stats(vmof);
 			}
 		}
+        if( zinfo->host_paging){
+            vmof << "host page table (EPT):" << std::endl;
+            zinfo->host_paging->calculate_stats(vmof);
+        }
+        if( zinfo->buddy_allocator)
+            zinfo->buddy_allocator->calculate_stats(vmof);
         std::ofstream addrof;
         std::string addr_outfile = zinfo->outputDir;
         addr_outfile += "/address.out";
@@ -1329,7 +1341,14 @@ VOID SimEnd() {
 				}
 			}
 		}
+		for (BaseTlb* shared_tlb : zinfo->shared_tlbs) {
+			if (shared_tlb) total_access_time += shared_tlb->calculate_stats(vmof);
+		}
 		vmof<<"total TLB access time: "<<total_access_time<<std::endl;
+		if( zinfo->tlb_shootdown_engine ){
+			zinfo->tlb_shootdown_engine->flush_all();
+			zinfo->tlb_shootdown_engine->calculate_stats(vmof);
+		}
 		if( zinfo->pg_walkers ){
 			for( unsigned i=0; i<zinfo->numCores; i++){
 				if( zinfo->pg_walkers[i])
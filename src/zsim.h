@@ -56,6 +56,8 @@ class ProcStats;
 class EventQueue;
 class ContentionSim;
 class EventRecorder;
+class PteArena;
+class LongModePaging;
 class PinCmd;
 class PortVirtualizer;
 class VectorCounter;
@@ -65,6 +67,7 @@ template <typename T> class g_vector;
 
 class BasePageTableWalker;
 class BaseTlb;
+class TlbShootdownEngine;
 class BuddyAllocator;
 class MemoryNode;
 class BasePaging;
@@ -218,7 +221,7 @@ struct GlobSimInfo {
     /**----- TLB and memory management related-----**/
 	uint64_t memory_size;
 	uint64_t max_mem_page_no;
-	MemoryNode* memory_node;
+	MemoryNode* memory_node; //node 0, buddy_allocator has them all
 	uint64_t page_size;
 	uint64_t page_shift;
 	BuddyAllocator* buddy_allocator;
@@ -230,18 +233,21 @@ struct GlobSimInfo {
 	unsigned block_size;
     unsigned life_time;
     BasePaging** paging_array;
+    PteArena* pte_arena; //PTE storage of radix page tables
+    LongModePaging* host_paging; //host page table (EPT) of virtualized guests, NULL if native
     bool pwc_enable;
-    g_vector<unsigned> pwc_ways;
-    g_vector<unsigned> pwc_size;
-    uint32_t pwc_accLat;
-    uint32_t pwc_invLat;
     unsigned cuckoo_d;
     unsigned cuckoo_size;
     double cuckoo_scale;
     double cuckoo_threshold;
+    PgtHashKind cuckoo_hash;
+    unsigned cuckoo_swaps;
+    bool cuckoo_gradual;
     unsigned hdc_size;
     double hdc_scale;
     double hdc_threshold;
+    PgtHashKind hdc_hash;
+    unsigned hdc_moves;
 	BasePageTableWalker** pg_walkers;
     /*####tlb related #####*/
     bool tlb_enabled;
@@ -249,6 +255,9 @@ struct GlobSimInfo {
     bool tlb_enable_timing_mode;
     bool ptw_enable_timing_mode;
 	int tlb_type;
+	unsigned tlb_asid_bits; //0 disables ASID tagging, TLBs are flushed on context switches
+	TlbShootdownEngine* tlb_shootdown_engine;
+	g_vector<BaseTlb*> shared_tlbs; //shared last-level TLBs, indexed by the first core that shares each one
 	PagingStyle paging_mode;
 	EVICTSTYLE ins_evict_policy;
 	EVICTSTYLE data_evict_policy;